@@ -0,0 +1,261 @@
+/***************************************************************************//**
+
+  @file         corpus.h
+
+  @brief        Deterministic generation of benchmark documents.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Each corpus is an array of records of one shape, written through a
+  `struct json_builder`, so it can go to a buffer or be streamed anywhere a
+  sink can go.  The same shape, count and seed always give the same bytes, on
+  any platform, so results from different builds are comparable.
+
+  The shapes are:
+  - tweets: objects modeled on twitapi.json (nested user and entities).
+  - numbers: short arrays of integers, decimals and exponents.
+  - strings: strings with escapes and non-ASCII text.
+  - nested: chains of objects and arrays, CORPUS_NESTED_DEPTH levels deep.
+    That is far deeper than a builder can nest, so these records are written
+    straight to the builder's sink.
+
+  This is included by the benchmark programs, so everything here is static.
+
+*******************************************************************************/
+
+#ifndef NOSJ_BENCH_CORPUS_H
+#define NOSJ_BENCH_CORPUS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nosj.h"
+#include "json_private.h" // for json_builder_raw() and json_sink_write()
+
+/**
+   @brief The shapes of document corpus_write() can produce.
+ */
+enum corpus_shape {
+  CORPUS_TWEETS, CORPUS_NUMBERS, CORPUS_STRINGS, CORPUS_NESTED, CORPUS_SHAPES
+};
+
+static const char *corpus_shape_names[CORPUS_SHAPES] = {
+  "tweets", "numbers", "strings", "nested"
+};
+
+/**
+   @brief Levels of nesting in each record of the nested corpus.  With the
+   array around the records, this stays under JSON_READER_MAXDEPTH.
+ */
+#define CORPUS_NESTED_DEPTH 4000
+
+/**
+   @brief A xorshift64* generator, so output doesn't depend on the C library.
+ */
+static uint64_t corpus_rand(uint64_t *state)
+{
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * UINT64_C(2685821657736338717);
+}
+
+/**
+   @brief Return a number in [0, n).
+ */
+static size_t corpus_below(uint64_t *state, size_t n)
+{
+  return (size_t) (corpus_rand(state) >> 33) % n;
+}
+
+static const char *corpus_words[] = {
+  "along", "with", "our", "new", "#Twitterbird", "we've", "also", "updated",
+  "display", "guidelines", "https://t.co/Ed4omjYs", "the", "API", "@twitter",
+  "and", "a", "Z\xc3\xbcrich", "caf\xc3\xa9", "\xe6\x97\xa5\xe6\x9c\xac",
+  "\xf0\x9f\x98\x80", "\"quoted\"", "back\\slash", "tab\there", "line\nbreak",
+};
+
+#define CORPUS_NWORDS (sizeof(corpus_words) / sizeof(corpus_words[0]))
+
+/**
+   @brief Write a string value of about `words` random words.
+ */
+static void corpus_text(struct json_builder *b, uint64_t *state, size_t words)
+{
+  char text[512];
+  size_t len = 0, i, n;
+  const char *word;
+  for (i = 0; i < words; i++) {
+    word = corpus_words[corpus_below(state, CORPUS_NWORDS)];
+    n = strlen(word);
+    if (len + n + 1 >= sizeof(text)) {
+      break;
+    }
+    if (i > 0) {
+      text[len++] = ' ';
+    }
+    memcpy(text + len, word, n);
+    len += n;
+  }
+  json_builder_string_n(b, text, len);
+}
+
+/**
+   @brief Write an id as a decimal string, like the _str fields in tweets.
+ */
+static void corpus_id_str(struct json_builder *b, uint64_t id)
+{
+  char buffer[24];
+  sprintf(buffer, "%lu", (unsigned long) id);
+  json_builder_string(b, buffer);
+}
+
+static void corpus_tweet(struct json_builder *b, uint64_t *state, size_t i)
+{
+  uint64_t id = UINT64_C(210462857140252672) + i * 7919;
+  uint64_t user = 6253282 + corpus_below(state, 100000);
+  size_t hashtags = corpus_below(state, 3), j;
+
+  json_builder_begin_object(b);
+  json_builder_key(b, "coordinates");
+  json_builder_null(b);
+  json_builder_key(b, "favorited");
+  json_builder_bool(b, corpus_below(state, 4) == 0);
+  json_builder_key(b, "created_at");
+  json_builder_string(b, "Wed Jun 06 20:07:10 +0000 2012");
+  json_builder_key(b, "id_str");
+  corpus_id_str(b, id);
+  json_builder_key(b, "entities");
+  json_builder_begin_object(b);
+  json_builder_key(b, "hashtags");
+  json_builder_begin_array(b);
+  for (j = 0; j < hashtags; j++) {
+    json_builder_begin_object(b);
+    json_builder_key(b, "text");
+    corpus_text(b, state, 1);
+    json_builder_key(b, "indices");
+    json_builder_begin_array(b);
+    json_builder_int64(b, (int64_t) (j * 12));
+    json_builder_int64(b, (int64_t) (j * 12 + 11));
+    json_builder_end(b);
+    json_builder_end(b);
+  }
+  json_builder_end(b);
+  json_builder_key(b, "user_mentions");
+  json_builder_begin_array(b);
+  json_builder_end(b);
+  json_builder_end(b);
+  json_builder_key(b, "text");
+  corpus_text(b, state, 4 + corpus_below(state, 16));
+  json_builder_key(b, "retweet_count");
+  json_builder_int64(b, (int64_t) corpus_below(state, 1000));
+  json_builder_key(b, "id");
+  json_builder_int64(b, (int64_t) id);
+  json_builder_key(b, "user");
+  json_builder_begin_object(b);
+  json_builder_key(b, "name");
+  corpus_text(b, state, 2);
+  json_builder_key(b, "id_str");
+  corpus_id_str(b, user);
+  json_builder_key(b, "followers_count");
+  json_builder_int64(b, (int64_t) corpus_below(state, 2000000));
+  json_builder_key(b, "verified");
+  json_builder_bool(b, corpus_below(state, 10) == 0);
+  json_builder_key(b, "lang");
+  json_builder_string(b, "en");
+  json_builder_end(b);
+  json_builder_key(b, "place");
+  json_builder_null(b);
+  json_builder_end(b);
+}
+
+static void corpus_numbers(struct json_builder *b, uint64_t *state)
+{
+  size_t j;
+  uint64_t r;
+  json_builder_begin_array(b);
+  for (j = 0; j < 8; j++) {
+    r = corpus_rand(state);
+    switch (r % 4) {
+    case 0:
+      json_builder_int64(b, (int64_t) (r >> 40) - (1 << 23));
+      break;
+    case 1:
+      json_builder_int64(b, (int64_t) (r >> 60));
+      break;
+    case 2:
+      json_builder_double(b, (double) (r >> 11) / 9007199254740992.0 * 1000);
+      break;
+    default:
+      json_builder_double(b, ((double) (r >> 11) + 1) * 1e-300 *
+                          (double) (r % 1000));
+      break;
+    }
+  }
+  json_builder_end(b);
+}
+
+static void corpus_nested(struct json_builder *b, uint64_t *state)
+{
+  char number[8];
+  size_t j;
+
+  if (!json_builder_raw(b)) {
+    return;
+  }
+  for (j = 0; j < CORPUS_NESTED_DEPTH; j++) {
+    if (j % 4 == 0) {
+      json_sink_write(b->sink, "{\"a\":", 5);
+    } else if (j % 2 == 0) {
+      json_sink_write(b->sink, "{\"child\":", 9);
+    } else {
+      json_sink_write(b->sink, number,
+                      (size_t) sprintf(number, "[%u,",
+                                       (unsigned) corpus_below(state, 100)));
+    }
+  }
+  json_sink_write(b->sink, "null", 4);
+  for (j = CORPUS_NESTED_DEPTH; j > 0; j--) {
+    json_sink_putc(b->sink, (j - 1) % 2 == 0 ? '}' : ']');
+  }
+}
+
+/**
+   @brief Write a corpus: an array of n records of one shape.
+   @param b The builder to write with.
+   @param shape The kind of record.
+   @param n The number of records.
+   @param seed Seed for the random choices.  Zero is replaced by one.
+ */
+static void corpus_write(struct json_builder *b, enum corpus_shape shape,
+                         size_t n, uint64_t seed)
+{
+  uint64_t state = seed != 0 ? seed : 1;
+  size_t i;
+
+  json_builder_begin_array(b);
+  for (i = 0; i < n; i++) {
+    switch (shape) {
+    case CORPUS_TWEETS:
+      corpus_tweet(b, &state, i);
+      break;
+    case CORPUS_NUMBERS:
+      corpus_numbers(b, &state);
+      break;
+    case CORPUS_STRINGS:
+      corpus_text(b, &state, 1 + corpus_below(&state, 24));
+      break;
+    case CORPUS_NESTED:
+    default:
+      corpus_nested(b, &state);
+      break;
+    }
+  }
+  json_builder_end(b);
+}
+
+#endif // NOSJ_BENCH_CORPUS_H
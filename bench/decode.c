@@ -0,0 +1,138 @@
+/***************************************************************************//**
+
+  @file         decode.c
+
+  @brief        Benchmark ways of decoding an object into a struct.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: bench_decode [count]
+
+  Decodes the same parsed message into a struct user (generated from
+  bench/user.schema) three ways: a chain of json_object_get() calls, the
+  json_decode() field table, and the user_decode() function generated by
+  nosj_gen.  It prints the average time per message, and checks that all three
+  agree.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nosj.h"
+#include "user.h"
+
+static wchar_t message[] =
+  L"{\"id\": 12345, \"name\": \"ann\", \"email\": \"ann@example.com\", "
+  L"\"created\": \"2026-10-19T12:00:00Z\", \"score\": 97.25, "
+  L"\"admin\": false, \"tags\": [\"a\", \"b\"], \"login-count\": 42, "
+  L"\"profile\": {\"bio\": \"hi\", \"links\": []}}";
+
+static const struct json_field user_fields[] = {
+  JSON_FIELD(L"id", struct user, id, JSON_FIELD_INT, JSON_FIELD_REQUIRED),
+  JSON_FIELD(L"score", struct user, score, JSON_FIELD_DOUBLE, 0),
+  JSON_FIELD(L"admin", struct user, admin, JSON_FIELD_BOOL, 0),
+  JSON_FIELD(L"name", struct user, name, JSON_FIELD_STRING, 0),
+  JSON_FIELD(L"email", struct user, email, JSON_FIELD_UTF8, 0),
+  JSON_FIELD(L"tags", struct user, tags, JSON_FIELD_INDEX, 0),
+  JSON_FIELD(L"login-count", struct user, login_count, JSON_FIELD_INT, 0),
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+   @brief Decode the way most callers do today: look up every field.
+ */
+static bool decode_by_lookup(const wchar_t *json,
+                             const struct json_token *tokens, struct user *u)
+{
+  size_t v;
+  if ((v = json_object_get(json, tokens, 0, L"id")) == 0) {
+    return false;
+  }
+  u->id = (int) json_number_get(json, tokens, v);
+  if ((v = json_object_get(json, tokens, 0, L"score")) != 0) {
+    u->score = json_number_get(json, tokens, v);
+  }
+  if ((v = json_object_get(json, tokens, 0, L"admin")) != 0) {
+    u->admin = tokens[v].type == JSON_TRUE;
+  }
+  if ((v = json_object_get(json, tokens, 0, L"name")) != 0 &&
+      tokens[v].length < sizeof(u->name) / sizeof(wchar_t)) {
+    json_string_load(json, tokens, v, u->name);
+  }
+  if ((v = json_object_get(json, tokens, 0, L"email")) != 0 &&
+      json_string_utf8_size(json, tokens, v) < sizeof(u->email)) {
+    json_string_load_utf8(json, tokens, v, u->email);
+  }
+  if ((v = json_object_get(json, tokens, 0, L"tags")) != 0) {
+    u->tags = v;
+  }
+  if ((v = json_object_get(json, tokens, 0, L"login-count")) != 0) {
+    u->login_count = (int) json_number_get(json, tokens, v);
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+  struct json_token tokens[32];
+  struct json_schema schema;
+  struct user results[3];
+  struct json_parser p;
+  double start, elapsed;
+  size_t i;
+  bool ok = true;
+
+  p = json_parse(message, tokens, 32);
+  if (p.error != JSONERR_NO_ERROR) {
+    json_print_error(stderr, p);
+    return 1;
+  }
+  json_schema_init(&schema, user_fields,
+                   sizeof(user_fields) / sizeof(user_fields[0]));
+  memset(results, 0, sizeof(results));
+
+  printf("method\tns_per_message\n");
+
+  start = now();
+  for (i = 0; i < n; i++) {
+    ok &= decode_by_lookup(message, tokens, &results[0]);
+  }
+  elapsed = now() - start;
+  printf("json_object_get\t%.1f\n", elapsed * 1e9 / n);
+
+  start = now();
+  for (i = 0; i < n; i++) {
+    ok &= json_decode(message, tokens, 0, &schema, &results[1], NULL);
+  }
+  elapsed = now() - start;
+  printf("json_decode\t%.1f\n", elapsed * 1e9 / n);
+
+  start = now();
+  for (i = 0; i < n; i++) {
+    ok &= user_decode(message, tokens, 0, &results[2]);
+  }
+  elapsed = now() - start;
+  printf("generated\t%.1f\n", elapsed * 1e9 / n);
+
+  for (i = 1; i < 3; i++) {
+    if (memcmp(&results[0], &results[i], sizeof(struct user)) != 0) {
+      fprintf(stderr, "method %lu decoded differently\n", (unsigned long) i);
+      ok = false;
+    }
+  }
+  return !ok;
+}
@@ -0,0 +1,115 @@
+/***************************************************************************//**
+
+  @file         format_double.c
+
+  @brief        Benchmark json_format_double() against printf("%.17g").
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: bench_format_double [count]
+
+  For each class of input, this formats the same array of doubles with both
+  functions, and prints the average time per call and the average output
+  length.  It also checks that every json_format_double() output reads back as
+  the original value.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nosj.h"
+
+/**
+   @brief Deterministic 64-bit PRNG (xorshift64*), so runs are comparable.
+ */
+static uint64_t next_random(uint64_t *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * UINT64_C(2685821657736338717);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+   @brief Fill the array with one class of values.
+ */
+static void fill(double *values, size_t n, int kind)
+{
+  uint64_t state = UINT64_C(0x9E3779B97F4A7C15), bits;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    switch (kind) {
+    case 0: // integers, as found in IDs and counts
+      values[i] = (double) (next_random(&state) % 100000000);
+      break;
+    case 1: // short decimals, as found in prices and coordinates
+      values[i] = (double) (next_random(&state) % 1000000) / 1000.0;
+      break;
+    default: // arbitrary finite doubles
+      do {
+        bits = next_random(&state);
+        memcpy(&values[i], &bits, sizeof(bits));
+      } while (values[i] != values[i] || values[i] - values[i] != 0);
+      break;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *kinds[] = {"integer", "decimal", "random"};
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  double *values = malloc(n * sizeof(double));
+  char buffer[64];
+  size_t i, bytes;
+  double start, elapsed;
+  int kind, errors = 0;
+
+  printf("input\tfunction\tns_per_call\tavg_bytes\n");
+  for (kind = 0; kind < 3; kind++) {
+    fill(values, n, kind);
+
+    bytes = 0;
+    start = now();
+    for (i = 0; i < n; i++) {
+      bytes += json_format_double(values[i], buffer);
+    }
+    elapsed = now() - start;
+    printf("%s\tjson_format_double\t%.1f\t%.2f\n", kinds[kind],
+           elapsed * 1e9 / n, (double) bytes / n);
+
+    bytes = 0;
+    start = now();
+    for (i = 0; i < n; i++) {
+      bytes += (size_t) snprintf(buffer, sizeof(buffer), "%.17g", values[i]);
+    }
+    elapsed = now() - start;
+    printf("%s\tprintf_17g\t%.1f\t%.2f\n", kinds[kind],
+           elapsed * 1e9 / n, (double) bytes / n);
+
+    for (i = 0; i < n; i++) {
+      json_format_double(values[i], buffer);
+      if (strtod(buffer, NULL) != values[i]) {
+        fprintf(stderr, "round trip failed: %.17g -> %s\n", values[i], buffer);
+        errors++;
+      }
+    }
+  }
+
+  free(values);
+  return errors != 0;
+}
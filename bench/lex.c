@@ -0,0 +1,114 @@
+/***************************************************************************//**
+
+  @file         lex.c
+
+  @brief        Benchmark lexing of numbers and literals.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: bench_lex [values]
+
+  Builds flat arrays holding only numbers, or only true/false/null, so that the
+  time is spent in the number DFA, the literal matcher, and the whitespace and
+  dispatch tables, rather than in strings or token bookkeeping.  Each array is
+  run through the counting pass (json_parse() with no buffer) a few times, and
+  the best time is reported.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wchar.h>
+
+#include "nosj.h"
+
+#define RUNS 5
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+   @brief Build an array of values, cycling through the given ones.
+   @param values Number of values.
+   @param cycle The values to cycle through.
+   @param ncycle The number of values in cycle.
+   @param len Set to the length in characters.
+ */
+static wchar_t *make_array(size_t values, const wchar_t **cycle, size_t ncycle,
+                           size_t *len)
+{
+  size_t cap = values * 24 + 4, i, n = 0;
+  wchar_t *text = malloc(cap * sizeof(wchar_t));
+  text[n++] = L'[';
+  for (i = 0; i < values; i++) {
+    n += (size_t) swprintf(text + n, cap - n, L"%ls%ls", cycle[i % ncycle],
+                           i + 1 < values ? L", " : L"");
+  }
+  text[n++] = L']';
+  text[n] = L'\0';
+  *len = n;
+  return text;
+}
+
+/**
+   @brief Time the counting pass over text and print a result line.
+   @returns False if the text didn't parse.
+ */
+static bool run(const char *name, wchar_t *text, size_t len)
+{
+  struct json_parser p;
+  double start, elapsed, best = 0;
+  int i;
+
+  for (i = 0; i < RUNS; i++) {
+    start = now();
+    p = json_parse(text, NULL, 0);
+    elapsed = now() - start;
+    if (i == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  printf("%s\t%.1f\t%.2f\t%lu\n", name, len / best / 1e6,
+         best * 1e9 / p.tokenidx, (unsigned long) p.tokenidx);
+  return p.error == JSONERR_NO_ERROR;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t values = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  const wchar_t *numbers[] = {
+    L"0", L"-1", L"42", L"123456789", L"3.14159", L"-0.5", L"6.02e23",
+    L"1E-9", L"-271828.1828e+3", L"100",
+  };
+  const wchar_t *literals[] = {L"true", L"false", L"null"};
+  size_t len;
+  wchar_t *text;
+  bool ok = true;
+
+  printf("input\tMchar_per_s\tns_per_token\ttokens\n");
+
+  text = make_array(values, numbers, sizeof(numbers) / sizeof(numbers[0]),
+                    &len);
+  ok = run("numbers", text, len) && ok;
+  free(text);
+
+  text = make_array(values, literals, sizeof(literals) / sizeof(literals[0]),
+                    &len);
+  ok = run("literals", text, len) && ok;
+  free(text);
+
+  if (!ok) {
+    fprintf(stderr, "benchmark input failed to parse\n");
+    return 1;
+  }
+  return 0;
+}
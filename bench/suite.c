@@ -0,0 +1,300 @@
+/***************************************************************************//**
+
+  @file         suite.c
+
+  @brief        Benchmark the core API over generated corpora.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: bench_suite [scale]
+
+  Generates each corpus in corpus.h (scaled by the optional factor), and for
+  each one times:
+  - json_parse() into a buffer, and the counting pass (best of RUNS runs).
+  - Reading every event with json_reader_next(), and skipping the whole
+    document with json_reader_skip().
+  - json_object_get() for a few keys on every object.
+  - json_array_get() for the first and last element of every array.
+  - json_number_get() on every number, and json_string_load() on every string.
+  - The peak RSS.  Each corpus runs in a child process of its own, so this is
+    the peak for that corpus alone, not for every corpus up to it.
+
+  Output is one tab-separated line per measurement (corpus, metric, value,
+  unit), so the output of two builds can be compared with diff or join.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "nosj.h"
+#include "corpus.h"
+
+#define RUNS 3
+
+/**
+   @brief Seed for every corpus, so that runs are reproducible.
+ */
+#define SEED 20151122
+
+/**
+   @brief Records in each corpus at scale 1 (about 10 MB each).
+ */
+static const size_t records[CORPUS_SHAPES] = {20000, 100000, 100000, 400};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long peak_rss_kb(void)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static void report(const char *corpus, const char *metric, double value,
+                   const char *unit)
+{
+  // Counts are printed as integers, rates with two decimals.
+  printf(value == (double) (long long) value ? "%s\t%s\t%.0f\t%s\n" :
+         "%s\t%s\t%.2f\t%s\n", corpus, metric, value, unit);
+}
+
+/**
+   @brief Generate a corpus as UTF-8, then decode it for the parser.
+   @param shape The corpus.
+   @param n Number of records.
+   @param[out] bytes Size of the UTF-8 text.
+   @param[out] len Length of the decoded text.
+ */
+static wchar_t *generate(enum corpus_shape shape, size_t n, size_t *bytes,
+                         size_t *len)
+{
+  struct json_sink sink;
+  struct json_builder b;
+  char *utf8;
+  wchar_t *text;
+
+  // Once to measure, once to write.
+  json_sink_buffer(&sink, NULL, 0);
+  json_builder_init(&b, &sink, 0);
+  corpus_write(&b, shape, n, SEED);
+  *bytes = sink.total;
+
+  utf8 = malloc(*bytes);
+  text = malloc((*bytes + 1) * sizeof(wchar_t));
+  if (utf8 == NULL || text == NULL) {
+    free(utf8);
+    free(text);
+    return NULL;
+  }
+  json_sink_buffer(&sink, utf8, *bytes);
+  json_builder_init(&b, &sink, 0);
+  corpus_write(&b, shape, n, SEED);
+
+  *len = json_utf8_decode(utf8, *bytes, text);
+  text[*len] = L'\0';
+  free(utf8);
+  return text;
+}
+
+/**
+   @brief Run every measurement on one corpus.
+   @returns False if the corpus didn't parse.
+ */
+static bool run(enum corpus_shape shape, size_t n)
+{
+  static const wchar_t *keys[] = {L"text", L"id", L"a", L"missing"};
+  const char *name = corpus_shape_names[shape];
+  size_t bytes, len, ntok, i, k, lookups, found = 0, chars = 0;
+  wchar_t *text = generate(shape, n, &bytes, &len), *string;
+  struct json_token *tokens;
+  struct json_parser p;
+  struct json_reader reader;
+  double start, best = 0, elapsed, sum = 0;
+  int r;
+
+  if (text == NULL) {
+    perror(name);
+    return false;
+  }
+  ntok = json_estimate_tokens(text, len);
+  tokens = malloc(ntok * sizeof(struct json_token));
+  string = malloc((len + 1) * sizeof(wchar_t));
+  if (tokens == NULL || string == NULL) {
+    perror(name);
+    free(text);
+    free(tokens);
+    free(string);
+    return false;
+  }
+  report(name, "bytes", bytes, "B");
+
+  for (r = 0; r < RUNS; r++) {
+    start = now();
+    p = json_parse(text, tokens, ntok);
+    elapsed = now() - start;
+    best = r == 0 || elapsed < best ? elapsed : best;
+  }
+  if (p.error != JSONERR_NO_ERROR) {
+    json_print_error(stderr, p);
+    free(text);
+    free(tokens);
+    free(string);
+    return false;
+  }
+  ntok = p.tokenidx;
+  report(name, "tokens", ntok, "tokens");
+  report(name, "parse", bytes / best / 1e6, "MB/s");
+  report(name, "parse", ntok / best / 1e6, "Mtokens/s");
+
+  for (r = 0; r < RUNS; r++) {
+    start = now();
+    p = json_parse(text, NULL, 0);
+    elapsed = now() - start;
+    best = r == 0 || elapsed < best ? elapsed : best;
+  }
+  report(name, "count", bytes / best / 1e6, "MB/s");
+
+  for (r = 0; r < RUNS; r++) {
+    start = now();
+    json_reader_init(&reader, text);
+    while (json_reader_next(&reader) > JSON_EVENT_ERROR) {
+    }
+    elapsed = now() - start;
+    best = r == 0 || elapsed < best ? elapsed : best;
+  }
+  report(name, "reader", bytes / best / 1e6, "MB/s");
+
+  for (r = 0; r < RUNS; r++) {
+    start = now();
+    json_reader_init(&reader, text);
+    json_reader_next(&reader);
+    json_reader_skip(&reader);
+    elapsed = now() - start;
+    best = r == 0 || elapsed < best ? elapsed : best;
+  }
+  report(name, "skip", bytes / best / 1e6, "MB/s");
+
+  lookups = 0;
+  start = now();
+  for (i = 0; i < ntok; i++) {
+    if (tokens[i].type == JSON_OBJECT) {
+      for (k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+        found += json_object_get(text, tokens, i, keys[k]) != 0;
+        lookups++;
+      }
+    }
+  }
+  elapsed = now() - start;
+  if (lookups > 0) {
+    report(name, "object_get", elapsed * 1e9 / lookups, "ns/lookup");
+  }
+
+  lookups = 0;
+  start = now();
+  for (i = 0; i < ntok; i++) {
+    if (tokens[i].type == JSON_ARRAY && tokens[i].length > 0) {
+      found += json_array_get(text, tokens, i, 0) != 0;
+      found += json_array_get(text, tokens, i, tokens[i].length - 1) != 0;
+      lookups += 2;
+    }
+  }
+  elapsed = now() - start;
+  if (lookups > 0) {
+    report(name, "array_get", elapsed * 1e9 / lookups, "ns/lookup");
+  }
+
+  lookups = 0;
+  start = now();
+  for (i = 0; i < ntok; i++) {
+    if (tokens[i].type == JSON_NUMBER) {
+      sum += json_number_get(text, tokens, i);
+      lookups++;
+    }
+  }
+  elapsed = now() - start;
+  if (lookups > 0) {
+    report(name, "number_get", elapsed * 1e9 / lookups, "ns/number");
+  }
+
+  lookups = 0;
+  start = now();
+  for (i = 0; i < ntok; i++) {
+    if (tokens[i].type == JSON_STRING) {
+      json_string_load(text, tokens, i, string);
+      chars += tokens[i].length;
+      lookups++;
+    }
+  }
+  elapsed = now() - start;
+  if (lookups > 0) {
+    report(name, "string_load", elapsed * 1e9 / lookups, "ns/string");
+    report(name, "string_load", chars / elapsed / 1e6, "Mchars/s");
+  }
+
+  report(name, "peak_rss", peak_rss_kb(), "kB");
+
+  // Keep the results live, so the loops aren't optimized away.
+  if (found == 0 && sum == 0) {
+    fprintf(stderr, "%s: nothing found\n", name);
+  }
+  free(text);
+  free(tokens);
+  free(string);
+  return true;
+}
+
+/**
+   @brief Run one corpus in a child process, so that its peak RSS is its own.
+   @returns False if it failed.
+ */
+static bool run_child(enum corpus_shape shape, size_t n)
+{
+  pid_t pid;
+  int status;
+
+  fflush(stdout); // or the child would print it again
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  } else if (pid == 0) {
+    status = run(shape, n) ? 0 : 1;
+    fflush(stdout);
+    _exit(status);
+  }
+  if (waitpid(pid, &status, 0) != pid) {
+    perror("waitpid");
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  double scale = argc > 1 ? strtod(argv[1], NULL) : 1.0;
+  size_t n;
+  int shape;
+  bool ok = true;
+
+  printf("corpus\tmetric\tvalue\tunit\n");
+  for (shape = 0; shape < CORPUS_SHAPES; shape++) {
+    n = (size_t) (records[shape] * scale);
+    ok = run_child((enum corpus_shape) shape, n > 0 ? n : 1) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/***************************************************************************//**
+
+  @file         utf8.c
+
+  @brief        Benchmark UTF-8 encoding of non-ASCII text.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: bench_utf8 [characters]
+
+  Builds strings of mostly two-byte (Cyrillic), mostly three-byte (CJK) and
+  mixed text, with ASCII spaces and punctuation between words as real text
+  has.  Each is encoded with json_utf8_encode_run(), and with a loop calling
+  json_utf8_encode() once per character, a few times each, and the best time
+  is reported.  The outputs are checked to be the same.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h" // for json_utf8_encode() and json_utf8_encode_run()
+
+#define RUNS 20
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+   @brief Deterministic 64-bit PRNG (xorshift64*), so runs are comparable.
+ */
+static uint64_t next_random(uint64_t *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * UINT64_C(2685821657736338717);
+}
+
+/**
+   @brief Fill text with words of random letters from the given ranges.
+   @param text Output.
+   @param n Number of characters.
+   @param ranges Pairs of first code point and count; a word picks one pair.
+   @param nranges Number of pairs.
+ */
+static void fill(wchar_t *text, size_t n, const unsigned long *ranges,
+                 size_t nranges)
+{
+  uint64_t state = UINT64_C(0x9E3779B97F4A7C15);
+  const unsigned long *range = ranges;
+  size_t i, word = 0;
+  for (i = 0; i < n; i++) {
+    if (word == 0) {
+      word = 2 + next_random(&state) % 9;
+      range = ranges + 2 * (next_random(&state) % nranges);
+      text[i] = i % 7 == 0 ? L',' : L' ';
+    } else {
+      text[i] = (wchar_t) (range[0] + next_random(&state) % range[1]);
+      word--;
+    }
+  }
+}
+
+static size_t encode_each(const wchar_t *src, size_t n, char *out)
+{
+  size_t i, outidx = 0;
+  for (i = 0; i < n; i++) {
+    outidx += json_utf8_encode(src[i], out + outidx);
+  }
+  return outidx;
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned long cyrillic[] = {0x0430, 32};
+  static const unsigned long cjk[] = {0x4E00, 20000};
+  static const unsigned long mixed[] = {0x0061, 26, 0x00E0, 30, 0x0430, 32,
+                                        0x4E00, 20000};
+  static const struct {
+    const char *name;
+    const unsigned long *ranges;
+    size_t nranges;
+  } kinds[] = {
+    {"cyrillic", cyrillic, 1}, {"cjk", cjk, 1}, {"mixed", mixed, 4},
+  };
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 4000000;
+  wchar_t *text = malloc(n * sizeof(wchar_t));
+  char *run = malloc(4 * n), *each = malloc(4 * n);
+  size_t k, bytes = 0, check = 0;
+  double start, best_run, best_each, t;
+  int i, errors = 0;
+
+  if (text == NULL || run == NULL || each == NULL) {
+    perror("bench_utf8");
+    return 1;
+  }
+  printf("input\tbytes_per_char\trun_mb_s\teach_mb_s\n");
+  for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+    fill(text, n, kinds[k].ranges, kinds[k].nranges);
+    best_run = best_each = 1e9;
+    for (i = 0; i < RUNS; i++) {
+      start = now();
+      bytes = json_utf8_encode_run(text, n, run);
+      t = now() - start;
+      best_run = t < best_run ? t : best_run;
+
+      start = now();
+      check = encode_each(text, n, each);
+      t = now() - start;
+      best_each = t < best_each ? t : best_each;
+    }
+    if (bytes != check || memcmp(run, each, bytes) != 0) {
+      fprintf(stderr, "%s: outputs differ\n", kinds[k].name);
+      errors++;
+    }
+    printf("%s\t%.2f\t%.0f\t%.0f\n", kinds[k].name, (double) bytes / n,
+           bytes / best_run / 1e6, bytes / best_each / 1e6);
+  }
+
+  free(text);
+  free(run);
+  free(each);
+  return errors != 0;
+}
@@ -0,0 +1,114 @@
+/***************************************************************************//**
+
+  @file         validate.c
+
+  @brief        Benchmark json_validate() against the json_parse() counting pass.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: bench_validate [records]
+
+  Builds a UTF-8 document (an array of records with strings, numbers, nested
+  arrays and some non-ASCII text), then times:
+  - json_validate() on the bytes.
+  - json_parse(text, NULL, 0) on text that was already decoded to wchar_t.
+  - json_estimate_tokens() on the same text, which is enough to size a token
+    buffer.
+  - Decoding with json_utf8_decode() plus that counting pass, which is what it
+    takes to check UTF-8 input with json_parse().
+  The validator and parser must agree on the token count.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nosj.h"
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+   @brief Build the test document.
+   @param records Number of records.
+   @param len Set to the length in bytes.
+ */
+static char *make_document(size_t records, size_t *len)
+{
+  size_t cap = records * 256 + 16, i;
+  char *text = malloc(cap);
+  size_t n = 0;
+  n += (size_t) sprintf(text + n, "[\n");
+  for (i = 0; i < records; i++) {
+    n += (size_t) sprintf(
+      text + n,
+      "  {\"id\": %lu, \"name\": \"user %lu\", \"city\": \"Z\xc3\xbcrich\", "
+      "\"score\": %lu.%02lu, \"active\": %s, \"tags\": [\"a\", \"b\\n\"], "
+      "\"bio\": \"A somewhat longer string, to exercise the fast path.\"}%s\n",
+      (unsigned long) i, (unsigned long) i * 7, (unsigned long) i % 1000,
+      (unsigned long) i % 100, i % 2 ? "true" : "false",
+      i + 1 < records ? "," : "");
+  }
+  n += (size_t) sprintf(text + n, "]\n");
+  *len = n;
+  return text;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t records = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+  size_t len, wlen, estimate;
+  char *text = make_document(records, &len);
+  wchar_t *wide = malloc((len + 1) * sizeof(wchar_t));
+  struct json_parser v, p;
+  double start, elapsed;
+
+  wlen = json_utf8_decode(text, len, wide);
+  wide[wlen] = L'\0';
+
+  printf("method\tMB_per_s\ttokens\n");
+
+  start = now();
+  v = json_validate(text, len);
+  elapsed = now() - start;
+  printf("json_validate\t%.1f\t%lu\n", len / elapsed / 1e6,
+         (unsigned long) v.tokenidx);
+
+  start = now();
+  p = json_parse(wide, NULL, 0);
+  elapsed = now() - start;
+  printf("json_parse_count\t%.1f\t%lu\n", len / elapsed / 1e6,
+         (unsigned long) p.tokenidx);
+
+  start = now();
+  estimate = json_estimate_tokens(wide, wlen);
+  elapsed = now() - start;
+  printf("json_estimate_tokens\t%.1f\t%lu\n", len / elapsed / 1e6,
+         (unsigned long) estimate);
+
+  start = now();
+  wlen = json_utf8_decode(text, len, wide);
+  wide[wlen] = L'\0';
+  p = json_parse(wide, NULL, 0);
+  elapsed = now() - start;
+  printf("decode_and_count\t%.1f\t%lu\n", len / elapsed / 1e6,
+         (unsigned long) p.tokenidx);
+
+  free(text);
+  free(wide);
+  if (v.error != JSONERR_NO_ERROR || p.error != JSONERR_NO_ERROR ||
+      v.tokenidx != p.tokenidx) {
+    fprintf(stderr, "validator and parser disagree\n");
+    return 1;
+  }
+  return 0;
+}
@@ -17,6 +17,7 @@
 #define SMB_JSON
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <wchar.h>
@@ -124,6 +125,10 @@ enum json_error {
      This error has an argument (e.g. expected ':').
    */
   JSONERR_EXPECTED_TOKEN,
+  /**
+     @brief Input bytes were not valid UTF-8 (only from `json_validate()`).
+   */
+  JSONERR_INVALID_UTF8,
 };
 
 /**
@@ -158,6 +163,89 @@ struct json_parser {
   size_t errorarg;
 };
 
+/**
+   @brief A function that receives output from a `struct json_sink`.
+   @param arg The argument given when the sink was created.
+   @param data The bytes to write out.
+   @param len The number of bytes.
+   @returns Zero on success, nonzero to stop further output.
+ */
+typedef int (*json_flush_fn)(void *arg, const char *data, size_t len);
+
+/**
+   @brief A destination for output that NOSJ produces.
+
+   A sink wraps a caller-provided buffer.  It can be used in three ways:
+   - As a plain buffer (`json_sink_buffer()`).  Output that doesn't fit is
+     dropped, but still counted in `total`, just like `snprintf()`.
+   - As a size query (`json_sink_buffer()` with a NULL buffer).  Nothing is
+     written, and `total` tells you how big a buffer you need.
+   - As a stream (`json_sink_stream()`).  When the buffer fills up, it is handed
+     to a flush function (e.g. to write it to a file), and reused.
+
+   NOSJ never allocates memory for a sink.
+ */
+struct json_sink {
+  /**
+     @brief The output buffer.  May be null for a size query.
+   */
+  char *buffer;
+  /**
+     @brief The number of bytes the buffer can hold.
+   */
+  size_t size;
+  /**
+     @brief The number of bytes currently held in the buffer.
+   */
+  size_t len;
+  /**
+     @brief The total number of bytes output so far, including dropped ones.
+   */
+  size_t total;
+  /**
+     @brief Function to call when the buffer is full.  Null for buffer mode.
+   */
+  json_flush_fn flush;
+  /**
+     @brief Argument to the flush function.
+   */
+  void *arg;
+  /**
+     @brief True if the flush function reported an error.
+   */
+  bool error;
+};
+
+/**
+   @brief Initialize a sink that writes into a fixed buffer.
+   @param sink The sink to initialize.
+   @param buffer The buffer.  May be null, to only count output.
+   @param size The size of the buffer.
+ */
+void json_sink_buffer(struct json_sink *sink, char *buffer, size_t size);
+
+/**
+   @brief Initialize a sink that flushes its buffer whenever it fills up.
+   @param sink The sink to initialize.
+   @param buffer The buffer to collect output in.  Must not be null.
+   @param size The size of the buffer.  Must not be zero.
+   @param flush Function to call with each full buffer.
+   @param arg Argument to pass to the flush function.
+ */
+void json_sink_stream(struct json_sink *sink, char *buffer, size_t size,
+                      json_flush_fn flush, void *arg);
+
+/**
+   @brief Finish writing to a sink.
+
+   For a stream, this flushes any remaining output.  For a buffer, this adds a
+   terminating NUL character if there's room for it (it is not counted in
+   `total`).
+   @param sink The sink.
+   @returns True if all output was delivered (or fit in the buffer).
+ */
+bool json_sink_finish(struct json_sink *sink);
+
 /**
    @brief Parse JSON into tokens.
 
@@ -176,6 +264,391 @@ struct json_parser {
  */
 struct json_parser json_parse(wchar_t *json, struct json_token *arr, size_t n);
 
+/**
+   @brief Return an upper bound on the number of tokens in some JSON.
+
+   Every token is the root value, or comes right after a `[`, `{`, `,` or `:`
+   outside of a string.  Counting those is a much simpler loop than parsing, so
+   this runs close to memory speed, and you can allocate a token buffer and
+   parse just once.  The bound is exact unless there are empty arrays or
+   objects (each adds one).  It holds for invalid JSON too: `json_parse()` never
+   writes more tokens than this.
+   @param json The text.
+   @param len The length of the text in characters (e.g. `wcslen(json)`).
+   @returns At least as many tokens as `json_parse()` would produce.
+ */
+size_t json_estimate_tokens(const wchar_t *json, size_t len);
+
+/**
+   @brief A function that receives one value from `json_parse_events()`.
+   @param arg The argument given to `json_parse_events()`.
+   @param json The text being parsed.
+   @param tok A token for the value, only valid during the call.  Its child and
+   next are always zero, but it can be passed to functions like
+   `json_string_load()` and `json_number_get()` (with index 0).
+ */
+typedef void (*json_event_fn)(void *arg, const wchar_t *json,
+                              const struct json_token *tok);
+
+/**
+   @brief Callbacks for `json_parse_events()`.  Any of them may be NULL.
+ */
+struct json_events {
+  /**
+     @brief An object started.  The token only has its type and start.
+   */
+  json_event_fn start_object;
+  /**
+     @brief The key of the next member of an object.
+   */
+  json_event_fn key;
+  /**
+     @brief An object ended.  The token has its end and length too.
+   */
+  json_event_fn end_object;
+  /**
+     @brief An array started.  The token only has its type and start.
+   */
+  json_event_fn start_array;
+  /**
+     @brief An array ended.  The token has its end and length too.
+   */
+  json_event_fn end_array;
+  /**
+     @brief A string value (not a key).
+   */
+  json_event_fn string;
+  /**
+     @brief A number.
+   */
+  json_event_fn number;
+  /**
+     @brief True or false (see the token's type).
+   */
+  json_event_fn boolean;
+  /**
+     @brief Null.
+   */
+  json_event_fn null;
+};
+
+/**
+   @brief Parse JSON, calling back for each value instead of storing tokens.
+
+   This is the same parser as `json_parse()`, but no token buffer is needed:
+   memory use depends only on how deeply the document is nested.  Events come
+   in document order.  If there is an error, the events up to it have already
+   been delivered, and the containers around it get no end event.
+   @param json The text buffer to parse.
+   @param events The callbacks.
+   @param arg Passed to each callback.
+   @returns A parser result.  `tokenidx` is the number of values seen.
+ */
+struct json_parser json_parse_events(wchar_t *json,
+                                     const struct json_events *events,
+                                     void *arg);
+
+/**
+   @brief Maximum nesting depth of a `struct json_reader`.
+ */
+#define JSON_READER_MAXDEPTH 4096
+
+/**
+   @brief What `json_reader_next()` found.
+ */
+enum json_event {
+  /**
+     @brief The document is complete.  There are no more events.
+   */
+  JSON_EVENT_DONE,
+  /**
+     @brief The text is malformed (see the reader's `parser`).
+   */
+  JSON_EVENT_ERROR,
+  /**
+     @brief An array or object started.
+   */
+  JSON_EVENT_BEGIN,
+  /**
+     @brief An array or object ended.
+   */
+  JSON_EVENT_END,
+  /**
+     @brief The key of an object member.  Its value is the next event.
+   */
+  JSON_EVENT_KEY,
+  /**
+     @brief A string, number, true, false or null.
+   */
+  JSON_EVENT_VALUE,
+};
+
+/**
+   @brief State for reading JSON one event at a time.
+
+   A reader is a pull parser: each call to `json_reader_next()` returns the next
+   event in the document, so the caller can stop (or skip a whole array or
+   object) at any point.  It checks everything `json_parse()` does, but keeps
+   no tokens, only one bit per level of nesting.
+ */
+struct json_reader {
+  /**
+     @brief The text being read.
+   */
+  const wchar_t *text;
+  /**
+     @brief Position, error and number of tokens read, as from `json_parse()`.
+     Tokens skipped by `json_reader_skip()` aren't counted.
+   */
+  struct json_parser parser;
+  /**
+     @brief The value of the last event.
+
+     For BEGIN and END, only the type and the bracket's position are set (start
+     and end are the same).  For KEY and VALUE, the start, end and length are
+     set, so the token can be passed to functions like `json_string_load()`
+     and `json_number_get()` (with index 0).
+   */
+  struct json_token token;
+  /**
+     @brief The last event.
+   */
+  enum json_event event;
+  /**
+     @brief Number of arrays and objects open after the last event.
+
+     A BEGIN counts the container it starts, and an END doesn't count the one it
+     ends, so both see the container at the same depth.
+   */
+  size_t depth;
+  /**
+     @brief One bit per level of nesting: set for objects, clear for arrays.
+   */
+  unsigned char stack[JSON_READER_MAXDEPTH / 8];
+  /**
+     @brief What the reader expects next.
+   */
+  int state;
+  /**
+     @brief True when a closing bracket may come next: after an opening bracket,
+     or after a comma (`json_parse()` allows a trailing comma).
+   */
+  bool opened;
+};
+
+/**
+   @brief Start reading a document.
+   @param r The reader.
+   @param json The text, NUL terminated.
+ */
+void json_reader_init(struct json_reader *r, const wchar_t *json);
+
+/**
+   @brief Read the next event.
+   @param r The reader.
+   @returns The event (also stored in `r->event`).  Once DONE or ERROR is
+   returned, it is returned again on every call.
+ */
+enum json_event json_reader_next(struct json_reader *r);
+
+/**
+   @brief Skip the rest of the value the last event started.
+
+   After BEGIN, this skips to the matching END.  After KEY, it skips the key's
+   value.  After anything else there is nothing to skip.  Arrays and objects are
+   skipped by only looking for brackets and the ends of strings, which is much
+   faster than reading them, but also means errors inside them are not found.
+   @param r The reader.
+   @returns The last event skipped: END for an array or object, VALUE for a
+   scalar after a key, or ERROR.  If there was nothing to skip, the last event.
+ */
+enum json_event json_reader_skip(struct json_reader *r);
+
+#ifdef NOSJ_STATS
+
+/**
+   @brief Statistics about the shape of a document, from `json_parse_stats()`.
+
+   These are only available when NOSJ is built with NOSJ_STATS defined (`make
+   STATS=1`), so that the ordinary parser carries no extra work.
+ */
+struct json_stats {
+  /**
+     @brief Number of tokens of each `enum json_type`.
+   */
+  size_t tokens[JSON_NULL+1];
+  /**
+     @brief Deepest nesting of arrays and objects (zero for a scalar).
+   */
+  size_t max_depth;
+  /**
+     @brief Whitespace characters skipped (each is one byte in UTF-8).
+   */
+  size_t whitespace;
+  /**
+     @brief Escape sequences in strings (including keys).  A surrogate pair
+     counts as two.
+   */
+  size_t escapes;
+  /**
+     @brief Surrogate pairs (two \u escapes making one character) in strings.
+   */
+  size_t surrogate_pairs;
+  /**
+     @brief Length of the longest string (or key), in characters.
+   */
+  size_t longest_string;
+  /**
+     @brief Most members in any object.
+   */
+  size_t largest_object;
+  /**
+     @brief Most elements in any array.
+   */
+  size_t largest_array;
+};
+
+/**
+   @brief Parse JSON into tokens, like `json_parse()`, and collect statistics.
+   @param json The text buffer to parse.
+   @param arr A buffer to put the tokens in.  May be null.
+   @param n The number of slots in the arr buffer.
+   @param stats Filled in with statistics about the text parsed (up to any
+   error).
+   @returns A parser result.
+ */
+struct json_parser json_parse_stats(wchar_t *json, struct json_token *arr,
+                                    size_t n, struct json_stats *stats);
+
+#endif // NOSJ_STATS
+
+#ifdef NOSJ_TRACE
+
+/**
+   @brief The kinds of event `json_parse_trace()` reports.
+ */
+enum json_trace_kind {
+  /**
+     @brief An array or object was started (`start` is its opening bracket).
+   */
+  JSON_TRACE_ENTER,
+  /**
+     @brief An array or object was finished (`end` is its closing bracket).
+   */
+  JSON_TRACE_LEAVE,
+  /**
+     @brief A string or key was parsed.
+   */
+  JSON_TRACE_STRING,
+  /**
+     @brief A number was parsed.
+   */
+  JSON_TRACE_NUMBER,
+  /**
+     @brief Parsing failed at `start`.  This is always the last event.
+   */
+  JSON_TRACE_ERROR,
+};
+
+/**
+   @brief One event from `json_parse_trace()`.
+ */
+struct json_trace_event {
+  /**
+     @brief What happened.
+   */
+  enum json_trace_kind kind;
+  /**
+     @brief The type of the value (not meaningful for errors).
+   */
+  enum json_type type;
+  /**
+     @brief The error, for JSON_TRACE_ERROR.
+   */
+  enum json_error error;
+  /**
+     @brief Index of the first character of the value in the text.
+   */
+  size_t start;
+  /**
+     @brief Index of the last character of the value (or `start`, on enter).
+   */
+  size_t end;
+  /**
+     @brief Number of arrays and objects enclosing the value.
+   */
+  size_t depth;
+};
+
+/**
+   @brief A function that receives events from `json_parse_trace()`.
+   @param arg The argument given to `json_parse_trace()`.
+   @param event The event.  It is only valid during the call.
+ */
+typedef void (*json_trace_fn)(void *arg, const struct json_trace_event *event);
+
+/**
+   @brief Parse JSON into tokens, like `json_parse()`, reporting each event.
+
+   This is only available when NOSJ is built with NOSJ_TRACE defined (`make
+   TRACE=1`).  The callback runs inside the parser's inner loop, so a slow one
+   slows parsing down, but the timing of one part of a document relative to
+   another is still meaningful.  See tools/nosj_trace.c for an example.
+   @param json The text buffer to parse.
+   @param arr A buffer to put the tokens in.  May be null.
+   @param n The number of slots in the arr buffer.
+   @param fn Called with each event, in order.
+   @param arg Passed to fn.
+   @returns A parser result.
+ */
+struct json_parser json_parse_trace(wchar_t *json, struct json_token *arr,
+                                    size_t n, json_trace_fn fn, void *arg);
+
+#endif // NOSJ_TRACE
+
+/**
+   @brief Decode UTF-8 bytes into the wide characters `json_parse()` expects.
+
+   Unlike `mbstowcs()`, this doesn't depend on the current locale, and it
+   doesn't stop at NUL bytes or invalid input.  Each malformed sequence becomes
+   U+FFFD.  The output is not NUL terminated.
+
+   Since every code point takes at least one byte, an output buffer of `n`
+   characters is always large enough, so callers can allocate once and decode
+   in a single pass.
+   @param src The UTF-8 bytes.
+   @param n The number of bytes.
+   @param out Buffer for the output, or NULL to only count.
+   @returns The number of characters decoded.
+ */
+size_t json_utf8_decode(const char *src, size_t n, wchar_t *out);
+
+/**
+   @brief Maximum nesting depth accepted by `json_validate()`.
+ */
+#define JSON_VALIDATE_MAXDEPTH 4096
+
+/**
+   @brief Check whether UTF-8 text is a single valid JSON value.
+
+   This is much cheaper than `json_parse()`, even when counting tokens: it
+   reads the UTF-8 bytes directly (no decoding to `wchar_t`), keeps no token
+   bookkeeping, and skips through strings several bytes at a time.  It checks
+   that the UTF-8 is well formed too.
+
+   It is also stricter than `json_parse()`.  Raw control characters in strings,
+   unpaired surrogate escapes, trailing commas in arrays and objects, and
+   anything but whitespace after the value are all rejected.  So is nesting
+   deeper than `JSON_VALIDATE_MAXDEPTH`, with `JSONERR_UNEXPECTED_TOKEN` at the
+   bracket that goes too deep.
+   @param text The UTF-8 text.  It doesn't need to be NUL terminated.
+   @param len The number of bytes.
+   @returns A parser result.  `error` says whether the text is valid, and if
+   not, `textidx` is the byte offset where the problem was found.  On success,
+   `tokenidx` is the number of tokens `json_parse()` would produce.
+ */
+struct json_parser json_validate(const char *text, size_t len);
+
 /**
    @brief Print a list of JSON tokens.
 
@@ -220,6 +693,34 @@ bool json_string_match(const wchar_t *json, const struct json_token *tokens,
 void json_string_load(const wchar_t *json, const struct json_token *tokens,
                       size_t index, wchar_t *buffer);
 
+/**
+   @brief Return the number of bytes a string occupies when encoded as UTF-8.
+   @param json The original JSON buffer.
+   @param tokens The parsed tokens.
+   @param index The index of the string token.
+   @return The number of bytes, not including the terminating NUL.
+
+   A string token's `length` counts code points, not bytes, so use this to size
+   the buffer for `json_string_load_utf8()`.
+ */
+size_t json_string_utf8_size(const wchar_t *json,
+                             const struct json_token *tokens, size_t index);
+
+/**
+   @brief Load a string into a buffer, encoded as UTF-8.
+   @param json The original JSON buffer.
+   @param tokens The parsed tokens.
+   @param index The index of the string token.
+   @param buffer The buffer to load the string into.
+
+   Escape sequences and surrogate pairs are decoded straight into UTF-8, so
+   there is no need for an intermediate `wchar_t` buffer and `wcstombs()`.  The
+   output does not depend on the current locale.  The buffer MUST NOT be null,
+   and must be at least `json_string_utf8_size() + 1` bytes long.
+ */
+void json_string_load_utf8(const wchar_t *json, const struct json_token *tokens,
+                           size_t index, char *buffer);
+
 /**
    @brief Return the value associated with a key in a JSON object.
    @param json The original JSON buffer.
@@ -252,4 +753,1226 @@ size_t json_array_get(const wchar_t *json, const struct json_token *tokens,
 double json_number_get(const wchar_t *json, const struct json_token *tokens,
                        size_t index);
 
+struct json_member;
+
+/**
+   @brief A JSON value loaded into memory by `json_load_dom()`.
+ */
+struct json_value {
+  /**
+     @brief Type of the value.
+   */
+  enum json_type type;
+  /**
+     @brief Number of elements (arrays), members (objects) or characters
+     (strings).  Zero for everything else.
+   */
+  size_t length;
+  /**
+     @brief The contents of the value, depending on its type.  True, false and
+     null don't have any.
+   */
+  union {
+    /**
+       @brief Numbers: the converted value.
+     */
+    double number;
+    /**
+       @brief Strings: the decoded string, NUL terminated.
+     */
+    wchar_t *string;
+    /**
+       @brief Arrays: the elements, in order.
+     */
+    struct json_value *array;
+    /**
+       @brief Objects: the key/value pairs, in the order they appear.
+     */
+    struct json_member *object;
+  } u;
+};
+
+/**
+   @brief A key/value pair in an object loaded by `json_load_dom()`.
+ */
+struct json_member {
+  /**
+     @brief The decoded key, NUL terminated.
+   */
+  wchar_t *key;
+  /**
+     @brief Number of characters in the key.
+   */
+  size_t keylen;
+  /**
+     @brief The value.
+   */
+  struct json_value value;
+};
+
+/**
+   @brief Return the number of bytes `json_load_dom()` needs for a value.
+   @param json The original JSON buffer.
+   @param tokens The parsed token buffer.
+   @param index The index of the value to load.
+   @returns The arena size, in bytes.
+ */
+size_t json_dom_size(const wchar_t *json, const struct json_token *tokens,
+                     size_t index);
+
+/**
+   @brief Load a parsed value (and everything inside it) into memory.
+
+   Strings are decoded and numbers converted, so nothing in the tree refers
+   back to the text or tokens.  Every node comes from the arena, and nothing
+   else is allocated.  The root is at the very start of the arena, so if you
+   got the arena from `malloc()`, then freeing it frees the whole tree.
+   @param json The original JSON buffer.
+   @param tokens The parsed token buffer.
+   @param index The index of the value to load.
+   @param arena Memory for the tree, suitably aligned for any type (as
+   `malloc()` returns).
+   @param size Size of the arena, which must be at least `json_dom_size()`.
+   @returns The root of the tree, or NULL if the arena is too small.
+ */
+struct json_value *json_load_dom(const wchar_t *json,
+                                 const struct json_token *tokens, size_t index,
+                                 void *arena, size_t size);
+
+/**
+   @brief An allocator that NOSJ's allocating functions can use.
+
+   Every function that takes one also accepts NULL, meaning
+   `json_malloc_allocator`.  The sizes passed to `realloc` and `free` are the
+   sizes the memory was requested with, so allocators don't need to store them.
+ */
+struct json_allocator {
+  /**
+     @brief Allocate n bytes, aligned for any type.  Return NULL on failure.
+   */
+  void *(*alloc)(void *ctx, size_t n);
+  /**
+     @brief Resize memory from alloc (or allocate, if ptr is NULL) from old
+     bytes to n bytes.  Return NULL on failure, leaving ptr alone.
+   */
+  void *(*realloc)(void *ctx, void *ptr, size_t old, size_t n);
+  /**
+     @brief Release n bytes at ptr.
+   */
+  void (*free)(void *ctx, void *ptr, size_t n);
+  /**
+     @brief Passed to each function.
+   */
+  void *ctx;
+};
+
+/**
+   @brief An allocator that uses `malloc()`, `realloc()` and `free()`.
+ */
+extern const struct json_allocator json_malloc_allocator;
+
+/**
+   @brief A bump allocator over a caller-provided buffer.
+
+   Allocating is just moving a pointer.  Memory is given back all at once, by
+   `json_arena_reset()`, which makes arenas a good fit for per-request memory
+   that can be reused once the request is done.  (The most recent allocation
+   can also be grown, shrunk or freed in place.)  Arenas aren't thread safe, so
+   give each thread its own.
+ */
+struct json_arena {
+  /**
+     @brief The buffer.
+   */
+  char *base;
+  /**
+     @brief Size of the buffer.
+   */
+  size_t size;
+  /**
+     @brief Number of bytes handed out.
+   */
+  size_t used;
+  /**
+     @brief Offset of the most recent allocation.
+   */
+  size_t last;
+};
+
+/**
+   @brief Create an arena over a buffer.
+   @param arena The arena.
+   @param buffer The memory to hand out.  It should be aligned for any type (as
+   `malloc()` returns).
+   @param size Size of the buffer.
+ */
+void json_arena_init(struct json_arena *arena, void *buffer, size_t size);
+
+/**
+   @brief Release everything allocated from an arena.
+ */
+void json_arena_reset(struct json_arena *arena);
+
+/**
+   @brief Fill in an allocator that allocates from an arena.
+ */
+void json_arena_allocator(struct json_arena *arena, struct json_allocator *a);
+
+/**
+   @brief An allocator of fixed-size blocks from a caller-provided buffer.
+
+   Blocks are kept on a free list, so they can be freed and reused in any
+   order.  Requests larger than the block size fail.  Like arenas, pools aren't
+   thread safe.
+ */
+struct json_pool {
+  /**
+     @brief The buffer.
+   */
+  char *base;
+  /**
+     @brief Size of each block (rounded up for alignment).
+   */
+  size_t block;
+  /**
+     @brief Number of blocks in the buffer.
+   */
+  size_t count;
+  /**
+     @brief First free block.
+   */
+  void *free;
+};
+
+/**
+   @brief Create a pool over a buffer.
+   @param pool The pool.
+   @param buffer The memory to hand out, aligned for any type.
+   @param size Size of the buffer.
+   @param block Size of each block.
+ */
+void json_pool_init(struct json_pool *pool, void *buffer, size_t size,
+                    size_t block);
+
+/**
+   @brief Return every block to the pool.
+ */
+void json_pool_reset(struct json_pool *pool);
+
+/**
+   @brief Fill in an allocator that allocates from a pool.
+ */
+void json_pool_allocator(struct json_pool *pool, struct json_allocator *a);
+
+/**
+   @brief Parse JSON into a token array that is allocated for you.
+
+   This allocates for `json_estimate_tokens()` and parses once, then shrinks
+   the buffer to fit.  If the estimate can't be allocated, it falls back to
+   counting the tokens exactly first.
+   @param json The text to parse.
+   @param arr Set to the tokens (allocated with `a`), or NULL if parsing or
+   allocation failed.  Free it with `a->free(a->ctx, *arr, tokenidx *
+   sizeof(struct json_token))`.
+   @param a The allocator, or NULL for malloc().
+   @returns The parser result.  Check `error`, and check that `*arr` isn't NULL.
+ */
+struct json_parser json_parse_alloc(wchar_t *json, struct json_token **arr,
+                                    const struct json_allocator *a);
+
+/**
+   @brief Load a parsed value into memory obtained from an allocator.
+
+   This sizes the tree, makes one allocation, and calls `json_load_dom()`.
+   @param json The original JSON buffer.
+   @param tokens The parsed token buffer.
+   @param index The index of the value to load.
+   @param a The allocator, or NULL for malloc().
+   @param size Set to the size of the allocation.  Free the whole tree with
+   `a->free(a->ctx, root, *size)`.
+   @returns The root of the tree, or NULL if allocation failed.
+ */
+struct json_value *json_dom_alloc(const wchar_t *json,
+                                  const struct json_token *tokens, size_t index,
+                                  const struct json_allocator *a, size_t *size);
+
+/**
+   @brief The C types that `json_decode()` can store into.
+ */
+enum json_field_type {
+  /**
+     @brief A `double`, from a number.
+   */
+  JSON_FIELD_DOUBLE,
+  /**
+     @brief An `int`, from a number that is an integer in range.
+   */
+  JSON_FIELD_INT,
+  /**
+     @brief A `bool`, from true or false.
+   */
+  JSON_FIELD_BOOL,
+  /**
+     @brief A `wchar_t` array, from a string.
+   */
+  JSON_FIELD_STRING,
+  /**
+     @brief A `char` array, from a string encoded as UTF-8.
+   */
+  JSON_FIELD_UTF8,
+  /**
+     @brief A `size_t` token index, from any value.  Use this for nested
+     objects and arrays, to decode them separately.
+   */
+  JSON_FIELD_INDEX
+};
+
+/**
+   @brief Flag for `struct json_field`: decoding fails if the key is missing.
+ */
+#define JSON_FIELD_REQUIRED 0x01
+
+/**
+   @brief Describes how to decode one member of an object into a struct.
+ */
+struct json_field {
+  /**
+     @brief The key in the JSON object.
+   */
+  const wchar_t *key;
+  /**
+     @brief The type of the struct member.
+   */
+  enum json_field_type type;
+  /**
+     @brief Offset of the struct member.
+   */
+  size_t offset;
+  /**
+     @brief Size of the struct member, in bytes.  Strings must fit in this,
+     including their NUL.
+   */
+  size_t size;
+  /**
+     @brief Zero, or JSON_FIELD_REQUIRED.
+   */
+  unsigned int flags;
+};
+
+/**
+   @brief Initializer for a `struct json_field`.
+   @param key_ The JSON key (a wide string literal).
+   @param struct_ The struct type.
+   @param member The struct member to store into.
+   @param type_ The `enum json_field_type`.
+   @param flags_ Zero, or JSON_FIELD_REQUIRED.
+ */
+#define JSON_FIELD(key_, struct_, member, type_, flags_)              \
+  {key_, type_, offsetof(struct_, member),                            \
+   sizeof(((struct_ *) 0)->member), flags_}
+
+/**
+   @brief Maximum number of fields in a schema.
+ */
+#define JSON_SCHEMA_MAXFIELDS 64
+/**
+   @brief Number of hash table slots in a schema (a power of two).
+ */
+#define JSON_SCHEMA_SLOTS (2 * JSON_SCHEMA_MAXFIELDS)
+
+/**
+   @brief A field table, plus a hash table for looking up keys.
+
+   Build it once with `json_schema_init()`, and reuse it for every object you
+   decode.
+ */
+struct json_schema {
+  /**
+     @brief The fields.
+   */
+  const struct json_field *fields;
+  /**
+     @brief Number of fields.
+   */
+  size_t nfields;
+  /**
+     @brief Open-addressed hash table: one plus the field index, or zero for an
+     empty slot.
+   */
+  unsigned char slots[JSON_SCHEMA_SLOTS];
+};
+
+/**
+   @brief Build the lookup table for a field table.
+   @param schema The schema to initialize.
+   @param fields The fields.  These are not copied, so they must outlive the
+   schema.
+   @param nfields Number of fields, at most JSON_SCHEMA_MAXFIELDS.
+   @returns False if there are too many fields.
+ */
+bool json_schema_init(struct json_schema *schema,
+                      const struct json_field *fields, size_t nfields);
+
+/**
+   @brief Decode a JSON object into a struct, in a single pass over its keys.
+
+   Keys that aren't in the schema are ignored, as are null values.  Struct
+   members whose keys are missing are left untouched, so initialize the struct
+   with any defaults first.
+   @param json The original JSON buffer.
+   @param tokens The parsed token buffer.
+   @param index The index of the object.
+   @param schema The schema.
+   @param out The struct to decode into.
+   @param failed If not NULL, set to the index of the field that failed: one
+   with the wrong type, a string that didn't fit, or a missing required field.
+   It's set to `nfields` if the value wasn't an object.
+   @returns True on success.  On failure, some members may have been stored.
+ */
+bool json_decode(const wchar_t *json, const struct json_token *tokens,
+                 size_t index, const struct json_schema *schema, void *out,
+                 size_t *failed);
+
+/**
+   @brief Serialize a parsed JSON value (and everything inside it) as UTF-8.
+
+   String and number tokens are copied verbatim from the original text (escape
+   sequences are kept as they were), so this never has to load or convert any
+   values.  Whitespace is dropped, and replaced with newlines and indentation if
+   you ask for pretty output.
+
+   To find out how large a buffer you need, give it a sink created with a NULL
+   buffer.  To write large values to a file, give it a streaming sink.
+   @param json The original JSON buffer.
+   @param tokens The parsed token buffer.
+   @param index The index of the value to write.
+   @param sink Where to write the output.
+   @param indent Zero for minified output, otherwise the number of spaces to
+   indent each level of nesting with.
+   @returns The number of bytes produced (including any that did not fit).
+ */
+size_t json_write(const wchar_t *json, const struct json_token *tokens,
+                  size_t index, struct json_sink *sink, unsigned int indent);
+
+/**
+   @brief Buffer size `json_format_double()` needs, including the NUL.
+ */
+#define JSON_FORMAT_DOUBLE_SIZE 26
+
+/**
+   @brief Format a double as JSON text, using as few digits as possible.
+
+   The output always reads back (e.g. with `strtod()` or `json_number_get()`)
+   as exactly the same double, but unlike `printf("%.17g")` it doesn't pad the
+   number out with noise digits: 0.1 is written as "0.1", not
+   "0.10000000000000001".  Integral values are written without a fraction or
+   exponent (up to 1e21), and very large or small values in scientific
+   notation.  NaN and infinities can't be represented in JSON, so they are
+   written as "null".
+   @param value The value to format.
+   @param buffer Output buffer, at least `JSON_FORMAT_DOUBLE_SIZE` chars.
+   @returns The length of the output, not including the terminating NUL.
+ */
+size_t json_format_double(double value, char *buffer);
+
+/**
+   @brief Maximum nesting depth of a `struct json_builder`.
+ */
+#define JSON_BUILDER_MAXDEPTH 64
+
+/**
+   @brief State for building JSON output one value at a time.
+
+   The builder writes straight into a `struct json_sink`, so it never allocates
+   memory.  It keeps track of nesting, and of where commas (and, for pretty
+   output, newlines) need to go, so that you only need to say what values to
+   write.  Every builder function returns false (and sets `error`) if it is
+   called at a point where the value would not be valid JSON, for example a
+   value inside an object without a key first.  After an error, the builder
+   ignores any further calls.
+ */
+struct json_builder {
+  /**
+     @brief Where output goes.
+   */
+  struct json_sink *sink;
+  /**
+     @brief Spaces per level of nesting, or zero for minified output.
+   */
+  unsigned int indent;
+  /**
+     @brief Number of currently open objects and arrays.
+   */
+  size_t depth;
+  /**
+     @brief Flags for each open object or array.
+   */
+  unsigned char stack[JSON_BUILDER_MAXDEPTH];
+  /**
+     @brief True when a key has been written, and its value is expected next.
+   */
+  bool key;
+  /**
+     @brief True once a complete top-level value has been written.
+   */
+  bool done;
+  /**
+     @brief True if the builder was used incorrectly.
+   */
+  bool error;
+};
+
+/**
+   @brief Initialize a builder.
+   @param b The builder.
+   @param sink Where to write output.
+   @param indent Zero for minified output, otherwise the number of spaces to
+   indent each level of nesting with.
+ */
+void json_builder_init(struct json_builder *b, struct json_sink *sink,
+                       unsigned int indent);
+
+/**
+   @brief Start an object.
+ */
+bool json_builder_begin_object(struct json_builder *b);
+
+/**
+   @brief Start an array.
+ */
+bool json_builder_begin_array(struct json_builder *b);
+
+/**
+   @brief End the innermost open object or array.
+ */
+bool json_builder_end(struct json_builder *b);
+
+/**
+   @brief Write an object key.  Must be followed by exactly one value.
+   @param b The builder.
+   @param key The key, as a NUL-terminated UTF-8 string.
+ */
+bool json_builder_key(struct json_builder *b, const char *key);
+
+/**
+   @brief Write a string value.
+   @param b The builder.
+   @param str The string, as a NUL-terminated UTF-8 string.  It is escaped as
+   necessary.
+ */
+bool json_builder_string(struct json_builder *b, const char *str);
+
+/**
+   @brief Write a string value of known length (which may contain NULs).
+   @param b The builder.
+   @param str The string, in UTF-8.
+   @param len The number of bytes in the string.
+ */
+bool json_builder_string_n(struct json_builder *b, const char *str, size_t len);
+
+/**
+   @brief Write an integer value.
+ */
+bool json_builder_int64(struct json_builder *b, int64_t value);
+
+/**
+   @brief Write a floating point value.
+
+   The value is written with the fewest digits that still read back as exactly
+   the same double.  NaN and infinities can't be represented in JSON, so they
+   are written as null.
+ */
+bool json_builder_double(struct json_builder *b, double value);
+
+/**
+   @brief Write true or false.
+ */
+bool json_builder_bool(struct json_builder *b, bool value);
+
+/**
+   @brief Write null.
+ */
+bool json_builder_null(struct json_builder *b);
+
+/**
+   @brief Check that a complete JSON value has been written.
+
+   This does not finish the sink; call `json_sink_finish()` for that.
+   @returns True if exactly one complete value was written without errors.
+ */
+bool json_builder_finish(struct json_builder *b);
+
+/**
+   @brief Maximum nesting depth of a `struct json_reformatter`.
+ */
+#define JSON_REFORMAT_MAXDEPTH 4096
+
+/**
+   @brief State for minifying or pretty-printing JSON as a stream of bytes.
+
+   The reformatter takes UTF-8 (or ASCII) input in chunks of any size, and
+   writes the reformatted text to a sink as it goes.  It doesn't build tokens,
+   so it can reformat input of any size in a fixed amount of memory.  Each
+   top-level value is followed by a newline, so several top-level values in a
+   row (e.g. newline-delimited JSON) are written one per line.
+
+   This checks the grammar the way `json_parse()` does: brackets must match,
+   values must be separated by commas, object keys must be strings followed by
+   colons, numbers and literals must be well formed, and escapes in strings
+   must be valid, with surrogate escapes in pairs.  A trailing comma is
+   accepted, as `json_parse()` accepts it, and left out of the output.  Other
+   string contents, including UTF-8, are copied as they are.
+ */
+struct json_reformatter {
+  /**
+     @brief Where output goes.
+   */
+  struct json_sink *sink;
+  /**
+     @brief Spaces per level of nesting, or zero for minified output.
+   */
+  unsigned int indent;
+  /**
+     @brief Number of currently open objects and arrays.
+   */
+  size_t depth;
+  /**
+     @brief One bit per level of nesting: set for objects, clear for arrays.
+   */
+  unsigned char stack[JSON_REFORMAT_MAXDEPTH / 8];
+  /**
+     @brief Where we are in the input (between values, in a string, etc).
+   */
+  int state;
+  /**
+     @brief What the grammar allows next, outside of strings and scalars.
+   */
+  int expect;
+  /**
+     @brief True right after an object or array was opened.
+   */
+  bool opened;
+  /**
+     @brief True after a comma that hasn't been written yet.
+
+     The comma is written when the next value or key begins, so that a trailing
+     comma can be dropped.
+   */
+  bool comma;
+  /**
+     @brief The literal being copied, or NULL for a number.
+   */
+  const char *literal;
+  /**
+     @brief How much of the literal matched, the number's scanner state, or
+     the number of hex digits of a \\u escape seen.
+   */
+  int sub;
+  /**
+     @brief The value of the \\u escape being read.
+   */
+  unsigned long code;
+  /**
+     @brief True after a \\u escape for a surrogate, which must be followed by
+     another.
+   */
+  bool surrogate;
+  /**
+     @brief Number of top-level values seen so far.
+   */
+  size_t values;
+  /**
+     @brief Number of input bytes handled so far (or the offset of an error).
+   */
+  size_t offset;
+  /**
+     @brief Error code, if the input was malformed.
+   */
+  enum json_error error;
+  /**
+     @brief Argument to the error code (like `json_parser.errorarg`).
+   */
+  size_t errorarg;
+};
+
+/**
+   @brief Initialize a reformatter.
+   @param r The reformatter.
+   @param sink Where to write output.
+   @param indent Zero to minify, otherwise the number of spaces to indent each
+   level of nesting with.
+ */
+void json_reformat_init(struct json_reformatter *r, struct json_sink *sink,
+                        unsigned int indent);
+
+/**
+   @brief Reformat the next chunk of input.
+
+   Chunks may be split anywhere, even in the middle of a string or number.
+   @param r The reformatter.
+   @param data The input bytes.
+   @param len The number of bytes.
+   @returns False if the input was malformed (see `error` and `offset`).
+ */
+bool json_reformat_feed(struct json_reformatter *r, const char *data,
+                        size_t len);
+
+/**
+   @brief Signal the end of input.
+
+   This does not finish the sink; call `json_sink_finish()` for that.
+   @returns False if the input ended in the middle of a value.
+ */
+bool json_reformat_finish(struct json_reformatter *r);
+
+/**
+   @brief Flag for `json_doc_map()`: verify the checksum of the whole file, and
+   that the tokens stay in bounds.
+ */
+#define JSON_DOC_VERIFY 0x01
+
+/**
+   @brief A parsed document mapped into memory by `json_doc_map()`.
+
+   The text and tokens point directly into the mapping, and can be used with
+   every function that doesn't modify them.  Release it with `json_doc_unmap()`.
+ */
+struct json_doc {
+  /**
+     @brief The document text, NUL terminated.
+   */
+  const wchar_t *text;
+  /**
+     @brief Number of characters in the text (not counting the NUL).
+   */
+  size_t textlen;
+  /**
+     @brief The token array.
+   */
+  const struct json_token *tokens;
+  /**
+     @brief Number of tokens.
+   */
+  size_t ntokens;
+  /**
+     @brief Start of the mapping.
+   */
+  void *base;
+  /**
+     @brief Size of the mapping, in bytes.
+   */
+  size_t size;
+};
+
+/**
+   @brief Save a parsed document to a file that `json_doc_map()` can load.
+
+   The file stores the text and tokens in their in-memory layout, so it can only
+   be loaded on a machine with the same architecture.  If other processes may be
+   mapping the file, save to a temporary name and rename() it into place.
+   @param path The file to write.
+   @param text The JSON text that was parsed.
+   @param textlen Number of characters in the text.
+   @param tokens The tokens from parsing it.
+   @param ntokens Number of tokens.
+   @returns 0 on success, or -1 with errno set.
+ */
+int json_doc_save(const char *path, const wchar_t *text, size_t textlen,
+                  const struct json_token *tokens, size_t ntokens);
+
+/**
+   @brief Map a document saved by `json_doc_save()` into memory.
+
+   Only the header is read, so this costs a few system calls no matter how big
+   the document is; pages are loaded as they are touched.  That means the
+   tokens are trusted: a damaged or hostile file can send lookups out of
+   bounds.  With JSON_DOC_VERIFY, the whole file is read to check its
+   checksum, and that every token's child, next, start and end are in bounds,
+   so use it for files that may not be yours.
+   @param path The file to map.
+   @param doc Filled in with the document.
+   @param flags Zero or JSON_DOC_VERIFY.
+   @returns 0 on success, or -1 with errno set.  errno is EINVAL for a file that
+   isn't a document, was saved on an incompatible machine, or (when verifying)
+   is corrupt.
+ */
+int json_doc_map(const char *path, struct json_doc *doc, unsigned int flags);
+
+/**
+   @brief Unmap a document mapped with `json_doc_map()`.
+ */
+void json_doc_unmap(struct json_doc *doc);
+
+/**
+   @brief Reads the elements of a top-level array one at a time.
+
+   For input like `[{...}, {...}, ...]` that is too big to parse at once, each
+   element is parsed on its own into a token buffer that is reused for the
+   next one.  Memory use is proportional to the largest element, not to the
+   whole input.  The input is UTF-8, from a file descriptor (read in chunks) or
+   from memory (e.g. a mapped window of a file).
+ */
+struct json_array_stream {
+  /**
+     @brief File to read from, or -1 when reading from memory.
+   */
+  int fd;
+  /**
+     @brief Input bytes: the current element, and whatever was read past it.
+   */
+  char *bytes;
+  /**
+     @brief Size of the input buffer, number of bytes in it, and where the
+     scan is.
+   */
+  size_t cap, len, pos;
+  /**
+     @brief Where in the buffer the current element starts.
+   */
+  size_t start;
+  /**
+     @brief File offset of the first byte in the buffer.
+   */
+  uint64_t base;
+  /**
+     @brief The buffer may not grow past this many bytes.
+   */
+  size_t max_record;
+  /**
+     @brief The current element, decoded for the parser.
+   */
+  wchar_t *text;
+  /**
+     @brief Size of the text buffer, in characters.
+   */
+  size_t textcap;
+  /**
+     @brief Tokens of the current element.
+   */
+  struct json_token *tokens;
+  /**
+     @brief Size of the token buffer.
+   */
+  size_t maxtoken;
+  /**
+     @brief The allocator the buffers come from.
+   */
+  const struct json_allocator *alloc;
+  /**
+     @brief Number of elements returned so far.
+   */
+  size_t index;
+  /**
+     @brief Where the stream is in the array.
+   */
+  int state;
+  /**
+     @brief Open brackets in the part of the current element scanned so far.
+   */
+  size_t depth;
+  /**
+     @brief True inside a string in the current element, and right after a
+     backslash in one.
+   */
+  bool instring, escape;
+  /**
+     @brief True once the whole input is in the buffer.
+   */
+  bool eof;
+  /**
+     @brief What was wrong with the input, if `json_array_stream_next()`
+     returned -1 with errno set to EINVAL.
+   */
+  enum json_error error;
+  /**
+     @brief File offset of the error.
+   */
+  uint64_t error_offset;
+};
+
+/**
+   @brief One element from `json_array_stream_next()`.
+
+   Everything here points into the stream, and is only valid until the next
+   call.  Token positions count characters from the start of the element; use
+   `json_element_offset()` to turn one into a file offset.
+ */
+struct json_element {
+  /**
+     @brief The element's text, NUL terminated.
+   */
+  const wchar_t *text;
+  /**
+     @brief Number of characters in the text.
+   */
+  size_t textlen;
+  /**
+     @brief The element's tokens.  The element itself is token 0.
+   */
+  const struct json_token *tokens;
+  /**
+     @brief Number of tokens.
+   */
+  size_t ntokens;
+  /**
+     @brief Index of the element in the array.
+   */
+  size_t index;
+  /**
+     @brief File offset of the element's first byte.
+   */
+  uint64_t offset;
+  /**
+     @brief Size of the element in bytes.
+   */
+  size_t bytes;
+};
+
+/**
+   @brief Read the elements of an array from a file descriptor.
+
+   Reading starts at the descriptor's current position, and the stream never
+   seeks, so pipes work too.  The descriptor isn't closed by
+   `json_array_stream_free()`.
+   @param s The stream.
+   @param fd The file to read.
+   @param max_record Most bytes to buffer for one element (0 for no limit).
+   @param alloc The allocator for the stream's buffers, or NULL for malloc().
+   @returns 0 on success, or -1 with errno set.
+ */
+int json_array_stream_fd(struct json_array_stream *s, int fd,
+                         size_t max_record, const struct json_allocator *alloc);
+
+/**
+   @brief Read the elements of an array from memory.
+
+   The bytes are used in place, so this is the way to read a mapped file.
+   @param s The stream.
+   @param data The input.  It must stay valid while the stream is used.
+   @param len The number of bytes.
+   @param alloc The allocator for the text and tokens of each element, or NULL
+   for malloc().
+ */
+void json_array_stream_buffer(struct json_array_stream *s, const char *data,
+                              size_t len, const struct json_allocator *alloc);
+
+/**
+   @brief Read and parse the next element.
+   @param s The stream.
+   @param el Filled in with the element.
+   @returns 1 for an element, 0 at the end of the array, or -1 with errno set.
+   errno is EINVAL for malformed input (see `error` and `error_offset`), EFBIG
+   for an element larger than max_record, ENOMEM if the allocator failed, or
+   whatever read() set.
+ */
+int json_array_stream_next(struct json_array_stream *s, struct json_element *el);
+
+/**
+   @brief Free the buffers of a stream.
+ */
+void json_array_stream_free(struct json_array_stream *s);
+
+/**
+   @brief Return the file offset of a character in an element.
+   @param el The element.
+   @param idx Index of a character in the element's text (e.g. a token's start).
+   @returns The offset of the character's first byte in the file.
+ */
+uint64_t json_element_offset(const struct json_element *el, size_t idx);
+
+/**
+   @brief Called by a `struct json_tokenizer` with each finished token.
+   @param arg The argument given to `json_tokenizer_init()`.
+   @param index The token's index: where `json_parse()` would have put it.
+   @param tok The token.  Its start and end are byte offsets in the input.
+   @returns Zero to continue, or nonzero (with errno set) to stop.
+ */
+typedef int (*json_token_fn)(void *arg, size_t index,
+                             const struct json_token *tok);
+
+/**
+   @brief One open array or object in a `struct json_tokenizer`.
+ */
+struct json_tokenizer_frame;
+
+/**
+   @brief Tokenizes input of any size, without keeping the text or tokens.
+
+   The tokenizer takes UTF-8 input in chunks, like the reformatter, and
+   produces the same tokens as `json_parse()`, with one difference: start and
+   end are byte offsets, not character offsets.  Each token is handed to a
+   function as soon as nothing more can change it, which is when the next token
+   after it starts (or its container ends), so the tokenizer only holds a
+   couple of tokens for each level of nesting.  Tokens may be handed over out
+   of order (a container comes after its children), but each index comes
+   exactly once.
+ */
+struct json_tokenizer {
+  /**
+     @brief Where tokens go, and its argument.
+   */
+  json_token_fn fn;
+  void *arg;
+  /**
+     @brief The open containers, and how many there are and have room.
+   */
+  struct json_tokenizer_frame *frames;
+  size_t depth, maxdepth;
+  /**
+     @brief The allocator the frames come from.
+   */
+  const struct json_allocator *alloc;
+  /**
+     @brief The string, number or literal being scanned.
+   */
+  struct json_token current;
+  /**
+     @brief Index of the current token.
+   */
+  size_t index;
+  /**
+     @brief Where we are in the input, and within the current token.
+   */
+  int state, sub;
+  /**
+     @brief The literal being matched.
+   */
+  const char *literal;
+  /**
+     @brief Value of the \\u escape being scanned.
+   */
+  unsigned long code;
+  /**
+     @brief True right after an object or array was opened (or a comma), while
+     scanning a key, and after the first half of a surrogate pair.
+   */
+  bool opened, key, surrogate;
+  /**
+     @brief Number of tokens started so far.
+   */
+  size_t ntokens;
+  /**
+     @brief Number of input bytes handled so far (or the offset of an error).
+   */
+  uint64_t offset;
+  /**
+     @brief Error code, if the input was malformed.
+   */
+  enum json_error error;
+  /**
+     @brief Argument to the error code (like `json_parser.errorarg`).
+   */
+  size_t errorarg;
+  /**
+     @brief errno from the failure, once the tokenizer has failed.
+   */
+  int errnum;
+};
+
+/**
+   @brief Initialize a tokenizer.
+   @param t The tokenizer.
+   @param fn Called with each token.  May be NULL, to only count and check.
+   @param arg Passed to fn.
+   @param alloc The allocator for the open containers, or NULL for malloc().
+ */
+void json_tokenizer_init(struct json_tokenizer *t, json_token_fn fn,
+                         void *arg, const struct json_allocator *alloc);
+
+/**
+   @brief Tokenize the next chunk of input.
+
+   Chunks may be split anywhere, even in the middle of a string or number.  Like
+   `json_parse()`, the tokenizer stops after the first complete value, and
+   ignores any input after it.
+   @param t The tokenizer.
+   @param data The input bytes.
+   @param len The number of bytes.
+   @returns 0 on success, or -1 with errno set.  errno is EINVAL for malformed
+   input (see `error` and `offset`), ENOMEM if the allocator failed, or
+   whatever the token function set.
+ */
+int json_tokenizer_feed(struct json_tokenizer *t, const char *data, size_t len);
+
+/**
+   @brief Signal the end of input.
+   @returns 0 if a complete value was tokenized, or -1 with errno set.
+ */
+int json_tokenizer_finish(struct json_tokenizer *t);
+
+/**
+   @brief Free the memory held by a tokenizer.
+ */
+void json_tokenizer_free(struct json_tokenizer *t);
+
+/**
+   @brief Tokenize a file into a token file, a window at a time.
+
+   Only the window, the tokenizer, and a block of tokens waiting to be written
+   are in memory, so this works on files of any size.  The token file holds the
+   tokens in index order behind a small header, so `json_tokens_get()` can read
+   any one of them with a single read, and a token's start and end are where
+   to read its bytes from the input.
+   @param fd The input.  Reading starts at its current position.
+   @param path The token file to write.
+   @param window Size of the input window in bytes (0 for a default).
+   @param[out] result Filled in like `json_parse()`'s result: the bytes read
+   (or the offset of an error), the number of tokens, and any error.
+   @returns 0 on success, or -1 with errno set (EINVAL for malformed input).
+ */
+int json_tokenize_file(int fd, const char *path, size_t window,
+                       struct json_parser *result);
+
+/**
+   @brief Open a token file written by `json_tokenize_file()`.
+   @param path The token file.
+   @param[out] ntokens Set to the number of tokens in it.
+   @returns A file descriptor for `json_tokens_get()`, or -1 with errno set.
+   errno is EINVAL for a file that isn't a token file, or was written on an
+   incompatible machine.
+ */
+int json_tokens_open(const char *path, size_t *ntokens);
+
+/**
+   @brief Read one token from a token file.
+   @param fd From `json_tokens_open()`.
+   @param index The token's index.
+   @param[out] tok The token.
+   @returns 0 on success, or -1 with errno set (EINVAL past the last token).
+ */
+int json_tokens_get(int fd, size_t index, struct json_token *tok);
+
+/**
+   @brief Most bytes (of UTF-8) in the name of the key an index is built on.
+ */
+#define JSON_INDEX_MAXKEY 47
+
+/**
+   @brief A key value and the record it belongs to, in an index file.
+ */
+struct json_index_entry;
+
+/**
+   @brief An open index of a newline-delimited JSON file.
+
+   The index is a sidecar file, built by `json_index_build()`, that holds the
+   byte offset of every record (every line that isn't blank) and, optionally,
+   a hash of the value each record has for one top-level key, sorted.  Opened
+   with `json_index_open()`, it is mapped into memory, so finding a record by
+   number takes one read of the data file, and finding one by key value a
+   binary search and one read per candidate.  Records are parsed into buffers
+   that are reused for the next lookup.
+ */
+struct json_index {
+  /**
+     @brief The data file.
+   */
+  int fd;
+  /**
+     @brief The mapped index file, and its size.
+   */
+  void *base;
+  size_t size;
+  /**
+     @brief Offset of each record in the data file, and then its size.
+   */
+  const uint64_t *offsets;
+  /**
+     @brief Key hashes, sorted, with their record numbers.
+   */
+  const struct json_index_entry *entries;
+  /**
+     @brief Number of records, and of records that had the key.
+   */
+  size_t nrecords, nentries;
+  /**
+     @brief The key the index was built on, or an empty string for none.
+   */
+  wchar_t key[JSON_INDEX_MAXKEY + 1];
+  /**
+     @brief Buffers for the current record: its bytes, text and tokens.
+   */
+  char *bytes;
+  wchar_t *text;
+  struct json_token *tokens;
+  size_t bytecap, textcap, maxtoken;
+  /**
+     @brief The allocator the buffers come from.
+   */
+  const struct json_allocator *alloc;
+  /**
+     @brief What was wrong with the last record read, if it returned -1 with
+     errno set to EINVAL.
+   */
+  enum json_error error;
+};
+
+/**
+   @brief Build an index of a newline-delimited JSON file.
+
+   The file is mapped and split between threads, which each find the records
+   in their part, and the values of the key in them (if there is a key).  So
+   this is a single pass over the data, in parallel.  The offsets (and the key
+   hashes) of all records are held in memory until they are written, which
+   takes 8 (or 24) bytes per record.  Records that aren't objects, or don't have
+   the key, or whose value for it is an array or object, are in the index, but
+   can't be found by key.
+   @param path The data file.
+   @param index_path The index file to write.
+   @param key The top-level key to index the values of, or NULL for none.
+   @param threads Number of threads, or 0 for one per online processor.
+   @param alloc The allocator for the offsets, entries and buffers, or NULL for
+   malloc().  Every thread allocates from it, so it must be thread safe unless
+   threads is 1.
+   @returns 0 on success, or -1 with errno set.
+ */
+int json_index_build(const char *path, const char *index_path,
+                     const wchar_t *key, unsigned int threads,
+                     const struct json_allocator *alloc);
+
+/**
+   @brief Open an index built by `json_index_build()`, and its data file.
+   @param ix Filled in with the index.
+   @param path The data file.
+   @param index_path The index file.
+   @param alloc The allocator for the record buffers, or NULL for malloc().
+   @returns 0 on success, or -1 with errno set.  errno is EINVAL for a file that
+   isn't an index or was built on an incompatible machine, or ESTALE if the data
+   file has changed since the index was built.
+ */
+int json_index_open(struct json_index *ix, const char *path,
+                    const char *index_path, const struct json_allocator *alloc);
+
+/**
+   @brief Read and parse record n.
+   @param ix The index.
+   @param n The record number, counting from 0.
+   @param el Filled in with the record, which is valid until the next lookup.
+   The record's text is its own line, and token 0 is its value.
+   @returns 0 on success, or -1 with errno set.  errno is ERANGE if there is no
+   record n, EINVAL if the record is malformed (see `error`), or whatever
+   pread() or the allocator set.
+ */
+int json_index_record(struct json_index *ix, size_t n, struct json_element *el);
+
+/**
+   @brief Find the first record whose value for the index's key is value.
+
+   A string matches a record whose value is that string, and also one whose
+   value is a number (or true, false or null) written exactly that way, so
+   L"42" finds {"id": 42} as well as {"id": "42"}.
+   @param ix The index.
+   @param value The value to find.
+   @param el Filled in with the record, as for `json_index_record()`.
+   @returns 1 if a record was found, 0 if none was, or -1 with errno set.
+   errno is EINVAL if the index has no key.
+ */
+int json_index_find(struct json_index *ix, const wchar_t *value,
+                    struct json_element *el);
+
+/**
+   @brief Close an index, its data file, and free its buffers.
+ */
+void json_index_close(struct json_index *ix);
+
 #endif // SMB_JSON
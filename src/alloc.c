@@ -0,0 +1,323 @@
+/***************************************************************************//**
+
+  @file         alloc.c
+
+  @brief        Pluggable allocators, and the entry points that use them.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief Allocations from arenas and pools are aligned to this.
+ */
+#define ALLOC_ALIGN sizeof(union { double d; void *p; size_t s; })
+
+/**
+   @brief Round n up to a multiple of ALLOC_ALIGN.
+ */
+static size_t alloc_round(size_t n)
+{
+  return (n + ALLOC_ALIGN - 1) / ALLOC_ALIGN * ALLOC_ALIGN;
+}
+
+/*******************************************************************************
+
+                                 malloc()
+
+*******************************************************************************/
+
+static void *malloc_alloc(void *ctx, size_t n)
+{
+  (void) ctx;
+  return malloc(n);
+}
+
+static void *malloc_realloc(void *ctx, void *ptr, size_t old, size_t n)
+{
+  (void) ctx;
+  (void) old;
+  return realloc(ptr, n);
+}
+
+static void malloc_free(void *ctx, void *ptr, size_t n)
+{
+  (void) ctx;
+  (void) n;
+  free(ptr);
+}
+
+const struct json_allocator json_malloc_allocator = {
+  malloc_alloc, malloc_realloc, malloc_free, NULL
+};
+
+const struct json_allocator *json_alloc_default(const struct json_allocator *a)
+{
+  return a == NULL ? &json_malloc_allocator : a;
+}
+
+/*******************************************************************************
+
+                                  Arenas
+
+*******************************************************************************/
+
+void json_arena_init(struct json_arena *arena, void *buffer, size_t size)
+{
+  arena->base = buffer;
+  arena->size = size;
+  arena->used = 0;
+  arena->last = 0;
+}
+
+void json_arena_reset(struct json_arena *arena)
+{
+  arena->used = 0;
+  arena->last = 0;
+}
+
+static void *arena_alloc(void *ctx, size_t n)
+{
+  struct json_arena *arena = ctx;
+  size_t rounded = alloc_round(n);
+  if (rounded < n || rounded > arena->size - arena->used) {
+    return NULL;
+  }
+  arena->last = arena->used;
+  arena->used += rounded;
+  return arena->base + arena->last;
+}
+
+/**
+   @brief Return true if ptr is the most recent allocation from the arena.
+ */
+static bool arena_is_last(struct json_arena *arena, void *ptr)
+{
+  return ptr != NULL && (char *) ptr == arena->base + arena->last &&
+    arena->used > arena->last;
+}
+
+static void *arena_realloc(void *ctx, void *ptr, size_t old, size_t n)
+{
+  struct json_arena *arena = ctx;
+  size_t rounded = alloc_round(n);
+  void *moved;
+
+  // The most recent allocation can grow or shrink in place.
+  if (arena_is_last(arena, ptr) && rounded >= n &&
+      rounded <= arena->size - arena->last) {
+    arena->used = arena->last + rounded;
+    return ptr;
+  }
+  moved = arena_alloc(ctx, n);
+  if (moved != NULL && ptr != NULL) {
+    memcpy(moved, ptr, old < n ? old : n);
+  }
+  return moved;
+}
+
+static void arena_free(void *ctx, void *ptr, size_t n)
+{
+  struct json_arena *arena = ctx;
+  (void) n;
+  // Only the most recent allocation can be given back; the rest waits for
+  // json_arena_reset().
+  if (arena_is_last(arena, ptr)) {
+    arena->used = arena->last;
+  }
+}
+
+void json_arena_allocator(struct json_arena *arena, struct json_allocator *a)
+{
+  a->alloc = arena_alloc;
+  a->realloc = arena_realloc;
+  a->free = arena_free;
+  a->ctx = arena;
+}
+
+/*******************************************************************************
+
+                                   Pools
+
+*******************************************************************************/
+
+void json_pool_init(struct json_pool *pool, void *buffer, size_t size,
+                    size_t block)
+{
+  // Each free block holds the free list link, so it needs room for one.
+  pool->block = alloc_round(block < sizeof(void *) ? sizeof(void *) : block);
+  pool->base = buffer;
+  pool->count = size / pool->block;
+  json_pool_reset(pool);
+}
+
+void json_pool_reset(struct json_pool *pool)
+{
+  size_t i;
+  void **block;
+  pool->free = NULL;
+  // Thread the list back to front, so blocks are handed out in address order.
+  for (i = pool->count; i > 0; i--) {
+    block = (void **) (pool->base + (i - 1) * pool->block);
+    *block = pool->free;
+    pool->free = block;
+  }
+}
+
+static void *pool_alloc(void *ctx, size_t n)
+{
+  struct json_pool *pool = ctx;
+  void **block = pool->free;
+  if (n > pool->block || block == NULL) {
+    return NULL;
+  }
+  pool->free = *block;
+  return block;
+}
+
+static void pool_free(void *ctx, void *ptr, size_t n)
+{
+  struct json_pool *pool = ctx;
+  (void) n;
+  if (ptr != NULL) {
+    *(void **) ptr = pool->free;
+    pool->free = ptr;
+  }
+}
+
+static void *pool_realloc(void *ctx, void *ptr, size_t old, size_t n)
+{
+  struct json_pool *pool = ctx;
+  (void) old;
+  if (n > pool->block) {
+    return NULL;
+  }
+  // Every block is the same size, so anything that fits can stay put.
+  return ptr != NULL ? ptr : pool_alloc(pool, n);
+}
+
+void json_pool_allocator(struct json_pool *pool, struct json_allocator *a)
+{
+  a->alloc = pool_alloc;
+  a->realloc = pool_realloc;
+  a->free = pool_free;
+  a->ctx = pool;
+}
+
+/*******************************************************************************
+
+                           Allocating Entry Points
+
+*******************************************************************************/
+
+struct json_parser json_parse_alloc(wchar_t *json, struct json_token **arr,
+                                    const struct json_allocator *a)
+{
+  size_t n = json_estimate_tokens(json, wcslen(json));
+  struct json_token *shrunk;
+  struct json_parser p;
+
+  a = json_alloc_default(a);
+  *arr = a->alloc(a->ctx, n * sizeof(struct json_token));
+  if (*arr == NULL) {
+    // The estimate may be too much for a small arena or pool, so fall back to
+    // an exact count.
+    p = json_parse(json, NULL, 0);
+    if (p.error != JSONERR_NO_ERROR || p.tokenidx == 0 || p.tokenidx >= n) {
+      return p;
+    }
+    n = p.tokenidx;
+    *arr = a->alloc(a->ctx, n * sizeof(struct json_token));
+    if (*arr == NULL) {
+      return p;
+    }
+  }
+
+  p = json_parse_unchecked(json, *arr);
+  if (p.error != JSONERR_NO_ERROR || p.tokenidx == 0) {
+    a->free(a->ctx, *arr, n * sizeof(struct json_token));
+    *arr = NULL;
+  } else if (p.tokenidx < n) {
+    shrunk = a->realloc(a->ctx, *arr, n * sizeof(struct json_token),
+                        p.tokenidx * sizeof(struct json_token));
+    if (shrunk != NULL) {
+      *arr = shrunk;
+    }
+  }
+  return p;
+}
+
+struct json_value *json_dom_alloc(const wchar_t *json,
+                                  const struct json_token *tokens, size_t index,
+                                  const struct json_allocator *a, size_t *size)
+{
+  struct json_value *root;
+  void *arena;
+
+  a = json_alloc_default(a);
+  *size = json_dom_size(json, tokens, index);
+  arena = a->alloc(a->ctx, *size);
+  if (arena == NULL) {
+    return NULL;
+  }
+  root = json_load_dom(json, tokens, index, arena, *size);
+  if (root == NULL) {
+    a->free(a->ctx, arena, *size);
+  }
+  return root;
+}
+
+int json_parse_element(const char *bytes, size_t n,
+                       const struct json_allocator *a, wchar_t **text,
+                       size_t *textcap, struct json_token **tokens,
+                       size_t *maxtoken, size_t *len, struct json_parser *p)
+{
+  size_t ntokens, i;
+  wchar_t *bigger, c;
+  struct json_token *more;
+
+  // Decoding never produces more characters than there are bytes.
+  if (n + 1 > *textcap) {
+    bigger = a->realloc(a->ctx, *text, *textcap * sizeof(wchar_t),
+                        (n + 1) * sizeof(wchar_t));
+    if (bigger == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    *text = bigger;
+    *textcap = n + 1;
+  }
+  *len = json_utf8_decode(bytes, n, *text);
+  (*text)[*len] = L'\0';
+
+  ntokens = json_estimate_tokens(*text, *len);
+  if (ntokens > *maxtoken) {
+    more = a->realloc(a->ctx, *tokens, *maxtoken * sizeof(struct json_token),
+                      ntokens * sizeof(struct json_token));
+    if (more == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    *tokens = more;
+    *maxtoken = ntokens;
+  }
+
+  *p = json_parse_unchecked(*text, *tokens);
+  for (i = p->textidx; p->error == JSONERR_NO_ERROR && i < *len; i++) {
+    c = (*text)[i];
+    if (c != L' ' && c != L'\t' && c != L'\n' && c != L'\r') {
+      p->error = JSONERR_UNEXPECTED_TOKEN; // more than one value
+    }
+  }
+  return 0;
+}
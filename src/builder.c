@@ -0,0 +1,342 @@
+/***************************************************************************//**
+
+  @file         builder.c
+
+  @brief        Building JSON output without allocating memory.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief Flag in the builder stack: this level is an object (not an array).
+ */
+#define BUILDER_OBJECT   0x01
+/**
+   @brief Flag in the builder stack: this level has at least one member.
+ */
+#define BUILDER_NONEMPTY 0x02
+
+/*******************************************************************************
+
+                                String Escaping
+
+*******************************************************************************/
+
+/**
+   @brief Byte values 0-31 map to the character after the backslash, or 'u' for
+   the ones that only have a \\u00XX escape.
+ */
+static const char escape_char[32] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+};
+
+#define ONES  UINT64_C(0x0101010101010101)
+#define HIGHS UINT64_C(0x8080808080808080)
+
+/**
+   @brief Return nonzero if any byte in the word needs escaping.
+
+   This checks eight bytes at once for '"', '\\' and control characters, using
+   the usual "has zero byte" bit tricks.  It may report false positives in the
+   bytes after a real hit, but never misses one, so the caller only needs to use
+   it to decide whether to look at the word byte by byte.
+ */
+static uint64_t needs_escape8(uint64_t w)
+{
+  uint64_t quote = w ^ (ONES * '"');
+  uint64_t slash = w ^ (ONES * '\\');
+  uint64_t ctrl = (w - ONES * 0x20) & ~w;
+  quote = (quote - ONES) & ~quote;
+  slash = (slash - ONES) & ~slash;
+  return (quote | slash | ctrl) & HIGHS;
+}
+
+static bool needs_escape(unsigned char c)
+{
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+/**
+   @brief Write a quoted, escaped string to a sink.
+
+   Runs of bytes that don't need escaping are found eight bytes at a time, and
+   written to the sink in one go.
+ */
+static void builder_write_string(struct json_sink *sink, const char *str,
+                                 size_t len)
+{
+  static const char hex[] = "0123456789abcdef";
+  char esc[6] = {'\\', 'u', '0', '0', '0', '0'};
+  size_t start = 0, i = 0;
+  unsigned char c;
+  uint64_t w;
+
+  json_sink_putc(sink, '"');
+  while (i < len) {
+    // Skip over eight clean bytes at a time.
+    while (i + 8 <= len) {
+      memcpy(&w, str + i, 8);
+      if (needs_escape8(w)) {
+        break;
+      }
+      i += 8;
+    }
+    // Then find the next byte that needs escaping (if any).
+    while (i < len && !needs_escape((unsigned char) str[i])) {
+      i++;
+      if ((i & 7) == 0 && i + 8 <= len) {
+        break; // word-aligned again, go back to the fast loop
+      }
+    }
+    if (i >= len || !needs_escape((unsigned char) str[i])) {
+      continue;
+    }
+
+    json_sink_write(sink, str + start, i - start);
+    c = (unsigned char) str[i];
+    if (c == '"' || c == '\\') {
+      esc[1] = (char) c;
+      json_sink_write(sink, esc, 2);
+    } else if (escape_char[c] != 'u') {
+      esc[1] = escape_char[c];
+      json_sink_write(sink, esc, 2);
+    } else {
+      esc[1] = 'u';
+      esc[4] = hex[c >> 4];
+      esc[5] = hex[c & 0xF];
+      json_sink_write(sink, esc, 6);
+    }
+    start = ++i;
+  }
+  json_sink_write(sink, str + start, len - start);
+  json_sink_putc(sink, '"');
+}
+
+/*******************************************************************************
+
+                               Builder Functions
+
+*******************************************************************************/
+
+void json_builder_init(struct json_builder *b, struct json_sink *sink,
+                       unsigned int indent)
+{
+  b->sink = sink;
+  b->indent = indent;
+  b->depth = 0;
+  b->key = false;
+  b->done = false;
+  b->error = false;
+}
+
+/**
+   @brief Mark the builder as misused, and return false.
+ */
+static bool builder_fail(struct json_builder *b)
+{
+  b->error = true;
+  return false;
+}
+
+/**
+   @brief Get ready to write a value: check that one is allowed here, and write
+   any comma and whitespace that needs to come first.
+   @returns True if a value may be written.
+ */
+static bool builder_value(struct json_builder *b)
+{
+  unsigned char *top;
+
+  if (b->error || b->done) {
+    return builder_fail(b);
+  }
+  if (b->depth == 0) {
+    return true; // the top-level value
+  }
+
+  top = &b->stack[b->depth - 1];
+  if (*top & BUILDER_OBJECT) {
+    // Inside an object, the key has already written everything we need.
+    if (!b->key) {
+      return builder_fail(b);
+    }
+    b->key = false;
+    return true;
+  }
+
+  if (*top & BUILDER_NONEMPTY) {
+    json_sink_putc(b->sink, ',');
+  }
+  *top |= BUILDER_NONEMPTY;
+  if (b->indent > 0) {
+    json_sink_newline(b->sink, b->depth * b->indent);
+  }
+  return true;
+}
+
+/**
+   @brief Finish writing a value.  Once the top-level value is done, no more
+   values may be written.
+ */
+static bool builder_value_done(struct json_builder *b)
+{
+  if (b->depth == 0) {
+    b->done = true;
+  }
+  return true;
+}
+
+static bool builder_begin(struct json_builder *b, unsigned char flags, char c)
+{
+  if (b->depth >= JSON_BUILDER_MAXDEPTH) {
+    return builder_fail(b);
+  }
+  if (!builder_value(b)) {
+    return false;
+  }
+  json_sink_putc(b->sink, c);
+  b->stack[b->depth++] = flags;
+  return true;
+}
+
+bool json_builder_begin_object(struct json_builder *b)
+{
+  return builder_begin(b, BUILDER_OBJECT, '{');
+}
+
+bool json_builder_begin_array(struct json_builder *b)
+{
+  return builder_begin(b, 0, '[');
+}
+
+bool json_builder_end(struct json_builder *b)
+{
+  unsigned char top;
+
+  if (b->error || b->depth == 0 || b->key) {
+    return builder_fail(b);
+  }
+  top = b->stack[--b->depth];
+  if (b->indent > 0 && (top & BUILDER_NONEMPTY)) {
+    json_sink_newline(b->sink, b->depth * b->indent);
+  }
+  json_sink_putc(b->sink, (top & BUILDER_OBJECT) ? '}' : ']');
+  return builder_value_done(b);
+}
+
+bool json_builder_key(struct json_builder *b, const char *key)
+{
+  unsigned char *top;
+
+  if (b->error || b->depth == 0 || b->key) {
+    return builder_fail(b);
+  }
+  top = &b->stack[b->depth - 1];
+  if (!(*top & BUILDER_OBJECT)) {
+    return builder_fail(b);
+  }
+
+  if (*top & BUILDER_NONEMPTY) {
+    json_sink_putc(b->sink, ',');
+  }
+  *top |= BUILDER_NONEMPTY;
+  if (b->indent > 0) {
+    json_sink_newline(b->sink, b->depth * b->indent);
+  }
+  builder_write_string(b->sink, key, strlen(key));
+  json_sink_write(b->sink, ": ", b->indent > 0 ? 2 : 1);
+  b->key = true;
+  return true;
+}
+
+bool json_builder_string_n(struct json_builder *b, const char *str, size_t len)
+{
+  if (!builder_value(b)) {
+    return false;
+  }
+  builder_write_string(b->sink, str, len);
+  return builder_value_done(b);
+}
+
+bool json_builder_string(struct json_builder *b, const char *str)
+{
+  return json_builder_string_n(b, str, strlen(str));
+}
+
+bool json_builder_int64(struct json_builder *b, int64_t value)
+{
+  char buffer[20];
+  size_t i = sizeof(buffer);
+  // Negate in unsigned arithmetic, so that INT64_MIN works.
+  uint64_t u = value < 0 ? -(uint64_t) value : (uint64_t) value;
+
+  if (!builder_value(b)) {
+    return false;
+  }
+  do {
+    buffer[--i] = (char) ('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (value < 0) {
+    buffer[--i] = '-';
+  }
+  json_sink_write(b->sink, buffer + i, sizeof(buffer) - i);
+  return builder_value_done(b);
+}
+
+bool json_builder_double(struct json_builder *b, double value)
+{
+  char buffer[JSON_FORMAT_DOUBLE_SIZE];
+
+  if (!builder_value(b)) {
+    return false;
+  }
+  json_sink_write(b->sink, buffer, json_format_double(value, buffer));
+  return builder_value_done(b);
+}
+
+bool json_builder_bool(struct json_builder *b, bool value)
+{
+  if (!builder_value(b)) {
+    return false;
+  }
+  if (value) {
+    json_sink_write(b->sink, "true", 4);
+  } else {
+    json_sink_write(b->sink, "false", 5);
+  }
+  return builder_value_done(b);
+}
+
+bool json_builder_null(struct json_builder *b)
+{
+  if (!builder_value(b)) {
+    return false;
+  }
+  json_sink_write(b->sink, "null", 4);
+  return builder_value_done(b);
+}
+
+bool json_builder_raw(struct json_builder *b)
+{
+  if (!builder_value(b)) {
+    return false;
+  }
+  return builder_value_done(b);
+}
+
+bool json_builder_finish(struct json_builder *b)
+{
+  return !b->error && b->done;
+}
@@ -0,0 +1,204 @@
+/***************************************************************************//**
+
+  @file         decode.c
+
+  @brief        Decoding JSON objects into C structs, driven by a field table.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Rather than looking up each field of a struct in the object (a scan of the
+  object per field), json_decode() walks the object's keys once, and looks each
+  one up in a small open-addressed hash table built by json_schema_init().
+
+  Keys are hashed straight from the JSON text.  Keys containing escapes can't
+  be hashed that way, since their text differs from their value, so those (rare)
+  keys fall back to comparing against every field.
+
+*******************************************************************************/
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief FNV-1a hash of a run of characters.
+ */
+static uint32_t decode_hash(const wchar_t *str, size_t len)
+{
+  uint32_t h = UINT32_C(2166136261);
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (uint32_t) str[i];
+    h *= UINT32_C(16777619);
+  }
+  return h;
+}
+
+bool json_schema_init(struct json_schema *schema,
+                      const struct json_field *fields, size_t nfields)
+{
+  size_t i, slot, mask = JSON_SCHEMA_SLOTS - 1;
+
+  if (nfields > JSON_SCHEMA_MAXFIELDS) {
+    return false;
+  }
+  schema->fields = fields;
+  schema->nfields = nfields;
+  memset(schema->slots, 0, sizeof(schema->slots));
+
+  // There are at least twice as many slots as fields, so probing terminates.
+  for (i = 0; i < nfields; i++) {
+    slot = decode_hash(fields[i].key, wcslen(fields[i].key)) & mask;
+    while (schema->slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    schema->slots[slot] = (unsigned char) (i + 1);
+  }
+  return true;
+}
+
+/**
+   @brief Find the field for a key token.
+   @returns The field's index, or nfields if there isn't one.
+ */
+static size_t decode_lookup(const wchar_t *json,
+                            const struct json_token *tokens, size_t key,
+                            const struct json_schema *schema)
+{
+  const wchar_t *text = json + tokens[key].start + 1;
+  size_t len = tokens[key].end - tokens[key].start - 1;
+  size_t slot, mask = JSON_SCHEMA_SLOTS - 1, i;
+  const wchar_t *name;
+
+  if (len != tokens[key].length) {
+    // The key has escapes, so its text isn't its value.
+    for (i = 0; i < schema->nfields; i++) {
+      if (json_string_match(json, tokens, key, schema->fields[i].key)) {
+        return i;
+      }
+    }
+    return schema->nfields;
+  }
+
+  slot = decode_hash(text, len) & mask;
+  while (schema->slots[slot] != 0) {
+    i = schema->slots[slot] - 1u;
+    name = schema->fields[i].key;
+    if (wcsncmp(name, text, len) == 0 && name[len] == L'\0') {
+      return i;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return schema->nfields;
+}
+
+/**
+   @brief Store one value into its field.
+   @returns False if the value has the wrong type, or doesn't fit.
+ */
+static bool decode_field(const wchar_t *json, const struct json_token *tokens,
+                         size_t value, const struct json_field *field,
+                         char *out)
+{
+  const struct json_token *tok = tokens + value;
+  double number;
+  int integer;
+  bool boolean;
+
+  switch (field->type) {
+  case JSON_FIELD_DOUBLE:
+    if (tok->type != JSON_NUMBER) {
+      return false;
+    }
+    number = json_number_get(json, tokens, value);
+    memcpy(out + field->offset, &number, sizeof(number));
+    return true;
+  case JSON_FIELD_INT:
+    if (tok->type != JSON_NUMBER) {
+      return false;
+    }
+    number = json_number_get(json, tokens, value);
+    // Converting an out-of-range double to int is undefined, so check first.
+    if (number < INT_MIN || number > INT_MAX) {
+      return false;
+    }
+    integer = (int) number;
+    if (integer != number) {
+      return false;
+    }
+    memcpy(out + field->offset, &integer, sizeof(integer));
+    return true;
+  case JSON_FIELD_BOOL:
+    if (tok->type != JSON_TRUE && tok->type != JSON_FALSE) {
+      return false;
+    }
+    boolean = tok->type == JSON_TRUE;
+    memcpy(out + field->offset, &boolean, sizeof(boolean));
+    return true;
+  case JSON_FIELD_STRING:
+    if (tok->type != JSON_STRING ||
+        (tok->length + 1) * sizeof(wchar_t) > field->size) {
+      return false;
+    }
+    json_string_load(json, tokens, value, (wchar_t *) (out + field->offset));
+    return true;
+  case JSON_FIELD_UTF8:
+    if (tok->type != JSON_STRING ||
+        json_string_utf8_size(json, tokens, value) + 1 > field->size) {
+      return false;
+    }
+    json_string_load_utf8(json, tokens, value, out + field->offset);
+    return true;
+  case JSON_FIELD_INDEX:
+    memcpy(out + field->offset, &value, sizeof(value));
+    return true;
+  }
+  return false;
+}
+
+bool json_decode(const wchar_t *json, const struct json_token *tokens,
+                 size_t index, const struct json_schema *schema, void *out,
+                 size_t *failed)
+{
+  uint64_t seen = 0;
+  size_t key, field, value;
+
+  if (failed != NULL) {
+    *failed = schema->nfields;
+  }
+  if (tokens[index].type != JSON_OBJECT) {
+    return false;
+  }
+
+  for (key = tokens[index].child; key != 0; key = tokens[key].next) {
+    field = decode_lookup(json, tokens, key, schema);
+    value = tokens[key].child;
+    if (field == schema->nfields || tokens[value].type == JSON_NULL) {
+      continue; // unknown keys and nulls are skipped
+    }
+    if (!decode_field(json, tokens, value, schema->fields + field, out)) {
+      if (failed != NULL) {
+        *failed = field;
+      }
+      return false;
+    }
+    seen |= UINT64_C(1) << field;
+  }
+
+  for (field = 0; field < schema->nfields; field++) {
+    if ((schema->fields[field].flags & JSON_FIELD_REQUIRED) &&
+        !(seen & (UINT64_C(1) << field))) {
+      if (failed != NULL) {
+        *failed = field;
+      }
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,272 @@
+/***************************************************************************//**
+
+  @file         doc.c
+
+  @brief        Saving parsed documents, and mapping them back into memory.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  A document file is the text and token array, exactly as they are in memory,
+  behind a small header.  Mapping the file gives you pointers straight into the
+  mapping, so nothing needs to be parsed or copied.  The flip side is that the
+  file is only readable on machines with the same wchar_t, size_t, struct
+  layout and byte order; the header records all of those, and
+  json_doc_map() refuses files that don't match.
+
+  Layout:
+  - header (struct doc_header, padded to DOC_HEADER_SIZE bytes)
+  - text, including its terminating NUL, padded to a multiple of 8 bytes
+  - tokens
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+#define DOC_MAGIC "NOSJDOC"
+#define DOC_VERSION 1
+#define DOC_BYTE_ORDER UINT32_C(0x01020304)
+#define DOC_HEADER_SIZE 64
+#define DOC_CHECKSUM_INIT UINT64_C(0xcbf29ce484222325)
+
+/**
+   @brief The header at the start of a document file.
+ */
+struct doc_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t wchar_size;
+  uint32_t token_size;
+  uint64_t textlen;
+  uint64_t ntokens;
+  uint64_t tokens_offset;
+  uint64_t checksum;
+};
+
+/**
+   @brief Round n up to a multiple of 8.
+ */
+static uint64_t doc_align(uint64_t n)
+{
+  return (n + 7) & ~(uint64_t) 7;
+}
+
+/**
+   @brief Checksum a region whose length is a multiple of 8 bytes.
+
+   This is FNV-1a, but taking a 64-bit word at a time instead of a byte, so
+   that verifying a large document runs at close to memory speed.
+   @param h The running checksum (start with DOC_CHECKSUM_INIT).
+ */
+static uint64_t doc_checksum(uint64_t h, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  uint64_t w;
+  size_t i;
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&w, p + i, 8);
+    h ^= w;
+    h *= UINT64_C(0x100000001b3);
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+/**
+   @brief Write bytes to a file, followed by zero padding.
+   @returns True on success.
+ */
+static bool doc_write(FILE *f, const void *data, size_t len, size_t padded)
+{
+  static const char zeros[DOC_HEADER_SIZE] = {0};
+  return fwrite(data, 1, len, f) == len &&
+    fwrite(zeros, 1, padded - len, f) == padded - len;
+}
+
+int json_doc_save(const char *path, const wchar_t *text, size_t textlen,
+                  const struct json_token *tokens, size_t ntokens)
+{
+  struct doc_header h;
+  // Checksum the text in pieces, since its padding isn't in memory.
+  size_t textbytes = (textlen + 1) * sizeof(wchar_t);
+  size_t whole = textbytes & ~(size_t) 7;
+  unsigned char tail[8] = {0};
+  FILE *f;
+  bool ok;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, DOC_MAGIC, sizeof(DOC_MAGIC));
+  h.version = DOC_VERSION;
+  h.byte_order = DOC_BYTE_ORDER;
+  h.wchar_size = sizeof(wchar_t);
+  h.token_size = sizeof(struct json_token);
+  h.textlen = textlen;
+  h.ntokens = ntokens;
+  h.tokens_offset = DOC_HEADER_SIZE + doc_align(textbytes);
+
+  memcpy(tail, (const char *) text + whole, textbytes - whole);
+  h.checksum = doc_checksum(DOC_CHECKSUM_INIT, text, whole);
+  if (whole != textbytes) {
+    h.checksum = doc_checksum(h.checksum, tail, sizeof(tail));
+  }
+  h.checksum = doc_checksum(h.checksum, tokens,
+                            ntokens * sizeof(struct json_token));
+
+  f = fopen(path, "wb");
+  if (f == NULL) {
+    return -1;
+  }
+  ok = doc_write(f, &h, sizeof(h), DOC_HEADER_SIZE) &&
+    doc_write(f, text, textbytes, (size_t) doc_align(textbytes)) &&
+    doc_write(f, tokens, ntokens * sizeof(struct json_token),
+              ntokens * sizeof(struct json_token));
+  if (fclose(f) != 0 || !ok) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+   @brief Check that every token stays inside the document.
+
+   A checksum only catches accidents; a file made to pass it could still send
+   a lookup out of bounds, or around in a circle.  So each child and next must
+   be a later token, and each token's text must be inside the text.
+   @returns True if they all do.
+ */
+static bool doc_check_tokens(const struct json_token *tokens, size_t ntokens,
+                             size_t textlen)
+{
+  size_t i;
+  for (i = 0; i < ntokens; i++) {
+    if ((unsigned int) tokens[i].type > JSON_NULL ||
+        tokens[i].start > tokens[i].end || tokens[i].end >= textlen ||
+        (tokens[i].child != 0 &&
+         (tokens[i].child <= i || tokens[i].child >= ntokens)) ||
+        (tokens[i].next != 0 &&
+         (tokens[i].next <= i || tokens[i].next >= ntokens))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+   @brief Check that a mapped file is a document we can use.
+   @returns True if it is.
+ */
+static bool doc_check(const unsigned char *base, size_t size, unsigned int flags)
+{
+  struct doc_header h;
+  uint64_t textbytes;
+
+  if (size < DOC_HEADER_SIZE) {
+    return false;
+  }
+  memcpy(&h, base, sizeof(h));
+  if (memcmp(h.magic, DOC_MAGIC, sizeof(DOC_MAGIC)) != 0 ||
+      h.version != DOC_VERSION || h.byte_order != DOC_BYTE_ORDER ||
+      h.wchar_size != sizeof(wchar_t) ||
+      h.token_size != sizeof(struct json_token)) {
+    return false;
+  }
+
+  // Make sure the sizes in the header agree with the size of the file, being
+  // careful not to overflow.
+  if (h.textlen >= (SIZE_MAX - DOC_HEADER_SIZE) / sizeof(wchar_t) - 8 ||
+      h.ntokens > SIZE_MAX / sizeof(struct json_token)) {
+    return false;
+  }
+  textbytes = (h.textlen + 1) * sizeof(wchar_t);
+  if (h.tokens_offset != DOC_HEADER_SIZE + doc_align(textbytes) ||
+      h.tokens_offset > size ||
+      size - h.tokens_offset != h.ntokens * sizeof(struct json_token)) {
+    return false;
+  }
+  if (((const wchar_t *) (base + DOC_HEADER_SIZE))[h.textlen] != L'\0') {
+    return false;
+  }
+
+  if ((flags & JSON_DOC_VERIFY) &&
+      (doc_checksum(DOC_CHECKSUM_INIT, base + DOC_HEADER_SIZE,
+                    size - DOC_HEADER_SIZE) != h.checksum ||
+       !doc_check_tokens((const struct json_token *) (base + h.tokens_offset),
+                         (size_t) h.ntokens, (size_t) h.textlen))) {
+    return false;
+  }
+  return true;
+}
+
+int json_doc_map(const char *path, struct json_doc *doc, unsigned int flags)
+{
+  struct stat st;
+  struct doc_header h;
+  void *base;
+  int fd, saved;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0) {
+    saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  if (st.st_size < DOC_HEADER_SIZE) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  saved = errno;
+  close(fd); // the mapping keeps the file open
+  if (base == MAP_FAILED) {
+    errno = saved;
+    return -1;
+  }
+
+  if (!doc_check(base, (size_t) st.st_size, flags)) {
+    munmap(base, (size_t) st.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+
+  memcpy(&h, base, sizeof(h));
+  doc->base = base;
+  doc->size = (size_t) st.st_size;
+  doc->text = (const wchar_t *) ((const char *) base + DOC_HEADER_SIZE);
+  doc->textlen = (size_t) h.textlen;
+  doc->tokens = (const struct json_token *)
+    ((const char *) base + h.tokens_offset);
+  doc->ntokens = (size_t) h.ntokens;
+  return 0;
+}
+
+void json_doc_unmap(struct json_doc *doc)
+{
+  if (doc->base != NULL) {
+    munmap(doc->base, doc->size);
+  }
+  doc->base = NULL;
+  doc->size = 0;
+  doc->text = NULL;
+  doc->textlen = 0;
+  doc->tokens = NULL;
+  doc->ntokens = 0;
+}
@@ -0,0 +1,152 @@
+/***************************************************************************//**
+
+  @file         dom.c
+
+  @brief        Loading parsed JSON into an in-memory tree.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Everything is carved out of one arena, front to back, with no other
+  allocation.  Sizing and loading are the same walk over the tokens: when
+  sizing, the arena has no memory and just counts how much it would have handed
+  out (in the same spirit as `json_parse()` with a NULL token buffer).
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief Every allocation is rounded up to a multiple of this.
+ */
+#define DOM_ALIGN sizeof(union { double d; void *p; size_t s; })
+
+/**
+   @brief A bump allocator over the caller's memory.
+ */
+struct dom_arena {
+  char *base;  // NULL when only sizing
+  size_t size;
+  size_t used;
+};
+
+/**
+   @brief Take n bytes from the arena.
+   @returns The memory, or NULL when sizing (or if the arena is too small).
+ */
+static void *dom_alloc(struct dom_arena *a, size_t n)
+{
+  size_t start = a->used;
+  a->used += (n + DOM_ALIGN - 1) / DOM_ALIGN * DOM_ALIGN;
+  if (a->base == NULL || a->used > a->size) {
+    return NULL;
+  }
+  return a->base + start;
+}
+
+/**
+   @brief Allocate and load a string token.
+   @param len Set to the number of characters.
+ */
+static wchar_t *dom_string(const wchar_t *json, const struct json_token *tokens,
+                           size_t index, struct dom_arena *a, size_t *len)
+{
+  wchar_t *str = dom_alloc(a, (tokens[index].length + 1) * sizeof(wchar_t));
+  *len = tokens[index].length;
+  if (str != NULL) {
+    json_string_load(json, tokens, index, str);
+  }
+  return str;
+}
+
+/**
+   @brief Load a value (and everything inside it).
+   @param out Where to store the value, or NULL when sizing.
+ */
+static void dom_load(const wchar_t *json, const struct json_token *tokens,
+                     size_t index, struct json_value *out, struct dom_arena *a)
+{
+  const struct json_token *tok = tokens + index;
+  struct json_value *values;
+  struct json_member *members;
+  size_t child, i = 0, len;
+  wchar_t *str;
+
+  switch (tok->type) {
+  case JSON_ARRAY:
+    values = dom_alloc(a, tok->length * sizeof(struct json_value));
+    for (child = tok->child; child != 0; child = tokens[child].next) {
+      dom_load(json, tokens, child, values == NULL ? NULL : values + i, a);
+      i++;
+    }
+    if (out != NULL) {
+      out->u.array = values;
+    }
+    break;
+  case JSON_OBJECT:
+    members = dom_alloc(a, tok->length * sizeof(struct json_member));
+    for (child = tok->child; child != 0; child = tokens[child].next) {
+      // child is a key, and the key's child is its value
+      str = dom_string(json, tokens, child, a, &len);
+      if (members != NULL) {
+        members[i].key = str;
+        members[i].keylen = len;
+      }
+      dom_load(json, tokens, tokens[child].child,
+               members == NULL ? NULL : &members[i].value, a);
+      i++;
+    }
+    if (out != NULL) {
+      out->u.object = members;
+    }
+    break;
+  case JSON_STRING:
+    str = dom_string(json, tokens, index, a, &len);
+    if (out != NULL) {
+      out->u.string = str;
+    }
+    break;
+  case JSON_NUMBER:
+    if (out != NULL) {
+      out->u.number = json_number_get(json, tokens, index);
+    }
+    break;
+  default:
+    break; // true, false and null are just their type
+  }
+
+  if (out != NULL) {
+    out->type = tok->type;
+    out->length = tok->length;
+  }
+}
+
+size_t json_dom_size(const wchar_t *json, const struct json_token *tokens,
+                     size_t index)
+{
+  struct dom_arena a = {NULL, 0, 0};
+  dom_alloc(&a, sizeof(struct json_value));
+  dom_load(json, tokens, index, NULL, &a);
+  return a.used;
+}
+
+struct json_value *json_load_dom(const wchar_t *json,
+                                 const struct json_token *tokens, size_t index,
+                                 void *arena, size_t size)
+{
+  struct dom_arena a = {arena, size, 0};
+  struct json_value *root;
+
+  // The sizing pass is the only way to know the walk will fit, and it is much
+  // cheaper than loading, since it doesn't decode anything.
+  if (arena == NULL || json_dom_size(json, tokens, index) > size) {
+    return NULL;
+  }
+  root = dom_alloc(&a, sizeof(struct json_value));
+  dom_load(json, tokens, index, root, &a);
+  return root;
+}
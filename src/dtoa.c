@@ -0,0 +1,537 @@
+/***************************************************************************//**
+
+  @file         dtoa.c
+
+  @brief        Shortest round-trip formatting of doubles.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  This is an implementation of Florian Loitsch's Grisu2 algorithm ("Printing
+  Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010),
+  following the structure of Milo Yip's public domain dtoa_milo.h.  It always
+  produces digits that read back as exactly the same double, and it only uses
+  64-bit integer arithmetic, which makes it many times faster than
+  `printf("%.17g")`.
+
+  Grisu2 narrows the interval of numbers that round to the double by its
+  arithmetic error, so for about one double in a few thousand it misses a
+  shorter number that lies in that margin, and gives an extra digit.  As in
+  Grisu3, digit generation notices when a shorter number might be in the
+  margin; only then, shorter candidates are checked with strtod(), which is
+  exact.  So the output is always the shortest.
+
+  json_format_double() puts an integer fast path in front of it, since JSON
+  numbers that happen to be whole are far more common than any other kind.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief A "do-it-yourself" floating point number: f * 2^e.
+ */
+struct diy_fp {
+  uint64_t f;
+  int e;
+};
+
+#define DP_SIGNIFICAND_MASK UINT64_C(0x000FFFFFFFFFFFFF)
+#define DP_EXPONENT_MASK    UINT64_C(0x7FF0000000000000)
+#define DP_HIDDEN_BIT       UINT64_C(0x0010000000000000)
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS    (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT     (-DP_EXPONENT_BIAS)
+#define DIY_SIGNIFICAND_SIZE 64
+
+/**
+   @brief Normalized powers of ten 10^-348, 10^-340, ..., 10^340.
+ */
+static const struct diy_fp cached_powers[] = {
+  {UINT64_C(0xfa8fd5a0081c0288), -1220}, {UINT64_C(0xbaaee17fa23ebf76), -1193},
+  {UINT64_C(0x8b16fb203055ac76), -1166}, {UINT64_C(0xcf42894a5dce35ea), -1140},
+  {UINT64_C(0x9a6bb0aa55653b2d), -1113}, {UINT64_C(0xe61acf033d1a45df), -1087},
+  {UINT64_C(0xab70fe17c79ac6ca), -1060}, {UINT64_C(0xff77b1fcbebcdc4f), -1034},
+  {UINT64_C(0xbe5691ef416bd60c), -1007}, {UINT64_C(0x8dd01fad907ffc3c),  -980},
+  {UINT64_C(0xd3515c2831559a83),  -954}, {UINT64_C(0x9d71ac8fada6c9b5),  -927},
+  {UINT64_C(0xea9c227723ee8bcb),  -901}, {UINT64_C(0xaecc49914078536d),  -874},
+  {UINT64_C(0x823c12795db6ce57),  -847}, {UINT64_C(0xc21094364dfb5637),  -821},
+  {UINT64_C(0x9096ea6f3848984f),  -794}, {UINT64_C(0xd77485cb25823ac7),  -768},
+  {UINT64_C(0xa086cfcd97bf97f4),  -741}, {UINT64_C(0xef340a98172aace5),  -715},
+  {UINT64_C(0xb23867fb2a35b28e),  -688}, {UINT64_C(0x84c8d4dfd2c63f3b),  -661},
+  {UINT64_C(0xc5dd44271ad3cdba),  -635}, {UINT64_C(0x936b9fcebb25c996),  -608},
+  {UINT64_C(0xdbac6c247d62a584),  -582}, {UINT64_C(0xa3ab66580d5fdaf6),  -555},
+  {UINT64_C(0xf3e2f893dec3f126),  -529}, {UINT64_C(0xb5b5ada8aaff80b8),  -502},
+  {UINT64_C(0x87625f056c7c4a8b),  -475}, {UINT64_C(0xc9bcff6034c13053),  -449},
+  {UINT64_C(0x964e858c91ba2655),  -422}, {UINT64_C(0xdff9772470297ebd),  -396},
+  {UINT64_C(0xa6dfbd9fb8e5b88f),  -369}, {UINT64_C(0xf8a95fcf88747d94),  -343},
+  {UINT64_C(0xb94470938fa89bcf),  -316}, {UINT64_C(0x8a08f0f8bf0f156b),  -289},
+  {UINT64_C(0xcdb02555653131b6),  -263}, {UINT64_C(0x993fe2c6d07b7fac),  -236},
+  {UINT64_C(0xe45c10c42a2b3b06),  -210}, {UINT64_C(0xaa242499697392d3),  -183},
+  {UINT64_C(0xfd87b5f28300ca0e),  -157}, {UINT64_C(0xbce5086492111aeb),  -130},
+  {UINT64_C(0x8cbccc096f5088cc),  -103}, {UINT64_C(0xd1b71758e219652c),   -77},
+  {UINT64_C(0x9c40000000000000),   -50}, {UINT64_C(0xe8d4a51000000000),   -24},
+  {UINT64_C(0xad78ebc5ac620000),     3}, {UINT64_C(0x813f3978f8940984),    30},
+  {UINT64_C(0xc097ce7bc90715b3),    56}, {UINT64_C(0x8f7e32ce7bea5c70),    83},
+  {UINT64_C(0xd5d238a4abe98068),   109}, {UINT64_C(0x9f4f2726179a2245),   136},
+  {UINT64_C(0xed63a231d4c4fb27),   162}, {UINT64_C(0xb0de65388cc8ada8),   189},
+  {UINT64_C(0x83c7088e1aab65db),   216}, {UINT64_C(0xc45d1df942711d9a),   242},
+  {UINT64_C(0x924d692ca61be758),   269}, {UINT64_C(0xda01ee641a708dea),   295},
+  {UINT64_C(0xa26da3999aef774a),   322}, {UINT64_C(0xf209787bb47d6b85),   348},
+  {UINT64_C(0xb454e4a179dd1877),   375}, {UINT64_C(0x865b86925b9bc5c2),   402},
+  {UINT64_C(0xc83553c5c8965d3d),   428}, {UINT64_C(0x952ab45cfa97a0b3),   455},
+  {UINT64_C(0xde469fbd99a05fe3),   481}, {UINT64_C(0xa59bc234db398c25),   508},
+  {UINT64_C(0xf6c69a72a3989f5c),   534}, {UINT64_C(0xb7dcbf5354e9bece),   561},
+  {UINT64_C(0x88fcf317f22241e2),   588}, {UINT64_C(0xcc20ce9bd35c78a5),   614},
+  {UINT64_C(0x98165af37b2153df),   641}, {UINT64_C(0xe2a0b5dc971f303a),   667},
+  {UINT64_C(0xa8d9d1535ce3b396),   694}, {UINT64_C(0xfb9b7cd9a4a7443c),   720},
+  {UINT64_C(0xbb764c4ca7a44410),   747}, {UINT64_C(0x8bab8eefb6409c1a),   774},
+  {UINT64_C(0xd01fef10a657842c),   800}, {UINT64_C(0x9b10a4e5e9913129),   827},
+  {UINT64_C(0xe7109bfba19c0c9d),   853}, {UINT64_C(0xac2820d9623bf429),   880},
+  {UINT64_C(0x80444b5e7aa7cf85),   907}, {UINT64_C(0xbf21e44003acdd2d),   933},
+  {UINT64_C(0x8e679c2f5e44ff8f),   960}, {UINT64_C(0xd433179d9c8cb841),   986},
+  {UINT64_C(0x9e19db92b4e31ba9),  1013}, {UINT64_C(0xeb96bf6ebadf77d9),  1039},
+  {UINT64_C(0xaf87023b9bf0ee6b),  1066}
+};
+
+/**
+   @brief Powers of ten that fit in 64 bits.
+ */
+static const uint64_t pow10_u64[] = {
+  UINT64_C(1), UINT64_C(10), UINT64_C(100), UINT64_C(1000), UINT64_C(10000),
+  UINT64_C(100000), UINT64_C(1000000), UINT64_C(10000000),
+  UINT64_C(100000000), UINT64_C(1000000000), UINT64_C(10000000000),
+  UINT64_C(100000000000), UINT64_C(1000000000000),
+  UINT64_C(10000000000000), UINT64_C(100000000000000),
+  UINT64_C(1000000000000000), UINT64_C(10000000000000000),
+  UINT64_C(100000000000000000), UINT64_C(1000000000000000000),
+  UINT64_C(10000000000000000000)
+};
+
+static struct diy_fp diy_fp_make(uint64_t f, int e)
+{
+  struct diy_fp r;
+  r.f = f;
+  r.e = e;
+  return r;
+}
+
+/**
+   @brief Split a double into its significand and exponent.
+ */
+static struct diy_fp diy_fp_from_double(double d)
+{
+  uint64_t bits;
+  int biased_e;
+  uint64_t significand;
+
+  memcpy(&bits, &d, sizeof(bits));
+  biased_e = (int) ((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+  significand = bits & DP_SIGNIFICAND_MASK;
+  if (biased_e != 0) {
+    return diy_fp_make(significand + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS);
+  } else {
+    return diy_fp_make(significand, DP_MIN_EXPONENT + 1);
+  }
+}
+
+/**
+   @brief Multiply two diy_fp's, keeping the (rounded) upper 64 bits.
+ */
+static struct diy_fp diy_fp_mul(struct diy_fp x, struct diy_fp y)
+{
+  const uint64_t M32 = UINT64_C(0xFFFFFFFF);
+  uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+  tmp += UINT64_C(1) << 31; // round
+  return diy_fp_make(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32),
+                     x.e + y.e + 64);
+}
+
+static struct diy_fp diy_fp_normalize(struct diy_fp r)
+{
+  while (!(r.f & DP_HIDDEN_BIT)) {
+    r.f <<= 1;
+    r.e--;
+  }
+  r.f <<= DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 1;
+  r.e -= DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 1;
+  return r;
+}
+
+static struct diy_fp diy_fp_normalize_boundary(struct diy_fp r)
+{
+  while (!(r.f & (DP_HIDDEN_BIT << 1))) {
+    r.f <<= 1;
+    r.e--;
+  }
+  r.f <<= DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 2;
+  r.e -= DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 2;
+  return r;
+}
+
+/**
+   @brief Compute the boundaries halfway to the neighboring doubles.
+   @param v The value.
+   @param minus Output: lower boundary.
+   @param plus Output: upper boundary (normalized).
+ */
+static void diy_fp_boundaries(struct diy_fp v, struct diy_fp *minus,
+                              struct diy_fp *plus)
+{
+  struct diy_fp pl = diy_fp_normalize_boundary(diy_fp_make((v.f << 1) + 1,
+                                                           v.e - 1));
+  struct diy_fp mi = (v.f == DP_HIDDEN_BIT)
+    ? diy_fp_make((v.f << 2) - 1, v.e - 2)
+    : diy_fp_make((v.f << 1) - 1, v.e - 1);
+  mi.f <<= mi.e - pl.e;
+  mi.e = pl.e;
+  *plus = pl;
+  *minus = mi;
+}
+
+/**
+   @brief Return a cached power of ten c such that c * 2^e lands in the range
+   Grisu needs, along with its decimal exponent.
+ */
+static struct diy_fp cached_power(int e, int *K)
+{
+  // dk must be positive, so can do ceiling in positive
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int k = (int) dk;
+  unsigned int index;
+  if (dk - k > 0.0) {
+    k++;
+  }
+  index = (unsigned int) ((k >> 3) + 1);
+  *K = -(-348 + (int) (index << 3)); // decimal exponent, no lookup needed
+  return cached_powers[index];
+}
+
+/**
+   @brief Nudge the last digit down while it stays closer to the real value.
+ */
+static void grisu_round(char *buffer, size_t len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w)
+{
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || // closer
+          wp_w - rest > rest + ten_kappa - wp_w)) {
+    buffer[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static int count_digits(uint32_t n)
+{
+  int d = 1;
+  while (n >= 10) {
+    n /= 10;
+    d++;
+  }
+  return d;
+}
+
+/**
+   @brief Bound on the error of the boundaries, in units of their last bit.
+
+   Each product in grisu2() is off by at most half a unit, and the boundaries
+   are moved in by one more, so this leaves some room to spare.
+ */
+#define GRISU_SLACK 4
+
+/**
+   @brief Generate the shortest digits within the boundaries.
+   @param[out] unsure Set to true if a shorter number might lie within the
+   error margin just outside the boundaries.
+ */
+static size_t digit_gen(struct diy_fp W, struct diy_fp Mp, uint64_t delta,
+                        char *buffer, int *K, bool *unsure)
+{
+  const struct diy_fp one = diy_fp_make(UINT64_C(1) << -Mp.e, Mp.e);
+  const uint64_t wp_w = Mp.f - W.f;
+  uint32_t p1 = (uint32_t) (Mp.f >> -one.e);
+  uint64_t p2 = Mp.f & (one.f - 1);
+  uint64_t slack = GRISU_SLACK;
+  int kappa = count_digits(p1);
+  size_t len = 0;
+  uint32_t d;
+  uint64_t tmp;
+
+  while (kappa > 0) {
+    d = p1 / (uint32_t) pow10_u64[kappa - 1];
+    p1 %= (uint32_t) pow10_u64[kappa - 1];
+    if (d || len) {
+      buffer[len++] = (char) ('0' + d);
+    }
+    kappa--;
+    tmp = ((uint64_t) p1 << -one.e) + p2;
+    if (tmp <= delta) {
+      *K += kappa;
+      grisu_round(buffer, len, delta, tmp, pow10_u64[kappa] << -one.e, wp_w);
+      return len;
+    }
+    // Would stopping here be within the boundaries, give or take the error?
+    if (tmp <= delta + slack || (pow10_u64[kappa] << -one.e) - tmp <= slack) {
+      *unsure = true;
+    }
+  }
+
+  // kappa = 0
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    slack *= 10;
+    d = (uint32_t) (p2 >> -one.e);
+    if (d || len) {
+      buffer[len++] = (char) ('0' + d);
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *K += kappa;
+      grisu_round(buffer, len, delta, p2, one.f,
+                  -kappa < 20 ? wp_w * pow10_u64[-kappa] : 0);
+      return len;
+    }
+    if (p2 <= delta + slack || one.f - p2 <= slack) {
+      *unsure = true;
+    }
+  }
+}
+
+/**
+   @brief Produce the shortest digits of a positive, finite, nonzero double.
+   @param value The value.
+   @param buffer Output buffer for the digits (at least 17 chars).
+   @param K Output: decimal exponent, so that value = digits * 10^K.
+   @param[out] unsure Set to true if the digits might not be the shortest.
+   @returns Number of digits.
+ */
+static size_t grisu2(double value, char *buffer, int *K, bool *unsure)
+{
+  struct diy_fp v = diy_fp_from_double(value);
+  struct diy_fp w_m, w_p, c_mk, W, Wp, Wm;
+
+  diy_fp_boundaries(v, &w_m, &w_p);
+  c_mk = cached_power(w_p.e, K);
+  W = diy_fp_mul(diy_fp_normalize(v), c_mk);
+  Wp = diy_fp_mul(w_p, c_mk);
+  Wm = diy_fp_mul(w_m, c_mk);
+  Wm.f++;
+  Wp.f--;
+  return digit_gen(W, Wp, Wp.f - Wm.f, buffer, K, unsure);
+}
+
+/**
+   @brief Write a decimal exponent, e.g. "e-7" or "e21".
+ */
+static size_t write_exponent(int K, char *buffer)
+{
+  size_t len = 0;
+  buffer[len++] = 'e';
+  if (K < 0) {
+    buffer[len++] = '-';
+    K = -K;
+  }
+  if (K >= 100) {
+    buffer[len++] = (char) ('0' + K / 100);
+    K %= 100;
+    buffer[len++] = (char) ('0' + K / 10);
+    buffer[len++] = (char) ('0' + K % 10);
+  } else if (K >= 10) {
+    buffer[len++] = (char) ('0' + K / 10);
+    buffer[len++] = (char) ('0' + K % 10);
+  } else {
+    buffer[len++] = (char) ('0' + K);
+  }
+  return len;
+}
+
+/**
+   @brief Return true if digits * 10^K reads back as value.
+
+   The text has no decimal point, so strtod() reads it the same in any locale.
+ */
+static bool round_trips(double value, const char *digits, size_t len, int K)
+{
+  char text[48];
+  memcpy(text, digits, len);
+  len += write_exponent(K, text + len);
+  text[len] = '\0';
+  return strtod(text, NULL) == value;
+}
+
+/**
+   @brief Drop trailing zeros from digits * 10^K.
+ */
+static size_t trim_zeros(char *digits, size_t len, int *K)
+{
+  while (len > 1 && digits[len - 1] == '0') {
+    len--;
+    (*K)++;
+  }
+  return len;
+}
+
+/**
+   @brief Remove digits that Grisu2 might have produced needlessly.
+
+   If any number with fewer digits reads back as the value, then so does one
+   of the two nearest to the current digits, rounded down or up.  So keep
+   trying those, one digit shorter each time, preferring the nearer one.
+ */
+static size_t shorten(double value, char *buffer, size_t len, int *K)
+{
+  char up[20];
+  size_t uplen, i;
+  int upK, downK;
+  bool down_ok, up_ok;
+
+  while (len > 1) {
+    downK = *K + 1;
+    uplen = len - 1;
+    upK = *K + 1;
+    memcpy(up, buffer, uplen);
+    for (i = uplen; i > 0 && up[i - 1] == '9'; i--) {
+      up[i - 1] = '0';
+    }
+    if (i == 0) {
+      up[0] = '1'; // 999 -> 1000
+      uplen = 1;
+      upK += (int) len - 1;
+    } else {
+      up[i - 1]++;
+    }
+    uplen = trim_zeros(up, uplen, &upK);
+
+    down_ok = round_trips(value, buffer, len - 1, downK);
+    up_ok = round_trips(value, up, uplen, upK);
+    if (down_ok && (!up_ok || buffer[len - 1] <= '5')) {
+      len = trim_zeros(buffer, len - 1, &downK);
+      *K = downK;
+    } else if (up_ok) {
+      memcpy(buffer, up, uplen);
+      len = uplen;
+      *K = upK;
+    } else {
+      break;
+    }
+  }
+  return len;
+}
+
+/**
+   @brief Lay out digits * 10^k as a human readable JSON number.
+
+   This follows the rules JavaScript's Number.prototype.toString() uses: plain
+   notation for decimal exponents from -6 to 21, scientific otherwise.  Unlike
+   JavaScript, the exponent's '+' sign is dropped, since JSON doesn't need it.
+ */
+static size_t prettify(char *buffer, size_t length, int k)
+{
+  const int len = (int) length;
+  const int kk = len + k; // 10^(kk-1) <= v < 10^kk
+  int i;
+
+  if (len <= kk && kk <= 21) {
+    // 1234e7 -> 12340000000
+    for (i = len; i < kk; i++) {
+      buffer[i] = '0';
+    }
+    return (size_t) kk;
+  } else if (0 < kk && kk <= 21) {
+    // 1234e-2 -> 12.34
+    memmove(&buffer[kk + 1], &buffer[kk], (size_t) (len - kk));
+    buffer[kk] = '.';
+    return length + 1;
+  } else if (-6 < kk && kk <= 0) {
+    // 1234e-6 -> 0.001234
+    const int offset = 2 - kk;
+    memmove(&buffer[offset], &buffer[0], length);
+    buffer[0] = '0';
+    buffer[1] = '.';
+    for (i = 2; i < offset; i++) {
+      buffer[i] = '0';
+    }
+    return length + (size_t) offset;
+  } else if (len == 1) {
+    // 1e30
+    return 1 + write_exponent(kk - 1, &buffer[1]);
+  } else {
+    // 1234e30 -> 1.234e33
+    memmove(&buffer[2], &buffer[1], length - 1);
+    buffer[1] = '.';
+    return length + 1 + write_exponent(kk - 1, &buffer[length + 1]);
+  }
+}
+
+size_t json_dtoa(double value, char *buffer)
+{
+  uint64_t bits;
+  size_t len = 0, ndigits;
+  bool unsure = false;
+  int K;
+
+  memcpy(&bits, &value, sizeof(bits));
+  if ((bits & DP_EXPONENT_MASK) == DP_EXPONENT_MASK) {
+    // NaN and infinity have no JSON representation.
+    memcpy(buffer, "null", 4);
+    return 4;
+  }
+  if (bits >> 63) {
+    buffer[len++] = '-';
+    value = -value;
+  }
+  if (value == 0.0) {
+    buffer[len++] = '0';
+    return len;
+  }
+  ndigits = grisu2(value, buffer + len, &K, &unsure);
+  if (unsure) {
+    ndigits = shorten(value, buffer + len, ndigits, &K);
+  }
+  return len + prettify(buffer + len, ndigits, K);
+}
+
+/**
+   @brief Largest magnitude below which every integer is exactly a double.
+ */
+#define EXACT_INTEGER_LIMIT 9007199254740992.0 // 2^53
+
+size_t json_format_double(double value, char *buffer)
+{
+  char digits[20];
+  size_t i = sizeof(digits), len = 0;
+  uint64_t u;
+
+  // Whole numbers below 2^53 are exactly representable, and no other integer
+  // rounds to them, so their shortest round-trip digits are just the integer
+  // itself.  Zero goes the slow way, so that -0 keeps its sign.
+  if (value != 0.0 && -EXACT_INTEGER_LIMIT < value &&
+      value < EXACT_INTEGER_LIMIT && value == (double) (int64_t) value) {
+    if (value < 0) {
+      buffer[len++] = '-';
+      u = (uint64_t) -value;
+    } else {
+      u = (uint64_t) value;
+    }
+    do {
+      digits[--i] = (char) ('0' + u % 10);
+      u /= 10;
+    } while (u != 0);
+    memcpy(buffer + len, digits + i, sizeof(digits) - i);
+    len += sizeof(digits) - i;
+  } else {
+    len = json_dtoa(value, buffer);
+  }
+  buffer[len] = '\0';
+  return len;
+}
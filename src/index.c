@@ -0,0 +1,722 @@
+/***************************************************************************//**
+
+  @file         index.c
+
+  @brief        Sidecar indexes for random access into newline-delimited JSON.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Building an index maps the data file and gives each thread an equal part of
+  it.  A record belongs to the part its first byte is in, so a thread starts at
+  the first line that begins in its part, and finishes the line that crosses
+  its end.  Each thread finds the value of the key in its records with a
+  json_reader, which stops at the key and skips nested values without making
+  tokens, and sorts its own entries.  The main thread then writes the offsets
+  in order, and merges the entries.
+
+  Entries hold a hash of the value, not the value, so that they are all the
+  same size and can be binary searched in place.  A lookup parses each record
+  with the right hash, and compares the real value, so collisions only cost an
+  extra read.
+
+  Layout of an index file:
+  - header (struct index_header, padded to INDEX_HEADER_SIZE bytes)
+  - offset of each record in the data file, then the data file's size
+  - entries, sorted by hash and then record number
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+#define INDEX_MAGIC "NOSJIDX"
+#define INDEX_VERSION 1
+#define INDEX_BYTE_ORDER UINT32_C(0x01020304)
+#define INDEX_HEADER_SIZE 128
+#define INDEX_HASH_INIT UINT64_C(0xcbf29ce484222325)
+
+/**
+   @brief Smallest part of a file worth starting a thread for.
+ */
+#define INDEX_MINCHUNK (64 * 1024)
+
+struct json_index_entry {
+  uint64_t hash;
+  uint64_t record;
+};
+
+/**
+   @brief The header at the start of an index file.
+ */
+struct index_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t nrecords;
+  uint64_t nentries;
+  uint64_t entries_offset;
+  /**
+     @brief Size and modification time of the data file, to notice when the
+     index is out of date.
+   */
+  uint64_t data_size;
+  int64_t data_mtime;
+  int64_t data_mtime_nsec;
+  /**
+     @brief The key, in UTF-8, NUL terminated.
+   */
+  char key[JSON_INDEX_MAXKEY + 1];
+};
+
+/**
+   @brief One thread's part of building an index.
+ */
+struct index_worker {
+  pthread_t thread;
+  bool started;
+  /**
+     @brief The whole data file, and the part of it this thread indexes.
+   */
+  const char *data;
+  size_t size, begin, end;
+  const wchar_t *key;
+  const struct json_allocator *alloc;
+  /**
+     @brief Offsets of the records that start in this part.
+   */
+  uint64_t *offsets;
+  size_t noffsets, offcap;
+  /**
+     @brief Entries for them.  Record numbers count from this part's first.
+   */
+  struct json_index_entry *entries;
+  size_t nentries, entcap;
+  /**
+     @brief The current record decoded, and room to load a string value.
+   */
+  wchar_t *text, *scratch;
+  size_t textcap;
+  /**
+     @brief errno if the thread failed, else 0.
+   */
+  int error;
+};
+
+/**
+   @brief Hash a run of characters.  This is FNV-1a, a character at a time.
+ */
+static uint64_t index_hash(const wchar_t *s, size_t n)
+{
+  uint64_t h = INDEX_HASH_INIT;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    h ^= (uint64_t) (unsigned long) s[i];
+    h *= UINT64_C(0x100000001b3);
+  }
+  return h;
+}
+
+/**
+   @brief Free memory from an allocator, if there is any.
+ */
+static void index_free(const struct json_allocator *a, void *ptr, size_t n)
+{
+  if (ptr != NULL) {
+    a->free(a->ctx, ptr, n);
+  }
+}
+
+/**
+   @brief Make room for n items of the given size in an array.
+   @returns True on success.
+ */
+static bool index_reserve(const struct json_allocator *a, void **array,
+                          size_t *cap, size_t n, size_t size)
+{
+  size_t newcap = *cap > 0 ? *cap : 1024;
+  void *bigger;
+
+  if (n <= *cap) {
+    return true;
+  }
+  while (newcap < n) {
+    newcap *= 2;
+  }
+  bigger = a->realloc(a->ctx, *array, *cap * size, newcap * size);
+  if (bigger == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+  *array = bigger;
+  *cap = newcap;
+  return true;
+}
+
+static bool index_blank(const char *line, size_t len)
+{
+  size_t i;
+  for (i = 0; i < len; i++) {
+    if (line[i] != ' ' && line[i] != '\t' && line[i] != '\r') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+   @brief Compare entries by hash, and then by record.
+ */
+static int index_compare(const void *a, const void *b)
+{
+  const struct json_index_entry *x = a, *y = b;
+  if (x->hash != y->hash) {
+    return x->hash < y->hash ? -1 : 1;
+  }
+  return x->record < y->record ? -1 : x->record > y->record;
+}
+
+/**
+   @brief Find the value of the key in a record, and add an entry for it.
+   @returns False if memory ran out.
+ */
+static bool index_key(struct index_worker *w, const char *line, size_t len,
+                      size_t record)
+{
+  struct json_reader r;
+  enum json_event event;
+  struct json_index_entry *entry;
+  const struct json_token *tok = &r.token;
+  size_t n;
+
+  if (len + 1 > w->textcap) {
+    index_free(w->alloc, w->text, w->textcap * sizeof(wchar_t));
+    index_free(w->alloc, w->scratch, w->textcap * sizeof(wchar_t));
+    w->textcap = len + 1;
+    w->text = w->alloc->alloc(w->alloc->ctx, w->textcap * sizeof(wchar_t));
+    w->scratch = w->alloc->alloc(w->alloc->ctx, w->textcap * sizeof(wchar_t));
+    if (w->text == NULL || w->scratch == NULL) {
+      errno = ENOMEM;
+      return false;
+    }
+  }
+  n = json_utf8_decode(line, len, w->text);
+  w->text[n] = L'\0';
+
+  json_reader_init(&r, w->text);
+  if (json_reader_next(&r) != JSON_EVENT_BEGIN || tok->type != JSON_OBJECT) {
+    return true;
+  }
+  while (json_reader_next(&r) == JSON_EVENT_KEY) {
+    if (json_string_match(w->text, tok, 0, w->key)) {
+      if (json_reader_next(&r) != JSON_EVENT_VALUE) {
+        return true; // an array or object, or an error
+      }
+      if (!index_reserve(w->alloc, (void **) &w->entries, &w->entcap,
+                         w->nentries + 1, sizeof(*w->entries))) {
+        return false;
+      }
+      entry = &w->entries[w->nentries++];
+      if (tok->type == JSON_STRING) {
+        json_string_load(w->text, tok, 0, w->scratch);
+        entry->hash = index_hash(w->scratch, tok->length);
+      } else {
+        entry->hash = index_hash(w->text + tok->start,
+                                 tok->end - tok->start + 1);
+      }
+      entry->record = record;
+      return true;
+    }
+    event = json_reader_next(&r);
+    if (event == JSON_EVENT_BEGIN) {
+      json_reader_skip(&r);
+    }
+  }
+  return true;
+}
+
+/**
+   @brief Index one part of the data file.
+ */
+static void *index_worker_run(void *arg)
+{
+  struct index_worker *w = arg;
+  const char *data = w->data, *nl;
+  size_t p = w->begin, end;
+
+  // Skip the end of a line that started in the previous part.
+  if (p > 0 && data[p - 1] != '\n') {
+    nl = memchr(data + p, '\n', w->end - p);
+    p = nl == NULL ? w->end : (size_t) (nl - data) + 1;
+  }
+  while (p < w->end) {
+    nl = memchr(data + p, '\n', w->size - p);
+    end = nl == NULL ? w->size : (size_t) (nl - data);
+    if (!index_blank(data + p, end - p)) {
+      if (!index_reserve(w->alloc, (void **) &w->offsets, &w->offcap,
+                         w->noffsets + 1, sizeof(*w->offsets))) {
+        w->error = errno;
+        return NULL;
+      }
+      w->offsets[w->noffsets++] = p;
+      if (w->key != NULL && !index_key(w, data + p, end - p, w->noffsets - 1)) {
+        w->error = errno;
+        return NULL;
+      }
+    }
+    p = end + 1;
+  }
+  if (w->nentries > 0) {
+    qsort(w->entries, w->nentries, sizeof(*w->entries), &index_compare);
+  }
+  return NULL;
+}
+
+/**
+   @brief Write the index file from the workers' results.
+   @returns 0 on success, or -1 with errno set.
+ */
+static int index_write(const char *index_path, struct index_header *h,
+                       struct index_worker *workers, size_t nworkers,
+                       const struct json_allocator *alloc)
+{
+  char header[INDEX_HEADER_SIZE] = {0};
+  size_t *next = alloc->alloc(alloc->ctx, nworkers * sizeof(size_t)), i, j;
+  size_t best;
+  uint64_t base = 0;
+  const struct json_index_entry *a, *b;
+  FILE *f;
+  bool ok;
+
+  if (next == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  memset(next, 0, nworkers * sizeof(size_t));
+  f = fopen(index_path, "wb");
+  if (f == NULL) {
+    alloc->free(alloc->ctx, next, nworkers * sizeof(size_t));
+    return -1;
+  }
+  memcpy(header, h, sizeof(*h));
+  ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+
+  // The offsets are already in order.  Number each part's entries from the
+  // part's first record, which doesn't change their order.
+  for (i = 0; ok && i < nworkers; i++) {
+    if (workers[i].noffsets > 0) {
+      ok = fwrite(workers[i].offsets, sizeof(uint64_t), workers[i].noffsets,
+                  f) == workers[i].noffsets;
+    }
+    for (j = 0; j < workers[i].nentries; j++) {
+      workers[i].entries[j].record += base;
+    }
+    base += workers[i].noffsets;
+  }
+  ok = ok && fwrite(&h->data_size, sizeof(uint64_t), 1, f) == 1;
+
+  // Merge the sorted entries.  There are only as many lists as threads.
+  while (ok) {
+    best = nworkers;
+    for (i = 0; i < nworkers; i++) {
+      if (next[i] == workers[i].nentries) {
+        continue;
+      }
+      a = &workers[i].entries[next[i]];
+      b = best < nworkers ? &workers[best].entries[next[best]] : NULL;
+      if (b == NULL || index_compare(a, b) < 0) {
+        best = i;
+      }
+    }
+    if (best == nworkers) {
+      break;
+    }
+    ok = fwrite(&workers[best].entries[next[best]++],
+                sizeof(struct json_index_entry), 1, f) == 1;
+  }
+
+  alloc->free(alloc->ctx, next, nworkers * sizeof(size_t));
+  if (fclose(f) != 0 || !ok) {
+    remove(index_path);
+    return -1;
+  }
+  return 0;
+}
+
+int json_index_build(const char *path, const char *index_path,
+                     const wchar_t *key, unsigned int threads,
+                     const struct json_allocator *alloc)
+{
+  struct index_header h;
+  struct index_worker *workers = NULL;
+  struct stat st;
+  char *data = NULL;
+  size_t size, nworkers, i;
+  long online;
+  int fd, rv = -1, saved = 0;
+
+  alloc = json_alloc_default(alloc);
+  memset(&h, 0, sizeof(h));
+  if (key != NULL && key[0] == L'\0') {
+    key = NULL; // an empty key is how an index without one is recorded
+  }
+  if (key != NULL) {
+    if (json_utf8_encode_run(key, wcslen(key), NULL) > JSON_INDEX_MAXKEY) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    h.key[json_utf8_encode_run(key, wcslen(key), h.key)] = '\0';
+  }
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0) {
+    saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  size = (size_t) st.st_size;
+  if (size > 0) {
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    saved = errno;
+    close(fd); // the mapping keeps the file open
+    if (data == MAP_FAILED) {
+      errno = saved;
+      return -1;
+    }
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+  } else {
+    close(fd);
+  }
+
+  online = sysconf(_SC_NPROCESSORS_ONLN);
+  nworkers = threads > 0 ? threads : online > 0 ? (size_t) online : 1;
+  if (nworkers > size / INDEX_MINCHUNK + 1) {
+    nworkers = size / INDEX_MINCHUNK + 1;
+  }
+  workers = alloc->alloc(alloc->ctx, nworkers * sizeof(*workers));
+  if (workers == NULL) {
+    saved = ENOMEM;
+    goto out;
+  }
+  memset(workers, 0, nworkers * sizeof(*workers));
+
+  for (i = 0; i < nworkers; i++) {
+    workers[i].data = data;
+    workers[i].size = size;
+    workers[i].begin = size / nworkers * i;
+    workers[i].end = i + 1 == nworkers ? size : size / nworkers * (i + 1);
+    workers[i].key = key;
+    workers[i].alloc = alloc;
+  }
+  // The first part is done on this thread.  If a thread can't be started, its
+  // part is done here too.
+  for (i = 1; i < nworkers; i++) {
+    workers[i].started = pthread_create(&workers[i].thread, NULL,
+                                        &index_worker_run, &workers[i]) == 0;
+  }
+  index_worker_run(&workers[0]);
+  for (i = 1; i < nworkers; i++) {
+    if (workers[i].started) {
+      pthread_join(workers[i].thread, NULL);
+    } else {
+      index_worker_run(&workers[i]);
+    }
+  }
+
+  for (i = 0; i < nworkers; i++) {
+    if (workers[i].error != 0) {
+      saved = workers[i].error;
+      goto out;
+    }
+    h.nrecords += workers[i].noffsets;
+    h.nentries += workers[i].nentries;
+  }
+  memcpy(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  h.version = INDEX_VERSION;
+  h.byte_order = INDEX_BYTE_ORDER;
+  h.entries_offset = INDEX_HEADER_SIZE + (h.nrecords + 1) * sizeof(uint64_t);
+  h.data_size = size;
+  h.data_mtime = st.st_mtim.tv_sec;
+  h.data_mtime_nsec = st.st_mtim.tv_nsec;
+  rv = index_write(index_path, &h, workers, nworkers, alloc);
+  saved = errno;
+
+ out:
+  for (i = 0; workers != NULL && i < nworkers; i++) {
+    index_free(alloc, workers[i].offsets,
+               workers[i].offcap * sizeof(*workers[i].offsets));
+    index_free(alloc, workers[i].entries,
+               workers[i].entcap * sizeof(*workers[i].entries));
+    index_free(alloc, workers[i].text, workers[i].textcap * sizeof(wchar_t));
+    index_free(alloc, workers[i].scratch,
+               workers[i].textcap * sizeof(wchar_t));
+  }
+  index_free(alloc, workers, nworkers * sizeof(*workers));
+  if (data != NULL) {
+    munmap(data, size);
+  }
+  errno = saved;
+  return rv;
+}
+
+/**
+   @brief Check that a mapped file is an index we can use.
+   @returns True if it is.
+ */
+static bool index_check(const struct index_header *h, size_t size)
+{
+  if (memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      h->version != INDEX_VERSION || h->byte_order != INDEX_BYTE_ORDER ||
+      h->key[JSON_INDEX_MAXKEY] != '\0') {
+    return false;
+  }
+  // Make sure the counts agree with the size of the file, being careful not
+  // to overflow.
+  if (h->nrecords >= size / sizeof(uint64_t) ||
+      h->nentries > size / sizeof(struct json_index_entry) ||
+      h->entries_offset !=
+      INDEX_HEADER_SIZE + (h->nrecords + 1) * sizeof(uint64_t) ||
+      h->entries_offset > size ||
+      size - h->entries_offset !=
+      h->nentries * sizeof(struct json_index_entry)) {
+    return false;
+  }
+  return true;
+}
+
+int json_index_open(struct json_index *ix, const char *path,
+                    const char *index_path, const struct json_allocator *alloc)
+{
+  struct index_header h;
+  struct stat st;
+  void *base;
+  int fd, saved;
+
+  memset(ix, 0, sizeof(*ix));
+  ix->fd = -1;
+  ix->alloc = json_alloc_default(alloc);
+
+  fd = open(index_path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0) {
+    saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  if (st.st_size < INDEX_HEADER_SIZE) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  saved = errno;
+  close(fd);
+  if (base == MAP_FAILED) {
+    errno = saved;
+    return -1;
+  }
+  ix->base = base;
+  ix->size = (size_t) st.st_size;
+
+  memcpy(&h, base, sizeof(h));
+  if (!index_check(&h, ix->size)) {
+    saved = EINVAL;
+    goto fail;
+  }
+
+  ix->fd = open(path, O_RDONLY);
+  if (ix->fd < 0 || fstat(ix->fd, &st) != 0) {
+    saved = errno;
+    goto fail;
+  }
+  if ((uint64_t) st.st_size != h.data_size ||
+      st.st_mtim.tv_sec != h.data_mtime ||
+      st.st_mtim.tv_nsec != h.data_mtime_nsec) {
+    saved = ESTALE;
+    goto fail;
+  }
+
+  ix->offsets = (const uint64_t *) ((const char *) base + INDEX_HEADER_SIZE);
+  ix->entries = (const struct json_index_entry *)
+    ((const char *) base + h.entries_offset);
+  ix->nrecords = (size_t) h.nrecords;
+  ix->nentries = (size_t) h.nentries;
+  ix->key[json_utf8_decode(h.key, strlen(h.key), ix->key)] = L'\0';
+  return 0;
+
+ fail:
+  json_index_close(ix);
+  errno = saved;
+  return -1;
+}
+
+void json_index_close(struct json_index *ix)
+{
+  if (ix->base != NULL) {
+    munmap(ix->base, ix->size);
+  }
+  if (ix->fd >= 0) {
+    close(ix->fd);
+  }
+  if (ix->alloc != NULL) {
+    index_free(ix->alloc, ix->bytes, ix->bytecap);
+    index_free(ix->alloc, ix->text, ix->textcap * sizeof(wchar_t));
+    index_free(ix->alloc, ix->tokens, ix->maxtoken * sizeof(struct json_token));
+  }
+  ix->base = NULL;
+  ix->fd = -1;
+  ix->bytes = NULL;
+  ix->text = NULL;
+  ix->tokens = NULL;
+  ix->offsets = NULL;
+  ix->entries = NULL;
+  ix->nrecords = ix->nentries = 0;
+  ix->bytecap = ix->textcap = ix->maxtoken = 0;
+}
+
+/**
+   @brief Read a record's bytes, up to the end of its line, into ix->bytes.
+   @returns The number of bytes, or -1 with errno set.
+ */
+static ssize_t index_read(struct json_index *ix, size_t n)
+{
+  uint64_t start = ix->offsets[n];
+  size_t len = (size_t) (ix->offsets[n + 1] - start), got = 0;
+  const char *nl;
+  char *bigger;
+  ssize_t r;
+
+  if (len > ix->bytecap) {
+    bigger = ix->alloc->realloc(ix->alloc->ctx, ix->bytes, ix->bytecap, len);
+    if (bigger == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    ix->bytes = bigger;
+    ix->bytecap = len;
+  }
+  while (got < len) {
+    r = pread(ix->fd, ix->bytes + got, len - got, (off_t) (start + got));
+    if (r < 0 && errno == EINTR) {
+      continue;
+    } else if (r < 0) {
+      return -1;
+    } else if (r == 0) {
+      errno = ESTALE; // the file was cut short after it was indexed
+      return -1;
+    }
+    got += (size_t) r;
+  }
+  nl = memchr(ix->bytes, '\n', len);
+  return nl == NULL ? (ssize_t) len : nl - ix->bytes;
+}
+
+int json_index_record(struct json_index *ix, size_t n, struct json_element *el)
+{
+  struct json_parser p;
+  ssize_t bytes;
+  size_t len;
+
+  if (n >= ix->nrecords) {
+    errno = ERANGE;
+    return -1;
+  }
+  bytes = index_read(ix, n);
+  if (bytes < 0) {
+    return -1;
+  }
+
+  if (json_parse_element(ix->bytes, (size_t) bytes, ix->alloc, &ix->text,
+                         &ix->textcap, &ix->tokens, &ix->maxtoken, &len,
+                         &p) != 0) {
+    return -1;
+  }
+  if (p.error != JSONERR_NO_ERROR) {
+    ix->error = p.error;
+    errno = EINVAL;
+    return -1;
+  }
+
+  el->text = ix->text;
+  el->textlen = len;
+  el->tokens = ix->tokens;
+  el->ntokens = p.tokenidx;
+  el->index = n;
+  el->offset = ix->offsets[n];
+  el->bytes = (size_t) bytes;
+  return 0;
+}
+
+/**
+   @brief Return true if the value at index v is the one being looked for.
+ */
+static bool index_matches(const wchar_t *text, const struct json_token *tokens,
+                          size_t v, const wchar_t *value)
+{
+  const struct json_token *tok = &tokens[v];
+  size_t len = tok->end - tok->start + 1;
+
+  if (tok->type == JSON_STRING) {
+    return json_string_match(text, tokens, v, value);
+  } else if (tok->type == JSON_ARRAY || tok->type == JSON_OBJECT) {
+    return false;
+  }
+  return wcslen(value) == len && wmemcmp(text + tok->start, value, len) == 0;
+}
+
+int json_index_find(struct json_index *ix, const wchar_t *value,
+                    struct json_element *el)
+{
+  uint64_t hash = index_hash(value, wcslen(value));
+  size_t lo = 0, hi = ix->nentries, mid, v;
+
+  if (ix->key[0] == L'\0') {
+    errno = EINVAL;
+    return -1;
+  }
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (ix->entries[mid].hash < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (; lo < ix->nentries && ix->entries[lo].hash == hash; lo++) {
+    if (json_index_record(ix, (size_t) ix->entries[lo].record, el) != 0) {
+      if (errno == EINVAL) {
+        continue; // a malformed record can't be the one
+      }
+      return -1;
+    }
+    if (el->tokens[0].type != JSON_OBJECT) {
+      continue;
+    }
+    v = json_object_get(el->text, el->tokens, 0, ix->key);
+    if (v != 0 && index_matches(el->text, el->tokens, v, value)) {
+      return 1;
+    }
+  }
+  return 0;
+}
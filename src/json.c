@@ -17,599 +17,408 @@
 #include <stdbool.h>
 #include <wchar.h>
 #include <stdio.h>
-#include <assert.h>
+#include <string.h>
 
 #include "nosj.h"
 #include "json_private.h"
 
-// forward declaration of the main parser
-static struct json_parser json_parse_rec(wchar_t *text, struct json_token *arr,
-                                         size_t maxtoken, struct json_parser p);
+/*******************************************************************************
+
+                            Character Classification
+
+  All of the per-character decisions the lexer makes are table lookups on the
+  low 256 code points.  Anything above that can only appear inside strings, so
+  it simply maps to the "nothing special" entry.
+
+*******************************************************************************/
 
 /**
-   @brief Return true if c is a whitespace character according to the JSON spec.
+   @brief Look up a character in a 256-entry table, or return 0 above U+00FF.
  */
-static bool json_isspace(wchar_t c)
-{
-  return (c == L' ' || c == L'\t' || c == L'\r' || c == L'\n');
-}
+#define JSON_CLASS(table, c) \
+  ((unsigned long) (c) < 256 ? (table)[(unsigned long) (c)] : 0)
 
 /**
-   @brief Return true if c could be the beginning of a JSON number.
+   @brief Kinds of JSON value, by their first character.
  */
-static bool json_isnumber(wchar_t c)
-{
-  return (c == L'-' || (L'0' <= c && c <= L'9'));
-}
+enum json_lex {
+  LEX_INVALID = 0, LEX_OBJECT, LEX_ARRAY, LEX_STRING, LEX_TRUE, LEX_FALSE,
+  LEX_NULL, LEX_NUMBER, LEX_SPACE
+};
 
 /**
-   @brief Place a token in the next open slot of arr.
-
-   If arr is null, we do nothing (so that the parser can be called for an
-   initial memory estimate).  Otherwise, if we've run past the end of the token
-   buffer, return an error.
-   @param arr The token buffer.  May be null.
-   @param tok The token to add.
-   @param p The parser state.
+   @brief Map from a character to the kind of value it begins (or whitespace).
  */
-void json_settoken(struct json_token *arr, struct json_token tok,
-                   struct json_parser p, size_t maxtoken)
-{
-  if (arr == NULL || p.tokenidx >= maxtoken) {
-    return;
-  }
-  arr[p.tokenidx] = tok;
-}
+static const unsigned char json_lex_table[256] = {
+  [' '] = LEX_SPACE, ['\t'] = LEX_SPACE, ['\r'] = LEX_SPACE,
+  ['\n'] = LEX_SPACE,
+  ['{'] = LEX_OBJECT, ['['] = LEX_ARRAY, ['"'] = LEX_STRING,
+  ['t'] = LEX_TRUE, ['f'] = LEX_FALSE, ['n'] = LEX_NULL,
+  ['-'] = LEX_NUMBER, ['0'] = LEX_NUMBER, ['1'] = LEX_NUMBER,
+  ['2'] = LEX_NUMBER, ['3'] = LEX_NUMBER, ['4'] = LEX_NUMBER,
+  ['5'] = LEX_NUMBER, ['6'] = LEX_NUMBER, ['7'] = LEX_NUMBER,
+  ['8'] = LEX_NUMBER, ['9'] = LEX_NUMBER,
+};
 
 /**
-   @brief Set the "next" pointer in a token to be a new value.
-
-   If arr is null, this does nothing.  If we've run past the end of the buffer,
-   do nothing.
-   @param arr The token buffer.  May be null.
-   @param tokidx The index of the token to update.
-   @param next New value for next.
+   @brief Return the parser state with textidx pointed at the next non-ws char.
+   @param text The text we're parsing.
+   @param p The current parser state
+   @returns The new parser state
  */
-static void json_setnext(struct json_token *arr, size_t tokidx, size_t next,
-                         size_t maxtoken)
+static struct json_parser json_skip_whitespace(wchar_t *text, struct json_parser p)
 {
-  if (arr == NULL || tokidx >= maxtoken) {
-    return;
+  while (JSON_CLASS(json_lex_table, text[p.textidx]) == LEX_SPACE) {
+    p.textidx++;
   }
-  struct json_token tok = arr[tokidx];
-  tok.next = next;
-  arr[tokidx] = tok;
+  return p;
 }
 
 /**
-   @brief Set the "child" pointer in a token to be a new value.
-
-   If arr is null, this does nothing.  If we've run past the end of the buffer,
-   do nothing.
-   @param arr The token buffer.  May be null.
-   @param tokidx The index of the token to update.
-   @param child New value for child.
+   @brief Character classes the number DFA distinguishes.
  */
-static void json_setchild(struct json_token *arr, size_t tokidx, size_t child,
-                          size_t maxtoken)
-{
-  if (arr == NULL || tokidx >= maxtoken) {
-    return;
-  }
-  struct json_token tok = arr[tokidx];
-  tok.child = child;
-  arr[tokidx] = tok;
-}
+enum number_class {
+  NC_OTHER = 0, NC_ZERO, NC_DIGIT, NC_MINUS, NC_PLUS, NC_DOT, NC_EXP, NC_COUNT
+};
+
+static const unsigned char number_class_table[256] = {
+  ['0'] = NC_ZERO, ['1'] = NC_DIGIT, ['2'] = NC_DIGIT, ['3'] = NC_DIGIT,
+  ['4'] = NC_DIGIT, ['5'] = NC_DIGIT, ['6'] = NC_DIGIT, ['7'] = NC_DIGIT,
+  ['8'] = NC_DIGIT, ['9'] = NC_DIGIT, ['-'] = NC_MINUS, ['+'] = NC_PLUS,
+  ['.'] = NC_DOT, ['e'] = NC_EXP, ['E'] = NC_EXP,
+};
 
 /**
-   @brief Set the "end" index in a token to be a new value.
+   @brief States of the number DFA.  Everything from END on stops the scan.
+ */
+enum number_state {
+  START, MINUS, ZERO, DIGIT, DECIMAL, DECIMAL_ACCEPT, EXPONENT,
+  EXPONENT_DIGIT, EXPONENT_DIGIT_ACCEPT, END, ERROR
+};
 
-   If arr is null, this does nothing.  If we've run past the end of the buffer,
-   do nothing.
-   @param arr The token buffer.  May be null.
-   @param tokidx The index of the token to update.
-   @param end New value for end.
+char *parse_number_state[] = {
+  "START", "MINUS", "ZERO", "DIGIT", "DECIMAL", "DECIMAL_ACCEPT", "EXPONENT",
+  "EXPONENT_DIGIT", "EXPONENT_DIGIT_ACCEPT", "END", "ERROR"
+};
+
+/*
+  The number DFA.  States marked by asterisk are accepting.  Unexpected input at
+  accepting states ends the number, and unexpected input at rejecting states
+  causes an error.  This state machine is designed to accept any input given by
+  the diagram in the ECMA JSON spec.
+
+                         -----START-----
+                        /       | (-)   \
+                       /        v        \
+                   (0) | +----MINUS----+ | (1-9)
+                       v v (0)   (1-9) v v
+                    *ZERO*            *DIGIT*--------
+                     |  \ (.)       (.) / |-\ (0-9)  \
+                     |   --->DECIMAL<---              \
+                     |          |                      \
+                     |          v (0-9)  /----\ (0-9)  |
+                     |   *DECIMAL_ACCEPT* ----/        |
+                     |          |                     /
+                     |(e,E)     v (e,E)   (e,E)      /
+                     +-----> EXPONENT <-------------
+                           /        \
+                      (+,-)v        v (0-9)
+              EXPONENT_DIGIT        *EXPONENT_DIGIT_ACCEPT*
+                          \-----------/         \    /(0-9)
+                                 (0-9)           \--/
  */
-static void json_setend(struct json_token *arr, size_t tokidx, size_t end,
-                        size_t maxtoken)
+static const unsigned char number_dfa[END][NC_COUNT] = {
+  // Columns: OTHER, 0, 1-9, -, +, ., e/E
+  [START]                 = {ERROR, ZERO, DIGIT, MINUS, ERROR, ERROR, ERROR},
+  [MINUS]                 = {ERROR, ZERO, DIGIT, ERROR, ERROR, ERROR, ERROR},
+  [ZERO]                  = {END, END, END, END, END, DECIMAL, EXPONENT},
+  [DIGIT]                 = {END, DIGIT, DIGIT, END, END, DECIMAL, EXPONENT},
+  [DECIMAL]               = {ERROR, DECIMAL_ACCEPT, DECIMAL_ACCEPT, ERROR,
+                             ERROR, ERROR, ERROR},
+  [DECIMAL_ACCEPT]        = {END, DECIMAL_ACCEPT, DECIMAL_ACCEPT, END, END,
+                             END, EXPONENT},
+  [EXPONENT]              = {ERROR, EXPONENT_DIGIT_ACCEPT,
+                             EXPONENT_DIGIT_ACCEPT, EXPONENT_DIGIT,
+                             EXPONENT_DIGIT, ERROR, ERROR},
+  [EXPONENT_DIGIT]        = {ERROR, EXPONENT_DIGIT_ACCEPT,
+                             EXPONENT_DIGIT_ACCEPT, ERROR, ERROR, ERROR, ERROR},
+  [EXPONENT_DIGIT_ACCEPT] = {END, EXPONENT_DIGIT_ACCEPT, EXPONENT_DIGIT_ACCEPT,
+                             END, END, END, END},
+};
+
+size_t json_scan_number(const wchar_t *text, size_t idx, enum json_error *error)
 {
-  if (arr == NULL || tokidx >= maxtoken) {
-    return;
+  unsigned char state = START, next;
+
+  while ((next = number_dfa[state][JSON_CLASS(number_class_table,
+                                              text[idx])]) < END) {
+    //printf("state: %s\n", parse_number_state[next]);
+    state = next;
+    idx++;
   }
-  struct json_token tok = arr[tokidx];
-  tok.end = end;
-  arr[tokidx] = tok;
+  if (next == ERROR) {
+    *error = JSONERR_INVALID_NUMBER;
+  }
+  return idx;
 }
 
-/**
-   @brief Set the "length" index in a token to be a new value.
-
-   If arr is null, this does nothing.  If we've run past the end of the buffer,
-   do nothing.
-   @param arr The token buffer.  May be null.
-   @param tokidx The index of the token to update.
-   @param length New value for end.
- */
-static void json_setlength(struct json_token *arr, size_t tokidx, size_t length,
-                           size_t maxtoken)
+int json_number_step(int state, wchar_t c)
 {
-  if (arr == NULL || tokidx >= maxtoken) {
-    return;
+  unsigned char next = number_dfa[state][JSON_CLASS(number_class_table, c)];
+  if (next == END) {
+    return JSON_NUMBER_END;
+  } else if (next == ERROR) {
+    return JSON_NUMBER_ERROR;
   }
-  struct json_token tok = arr[tokidx];
-  tok.length = length;
-  arr[tokidx] = tok;
+  return next;
 }
 
+/*
+  The parser itself is instantiated three times from json_parse.h: once for
+  counting tokens, once for filling a buffer that is known to be big enough, and
+  once for filling a buffer that might be too small.  A fourth copy, for
+  json_parse_events(), follows them.
+ */
+
+#define PARSE_NAME(name) json_count_ ## name
+#define PARSE_SETTOKEN(arr, maxtoken, idx, tok) \
+  ((void) (arr), (void) (maxtoken), (void) (idx), (void) (tok))
+#define PARSE_SET(arr, maxtoken, idx, field, value) \
+  ((void) (arr), (void) (maxtoken), (void) (idx), (void) (value))
+#include "json_parse.h"
+
+#define PARSE_NAME(name) json_fill_ ## name
+#define PARSE_SETTOKEN(arr, maxtoken, idx, tok) \
+  ((void) (maxtoken), (arr)[idx] = (tok))
+#define PARSE_SET(arr, maxtoken, idx, field, value) \
+  ((void) (maxtoken), (arr)[idx].field = (value))
+#include "json_parse.h"
+
+#define PARSE_NAME(name) json_checked_ ## name
+#define PARSE_SETTOKEN(arr, maxtoken, idx, tok) \
+  do { if ((idx) < (maxtoken)) (arr)[idx] = (tok); } while (0)
+#define PARSE_SET(arr, maxtoken, idx, field, value) \
+  do { if ((idx) < (maxtoken)) (arr)[idx].field = (value); } while (0)
+#include "json_parse.h"
+
+/*
+  The event variant stores no tokens at all.  Each value is handed to a
+  callback as soon as it is parsed, in a token of its own, so memory use only
+  depends on how deeply the document is nested.
+ */
+
 /**
-   @brief Return the parser state with textidx pointed at the next non-ws char.
-   @param text The text we're parsing.
-   @param p The current parser state
-   @returns The new parser state
+   @brief The callbacks for the event variant, and their argument.
  */
-static struct json_parser json_skip_whitespace(wchar_t *text, struct json_parser p)
+struct json_dispatch {
+  const struct json_events *events;
+  void *arg;
+};
+
+static void events_call(const struct json_dispatch *d, json_event_fn fn,
+                        const wchar_t *text, struct json_token tok)
 {
-  while (json_isspace(text[p.textidx]) && text[p.textidx] != '\0') {
-    p.textidx++;
+  if (fn != NULL) {
+    fn(d->arg, text, &tok);
   }
-  return p;
 }
 
-/**
-   @brief Parse the "true" literal.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing true.
- */
-static struct json_parser json_parse_true(wchar_t *text, struct json_token *arr,
-                                          size_t maxtoken, struct json_parser p)
+static void events_value(const struct json_dispatch *d, const wchar_t *text,
+                         struct json_token tok)
 {
-  struct json_token tok;
-  tok.type = JSON_TRUE;
-  tok.start = p.textidx;
-  tok.end = p.textidx + 3;
-  tok.length = 0;
-  tok.child = 0;
-  tok.next = 0;
-  if (wcsncmp(L"true", text + p.textidx, 4) == 0) {
-    json_settoken(arr, tok, p, maxtoken);
-    p.textidx += 4;
-    p.tokenidx += 1;
-    return p;
-  } else {
-    p.error = JSONERR_UNEXPECTED_TOKEN;
-    return p;
-  }
+  const struct json_events *e = d->events;
+  events_call(d, tok.type == JSON_NUMBER ? e->number :
+              tok.type == JSON_NULL ? e->null : e->boolean, text, tok);
 }
 
-/**
-   @brief Parse the "false" literal.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing false.
- */
-static struct json_parser json_parse_false(wchar_t *text, struct json_token *arr,
-                                           size_t maxtoken, struct json_parser p)
+static void events_leave(const struct json_dispatch *d, const wchar_t *text,
+                         struct json_token tok, size_t length, size_t end)
 {
-  (void) maxtoken; //unused
-  struct json_token tok;
-  tok.type = JSON_FALSE;
-  tok.start = p.textidx;
-  tok.end = p.textidx + 4;
-  tok.length = 0;
-  tok.child = 0;
-  tok.next = 0;
-  if (wcsncmp(L"false", text + p.textidx, 5) == 0) {
-    json_settoken(arr, tok, p, maxtoken);
-    p.textidx += 5;
-    p.tokenidx += 1;
-    return p;
-  } else {
-    p.error = JSONERR_UNEXPECTED_TOKEN;
-    return p;
-  }
+  tok.length = length;
+  tok.end = end;
+  events_call(d, tok.type == JSON_OBJECT ? d->events->end_object :
+              d->events->end_array, text, tok);
 }
 
+#define PARSE_NAME(name) json_events_ ## name
+#define PARSE_SETTOKEN(arr, maxtoken, idx, tok) \
+  ((void) (arr), (void) (maxtoken), (void) (idx), (void) (tok))
+#define PARSE_SET(arr, maxtoken, idx, field, value) \
+  ((void) (arr), (void) (maxtoken), (void) (idx), (void) (value))
+#define PARSE_EXTRA_PARAM , const struct json_dispatch *dispatch
+#define PARSE_EXTRA_ARG , dispatch
+#define PARSE_HOOK_VALUE(text, tok) events_value(dispatch, text, tok)
+#define PARSE_HOOK_STRING(text, tok, key) \
+  events_call(dispatch, (key) ? dispatch->events->key : \
+              dispatch->events->string, text, tok)
+#define PARSE_HOOK_ENTER(tok) \
+  events_call(dispatch, (tok).type == JSON_OBJECT ? \
+              dispatch->events->start_object : dispatch->events->start_array, \
+              text, tok)
+#define PARSE_HOOK_LEAVE(tok, length, end) \
+  events_leave(dispatch, text, tok, length, end)
+#include "json_parse.h"
+
+#ifdef NOSJ_STATS
+
+/*
+  A fourth variant, only built with NOSJ_STATS, fills a struct json_stats as it
+  goes.  It stores tokens like the checked variant.
+ */
+
 /**
-   @brief Parse the "null" literal.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing null.
+   @brief The statistics being filled in, and the state needed to fill them.
  */
-static struct json_parser json_parse_null(wchar_t *text, struct json_token *arr,
-                                          size_t maxtoken, struct json_parser p)
-{
-  struct json_token tok;
-  tok.type = JSON_NULL;
-  tok.start = p.textidx;
-  tok.end = p.textidx + 3;
-  tok.length = 0;
-  tok.child = 0;
-  tok.next = 0;
-  if (wcsncmp(L"null", text + p.textidx, 4) == 0) {
-    json_settoken(arr, tok, p, maxtoken);
-    p.textidx += 4;
-    p.tokenidx += 1;
-    return p;
-  } else {
-    p.error = JSONERR_UNEXPECTED_TOKEN;
-    return p;
-  }
-}
+struct json_stats_state {
+  struct json_stats *stats;
+  size_t depth;
+};
 
 /**
-   @brief Parse an array.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing the array.
+   @brief Skip whitespace, counting it.
  */
-static struct json_parser json_parse_array(wchar_t *text, struct json_token *arr,
-                                           size_t maxtoken, struct json_parser p)
+static struct json_parser stats_skip(wchar_t *text, struct json_parser p,
+                                     struct json_stats *stats)
 {
-  size_t array_tokenidx = p.tokenidx, prev_tokenidx, curr_tokenidx, length=0;
-  struct json_token tok = {
-    .type = JSON_ARRAY,
-    .start = p.textidx,
-    .length = 0,
-    .end = 0,
-    .child = 0,
-    .next = 0,
-  };
-  json_settoken(arr, tok, p, maxtoken);
-
-  // current char is [, so we need to go past it.
-  p.textidx++;
-  p.tokenidx++;
-
-  // Skip through whitespace.
+  size_t start = p.textidx;
   p = json_skip_whitespace(text, p);
-  while (text[p.textidx] != L']') {
-
-    if (text[p.textidx] == L'\0') {
-      p.error = JSONERR_PREMATURE_EOF;
-      return p;
-    }
-    // Parse a value.
-    prev_tokenidx = curr_tokenidx;
-    curr_tokenidx = p.tokenidx;
-    p = json_parse_rec(text, arr, maxtoken, p);
-    if (p.error != JSONERR_NO_ERROR) {
-      return p;
-    }
-
-    // Now set some bookkeeping of previous values.
-    if (tok.child == 0) {
-      // If this is the first element of the list, set the list's child to point
-      // to it.
-      tok.child = curr_tokenidx;
-      json_setchild(arr, array_tokenidx, curr_tokenidx, maxtoken);
-    } else {
-      // Otherwise set the previous element's next pointer to point to it.
-      json_setnext(arr, prev_tokenidx, curr_tokenidx, maxtoken);
-    }
-
-    length++;
-
-    // Skip whitespace.
-    p = json_skip_whitespace(text, p);
-    if (text[p.textidx] == L',') {
-      p.textidx++;
-      p = json_skip_whitespace(text, p);
-    } else if (text[p.textidx] != L']') {
-      // If there was no comma, this better be the end of the object.
-      p.error = JSONERR_EXPECTED_TOKEN;
-      p.errorarg = L',';
-      return p;
-    }
-  }
-
-  // Set the end of the array token to point to the closing bracket, then move
-  // it up.
-  json_setend(arr, array_tokenidx, p.textidx, maxtoken);
-  json_setlength(arr, array_tokenidx, length, maxtoken);
-  p.textidx++;
+  stats->whitespace += p.textidx - start;
   return p;
 }
 
 /**
-   @brief Parse an object.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing the object.
+   @brief Record a string token: its length, and the escapes in its text.
  */
-static struct json_parser json_parse_object(wchar_t *text, struct json_token *arr,
-                                            size_t maxtoken, struct json_parser p)
+static void stats_string(const wchar_t *text, struct json_token tok,
+                         struct json_stats *stats)
 {
-  size_t object_tokenidx = p.tokenidx, prev_keyidx, curr_keyidx, length=0;
-  struct json_token tok = {
-    .type  = JSON_OBJECT,
-    .start = p.textidx,
-    .length = 0,
-    .end   = 0,
-    .child = 0,
-    .next  = 0,
-  };
-  json_settoken(arr, tok, p, maxtoken);
-
-  // current char is {, so we need to go past it.
-  p.textidx++;
-  p.tokenidx++;
-
-  // Skip through whitespace.
-  p = json_skip_whitespace(text, p);
-  while (text[p.textidx] != L'}') {
-    // Make sure the string didn't end.
-    if (text[p.textidx] == L'\0') {
-      p.error = JSONERR_PREMATURE_EOF;
-      return p;
-    }
-
-    // Parse a string (key) and value.
-    prev_keyidx = curr_keyidx;
-    curr_keyidx = p.tokenidx;
-    p = json_parse_string(text, arr, maxtoken, p);
-    if (p.error != JSONERR_NO_ERROR) {
-      return p;
-    }
-    p = json_skip_whitespace(text, p);
-    if (text[p.textidx] != L':') {
-      p.error = JSONERR_EXPECTED_TOKEN;
-      p.errorarg = L':';
-      return p;
+  size_t i;
+  stats->tokens[JSON_STRING]++;
+  if (tok.length > stats->longest_string) {
+    stats->longest_string = tok.length;
+  }
+  for (i = tok.start + 1; i < tok.end; i++) {
+    if (text[i] != L'\\') {
+      continue;
     }
-    p.textidx++;
-    p = json_parse_rec(text, arr, maxtoken, p);
-    if (p.error != JSONERR_NO_ERROR) {
-      return p;
+    stats->escapes++;
+    i++;
+    // Count high surrogate escapes (D800 to DBFF).  The scanner has already
+    // checked that each one is followed by a low surrogate.
+    if (text[i] == L'u' && (text[i + 1] == L'd' || text[i + 1] == L'D') &&
+        wcschr(L"89abAB", text[i + 2]) != NULL && text[i + 2] != L'\0') {
+      stats->surrogate_pairs++;
     }
+  }
+}
 
-    // Now set some bookkeeping of previous values.
-    if (tok.child == 0) {
-      // If this is the first element of the list, set the list's child to point
-      // to it.
-      tok.child = curr_keyidx;
-      json_setchild(arr, object_tokenidx, curr_keyidx, maxtoken);
-    } else {
-      // Otherwise set the previous element's next pointer to point to it.
-      json_setnext(arr, prev_keyidx, curr_keyidx, maxtoken);
-    }
-    // Set the key's child pointer to point at its value.  Just cause we can.
-    json_setchild(arr, curr_keyidx, curr_keyidx + 1, maxtoken);
-
-    length++;
-
-    // Skip whitespace.
-    p = json_skip_whitespace(text, p);
-    if (text[p.textidx] == L',') {
-      p.textidx++;
-      p = json_skip_whitespace(text, p);
-    } else if (text[p.textidx] != L'}') {
-      // If there was no comma, this better be the end of the object.
-      p.error = JSONERR_EXPECTED_TOKEN;
-      p.errorarg = L',';
-      return p;
-    }
+static void stats_enter(struct json_stats_state *state)
+{
+  state->depth++;
+  if (state->depth > state->stats->max_depth) {
+    state->stats->max_depth = state->depth;
   }
+}
 
-  // Set the end of the array token to point to the closing bracket, then move
-  // it up.
-  json_setend(arr, object_tokenidx, p.textidx, maxtoken);
-  json_setlength(arr, object_tokenidx, length, maxtoken);
-  p.textidx++;
-  return p;
+static void stats_leave(enum json_type type, size_t length,
+                        struct json_stats_state *state)
+{
+  size_t *largest = type == JSON_OBJECT ? &state->stats->largest_object :
+    &state->stats->largest_array;
+  state->depth--;
+  if (length > *largest) {
+    *largest = length;
+  }
 }
 
-char *parse_number_state[] = {
-  "START", "MINUS", "ZERO", "DIGIT", "DECIMAL", "DECIMAL_ACCEPT", "EXPONENT",
-  "EXPONENT_DIGIT", "EXPONENT_DIGIT_ACCEPT", "END"
+#define PARSE_NAME(name) json_stats_ ## name
+#define PARSE_SETTOKEN(arr, maxtoken, idx, tok) \
+  do { if ((idx) < (maxtoken)) (arr)[idx] = (tok); } while (0)
+#define PARSE_SET(arr, maxtoken, idx, field, value) \
+  do { if ((idx) < (maxtoken)) (arr)[idx].field = (value); } while (0)
+#define PARSE_EXTRA_PARAM , struct json_stats_state *state
+#define PARSE_EXTRA_ARG , state
+#define PARSE_SKIP(text, p) stats_skip(text, p, state->stats)
+#define PARSE_HOOK_VALUE(text, tok) (state->stats->tokens[(tok).type]++)
+#define PARSE_HOOK_STRING(text, tok, key) \
+  stats_string(text, tok, state->stats)
+#define PARSE_HOOK_ENTER(tok) \
+  (state->stats->tokens[(tok).type]++, stats_enter(state))
+#define PARSE_HOOK_LEAVE(tok, length, end) \
+  stats_leave((tok).type, length, state)
+#include "json_parse.h"
+
+#endif // NOSJ_STATS
+
+#ifdef NOSJ_TRACE
+
+/*
+  With NOSJ_TRACE, another variant reports events to a callback as it goes.  It
+  also stores tokens like the checked variant.
+ */
+
+/**
+   @brief The callback, and the state needed to fill in its events.
+ */
+struct json_tracer {
+  json_trace_fn fn;
+  void *arg;
+  size_t depth;
 };
 
 /**
-   @brief Parse a string number.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing the number.
+   @brief Report one event to the tracer's callback.
  */
-static struct json_parser json_parse_number(wchar_t *text, struct json_token *arr,
-                                            size_t maxtoken, struct json_parser p)
+static void trace_emit(struct json_tracer *tracer, enum json_trace_kind kind,
+                       enum json_type type, size_t start, size_t end)
 {
-  struct json_token tok = {
-    .type  = JSON_NUMBER,
-    .start = p.textidx,
-    .length = 0, // not used
-    .end   = 0,
-    .child = 0,
-    .next  = 0
+  struct json_trace_event event = {
+    .kind = kind,
+    .type = type,
+    .error = JSONERR_NO_ERROR,
+    .start = start,
+    .end = end,
+    .depth = tracer->depth,
   };
-  enum state {
-    START, MINUS, ZERO, DIGIT, DECIMAL, DECIMAL_ACCEPT, EXPONENT,
-    EXPONENT_DIGIT, EXPONENT_DIGIT_ACCEPT, END
-  } state = START;
-
-  /*
-    This function is completely described by this FSM.  States marked by
-    asterisk are accepting.  Unexpected input at accepting states ends the
-    number, and unexpected input at rejecting states causes an error.  This
-    state machine is designed to accept any input given by the diagram in the
-    ECMA JSON spec.
+  tracer->fn(tracer->arg, &event);
+}
 
-                         -----START-----
-                        /       | (-)   \
-                       /        v        \
-                   (0) | +----MINUS----+ | (1-9)
-                       v v (0)   (1-9) v v
-                    *ZERO*            *DIGIT*--------
-                     |  \ (.)       (.) / |-\ (0-9)  \
-                     |   --->DECIMAL<---              \
-                     |          |                      \
-                     |          v (0-9)  /----\ (0-9)  |
-                     |   *DECIMAL_ACCEPT* ----/        |
-                     |          |                     /
-                     |(e,E)     v (e,E)   (e,E)      /
-                     +-----> EXPONENT <-------------
-                           /        \
-                      (+,-)v        v (0-9)
-              EXPONENT_DIGIT        *EXPONENT_DIGIT_ACCEPT*
-                          \-----------/         \    /(0-9)
-                                 (0-9)           \--/
-   */
-
-  //printf("input: %s\n", text + p.textidx);
-  while (state != END) {
-    wchar_t c = text[p.textidx];
-    //printf("state: %s\n", parse_number_state[state]);
-    switch (state) {
-    case START:
-      if (c == L'0') {
-        state = ZERO;
-      } else if (c == L'-') {
-        state = MINUS;
-      } else if (L'1' <= c && c <= L'9') {
-        state = DIGIT;
-      } else {
-        p.error = JSONERR_INVALID_NUMBER;
-        state = END; // ERROR
-      }
-      break;
-    case MINUS:
-      if (c == L'0') {
-        state = ZERO;
-      } else if (L'1' <= c && c <= L'9') {
-        state = DIGIT;
-      } else {
-        p.error = JSONERR_INVALID_NUMBER;
-        state = END; // ERROR
-      }
-      break;
-    case ZERO:
-      if (c == L'.') {
-        state = DECIMAL;
-      } else if (c == L'e' || c == L'E') {
-        state = EXPONENT;
-      } else {
-        state = END;
-      }
-      break;
-    case DIGIT:
-      if (c == L'.') {
-        state = DECIMAL;
-      } else if (c == L'e' || c == L'E') {
-        state = EXPONENT;
-      } else if (L'0' <= c && c <= L'9') {
-        state = DIGIT;
-      } else {
-        state = END;
-      }
-      break;
-    case DECIMAL:
-      if (L'0' <= c && c <= L'9') {
-        state = DECIMAL_ACCEPT;
-      } else {
-        p.error = JSONERR_INVALID_NUMBER;
-        state = END; // ERROR
-      }
-      break;
-    case DECIMAL_ACCEPT:
-      if (L'0' <= c && c <= L'9') {
-        state = DECIMAL_ACCEPT;
-      } else if (c == L'e' || c == L'E') {
-        state = EXPONENT;
-      } else {
-        state = END;
-      }
-      break;
-    case EXPONENT:
-      if (c == L'+' || c == L'-') {
-        state = EXPONENT_DIGIT;
-      } else if (L'0' <= c && c <= L'9') {
-        state = EXPONENT_DIGIT_ACCEPT;
-      } else {
-        p.error = JSONERR_INVALID_NUMBER;
-        state = END; // ERROR
-      }
-      break;
-    case EXPONENT_DIGIT:
-      if (L'0' <= c && c <= L'9') {
-        state = EXPONENT_DIGIT_ACCEPT;
-      } else {
-        p.error = JSONERR_INVALID_NUMBER;
-        state = END; // ERROR
-      }
-      break;
-    case EXPONENT_DIGIT_ACCEPT:
-      if (L'0' <= c && c <= L'9') {
-        state = EXPONENT_DIGIT_ACCEPT;
-      } else {
-        state = END;
-      }
-      break;
-    case END:
-      // never happens
-      assert(false);
-    }
-    p.textidx++;
+static void trace_value(struct json_tracer *tracer, struct json_token tok)
+{
+  if (tok.type == JSON_NUMBER) {
+    trace_emit(tracer, JSON_TRACE_NUMBER, tok.type, tok.start, tok.end);
   }
-
-  p.textidx--; // the character we failed on
-  tok.end = p.textidx - 1; // the previous character
-  json_settoken(arr, tok, p, maxtoken);
-  p.tokenidx++;
-  return p;
 }
 
-/**
-   @brief Parse any JSON value.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing the value.
- */
-static struct json_parser json_parse_rec(wchar_t *text, struct json_token *arr,
-                                         size_t maxtoken, struct json_parser p)
+static void trace_enter(struct json_tracer *tracer, struct json_token tok)
 {
-  p = json_skip_whitespace(text, p);
-
-  if (text[p.textidx] == '\0') {
-    p.error = JSONERR_PREMATURE_EOF;
-    return p;
-  }
+  trace_emit(tracer, JSON_TRACE_ENTER, tok.type, tok.start, tok.start);
+  tracer->depth++;
+}
 
-  switch (text[p.textidx]) {
-  case L'{':
-    return json_parse_object(text, arr, maxtoken, p);
-  case L'[':
-    return json_parse_array(text, arr, maxtoken, p);
-  case L'"':
-    return json_parse_string(text, arr, maxtoken, p);
-  case L't':
-    return json_parse_true(text, arr, maxtoken, p);
-  case L'f':
-    return json_parse_false(text, arr, maxtoken, p);
-  case L'n':
-    return json_parse_null(text, arr, maxtoken, p);
-  default:
-    if (json_isnumber(text[p.textidx])) {
-      return json_parse_number(text, arr, maxtoken, p);
-    } else {
-      p.error = JSONERR_UNEXPECTED_TOKEN;
-      return p;
-    }
-  }
+static void trace_leave(struct json_tracer *tracer, struct json_token tok,
+                        size_t end)
+{
+  tracer->depth--;
+  trace_emit(tracer, JSON_TRACE_LEAVE, tok.type, tok.start, end);
 }
 
+#define PARSE_NAME(name) json_trace_ ## name
+#define PARSE_SETTOKEN(arr, maxtoken, idx, tok) \
+  do { if ((idx) < (maxtoken)) (arr)[idx] = (tok); } while (0)
+#define PARSE_SET(arr, maxtoken, idx, field, value) \
+  do { if ((idx) < (maxtoken)) (arr)[idx].field = (value); } while (0)
+#define PARSE_EXTRA_PARAM , struct json_tracer *tracer
+#define PARSE_EXTRA_ARG , tracer
+#define PARSE_HOOK_VALUE(text, tok) trace_value(tracer, tok)
+#define PARSE_HOOK_STRING(text, tok, key) \
+  trace_emit(tracer, JSON_TRACE_STRING, JSON_STRING, (tok).start, (tok).end)
+#define PARSE_HOOK_ENTER(tok) trace_enter(tracer, tok)
+#define PARSE_HOOK_LEAVE(tok, length, end) trace_leave(tracer, tok, end)
+#include "json_parse.h"
+
+#endif // NOSJ_TRACE
+
 char *json_type_str[] = {
   "object",
   "array",
@@ -627,6 +436,7 @@ char *json_error_str[] = {
   "unexpected token",
   "invalid surrogate pair",
   "expected token '%c'",
+  "invalid UTF-8",
 };
 
 struct json_parser json_parse(wchar_t *text, struct json_token *arr, size_t maxtoken)
@@ -637,7 +447,155 @@ struct json_parser json_parse(wchar_t *text, struct json_token *arr, size_t maxt
     .error = JSONERR_NO_ERROR,
     .errorarg = 0
   };
-  return json_parse_rec(text, arr, maxtoken, parser);
+  if (arr == NULL || maxtoken == 0) {
+    return json_count_rec(text, NULL, 0, parser);
+  }
+  return json_checked_rec(text, arr, maxtoken, parser);
+}
+
+struct json_parser json_parse_unchecked(wchar_t *text, struct json_token *arr)
+{
+  struct json_parser parser = {
+    .textidx = 0,
+    .tokenidx = 0,
+    .error = JSONERR_NO_ERROR,
+    .errorarg = 0
+  };
+  return json_fill_rec(text, arr, 0, parser);
+}
+
+struct json_parser json_parse_events(wchar_t *text,
+                                     const struct json_events *events,
+                                     void *arg)
+{
+  struct json_parser parser = {
+    .textidx = 0,
+    .tokenidx = 0,
+    .error = JSONERR_NO_ERROR,
+    .errorarg = 0
+  };
+  struct json_dispatch dispatch = {.events = events, .arg = arg};
+  return json_events_rec(text, NULL, 0, parser, &dispatch);
+}
+
+#ifdef NOSJ_STATS
+struct json_parser json_parse_stats(wchar_t *text, struct json_token *arr,
+                                    size_t maxtoken, struct json_stats *stats)
+{
+  struct json_parser parser = {
+    .textidx = 0,
+    .tokenidx = 0,
+    .error = JSONERR_NO_ERROR,
+    .errorarg = 0
+  };
+  struct json_stats_state state = {.stats = stats, .depth = 0};
+  memset(stats, 0, sizeof(*stats));
+  if (arr == NULL) {
+    maxtoken = 0;
+  }
+  return json_stats_rec(text, arr, maxtoken, parser, &state);
+}
+#endif // NOSJ_STATS
+
+#ifdef NOSJ_TRACE
+struct json_parser json_parse_trace(wchar_t *text, struct json_token *arr,
+                                    size_t maxtoken, json_trace_fn fn,
+                                    void *arg)
+{
+  struct json_parser parser = {
+    .textidx = 0,
+    .tokenidx = 0,
+    .error = JSONERR_NO_ERROR,
+    .errorarg = 0
+  };
+  struct json_tracer tracer = {.fn = fn, .arg = arg, .depth = 0};
+  struct json_trace_event event;
+  if (arr == NULL) {
+    maxtoken = 0;
+  }
+  parser = json_trace_rec(text, arr, maxtoken, parser, &tracer);
+  if (parser.error != JSONERR_NO_ERROR) {
+    // The containers still open get no LEAVE event, but the error's depth
+    // says how many there are.
+    event.kind = JSON_TRACE_ERROR;
+    event.type = JSON_NULL;
+    event.error = parser.error;
+    event.start = event.end = parser.textidx;
+    event.depth = tracer.depth;
+    fn(arg, &event);
+  }
+  return parser;
+}
+#endif // NOSJ_TRACE
+
+/**
+   @brief Characters json_estimate_tokens() handles at a time.
+ */
+#define ESTIMATE_BLOCK 16
+
+/**
+   @brief Return 1 if c can come right before a value (or a key), else 0.
+ */
+static size_t json_precedes_value(wchar_t c)
+{
+  return (c == L'[') | (c == L'{') | (c == L',') | (c == L':');
+}
+
+size_t json_estimate_tokens(const wchar_t *json, size_t len)
+{
+  size_t count = 1, i = 0, j, structural;
+  unsigned int special;
+
+  // The block loops have no data-dependent branches, so the compiler can
+  // vectorize them.  Blocks that contain anything interesting are done again
+  // one character at a time.
+  while (i < len) {
+    // Outside a string: count structural characters up to the next quote.
+    while (i + ESTIMATE_BLOCK <= len) {
+      structural = 0;
+      special = 0;
+      for (j = 0; j < ESTIMATE_BLOCK; j++) {
+        structural += json_precedes_value(json[i + j]);
+        special |= json[i + j] == L'"';
+      }
+      if (special) {
+        break;
+      }
+      count += structural;
+      i += ESTIMATE_BLOCK;
+    }
+    while (i < len && json[i] != L'"') {
+      count += json_precedes_value(json[i]);
+      i++;
+    }
+
+    // Inside a string: skip to the closing quote, stepping over escapes.
+    i++;
+    for (;;) {
+      while (i + ESTIMATE_BLOCK <= len) {
+        special = 0;
+        for (j = 0; j < ESTIMATE_BLOCK; j++) {
+          special |= (json[i + j] == L'"') | (json[i + j] == L'\\');
+        }
+        if (special) {
+          break;
+        }
+        i += ESTIMATE_BLOCK;
+      }
+      while (i < len && json[i] != L'"' && json[i] != L'\\') {
+        i++;
+      }
+      if (i >= len) {
+        return count;
+      }
+      if (json[i] == L'"') {
+        i++;
+        break;
+      }
+      i += 2; // backslash and the escaped character
+    }
+  }
+  return count;
 }
 
 void json_print(struct json_token *arr, size_t n)
@@ -0,0 +1,402 @@
+/***************************************************************************//**
+
+  @file         json_parse.h
+
+  @brief        Parser template, included by json.c once per variant.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  The parser writes tokens in three different situations, and each gets its own
+  copy of the code, so the inner loop only carries the checks it needs:
+
+  - Counting tokens (no buffer): token writes compile to nothing.
+  - Filling a buffer known to be large enough: fields are written directly.
+  - Filling a buffer that may be too small: each write is bounds checked.
+
+  Before including this file, define:
+
+  - PARSE_NAME(name): the name of this variant of a function.
+  - PARSE_SETTOKEN(arr, maxtoken, idx, tok): store a whole token.
+  - PARSE_SET(arr, maxtoken, idx, field, value): store one field of a token.
+
+  Both macros must use (or void) every argument, so that no variant has unused
+  parameters.  A variant may also define these, which default to nothing (or
+  to the plain behavior):
+
+  - PARSE_EXTRA_PARAM / PARSE_EXTRA_ARG: an extra trailing parameter (written
+    with its leading comma), and the argument that passes it on.
+  - PARSE_SKIP(text, p): skip whitespace.
+  - PARSE_HOOK_VALUE(text, tok): a number or literal token was parsed.
+  - PARSE_HOOK_STRING(text, tok, key): a string token was parsed.  `key` is
+    true for the keys of objects.
+  - PARSE_HOOK_ENTER(tok): an array or object was started.
+  - PARSE_HOOK_LEAVE(tok, length, end): an array or object was finished, with
+    `length` members and its closing bracket at `end`.
+
+  The hooks see the token as it was first stored, so only the type and start
+  (and end, for values and strings) are meaningful.
+
+  Everything defined here is static, and the macros are undefined at the end,
+  ready for the next variant.
+
+  There is deliberately no include guard.
+
+*******************************************************************************/
+
+#ifndef PARSE_EXTRA_PARAM
+#define PARSE_EXTRA_PARAM
+#define PARSE_EXTRA_ARG
+#endif
+#ifndef PARSE_SKIP
+#define PARSE_SKIP(text, p) json_skip_whitespace(text, p)
+#endif
+#ifndef PARSE_HOOK_VALUE
+#define PARSE_HOOK_VALUE(text, tok) ((void) 0)
+#define PARSE_HOOK_STRING(text, tok, key) ((void) 0)
+#define PARSE_HOOK_ENTER(tok) ((void) 0)
+#define PARSE_HOOK_LEAVE(tok, length, end) ((void) 0)
+#endif
+
+static struct json_parser PARSE_NAME(rec)(wchar_t *text, struct json_token *arr,
+                                          size_t maxtoken, struct json_parser p
+                                          PARSE_EXTRA_PARAM);
+
+/**
+   @brief Parse a literal (true, false or null).
+   @param text The text we're parsing.
+   @param arr The token buffer.
+   @param maxtoken The length of the token buffer.
+   @param p The parser state.
+   @param type The type of the literal.
+   @param lit The literal's text.
+   @param len The literal's length.
+   @returns Parser state after parsing the literal.
+ */
+static struct json_parser PARSE_NAME(literal)(
+  wchar_t *text, struct json_token *arr, size_t maxtoken, struct json_parser p,
+  enum json_type type, const wchar_t *lit, size_t len PARSE_EXTRA_PARAM)
+{
+  struct json_token tok = {
+    .type = type,
+    .start = p.textidx,
+    .end = p.textidx + len - 1,
+    .length = 0,
+    .child = 0,
+    .next = 0,
+  };
+  size_t i;
+  // This stops at the first mismatch, so it never reads past a NUL.
+  for (i = 0; i < len; i++) {
+    if (text[p.textidx + i] != lit[i]) {
+      p.error = JSONERR_UNEXPECTED_TOKEN;
+      return p;
+    }
+  }
+  PARSE_SETTOKEN(arr, maxtoken, p.tokenidx, tok);
+  PARSE_HOOK_VALUE(text, tok);
+  p.textidx += len;
+  p.tokenidx += 1;
+  return p;
+}
+
+/**
+   @brief Parse a string literal.
+   @param text The text we're parsing.
+   @param arr The token buffer.
+   @param maxtoken The length of the token buffer.
+   @param p The parser state.
+   @param key True if the string is the key of an object.
+   @returns Parser state after parsing the string.
+ */
+static struct json_parser PARSE_NAME(string)(wchar_t *text,
+                                             struct json_token *arr,
+                                             size_t maxtoken,
+                                             struct json_parser p, bool key
+                                             PARSE_EXTRA_PARAM)
+{
+  struct json_token tok = {
+    .type = JSON_STRING,
+    .start = p.textidx,
+    .end = 0,
+    .length = 0,
+    .child = 0,
+    .next = 0,
+  };
+  p.textidx = json_scan_string(text, p.textidx, &tok.length, &p.error);
+  tok.end = p.textidx - 1;
+  PARSE_SETTOKEN(arr, maxtoken, p.tokenidx, tok);
+  if (p.error == JSONERR_NO_ERROR) {
+    PARSE_HOOK_STRING(text, tok, key);
+  }
+  (void) key;
+  p.tokenidx++;
+  return p;
+}
+
+/**
+   @brief Parse a number.
+   @param text The text we're parsing.
+   @param arr The token buffer.
+   @param maxtoken The length of the token buffer.
+   @param p The parser state.
+   @returns Parser state after parsing the number.
+ */
+static struct json_parser PARSE_NAME(number)(wchar_t *text,
+                                             struct json_token *arr,
+                                             size_t maxtoken,
+                                             struct json_parser p
+                                             PARSE_EXTRA_PARAM)
+{
+  struct json_token tok = {
+    .type  = JSON_NUMBER,
+    .start = p.textidx,
+    .length = 0, // not used
+    .end   = 0,
+    .child = 0,
+    .next  = 0
+  };
+  p.textidx = json_scan_number(text, p.textidx, &p.error);
+  tok.end = p.textidx - 1;
+  PARSE_SETTOKEN(arr, maxtoken, p.tokenidx, tok);
+  if (p.error == JSONERR_NO_ERROR) {
+    PARSE_HOOK_VALUE(text, tok);
+  }
+  p.tokenidx++;
+  return p;
+}
+
+/**
+   @brief Parse an array.
+   @param text The text we're parsing.
+   @param arr The token buffer.
+   @param maxtoken The length of the token buffer.
+   @param p The parser state.
+   @returns Parser state after parsing the array.
+ */
+static struct json_parser PARSE_NAME(array)(wchar_t *text,
+                                            struct json_token *arr,
+                                            size_t maxtoken,
+                                            struct json_parser p
+                                            PARSE_EXTRA_PARAM)
+{
+  size_t array_tokenidx = p.tokenidx, prev_tokenidx = 0, curr_tokenidx,
+    length = 0;
+  struct json_token tok = {
+    .type = JSON_ARRAY,
+    .start = p.textidx,
+    .length = 0,
+    .end = 0,
+    .child = 0,
+    .next = 0,
+  };
+  PARSE_SETTOKEN(arr, maxtoken, p.tokenidx, tok);
+  PARSE_HOOK_ENTER(tok);
+
+  // current char is [, so we need to go past it.
+  p.textidx++;
+  p.tokenidx++;
+
+  // Skip through whitespace.
+  p = PARSE_SKIP(text, p);
+  while (text[p.textidx] != L']') {
+
+    if (text[p.textidx] == L'\0') {
+      p.error = JSONERR_PREMATURE_EOF;
+      return p;
+    }
+    // Parse a value.
+    curr_tokenidx = p.tokenidx;
+    p = PARSE_NAME(rec)(text, arr, maxtoken, p PARSE_EXTRA_ARG);
+    if (p.error != JSONERR_NO_ERROR) {
+      return p;
+    }
+
+    // Now set some bookkeeping of previous values.
+    if (length == 0) {
+      // If this is the first element of the list, set the list's child to point
+      // to it.
+      PARSE_SET(arr, maxtoken, array_tokenidx, child, curr_tokenidx);
+    } else {
+      // Otherwise set the previous element's next pointer to point to it.
+      PARSE_SET(arr, maxtoken, prev_tokenidx, next, curr_tokenidx);
+    }
+    prev_tokenidx = curr_tokenidx;
+
+    length++;
+
+    // Skip whitespace.
+    p = PARSE_SKIP(text, p);
+    if (text[p.textidx] == L',') {
+      p.textidx++;
+      p = PARSE_SKIP(text, p);
+    } else if (text[p.textidx] != L']') {
+      // If there was no comma, this better be the end of the object.
+      p.error = JSONERR_EXPECTED_TOKEN;
+      p.errorarg = L',';
+      return p;
+    }
+  }
+
+  // Set the end of the array token to point to the closing bracket, then move
+  // it up.
+  PARSE_SET(arr, maxtoken, array_tokenidx, end, p.textidx);
+  PARSE_SET(arr, maxtoken, array_tokenidx, length, length);
+  PARSE_HOOK_LEAVE(tok, length, p.textidx);
+  p.textidx++;
+  return p;
+}
+
+/**
+   @brief Parse an object.
+   @param text The text we're parsing.
+   @param arr The token buffer.
+   @param maxtoken The length of the token buffer.
+   @param p The parser state.
+   @returns Parser state after parsing the object.
+ */
+static struct json_parser PARSE_NAME(object)(wchar_t *text,
+                                             struct json_token *arr,
+                                             size_t maxtoken,
+                                             struct json_parser p
+                                             PARSE_EXTRA_PARAM)
+{
+  size_t object_tokenidx = p.tokenidx, prev_keyidx = 0, curr_keyidx,
+    length = 0;
+  struct json_token tok = {
+    .type  = JSON_OBJECT,
+    .start = p.textidx,
+    .length = 0,
+    .end   = 0,
+    .child = 0,
+    .next  = 0,
+  };
+  PARSE_SETTOKEN(arr, maxtoken, p.tokenidx, tok);
+  PARSE_HOOK_ENTER(tok);
+
+  // current char is {, so we need to go past it.
+  p.textidx++;
+  p.tokenidx++;
+
+  // Skip through whitespace.
+  p = PARSE_SKIP(text, p);
+  while (text[p.textidx] != L'}') {
+    // Make sure the string didn't end.
+    if (text[p.textidx] == L'\0') {
+      p.error = JSONERR_PREMATURE_EOF;
+      return p;
+    }
+
+    // Parse a string (key) and value.
+    curr_keyidx = p.tokenidx;
+    if (text[p.textidx] != L'"') {
+      p.error = JSONERR_UNEXPECTED_TOKEN;
+      return p;
+    }
+    p = PARSE_NAME(string)(text, arr, maxtoken, p, true PARSE_EXTRA_ARG);
+    if (p.error != JSONERR_NO_ERROR) {
+      return p;
+    }
+    p = PARSE_SKIP(text, p);
+    if (text[p.textidx] != L':') {
+      p.error = JSONERR_EXPECTED_TOKEN;
+      p.errorarg = L':';
+      return p;
+    }
+    p.textidx++;
+    p = PARSE_NAME(rec)(text, arr, maxtoken, p PARSE_EXTRA_ARG);
+    if (p.error != JSONERR_NO_ERROR) {
+      return p;
+    }
+
+    // Now set some bookkeeping of previous values.
+    if (length == 0) {
+      // If this is the first element of the list, set the list's child to point
+      // to it.
+      PARSE_SET(arr, maxtoken, object_tokenidx, child, curr_keyidx);
+    } else {
+      // Otherwise set the previous element's next pointer to point to it.
+      PARSE_SET(arr, maxtoken, prev_keyidx, next, curr_keyidx);
+    }
+    prev_keyidx = curr_keyidx;
+    // Set the key's child pointer to point at its value.  Just cause we can.
+    PARSE_SET(arr, maxtoken, curr_keyidx, child, curr_keyidx + 1);
+
+    length++;
+
+    // Skip whitespace.
+    p = PARSE_SKIP(text, p);
+    if (text[p.textidx] == L',') {
+      p.textidx++;
+      p = PARSE_SKIP(text, p);
+    } else if (text[p.textidx] != L'}') {
+      // If there was no comma, this better be the end of the object.
+      p.error = JSONERR_EXPECTED_TOKEN;
+      p.errorarg = L',';
+      return p;
+    }
+  }
+
+  // Set the end of the object token to point to the closing bracket, then move
+  // it up.
+  PARSE_SET(arr, maxtoken, object_tokenidx, end, p.textidx);
+  PARSE_SET(arr, maxtoken, object_tokenidx, length, length);
+  PARSE_HOOK_LEAVE(tok, length, p.textidx);
+  p.textidx++;
+  return p;
+}
+
+/**
+   @brief Parse any JSON value.
+   @param text The text we're parsing.
+   @param arr The token buffer.
+   @param maxtoken The length of the token buffer.
+   @param p The parser state.
+   @returns Parser state after parsing the value.
+ */
+static struct json_parser PARSE_NAME(rec)(wchar_t *text, struct json_token *arr,
+                                          size_t maxtoken, struct json_parser p
+                                          PARSE_EXTRA_PARAM)
+{
+  p = PARSE_SKIP(text, p);
+
+  if (text[p.textidx] == '\0') {
+    p.error = JSONERR_PREMATURE_EOF;
+    return p;
+  }
+
+  switch (JSON_CLASS(json_lex_table, text[p.textidx])) {
+  case LEX_OBJECT:
+    return PARSE_NAME(object)(text, arr, maxtoken, p PARSE_EXTRA_ARG);
+  case LEX_ARRAY:
+    return PARSE_NAME(array)(text, arr, maxtoken, p PARSE_EXTRA_ARG);
+  case LEX_STRING:
+    return PARSE_NAME(string)(text, arr, maxtoken, p, false
+                               PARSE_EXTRA_ARG);
+  case LEX_TRUE:
+    return PARSE_NAME(literal)(text, arr, maxtoken, p, JSON_TRUE, L"true", 4
+                               PARSE_EXTRA_ARG);
+  case LEX_FALSE:
+    return PARSE_NAME(literal)(text, arr, maxtoken, p, JSON_FALSE, L"false", 5
+                               PARSE_EXTRA_ARG);
+  case LEX_NULL:
+    return PARSE_NAME(literal)(text, arr, maxtoken, p, JSON_NULL, L"null", 4
+                               PARSE_EXTRA_ARG);
+  case LEX_NUMBER:
+    return PARSE_NAME(number)(text, arr, maxtoken, p PARSE_EXTRA_ARG);
+  default:
+    p.error = JSONERR_UNEXPECTED_TOKEN;
+    return p;
+  }
+}
+
+#undef PARSE_NAME
+#undef PARSE_SETTOKEN
+#undef PARSE_SET
+#undef PARSE_EXTRA_PARAM
+#undef PARSE_EXTRA_ARG
+#undef PARSE_SKIP
+#undef PARSE_HOOK_VALUE
+#undef PARSE_HOOK_STRING
+#undef PARSE_HOOK_ENTER
+#undef PARSE_HOOK_LEAVE
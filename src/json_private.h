@@ -21,17 +21,169 @@
 /**
    @brief Array mapping JSON type to a string representation of that type.
  */
-char *json_type_str[JSON_NULL+1];
+extern char *json_type_str[JSON_NULL+1];
 
 /**
    @brief Array mapping error to printf format string.
  */
-char *json_error_str[JSONERR_EXPECTED_TOKEN+1];
+extern char *json_error_str[JSONERR_INVALID_UTF8+1];
 
-void json_settoken(struct json_token *arr, struct json_token tok,
-                   struct json_parser p, size_t maxtoken);
-struct json_parser json_parse_string(wchar_t *text, struct json_token *arr,
-                                     size_t maxtoken, struct json_parser p);
+/**
+   @brief Scan a string literal, without storing a token for it.
+   @param text The text we're parsing.
+   @param idx Index of the string's opening quote.
+   @param[out] length Number of characters the string decodes to.
+   @param[out] error Set to the error, or JSONERR_NO_ERROR.
+   @returns Index of the character after the closing quote.
+ */
+size_t json_scan_string(const wchar_t *text, size_t idx, size_t *length,
+                        enum json_error *error);
+
+/**
+   @brief Return the value of a hex digit, or 0xFF if c isn't one.
+ */
+unsigned char json_xdigit(wchar_t c);
+
+/**
+   @brief Scan a number, without storing a token for it.
+   @param text The text we're parsing.
+   @param idx Index of the number's first character.
+   @param[out] error Set to JSONERR_INVALID_NUMBER if the number is malformed.
+   @returns Index of the first character after the number (or of the character
+   that made it malformed).
+ */
+size_t json_scan_number(const wchar_t *text, size_t idx, enum json_error *error);
+
+/**
+   @brief Returned by json_number_step() when a character isn't part of the
+   number, and the number before it is complete.
+ */
+#define JSON_NUMBER_END (-1)
+
+/**
+   @brief Returned by json_number_step() when the number is malformed.
+ */
+#define JSON_NUMBER_ERROR (-2)
+
+/**
+   @brief Scan a number one character at a time.
+
+   This is the state machine json_scan_number() runs, for callers whose number
+   may be split between two buffers.
+   @param state The state after the previous character, or 0 to start.
+   @param c The next character.
+   @returns The state to pass with the next character, or JSON_NUMBER_END or
+   JSON_NUMBER_ERROR.
+ */
+int json_number_step(int state, wchar_t c);
+
+/**
+   @brief Parse into a token buffer that is known to be large enough.
+
+   This is json_parse() without the bounds check on each token write, for
+   callers that already counted the tokens (with a NULL buffer).
+   @param text The text to parse.
+   @param arr The token buffer, with room for every token.
+   @returns The parser state after parsing.
+ */
+struct json_parser json_parse_unchecked(wchar_t *text, struct json_token *arr);
+
+/**
+   @brief Encode a single code point as UTF-8.
+   @param c The code point.
+   @param out Where to put the bytes (up to 4).  May be null, to only count.
+   @returns The number of bytes the code point encodes to.
+ */
+size_t json_utf8_encode(wchar_t c, char *out);
+
+/**
+   @brief Encode a run of code points as UTF-8.
+   @param src The code points.
+   @param n How many code points to encode.
+   @param out Where to put the bytes.  May be null, to only count.
+   @returns The number of bytes written (or that would have been written).
+ */
+size_t json_utf8_encode_run(const wchar_t *src, size_t n, char *out);
 
+/**
+   @brief Write bytes to a sink.
+   @param sink The sink.
+   @param data The bytes.
+   @param n How many bytes.
+ */
+void json_sink_write(struct json_sink *sink, const char *data, size_t n);
+
+/**
+   @brief Write a single byte to a sink.
+ */
+void json_sink_putc(struct json_sink *sink, char c);
+
+/**
+   @brief Write a run of code points to a sink, encoded as UTF-8.
+   @param sink The sink.
+   @param src The code points.
+   @param n How many code points.
+ */
+void json_sink_wcs(struct json_sink *sink, const wchar_t *src, size_t n);
+
+/**
+   @brief Write a newline followed by indentation to a sink.
+   @param sink The sink.
+   @param spaces The number of spaces to indent.
+ */
+void json_sink_newline(struct json_sink *sink, size_t spaces);
+
+/**
+   @brief Make room in a builder for a value written straight to its sink.
+
+   This writes any comma and whitespace that come before the value, and counts
+   the value as written, so the caller must then write exactly one complete
+   value with json_sink_write().  It is for values the builder can't write,
+   like ones nested deeper than JSON_BUILDER_MAXDEPTH.
+   @returns True if a value may be written.
+ */
+bool json_builder_raw(struct json_builder *b);
+
+/**
+   @brief Return the allocator to use, given what the caller passed in.
+   @param a The caller's allocator, or NULL.
+   @returns a, or &json_malloc_allocator if it was NULL.
+ */
+const struct json_allocator *json_alloc_default(const struct json_allocator *a);
+
+/**
+   @brief Decode one UTF-8 value and parse it, into buffers that grow to fit.
+
+   This is what the array stream and the index do with each element or record.
+   The buffers are reused from call to call, and only grow.
+   @param bytes The value's bytes.
+   @param n How many bytes.
+   @param a The allocator the buffers come from (not NULL).
+   @param text The text buffer.
+   @param textcap Size of the text buffer, in characters.
+   @param tokens The token buffer.
+   @param maxtoken Size of the token buffer.
+   @param len Set to the length of the decoded text.
+   @param p Set to the parser result.  If anything but whitespace follows the
+   value, the error is JSONERR_UNEXPECTED_TOKEN.
+   @returns 0, or -1 with errno set to ENOMEM if a buffer couldn't grow.
+ */
+int json_parse_element(const char *bytes, size_t n,
+                       const struct json_allocator *a, wchar_t **text,
+                       size_t *textcap, struct json_token **tokens,
+                       size_t *maxtoken, size_t *len, struct json_parser *p);
+
+/**
+   @brief Longest output of json_dtoa() (e.g. "-1.2345678901234567e-308").
+ */
+#define JSON_DTOA_SIZE 25
+
+/**
+   @brief Format a double as the shortest decimal that reads back identically.
+   @param value The value.  NaN and infinities are written as "null".
+   @param buffer Output, at least JSON_DTOA_SIZE chars.  Not NUL-terminated.
+   @returns The number of chars written.
+ */
+size_t json_dtoa(double value, char *buffer);
 
 #endif // SMB_JSON_PRIVATE_H
@@ -13,50 +13,237 @@
 
 *******************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L // for fileno(), mmap() and clock_gettime()
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
-#include "libstephen/str.h" // for read_filew()
 #include "nosj.h"
 
-int main(int argc, char *argv[])
+/**
+   @brief Size of the input and output buffers, and of the first buffer used
+   when reading a whole pipe.
+ */
+#define REFORMAT_BUFSIZE (1024 * 1024)
+
+/**
+   @brief The raw bytes of an input file.
+ */
+struct input {
+  char *data;
+  size_t len;
+  bool mapped;
+};
+
+/**
+   @brief Map a regular file into memory.
+
+   This only works on regular files, so pipes and terminals (and empty files,
+   which can't be mapped) return false and need to be read instead.
+   @param f The file.
+   @param in Filled in with the mapping.
+   @returns True if the file was mapped.
+ */
+static bool input_map(FILE *f, struct input *in)
 {
-  FILE *f;
+  struct stat st;
+  void *data;
+
+  if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+    return false;
+  }
+  data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  posix_madvise(data, (size_t) st.st_size, POSIX_MADV_SEQUENTIAL);
+  in->data = data;
+  in->len = (size_t) st.st_size;
+  in->mapped = true;
+  return true;
+}
+
+/**
+   @brief Get the whole contents of a file: mapped if possible, else read.
+   @param f The file.
+   @param in Filled in with the contents.
+   @returns True on success.
+ */
+static bool input_read(FILE *f, struct input *in)
+{
+  size_t cap = REFORMAT_BUFSIZE, n;
+  char *bigger;
+
+  if (input_map(f, in)) {
+    return true;
+  }
+
+  in->data = malloc(cap);
+  in->len = 0;
+  in->mapped = false;
+  while (in->data != NULL &&
+         (n = fread(in->data + in->len, 1, cap - in->len, f)) > 0) {
+    in->len += n;
+    if (in->len == cap) {
+      cap *= 2;
+      bigger = realloc(in->data, cap);
+      if (bigger == NULL) {
+        free(in->data);
+      }
+      in->data = bigger;
+    }
+  }
+  return in->data != NULL && !ferror(f);
+}
+
+static void input_close(struct input *in)
+{
+  if (in->mapped) {
+    munmap(in->data, in->len);
+  } else {
+    free(in->data);
+  }
+  in->data = NULL;
+  in->len = 0;
+}
+
+/**
+   @brief Decode an input file into a NUL terminated wide string for parsing.
+
+   The parser works on wide characters, so this is the one copy we can't avoid.
+   It is allocated once, at its largest possible size, and filled in a single
+   pass.  The raw bytes are released as soon as they are decoded.
+   @param f The file.
+   @param[out] bytes Set to the size of the file in bytes.
+   @param[out] len Set to the length of the text in characters.
+   @returns The text, or NULL on error.
+ */
+static wchar_t *read_text(FILE *f, size_t *bytes, size_t *len)
+{
+  struct input in;
   wchar_t *text;
-  struct json_token *tokens = NULL;
+
+  if (!input_read(f, &in)) {
+    return NULL;
+  }
+  *bytes = in.len;
+  text = malloc((in.len + 1) * sizeof(wchar_t));
+  if (text != NULL) {
+    *len = json_utf8_decode(in.data, in.len, text);
+    text[*len] = L'\0';
+  }
+  input_close(&in);
+  return text;
+}
+
+/**
+   @brief Flush function that writes sink output to a FILE.
+ */
+static int flush_file(void *arg, const char *data, size_t len)
+{
+  return fwrite(data, 1, len, arg) == len ? 0 : 1;
+}
+
+/**
+   @brief Minify or pretty-print a file to stdout, in a single streaming pass.
+   @param f The input file.
+   @param indent Zero to minify, else the number of spaces to indent by.
+   @returns Exit code.
+ */
+static int reformat(FILE *f, unsigned int indent)
+{
+  char *in = NULL, *out = malloc(REFORMAT_BUFSIZE);
+  struct json_sink sink;
+  struct json_reformatter r;
   struct json_parser p;
+  size_t n;
   int returncode = 0;
 
-  // When no filename specified, or "-" specified, use STDIN.  Else, use the
-  // specified filename as input.
-  if (argc < 2 || strcmp(argv[1], "-") == 0) {
-    f = stdin;
-  } else {
-    f = fopen(argv[1], "r");
-  }
+  struct input mapped;
 
-  // Read the whole contents of the file.  This uses a libstephen helper
-  // function.  http://stephen-brennan.com/libstephen/doc/api/str.html
-  text = read_filew(f);
+  if (out == NULL) {
+    perror("main");
+    return 1;
+  }
+  json_sink_stream(&sink, out, REFORMAT_BUFSIZE, flush_file, stdout);
+  json_reformat_init(&r, &sink, indent);
 
-  // Parse the first time to get the number of tokens.
-  p = json_parse(text, tokens, 0);
-  if (p.error != JSONERR_NO_ERROR) {
+  if (input_map(f, &mapped)) {
+    // No need to copy a regular file through a buffer.
+    json_reformat_feed(&r, mapped.data, mapped.len);
+    input_close(&mapped);
+  } else if ((in = malloc(REFORMAT_BUFSIZE)) == NULL) {
+    perror("main");
+    free(out);
+    return 1;
+  } else {
+    while ((n = fread(in, 1, REFORMAT_BUFSIZE, f)) > 0) {
+      if (!json_reformat_feed(&r, in, n)) {
+        break;
+      }
+    }
+  }
+  json_reformat_finish(&r);
+  if (!json_sink_finish(&sink) || ferror(f)) {
+    perror("main");
+    returncode = 1;
+  } else if (r.error != JSONERR_NO_ERROR) {
+    // json_print_error() knows how to describe the error, given the offset.
+    p.textidx = r.offset;
+    p.error = r.error;
+    p.errorarg = r.errorarg;
     json_print_error(stderr, p);
     returncode = 1;
-    goto cleanup_text;
   }
 
-  // Then allocate and parse to save the tokens.
-  tokens = calloc(p.tokenidx, sizeof(struct json_token));
-  p = json_parse(text, tokens, p.tokenidx);
+  free(in);
+  free(out);
+  return returncode;
+}
+
+/**
+   @brief Tokenize a file of any size into a token file, a window at a time.
+   @param f The input file.
+   @param path The token file to write.
+   @returns Exit code.
+ */
+static int tokenize(FILE *f, const char *path)
+{
+  struct json_parser p;
+
+  if (json_tokenize_file(fileno(f), path, REFORMAT_BUFSIZE, &p) != 0) {
+    if (p.error != JSONERR_NO_ERROR) {
+      // The offset is in bytes, since the text is never decoded.
+      json_print_error(stderr, p);
+    } else {
+      perror(path);
+    }
+    return 1;
+  }
+  printf("%zu tokens from %zu bytes written to %s\n", p.tokenidx, p.textidx,
+         path);
+  return 0;
+}
 
+/**
+   @brief Print the tokens, then look up and print the key "text" in the root.
+   @param text The parsed text.
+   @param tokens The tokens.
+   @param ntokens The number of tokens.
+ */
+static void print_result(wchar_t *text, struct json_token *tokens,
+                         size_t ntokens)
+{
   // Finally, print the entire token array.
-  json_print(tokens, p.tokenidx);
+  json_print(tokens, ntokens);
 
   // Now, let's look for the key "text" in the root object.
-  if (p.tokenidx > 0 && tokens[0].type == JSON_OBJECT) {
+  if (ntokens > 0 && tokens[0].type == JSON_OBJECT) {
     // We can only do this if there is a root value and it's an object.
     printf("Searching for key \"text\" in the base object.\n");
     size_t value = json_object_get(text, tokens, 0, L"text");
@@ -79,10 +266,226 @@ int main(int argc, char *argv[])
       printf("Key \"text\" not found in base object.\n");
     }
   }
+}
+
+/**
+   @brief Return the time from a monotonic clock, in seconds.
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
+/**
+   @brief Print one line of the --stats report: a phase's time and throughput.
+ */
+static void report_phase(const char *phase, double seconds, size_t bytes)
+{
+  fprintf(stderr, "%-10s %12.6f s %10.2f MB/s\n", phase, seconds,
+          seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+}
+
+/**
+   @brief Parse and print a document like the default mode, timing each phase.
+
+   The estimate, the counting parse, the emitting parse and the lookups are each
+   run `repeat` times, and the fastest run is reported.  The lookups search for
+   "text" in every object, which is the driver's own query applied everywhere.
+   The output is printed once, as usual, and the report goes to stderr.
+   @param text The text to parse.
+   @param len Length of the text in characters.
+   @param bytes Size of the input in bytes, which throughput is measured in.
+   @param read_time Time taken to read and decode the input.
+   @param repeat Number of runs of each repeated phase.
+   @returns Exit code.
+ */
+static int profile(wchar_t *text, size_t len, size_t bytes, double read_time,
+                   int repeat)
+{
+  struct json_token *tokens;
+  struct json_parser p;
+  size_t ntokens = 0, i, lookups = 0, found = 0;
+  double start, elapsed, estimate = 0, count = 0, parse = 0, lookup = 0, output;
+  struct rusage usage;
+  int r;
+
+  for (r = 0; r < repeat; r++) {
+    start = now();
+    ntokens = json_estimate_tokens(text, len);
+    elapsed = now() - start;
+    estimate = r == 0 || elapsed < estimate ? elapsed : estimate;
+  }
+
+  for (r = 0; r < repeat; r++) {
+    start = now();
+    p = json_parse(text, NULL, 0);
+    elapsed = now() - start;
+    count = r == 0 || elapsed < count ? elapsed : count;
+  }
+
+  tokens = malloc(ntokens * sizeof(struct json_token));
+  if (tokens == NULL) {
+    perror("main");
+    return 1;
+  }
+  for (r = 0; r < repeat; r++) {
+    start = now();
+    p = json_parse(text, tokens, ntokens);
+    elapsed = now() - start;
+    parse = r == 0 || elapsed < parse ? elapsed : parse;
+  }
+  if (p.error != JSONERR_NO_ERROR) {
+    json_print_error(stderr, p);
+    free(tokens);
+    return 1;
+  }
+
+  for (r = 0; r < repeat; r++) {
+    lookups = 0;
+    start = now();
+    for (i = 0; i < p.tokenidx; i++) {
+      if (tokens[i].type == JSON_OBJECT) {
+        found += json_object_get(text, tokens, i, L"text") != 0;
+        lookups++;
+      }
+    }
+    elapsed = now() - start;
+    lookup = r == 0 || elapsed < lookup ? elapsed : lookup;
+  }
+
+  start = now();
+  print_result(text, tokens, p.tokenidx);
+  fflush(stdout);
+  output = now() - start;
+
+  report_phase("read", read_time, bytes);
+  report_phase("estimate", estimate, bytes);
+  report_phase("count", count, bytes);
+  report_phase("parse", parse, bytes);
+  fprintf(stderr, "%-10s %12.6f s %10.2f ns/lookup (%zu lookups, %zu found)\n",
+          "lookup", lookup, lookups > 0 ? lookup * 1e9 / lookups : 0.0,
+          lookups, found / repeat);
+  report_phase("output", output, bytes);
+  fprintf(stderr, "%-10s %12zu bytes\n", "input", bytes);
+  fprintf(stderr, "%-10s %12zu bytes (%zu characters)\n", "text",
+          (len + 1) * sizeof(wchar_t), len);
+  fprintf(stderr, "%-10s %12zu bytes (%zu of %zu tokens used)\n", "tokens",
+          ntokens * sizeof(struct json_token), p.tokenidx, ntokens);
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(stderr, "%-10s %12ld kB\n", "peak rss", usage.ru_maxrss);
+
+  free(tokens);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *f;
+  wchar_t *text;
+  struct json_token *tokens = NULL;
+  struct json_parser p;
+  size_t bytes, len, ntokens;
+  int returncode = 0, i;
+  char *filename = NULL, *tokens_path = NULL;
+  int indent = -1; // -1: dump tokens, 0: minify, >0: pretty-print
+  bool stats = false;
+  int repeat = 1;
+  double start, read_time;
+
+  // Options may come before or after the filename.
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--minify") == 0) {
+      indent = 0;
+    } else if (strcmp(argv[i], "--pretty") == 0) {
+      indent = 2;
+    } else if (strncmp(argv[i], "--pretty=", 9) == 0) {
+      indent = atoi(argv[i] + 9);
+      if (indent < 0) {
+        indent = 2;
+      }
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = true;
+    } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+      repeat = atoi(argv[i] + 9);
+      if (repeat < 1) {
+        repeat = 1;
+      }
+    } else if (strncmp(argv[i], "--tokens=", 9) == 0) {
+      tokens_path = argv[i] + 9;
+    } else {
+      filename = argv[i];
+    }
+  }
+
+  // When no filename specified, or "-" specified, use STDIN.  Else, use the
+  // specified filename as input.
+  if (filename == NULL || strcmp(filename, "-") == 0) {
+    f = stdin;
+  } else {
+    f = fopen(filename, "r");
+    if (f == NULL) {
+      perror(filename);
+      return 1;
+    }
+  }
+
+  // Reformatting streams the input, so it never reads the whole file.
+  if (indent >= 0) {
+    returncode = reformat(f, (unsigned int) indent);
+    if (f != stdin) {
+      fclose(f);
+    }
+    return returncode;
+  }
+
+  // So does tokenizing into a token file.
+  if (tokens_path != NULL) {
+    returncode = tokenize(f, tokens_path);
+    if (f != stdin) {
+      fclose(f);
+    }
+    return returncode;
+  }
+
+  // Read the whole contents of the file.
+  start = now();
+  text = read_text(f, &bytes, &len);
+  read_time = now() - start;
+  if (f != stdin) {
+    fclose(f);
+  }
+  if (text == NULL) {
+    perror("main");
+    return 1;
+  }
+
+  if (stats) {
+    returncode = profile(text, len, bytes, read_time, repeat);
+    goto cleanup_text;
+  }
+
+  // Allocate for an upper bound on the number of tokens, and parse once.
+  ntokens = json_estimate_tokens(text, len);
+  tokens = malloc(ntokens * sizeof(struct json_token));
+  if (tokens == NULL) {
+    perror("main");
+    returncode = 1;
+    goto cleanup_text;
+  }
+  p = json_parse(text, tokens, ntokens);
+  if (p.error != JSONERR_NO_ERROR) {
+    json_print_error(stderr, p);
+    returncode = 1;
+    goto cleanup_tokens;
+  }
+
+  print_result(text, tokens, p.tokenidx);
+
+ cleanup_tokens:
   free(tokens);
  cleanup_text:
   free(text);
   return returncode;
 }
-
@@ -0,0 +1,302 @@
+/***************************************************************************//**
+
+  @file         reader.c
+
+  @brief        Pull parser: read a document one event at a time.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  The recursive parser in json.c keeps its place on the C stack, so it can't
+  return in the middle of a document.  The reader keeps its place in a small
+  state machine instead, like the reformatter: the state says what may come
+  next, and a bit stack says whether each open container is an object or an
+  array.  Strings and numbers are scanned with the same functions the parser
+  uses, so both accept exactly the same documents.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief Values of json_reader.state.
+ */
+enum reader_st {
+  RD_VALUE,  // expecting a value
+  RD_KEY,    // expecting a key (or the end of an empty object)
+  RD_AFTER,  // after a value: expecting a comma or the end of a container
+  RD_DONE,
+  RD_ERROR,
+};
+
+void json_reader_init(struct json_reader *r, const wchar_t *json)
+{
+  r->text = json;
+  r->parser.textidx = 0;
+  r->parser.tokenidx = 0;
+  r->parser.error = JSONERR_NO_ERROR;
+  r->parser.errorarg = 0;
+  r->token.type = JSON_NULL;
+  r->token.start = 0;
+  r->token.end = 0;
+  r->token.length = 0;
+  r->token.child = 0;
+  r->token.next = 0;
+  r->event = JSON_EVENT_VALUE; // nothing to skip yet
+  r->depth = 0;
+  r->state = RD_VALUE;
+  r->opened = false;
+}
+
+static size_t reader_skip_space(const wchar_t *text, size_t i)
+{
+  while (text[i] == L' ' || text[i] == L'\t' || text[i] == L'\n' ||
+         text[i] == L'\r') {
+    i++;
+  }
+  return i;
+}
+
+/**
+   @brief Return true if the container at the current depth is an object.
+ */
+static bool reader_top_is_object(const struct json_reader *r)
+{
+  size_t d = r->depth - 1;
+  return (r->stack[d >> 3] >> (d & 7)) & 1;
+}
+
+/**
+   @brief Stop reading with an error at index i.
+ */
+static enum json_event reader_fail(struct json_reader *r, size_t i,
+                                   enum json_error error, size_t errorarg)
+{
+  r->parser.textidx = i;
+  r->parser.error = error;
+  r->parser.errorarg = errorarg;
+  r->state = RD_ERROR;
+  return r->event = JSON_EVENT_ERROR;
+}
+
+/**
+   @brief Set the token for the event, and return the event.
+ */
+static enum json_event reader_emit(struct json_reader *r, enum json_event event,
+                                   enum json_type type, size_t start,
+                                   size_t end, size_t length)
+{
+  r->token.type = type;
+  r->token.start = start;
+  r->token.end = end;
+  r->token.length = length;
+  return r->event = event;
+}
+
+/**
+   @brief Open an array or object at index i.
+ */
+static enum json_event reader_begin(struct json_reader *r, size_t i)
+{
+  bool object = r->text[i] == L'{';
+  unsigned char bit = (unsigned char) (1u << (r->depth & 7));
+
+  if (r->depth >= JSON_READER_MAXDEPTH) {
+    return reader_fail(r, i, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  if (object) {
+    r->stack[r->depth >> 3] |= bit;
+  } else {
+    r->stack[r->depth >> 3] &= (unsigned char) ~bit;
+  }
+  r->depth++;
+  r->parser.textidx = i + 1;
+  r->parser.tokenidx++;
+  r->state = object ? RD_KEY : RD_VALUE;
+  r->opened = true;
+  return reader_emit(r, JSON_EVENT_BEGIN, object ? JSON_OBJECT : JSON_ARRAY,
+                     i, i, 0);
+}
+
+/**
+   @brief Close the innermost array or object with the bracket at index i.
+ */
+static enum json_event reader_end(struct json_reader *r, size_t i)
+{
+  bool object = r->text[i] == L'}';
+
+  if (r->depth == 0 || reader_top_is_object(r) != object) {
+    return reader_fail(r, i, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  r->depth--;
+  r->parser.textidx = i + 1;
+  r->state = RD_AFTER;
+  r->opened = false;
+  return reader_emit(r, JSON_EVENT_END, object ? JSON_OBJECT : JSON_ARRAY,
+                     i, i, 0);
+}
+
+/**
+   @brief Match a literal (true, false or null) at index i.
+ */
+static enum json_event reader_literal(struct json_reader *r, size_t i,
+                                      enum json_type type, const wchar_t *lit)
+{
+  size_t len;
+  // This stops at the first mismatch, so it never reads past a NUL.
+  for (len = 0; lit[len] != L'\0'; len++) {
+    if (r->text[i + len] != lit[len]) {
+      return reader_fail(r, i, JSONERR_UNEXPECTED_TOKEN, 0);
+    }
+  }
+  r->parser.textidx = i + len;
+  r->parser.tokenidx++;
+  r->state = RD_AFTER;
+  return reader_emit(r, JSON_EVENT_VALUE, type, i, i + len - 1, 0);
+}
+
+/**
+   @brief Read the value starting at index i.
+ */
+static enum json_event reader_value(struct json_reader *r, size_t i)
+{
+  enum json_error error = JSONERR_NO_ERROR;
+  size_t end, length = 0;
+
+  switch (r->text[i]) {
+  case L'{':
+  case L'[':
+    return reader_begin(r, i);
+  case L'"':
+    end = json_scan_string(r->text, i, &length, &error);
+    break;
+  case L'-':
+  case L'0': case L'1': case L'2': case L'3': case L'4':
+  case L'5': case L'6': case L'7': case L'8': case L'9':
+    end = json_scan_number(r->text, i, &error);
+    break;
+  case L't':
+    return reader_literal(r, i, JSON_TRUE, L"true");
+  case L'f':
+    return reader_literal(r, i, JSON_FALSE, L"false");
+  case L'n':
+    return reader_literal(r, i, JSON_NULL, L"null");
+  case L'\0':
+    return reader_fail(r, i, JSONERR_PREMATURE_EOF, 0);
+  default:
+    return reader_fail(r, i, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+
+  if (error != JSONERR_NO_ERROR) {
+    return reader_fail(r, end, error, 0);
+  }
+  r->parser.textidx = end;
+  r->parser.tokenidx++;
+  r->state = RD_AFTER;
+  return reader_emit(r, JSON_EVENT_VALUE,
+                     r->text[i] == L'"' ? JSON_STRING : JSON_NUMBER,
+                     i, end - 1, length);
+}
+
+/**
+   @brief Read an object's key at index i, and the colon after it.
+ */
+static enum json_event reader_key(struct json_reader *r, size_t i)
+{
+  enum json_error error = JSONERR_NO_ERROR;
+  size_t end, colon, length = 0;
+
+  if (r->text[i] != L'"') {
+    return reader_fail(r, i, r->text[i] == L'\0' ? JSONERR_PREMATURE_EOF :
+                       JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  end = json_scan_string(r->text, i, &length, &error);
+  if (error != JSONERR_NO_ERROR) {
+    return reader_fail(r, end, error, 0);
+  }
+  colon = reader_skip_space(r->text, end);
+  if (r->text[colon] != L':') {
+    return reader_fail(r, colon, JSONERR_EXPECTED_TOKEN, L':');
+  }
+  r->parser.textidx = colon + 1;
+  r->parser.tokenidx++;
+  r->state = RD_VALUE;
+  r->opened = false;
+  return reader_emit(r, JSON_EVENT_KEY, JSON_STRING, i, end - 1, length);
+}
+
+enum json_event json_reader_next(struct json_reader *r)
+{
+  const wchar_t *text = r->text;
+  size_t i;
+
+  if (r->state == RD_DONE || r->state == RD_ERROR) {
+    return r->event;
+  }
+  i = reader_skip_space(text, r->parser.textidx);
+
+  if (r->state == RD_AFTER) {
+    if (r->depth == 0) {
+      // Like json_parse(), stop after the first complete value.
+      r->state = RD_DONE;
+      return r->event = JSON_EVENT_DONE;
+    } else if (text[i] == L',') {
+      // json_parse() allows a trailing comma, so the reader does too.
+      i = reader_skip_space(text, i + 1);
+      r->state = reader_top_is_object(r) ? RD_KEY : RD_VALUE;
+      r->opened = true;
+    } else if (text[i] == (reader_top_is_object(r) ? L'}' : L']')) {
+      return reader_end(r, i);
+    } else {
+      // This includes the end of the input, as in json_parse().
+      return reader_fail(r, i, JSONERR_EXPECTED_TOKEN, L',');
+    }
+  }
+  if (r->opened && (text[i] == L']' || text[i] == L'}')) {
+    // An empty array or object (or a trailing comma).
+    return reader_end(r, i);
+  }
+
+  if (r->state == RD_KEY) {
+    return reader_key(r, i);
+  }
+  return reader_value(r, i);
+}
+
+enum json_event json_reader_skip(struct json_reader *r)
+{
+  const wchar_t *text = r->text;
+  size_t i, level = 1;
+
+  if (r->event == JSON_EVENT_KEY && json_reader_next(r) != JSON_EVENT_BEGIN) {
+    return r->event;
+  }
+  if (r->event != JSON_EVENT_BEGIN) {
+    return r->event;
+  }
+
+  // Only brackets and strings matter.  Escaped quotes are the only thing that
+  // could fool this, so backslashes in strings skip the next character.
+  for (i = r->parser.textidx; ; i++) {
+    if (text[i] == L'"') {
+      for (i++; text[i] != L'"'; i++) {
+        if (text[i] == L'\0' || (text[i] == L'\\' && text[++i] == L'\0')) {
+          return reader_fail(r, i, JSONERR_PREMATURE_EOF, 0);
+        }
+      }
+    } else if (text[i] == L'[' || text[i] == L'{') {
+      level++;
+    } else if (text[i] == L']' || text[i] == L'}') {
+      if (--level == 0) {
+        return reader_end(r, i);
+      }
+    } else if (text[i] == L'\0') {
+      return reader_fail(r, i, JSONERR_PREMATURE_EOF, 0);
+    }
+  }
+}
@@ -0,0 +1,451 @@
+/***************************************************************************//**
+
+  @file         reformat.c
+
+  @brief        Streaming minify and pretty-print.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  The reformatter works directly on bytes, in a single pass, and never needs
+  more than the chunk it is given plus a small fixed amount of state.  It
+  doesn't produce tokens: it only needs to know whether it's inside a string,
+  what kind of container it's in, and what the grammar allows next.  Strings,
+  numbers and literals are copied to the sink in bulk, and only the bytes
+  between them (and those of numbers and literals, to check them) are looked
+  at one at a time.
+
+  Since every byte of a multi-byte UTF-8 sequence is 0x80 or above, UTF-8 input
+  passes through untouched.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief Values of json_reformatter.state.
+ */
+enum reformat_st {
+  RF_BETWEEN, RF_STRING, RF_ESCAPE, RF_UESC, RF_SCALAR
+};
+
+/**
+   @brief Values of json_reformatter.expect.
+ */
+enum reformat_expect {
+  RX_VALUE,  // expecting a value
+  RX_KEY,    // expecting a key (or the end of an object)
+  RX_COLON,  // after a key
+  RX_AFTER,  // after a value: expecting a comma or the end of a container
+};
+
+void json_reformat_init(struct json_reformatter *r, struct json_sink *sink,
+                        unsigned int indent)
+{
+  r->sink = sink;
+  r->indent = indent;
+  r->depth = 0;
+  r->state = RF_BETWEEN;
+  r->expect = RX_VALUE;
+  r->opened = false;
+  r->comma = false;
+  r->literal = NULL;
+  r->sub = 0;
+  r->code = 0;
+  r->surrogate = false;
+  r->values = 0;
+  r->offset = 0;
+  r->error = JSONERR_NO_ERROR;
+  r->errorarg = 0;
+}
+
+/**
+   @brief Return true for bytes that end a number or literal.
+ */
+static bool reformat_delimiter(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' ||
+    c == ':' || c == ']' || c == '}' || c == '[' || c == '{' || c == '"';
+}
+
+/**
+   @brief Record an error.
+   @returns False, for convenience.
+ */
+static bool reformat_fail(struct json_reformatter *r, enum json_error error,
+                          size_t errorarg)
+{
+  r->error = error;
+  r->errorarg = errorarg;
+  return false;
+}
+
+/**
+   @brief Set what may follow a value that just started or ended.
+
+   At the top level, another value may follow (as in newline-delimited JSON).
+   Inside a container, only a comma or the end of the container may.
+ */
+static void reformat_after(struct json_reformatter *r)
+{
+  r->expect = r->depth == 0 ? RX_VALUE : RX_AFTER;
+}
+
+/**
+   @brief Called before anything that starts a value or key.
+
+   Writes the pending comma, and the newline and indentation that a freshly
+   opened container or a new element needs, or the newline that separates
+   top-level values.
+ */
+static void reformat_begin(struct json_reformatter *r)
+{
+  if (r->opened || r->comma) {
+    if (r->comma) {
+      json_sink_putc(r->sink, ',');
+    }
+    r->opened = false;
+    r->comma = false;
+    if (r->indent > 0) {
+      json_sink_newline(r->sink, r->depth * r->indent);
+    }
+  } else if (r->depth == 0) {
+    if (r->values > 0) {
+      json_sink_putc(r->sink, '\n');
+    }
+    r->values++;
+  }
+}
+
+/**
+   @brief Remember whether the container at the current depth is an object.
+ */
+static void reformat_push(struct json_reformatter *r, bool object)
+{
+  unsigned char bit = (unsigned char) (1u << (r->depth & 7));
+  if (object) {
+    r->stack[r->depth >> 3] |= bit;
+  } else {
+    r->stack[r->depth >> 3] &= (unsigned char) ~bit;
+  }
+  r->depth++;
+}
+
+/**
+   @brief Return true if the container at the current depth is an object.
+ */
+static bool reformat_top_is_object(struct json_reformatter *r)
+{
+  size_t d = r->depth - 1;
+  return (r->stack[d >> 3] >> (d & 7)) & 1;
+}
+
+/**
+   @brief Close the current container with c.
+   @returns False on error.
+ */
+static bool reformat_close(struct json_reformatter *r, char c)
+{
+  if (r->depth == 0 || reformat_top_is_object(r) != (c == '}')) {
+    return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  r->depth--;
+  if (r->opened) {
+    r->opened = false; // empty container stays on one line
+  } else if (r->indent > 0) {
+    json_sink_newline(r->sink, r->depth * r->indent);
+  }
+  r->comma = false; // a trailing comma is dropped
+  json_sink_putc(r->sink, c);
+  reformat_after(r);
+  return true;
+}
+
+/**
+   @brief Start the value beginning with byte c.
+   @returns False on error.
+ */
+static bool reformat_value(struct json_reformatter *r, char c)
+{
+  switch (c) {
+  case '{':
+  case '[':
+    if (r->depth >= JSON_REFORMAT_MAXDEPTH) {
+      return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+    }
+    reformat_begin(r);
+    json_sink_putc(r->sink, c);
+    reformat_push(r, c == '{');
+    r->opened = true;
+    r->expect = c == '{' ? RX_KEY : RX_VALUE;
+    return true;
+  case '"':
+    reformat_begin(r);
+    json_sink_putc(r->sink, '"');
+    r->state = RF_STRING;
+    reformat_after(r);
+    return true;
+  case '-':
+  case '0': case '1': case '2': case '3': case '4':
+  case '5': case '6': case '7': case '8': case '9':
+    r->literal = NULL;
+    break;
+  case 't':
+    r->literal = "true";
+    break;
+  case 'f':
+    r->literal = "false";
+    break;
+  case 'n':
+    r->literal = "null";
+    break;
+  default:
+    return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  reformat_begin(r);
+  r->state = RF_SCALAR;
+  r->sub = 0;
+  reformat_after(r);
+  return true;
+}
+
+/**
+   @brief Handle a single structural byte (or whitespace).
+   @returns False on error.
+ */
+static bool reformat_structural(struct json_reformatter *r, char c)
+{
+  if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+    return true;
+  }
+  switch (r->expect) {
+  case RX_AFTER:
+    if (c == ',') {
+      r->comma = true;
+      r->expect = reformat_top_is_object(r) ? RX_KEY : RX_VALUE;
+      return true;
+    } else if (c == '}' || c == ']') {
+      return reformat_close(r, c);
+    }
+    return reformat_fail(r, JSONERR_EXPECTED_TOKEN, L',');
+  case RX_COLON:
+    if (c != ':') {
+      return reformat_fail(r, JSONERR_EXPECTED_TOKEN, L':');
+    }
+    json_sink_write(r->sink, ": ", r->indent > 0 ? 2 : 1);
+    r->expect = RX_VALUE;
+    return true;
+  case RX_KEY:
+    if (c == '}' || c == ']') {
+      return reformat_close(r, c);
+    } else if (c != '"') {
+      return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+    }
+    reformat_begin(r);
+    json_sink_putc(r->sink, '"');
+    r->state = RF_STRING;
+    r->expect = RX_COLON;
+    return true;
+  case RX_VALUE:
+  default:
+    if ((r->opened || r->comma) && (c == '}' || c == ']')) {
+      return reformat_close(r, c);
+    }
+    return reformat_value(r, c);
+  }
+}
+
+/**
+   @brief Check one byte of a number or literal.
+   @returns False on error.
+ */
+static bool reformat_scalar(struct json_reformatter *r, char c)
+{
+  int next;
+
+  if (r->literal != NULL && r->literal[r->sub] != '\0') {
+    if (c != r->literal[r->sub++]) {
+      return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+    }
+    return true;
+  } else if (r->literal == NULL) {
+    next = json_number_step(r->sub, (unsigned char) c);
+    if (next == JSON_NUMBER_ERROR) {
+      return reformat_fail(r, JSONERR_INVALID_NUMBER, 0);
+    } else if (next != JSON_NUMBER_END) {
+      r->sub = next;
+      return true;
+    }
+  }
+  // The scalar is complete, and something other than a delimiter follows.
+  if (r->depth > 0) {
+    return reformat_fail(r, JSONERR_EXPECTED_TOKEN, L',');
+  }
+  return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+}
+
+/**
+   @brief Check the byte after a backslash.
+   @returns False on error.
+ */
+static bool reformat_escape(struct json_reformatter *r, char c)
+{
+  if (c == 'u') {
+    r->state = RF_UESC;
+    r->sub = 0;
+    r->code = 0;
+    return true;
+  } else if (strchr("\"\\/bfnrt", c) == NULL || c == '\0') {
+    return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+  } else if (r->surrogate) {
+    return reformat_fail(r, JSONERR_INVALID_SURROGATE, 0);
+  }
+  r->state = RF_STRING;
+  return true;
+}
+
+/**
+   @brief Check one byte of a \u escape.
+
+   As in the tokenizer, a surrogate must be followed by another surrogate
+   escape.
+   @returns False on error.
+ */
+static bool reformat_uesc(struct json_reformatter *r, char c)
+{
+  unsigned char digit = json_xdigit((unsigned char) c);
+  bool surrogate;
+
+  if (digit == 0xFF) {
+    return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  r->code = (r->code << 4) | digit;
+  if (++r->sub < 4) {
+    return true;
+  }
+  r->state = RF_STRING;
+  surrogate = 0xD800 <= r->code && r->code <= 0xDFFF;
+  if (r->surrogate && !surrogate) {
+    return reformat_fail(r, JSONERR_INVALID_SURROGATE, 0);
+  }
+  r->surrogate = !r->surrogate && surrogate;
+  return true;
+}
+
+/**
+   @brief Check that the number or literal just copied is complete.
+   @returns False on error.
+ */
+static bool reformat_scalar_end(struct json_reformatter *r)
+{
+  if (r->literal != NULL) {
+    if (r->literal[r->sub] != '\0') {
+      return reformat_fail(r, JSONERR_UNEXPECTED_TOKEN, 0);
+    }
+  } else if (json_number_step(r->sub, L' ') == JSON_NUMBER_ERROR) {
+    return reformat_fail(r, JSONERR_INVALID_NUMBER, 0);
+  }
+  return true;
+}
+
+bool json_reformat_feed(struct json_reformatter *r, const char *data,
+                        size_t len)
+{
+  size_t i = 0, start;
+
+  while (i < len && r->error == JSONERR_NO_ERROR) {
+    switch (r->state) {
+    case RF_BETWEEN:
+      // Indentation comes in runs, so skip it without the big switch.
+      while (i < len && (data[i] == ' ' || data[i] == '\n' || data[i] == '\t' ||
+                         data[i] == '\r')) {
+        i++;
+      }
+      if (i >= len) {
+        break;
+      }
+      if (!reformat_structural(r, data[i])) {
+        r->offset += i;
+        return false;
+      }
+      if (r->state != RF_SCALAR) {
+        i++; // scalars copy their own first byte below
+      }
+      break;
+    case RF_STRING:
+      // Only another escape may follow half of a surrogate pair.
+      if (r->surrogate && data[i] != '\\') {
+        r->offset += i;
+        return reformat_fail(r, JSONERR_INVALID_SURROGATE, 0);
+      }
+      // Copy everything up to the next quote or backslash in one go.
+      start = i;
+      while (i < len && data[i] != '"' && data[i] != '\\') {
+        i++;
+      }
+      if (i < len) {
+        r->state = data[i] == '"' ? RF_BETWEEN : RF_ESCAPE;
+        i++;
+      }
+      json_sink_write(r->sink, data + start, i - start);
+      break;
+    case RF_ESCAPE:
+      if (!reformat_escape(r, data[i])) {
+        r->offset += i;
+        return false;
+      }
+      json_sink_putc(r->sink, data[i++]);
+      break;
+    case RF_UESC:
+      if (!reformat_uesc(r, data[i])) {
+        r->offset += i;
+        return false;
+      }
+      json_sink_putc(r->sink, data[i++]);
+      break;
+    case RF_SCALAR:
+      start = i;
+      while (i < len && !reformat_delimiter(data[i])) {
+        if (!reformat_scalar(r, data[i])) {
+          r->offset += i;
+          return false;
+        }
+        i++;
+      }
+      json_sink_write(r->sink, data + start, i - start);
+      if (i < len) {
+        if (!reformat_scalar_end(r)) {
+          r->offset += i;
+          return false;
+        }
+        r->state = RF_BETWEEN;
+      }
+      break;
+    }
+  }
+  r->offset += len;
+  return r->error == JSONERR_NO_ERROR;
+}
+
+bool json_reformat_finish(struct json_reformatter *r)
+{
+  if (r->error == JSONERR_NO_ERROR && r->state == RF_SCALAR) {
+    reformat_scalar_end(r);
+  }
+  if (r->error == JSONERR_NO_ERROR &&
+      (r->values == 0 || r->depth > 0 || r->state == RF_STRING ||
+       r->state == RF_ESCAPE || r->state == RF_UESC)) {
+    r->error = JSONERR_PREMATURE_EOF;
+  }
+  if (r->error == JSONERR_NO_ERROR && r->values > 0) {
+    json_sink_putc(r->sink, '\n');
+  }
+  r->state = RF_BETWEEN;
+  return r->error == JSONERR_NO_ERROR;
+}
@@ -0,0 +1,165 @@
+/***************************************************************************//**
+
+  @file         sink.c
+
+  @brief        Output sinks.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Everything in NOSJ that produces output writes it through a `struct
+  json_sink`.  The sink batches small writes into the caller's buffer, so that
+  producers can write a byte at a time without paying for a function call into
+  stdio (or whatever the flush function does) each time.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief Number of code points json_sink_wcs() encodes at a time.
+ */
+#define SINK_WCS_CHUNK 64
+
+void json_sink_buffer(struct json_sink *sink, char *buffer, size_t size)
+{
+  sink->buffer = buffer;
+  sink->size = buffer == NULL ? 0 : size;
+  sink->len = 0;
+  sink->total = 0;
+  sink->flush = NULL;
+  sink->arg = NULL;
+  sink->error = false;
+}
+
+void json_sink_stream(struct json_sink *sink, char *buffer, size_t size,
+                      json_flush_fn flush, void *arg)
+{
+  json_sink_buffer(sink, buffer, size);
+  sink->flush = flush;
+  sink->arg = arg;
+}
+
+/**
+   @brief Hand some bytes to the flush function, recording any error.
+ */
+static void json_sink_deliver(struct json_sink *sink, const char *data, size_t n)
+{
+  if (!sink->error && n > 0 && sink->flush(sink->arg, data, n) != 0) {
+    sink->error = true;
+  }
+}
+
+void json_sink_write(struct json_sink *sink, const char *data, size_t n)
+{
+  size_t space;
+
+  sink->total += n;
+
+  if (sink->flush == NULL) {
+    // Buffer mode: keep what fits, and drop the rest.
+    space = sink->size - sink->len;
+    if (n > space) {
+      n = space;
+    }
+    if (n > 0) {
+      memcpy(sink->buffer + sink->len, data, n);
+      sink->len += n;
+    }
+    return;
+  }
+
+  // Stream mode.
+  space = sink->size - sink->len;
+  if (n <= space) {
+    memcpy(sink->buffer + sink->len, data, n);
+    sink->len += n;
+    return;
+  }
+
+  // Top off the buffer and flush it.
+  memcpy(sink->buffer + sink->len, data, space);
+  json_sink_deliver(sink, sink->buffer, sink->size);
+  data += space;
+  n -= space;
+  sink->len = 0;
+
+  // Anything bigger than the whole buffer can go straight to the flush
+  // function, without copying.
+  if (n >= sink->size) {
+    json_sink_deliver(sink, data, n);
+    return;
+  }
+  memcpy(sink->buffer, data, n);
+  sink->len = n;
+}
+
+void json_sink_putc(struct json_sink *sink, char c)
+{
+  if (sink->len < sink->size) {
+    sink->buffer[sink->len++] = c;
+    sink->total++;
+  } else {
+    json_sink_write(sink, &c, 1);
+  }
+}
+
+void json_sink_wcs(struct json_sink *sink, const wchar_t *src, size_t n)
+{
+  char tmp[4 * SINK_WCS_CHUNK];
+  size_t chunk, bytes;
+
+  if (sink->buffer == NULL) {
+    // Size query: just count.
+    sink->total += json_utf8_encode_run(src, n, NULL);
+    return;
+  }
+
+  while (n > 0) {
+    chunk = n < SINK_WCS_CHUNK ? n : SINK_WCS_CHUNK;
+    if (sink->size - sink->len >= 4 * chunk) {
+      // Enough room for the worst case: encode right into the buffer.
+      bytes = json_utf8_encode_run(src, chunk, sink->buffer + sink->len);
+      sink->len += bytes;
+      sink->total += bytes;
+    } else {
+      bytes = json_utf8_encode_run(src, chunk, tmp);
+      json_sink_write(sink, tmp, bytes);
+    }
+    src += chunk;
+    n -= chunk;
+  }
+}
+
+void json_sink_newline(struct json_sink *sink, size_t spaces)
+{
+  static const char blanks[] = "                                ";
+  size_t n;
+
+  json_sink_putc(sink, '\n');
+  while (spaces > 0) {
+    n = spaces < sizeof(blanks) - 1 ? spaces : sizeof(blanks) - 1;
+    json_sink_write(sink, blanks, n);
+    spaces -= n;
+  }
+}
+
+bool json_sink_finish(struct json_sink *sink)
+{
+  if (sink->flush != NULL) {
+    json_sink_deliver(sink, sink->buffer, sink->len);
+    sink->len = 0;
+    return !sink->error;
+  }
+
+  if (sink->len < sink->size) {
+    sink->buffer[sink->len] = '\0';
+  }
+  return sink->total <= sink->len;
+}
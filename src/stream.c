@@ -0,0 +1,309 @@
+/***************************************************************************//**
+
+  @file         stream.c
+
+  @brief        Parse the elements of a huge top-level array one at a time.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  The stream finds where each element ends by scanning its bytes for brackets
+  and the ends of strings, which is all it takes to find the comma after it.
+  The scan keeps its state in the stream, so it picks up where it left off
+  when more input is read.  Only then is the element decoded and parsed, by
+  the same parser as json_parse(), into buffers that are reused for the next
+  element.
+
+  When reading from a file, the buffer only holds the current element (and
+  what was read past it).  Before each read, the bytes of earlier elements are
+  dropped, and the buffer only grows if one element doesn't fit.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief Size of the first input buffer when reading a file.
+ */
+#define STREAM_BUFSIZE 65536
+
+/**
+   @brief Values of json_array_stream.state.
+ */
+enum stream_st {
+  AS_START,    // before the opening bracket
+  AS_FIRST,    // expecting an element, or the end of the array
+  AS_BETWEEN,  // after an element: expecting a comma or the end of the array
+  AS_ELEMENT,  // in an array, object or string element
+  AS_SCALAR,   // in a number or literal element
+  AS_DONE,
+  AS_ERROR,
+};
+
+static bool stream_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+int json_array_stream_fd(struct json_array_stream *s, int fd,
+                         size_t max_record, const struct json_allocator *alloc)
+{
+  memset(s, 0, sizeof(*s));
+  s->fd = fd;
+  s->alloc = json_alloc_default(alloc);
+  s->max_record = max_record > 0 ? max_record : SIZE_MAX;
+  s->cap = STREAM_BUFSIZE < s->max_record ? STREAM_BUFSIZE : s->max_record;
+  s->bytes = s->alloc->alloc(s->alloc->ctx, s->cap);
+  s->state = AS_START;
+  if (s->bytes == NULL) {
+    s->cap = 0;
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+void json_array_stream_buffer(struct json_array_stream *s, const char *data,
+                              size_t len, const struct json_allocator *alloc)
+{
+  memset(s, 0, sizeof(*s));
+  s->fd = -1;
+  s->alloc = json_alloc_default(alloc);
+  s->bytes = (char *) data; // never written to
+  s->cap = s->len = s->max_record = len;
+  s->eof = true;
+  s->state = AS_START;
+}
+
+void json_array_stream_free(struct json_array_stream *s)
+{
+  const struct json_allocator *a = s->alloc;
+  if (s->fd >= 0 && s->bytes != NULL) {
+    a->free(a->ctx, s->bytes, s->cap);
+  }
+  if (s->text != NULL) {
+    a->free(a->ctx, s->text, s->textcap * sizeof(wchar_t));
+  }
+  if (s->tokens != NULL) {
+    a->free(a->ctx, s->tokens, s->maxtoken * sizeof(struct json_token));
+  }
+  s->bytes = NULL;
+  s->text = NULL;
+  s->tokens = NULL;
+}
+
+/**
+   @brief Stop with an error in the input at the current position.
+ */
+static int stream_fail(struct json_array_stream *s, enum json_error error,
+                       uint64_t offset)
+{
+  s->error = error;
+  s->error_offset = offset;
+  s->state = AS_ERROR;
+  errno = EINVAL;
+  return -1;
+}
+
+/**
+   @brief Read more input, first dropping what's no longer needed.
+   @returns 1 if there is more input, 0 at the end of the input, -1 on error.
+ */
+static int stream_fill(struct json_array_stream *s)
+{
+  size_t keep = s->state == AS_ELEMENT || s->state == AS_SCALAR ? s->start :
+    s->pos, cap;
+  char *bigger;
+  ssize_t n;
+
+  if (s->eof) {
+    return 0;
+  }
+  if (keep > 0) {
+    memmove(s->bytes, s->bytes + keep, s->len - keep);
+    s->len -= keep;
+    s->pos -= keep;
+    s->start -= keep;
+    s->base += keep;
+  }
+  if (s->len == s->cap) {
+    if (s->cap >= s->max_record) {
+      errno = EFBIG;
+      return -1;
+    }
+    cap = s->cap <= s->max_record / 2 ? 2 * s->cap : s->max_record;
+    bigger = s->alloc->realloc(s->alloc->ctx, s->bytes, s->cap, cap);
+    if (bigger == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    s->bytes = bigger;
+    s->cap = cap;
+  }
+  do {
+    n = read(s->fd, s->bytes + s->len, s->cap - s->len);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return -1;
+  }
+  if (n == 0) {
+    s->eof = true;
+    return 0;
+  }
+  s->len += (size_t) n;
+  return 1;
+}
+
+/**
+   @brief Parse the element that ends at index end of the buffer.
+   @returns 1, or -1 on error.
+ */
+static int stream_element(struct json_array_stream *s, struct json_element *el,
+                          size_t end)
+{
+  size_t n = end - s->start, len;
+  struct json_parser p;
+
+  if (json_parse_element(s->bytes + s->start, n, s->alloc, &s->text,
+                         &s->textcap, &s->tokens, &s->maxtoken, &len,
+                         &p) != 0) {
+    return -1;
+  }
+  if (p.error != JSONERR_NO_ERROR) {
+    // Including something like "12ab", which the scan took as one element.
+    return stream_fail(s, p.error, s->base + s->start +
+                       json_utf8_encode_run(s->text, p.textidx, NULL));
+  }
+
+  el->text = s->text;
+  el->textlen = len;
+  el->tokens = s->tokens;
+  el->ntokens = p.tokenidx;
+  el->index = s->index++;
+  el->offset = s->base + s->start;
+  el->bytes = n;
+  s->pos = end;
+  s->state = AS_BETWEEN;
+  return 1;
+}
+
+/**
+   @brief Scan the current array, object or string element.
+   @returns 1 if it ended (and was parsed), 0 if more input is needed, or -1.
+ */
+static int stream_scan(struct json_array_stream *s, struct json_element *el)
+{
+  const char *bytes = s->bytes;
+  char c;
+
+  for (; s->pos < s->len; s->pos++) {
+    c = bytes[s->pos];
+    if (s->instring) {
+      if (s->escape) {
+        s->escape = false;
+      } else if (c == '\\') {
+        s->escape = true;
+      } else if (c == '"') {
+        s->instring = false;
+        if (s->depth == 0) {
+          return stream_element(s, el, s->pos + 1);
+        }
+      }
+    } else if (c == '"') {
+      s->instring = true;
+    } else if (c == '[' || c == '{') {
+      s->depth++;
+    } else if ((c == ']' || c == '}') && --s->depth == 0) {
+      return stream_element(s, el, s->pos + 1);
+    }
+  }
+  return 0;
+}
+
+int json_array_stream_next(struct json_array_stream *s, struct json_element *el)
+{
+  int r;
+  char c;
+
+  for (;;) {
+    if (s->state == AS_DONE) {
+      return 0;
+    } else if (s->state == AS_ERROR) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (s->pos == s->len) {
+      r = stream_fill(s);
+      if (r < 0) {
+        return -1;
+      } else if (r == 0 && s->state == AS_SCALAR) {
+        return stream_element(s, el, s->pos);
+      } else if (r == 0) {
+        return stream_fail(s, JSONERR_PREMATURE_EOF, s->base + s->pos);
+      }
+      continue;
+    }
+
+    c = s->bytes[s->pos];
+    switch (s->state) {
+    case AS_START:
+      if (c == '[') {
+        s->state = AS_FIRST;
+      } else if (!stream_space(c)) {
+        return stream_fail(s, JSONERR_UNEXPECTED_TOKEN, s->base + s->pos);
+      }
+      s->pos++;
+      break;
+    case AS_FIRST:
+      if (c == ']') {
+        // An empty array, or (like json_parse()) a trailing comma.
+        s->pos++;
+        s->state = AS_DONE;
+      } else if (stream_space(c)) {
+        s->pos++;
+      } else {
+        s->start = s->pos;
+        s->depth = 0;
+        s->instring = s->escape = false;
+        s->state = c == '[' || c == '{' || c == '"' ? AS_ELEMENT : AS_SCALAR;
+      }
+      break;
+    case AS_BETWEEN:
+      if (c == ',') {
+        s->state = AS_FIRST;
+      } else if (c == ']') {
+        s->state = AS_DONE;
+      } else if (!stream_space(c)) {
+        return stream_fail(s, JSONERR_EXPECTED_TOKEN, s->base + s->pos);
+      }
+      s->pos++;
+      break;
+    case AS_ELEMENT:
+      if ((r = stream_scan(s, el)) != 0) {
+        return r;
+      }
+      break;
+    case AS_SCALAR:
+    default:
+      if (stream_space(c) || c == ',' || c == ']' || c == '}') {
+        return stream_element(s, el, s->pos);
+      }
+      s->pos++;
+      break;
+    }
+  }
+}
+
+uint64_t json_element_offset(const struct json_element *el, size_t idx)
+{
+  return el->offset + json_utf8_encode_run(el->text, idx, NULL);
+}
@@ -104,48 +104,42 @@ struct parser_arg {
 *******************************************************************************/
 
 /**
-   @brief Return true if c is a valid character to come after a backslash.
+   @brief Map from the character after a backslash to the character it stands
+   for, or 0 if it isn't a valid escape.
  */
-static wchar_t json_escape(wchar_t c)
-{
-  switch (c) {
-  case L'\"':
-  case L'\\':
-  case L'/':
-    return c;
-  case L'b':
-    return L'\b';
-  case L'f':
-    return L'\f';
-  case L'n':
-    return L'\n';
-  case L'r':
-    return L'\r';
-  case L't':
-    return L'\t';
-  default:
-    return L'\0';
-  }
-}
+static const wchar_t escape_table[256] = {
+  ['"'] = L'"', ['\\'] = L'\\', ['/'] = L'/', ['b'] = L'\b', ['f'] = L'\f',
+  ['n'] = L'\n', ['r'] = L'\r', ['t'] = L'\t',
+};
 
 /**
-   @brief Return true if c is a valid hexadecimal digit for JSON.
+   @brief Map from a hex digit to its value plus one, or 0 for non-hex digits.
 
    Although there is an iswxdigit function in the C standard library, it allows
    for other hexadecimal other than just 0-9, a-f, A-F (depending on locale).
    The JSON spec explicitly states that these are the only hex characters it
-   accepts, so I've written my own to explicitly cover only those.
+   accepts, so this table explicitly covers only those.
  */
-static unsigned char json_xdigit(wchar_t c) {
-  if (L'0' <= c && c <= L'9') {
-    return (unsigned char) (c - L'0');
-  } else if (L'a' <= c && c <= L'f') {
-    return (unsigned char) (10 + c - L'a');
-  } else if (L'A' <= c && c <= L'F') {
-    return (unsigned char) (10 + c - L'A');
-  } else {
-    return 0xFF;
+static const unsigned char xdigit_table[256] = {
+  ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7,
+  ['7'] = 8, ['8'] = 9, ['9'] = 10,
+  ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+  ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/**
+   @brief Return the character an escape stands for, or 0 if it's invalid.
+ */
+static wchar_t json_escape(wchar_t c)
+{
+  return (unsigned long) c < 256 ? escape_table[(unsigned long) c] : L'\0';
+}
+
+unsigned char json_xdigit(wchar_t c) {
+  if ((unsigned long) c < 256) {
+    return (unsigned char) (xdigit_table[(unsigned long) c] - 1);
   }
+  return 0xFF;
 }
 
 /**
@@ -359,35 +353,13 @@ static struct parser_arg json_string(const wchar_t *text, size_t idx,
 
 *******************************************************************************/
 
-/**
-   @brief Parse a string literal.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing the string.
- */
-struct json_parser json_parse_string(wchar_t *text, struct json_token *arr,
-                                     size_t maxtoken, struct json_parser p)
+size_t json_scan_string(const wchar_t *text, size_t idx, size_t *length,
+                        enum json_error *error)
 {
-  struct json_token tok;
-  struct parser_arg a;
-
-  tok.type = JSON_STRING;
-  tok.start = p.textidx;
-
-  a = json_string(text, p.textidx, NULL, NULL);
-
-  tok.end = a.textidx - 1;
-  tok.child = 0;
-  tok.next = 0;
-  tok.length = a.outidx;
-  json_settoken(arr, tok, p, maxtoken);
-
-  p.error = a.error;
-  p.tokenidx++;
-  p.textidx = a.textidx;
-  return p;
+  struct parser_arg a = json_string(text, idx, NULL, NULL);
+  *length = a.outidx;
+  *error = a.error;
+  return a.textidx;
 }
 
 /**
@@ -461,3 +433,85 @@ void json_string_load(const wchar_t *json, const struct json_token *tokens,
 
   buffer[pa.outidx] = L'\0';
 }
+
+/**
+   @brief Read the four hex digits of a unicode escape.
+   @param text The text, pointing at the first hex digit.
+   @returns The escaped code unit.
+ */
+static wchar_t json_string_hex4(const wchar_t *text)
+{
+  return (wchar_t) ((json_xdigit(text[0]) << 12) | (json_xdigit(text[1]) << 8) |
+                    (json_xdigit(text[2]) << 4) | json_xdigit(text[3]));
+}
+
+/**
+   @brief Decode a string token straight into UTF-8.
+   @param text The original JSON buffer.
+   @param idx Index of the opening quote of the string.
+   @param out Output buffer.  May be null, to only count bytes.
+   @returns The number of bytes in the encoded string.
+
+   Unlike the other loaders, this doesn't go through json_string() one character
+   at a time.  The token has already been validated by the parser, so we can
+   hand whole runs of unescaped characters to json_utf8_encode_run(), and only
+   stop to decode escape sequences.
+ */
+static size_t json_string_utf8(const wchar_t *text, size_t idx, char *out)
+{
+  size_t outidx = 0, run;
+  wchar_t wc, low;
+
+  idx++; // skip the opening quote
+  for (;;) {
+    // Find the length of the next run of plain characters.
+    run = 0;
+    while (text[idx + run] != L'"' && text[idx + run] != L'\\' &&
+           text[idx + run] != L'\0') {
+      run++;
+    }
+    outidx += json_utf8_encode_run(text + idx, run,
+                                   out == NULL ? NULL : out + outidx);
+    idx += run;
+
+    if (text[idx] != L'\\') {
+      return outidx; // closing quote (or end of the buffer)
+    }
+
+    // Decode a single escape sequence.
+    if (text[idx + 1] == L'u') {
+      wc = json_string_hex4(text + idx + 2);
+      idx += 6;
+      if (0xD800 <= wc && wc <= 0xDFFF) {
+        if (text[idx] != L'\\' || text[idx + 1] != L'u' ||
+            (low = json_string_hex4(text + idx + 2)) < 0xD800 || low > 0xDFFF) {
+          // The parser rejects a lone surrogate, but tokens needn't come from
+          // the parser.  Drop it, as json_string_load() does, rather than
+          // encoding half a character.
+          continue;
+        }
+        // combine the surrogate pair, the same way json_string_uesc() does
+        wc = ((wc & 0x03FF) << 10) | (low & 0x03FF);
+        wc += 0x10000;
+        idx += 6;
+      }
+    } else {
+      wc = json_escape(text[idx + 1]);
+      idx += 2;
+    }
+    outidx += json_utf8_encode(wc, out == NULL ? NULL : out + outidx);
+  }
+}
+
+size_t json_string_utf8_size(const wchar_t *json,
+                             const struct json_token *tokens, size_t index)
+{
+  return json_string_utf8(json, tokens[index].start, NULL);
+}
+
+void json_string_load_utf8(const wchar_t *json, const struct json_token *tokens,
+                           size_t index, char *buffer)
+{
+  size_t len = json_string_utf8(json, tokens[index].start, buffer);
+  buffer[len] = '\0';
+}
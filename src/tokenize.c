@@ -0,0 +1,729 @@
+/***************************************************************************//**
+
+  @file         tokenize.c
+
+  @brief        Tokenize input of any size, and save the tokens to a file.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  The tokenizer works on bytes, one at a time, with its place kept in a state
+  machine like the reformatter's, so input can arrive in windows of any size.
+  It makes the same tokens as json_parse(), in the same order.  What makes that
+  possible without an array to patch is that a token is only finished when the
+  token after it starts: that sets its next (or for a container, its child).
+  So each open container keeps its own token, and the last token inside it,
+  until then.  Values in objects are never linked, so they go out right away.
+
+  A token file is written through a block of tokens in memory.  Almost all
+  tokens finish in index order, and land in the block; the few that finish
+  after the block has been written (containers, mostly) are written to their
+  place in the file directly.
+
+  Layout of a token file:
+  - header (struct tokens_header, padded to TOKENS_HEADER_SIZE bytes)
+  - tokens
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+#define TOKENS_MAGIC "NOSJTOK"
+#define TOKENS_VERSION 1
+#define TOKENS_BYTE_ORDER UINT32_C(0x01020304)
+#define TOKENS_HEADER_SIZE 64
+
+/**
+   @brief Default size of the input window for json_tokenize_file().
+ */
+#define TOKENIZE_WINDOW (1024 * 1024)
+
+/**
+   @brief Number of tokens json_tokenize_file() collects before writing.
+ */
+#define TOKENIZE_BLOCK 4096
+
+/**
+   @brief Values of json_tokenizer.state.
+ */
+enum tokenize_st {
+  TK_VALUE,    // expecting a value
+  TK_KEY,      // expecting a key (or the end of an empty object)
+  TK_COLON,    // after a key
+  TK_AFTER,    // after a value: expecting a comma or the end of a container
+  TK_STRING,
+  TK_ESCAPE,
+  TK_UESC,     // in the hex digits of a \u escape (sub counts them)
+  TK_NUMBER,   // sub is the number DFA's state
+  TK_LITERAL,  // sub is how much of the literal matched
+  TK_DONE,
+  TK_ERROR,
+};
+
+struct json_tokenizer_frame {
+  /**
+     @brief The container's token and index.
+   */
+  struct json_token tok;
+  size_t index;
+  /**
+     @brief The last element (or key) in it, which waits for its next.
+   */
+  struct json_token last;
+  size_t last_index;
+  bool has_last;
+};
+
+void json_tokenizer_init(struct json_tokenizer *t, json_token_fn fn, void *arg,
+                         const struct json_allocator *alloc)
+{
+  memset(t, 0, sizeof(*t));
+  t->fn = fn;
+  t->arg = arg;
+  t->alloc = json_alloc_default(alloc);
+  t->frames = NULL;
+  t->literal = NULL;
+  t->state = TK_VALUE;
+  t->error = JSONERR_NO_ERROR;
+}
+
+void json_tokenizer_free(struct json_tokenizer *t)
+{
+  if (t->frames != NULL) {
+    t->alloc->free(t->alloc->ctx, t->frames,
+                   t->maxdepth * sizeof(struct json_tokenizer_frame));
+  }
+  t->frames = NULL;
+  t->depth = t->maxdepth = 0;
+}
+
+/**
+   @brief Stop with an error in the input at the current byte.
+ */
+static int tokenizer_fail(struct json_tokenizer *t, enum json_error error,
+                          size_t errorarg)
+{
+  t->error = error;
+  t->errorarg = errorarg;
+  t->errnum = EINVAL;
+  t->state = TK_ERROR;
+  errno = EINVAL;
+  return -1;
+}
+
+/**
+   @brief Hand a finished token to the token function.
+ */
+static int tokenizer_emit(struct json_tokenizer *t, size_t index,
+                          const struct json_token *tok)
+{
+  if (t->fn != NULL && t->fn(t->arg, index, tok) != 0) {
+    t->errnum = errno;
+    t->state = TK_ERROR;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+   @brief Start a token of the given type at the current byte.
+
+   This is where the previous token in the same container gets its next, and
+   an empty container gets its child.
+ */
+static int tokenizer_start(struct json_tokenizer *t, enum json_type type)
+{
+  struct json_tokenizer_frame *f;
+  size_t index = t->ntokens++;
+
+  t->current.type = type;
+  t->current.start = t->offset;
+  t->current.end = t->offset;
+  t->current.length = 0;
+  t->current.child = 0;
+  t->current.next = 0;
+  t->index = index;
+
+  if (t->depth == 0) {
+    return 0;
+  }
+  f = &t->frames[t->depth - 1];
+  if (f->tok.type == JSON_OBJECT && !t->key) {
+    return 0; // a value: only keys are linked
+  }
+  f->tok.length++;
+  if (f->tok.child == 0) {
+    f->tok.child = index;
+  } else if (f->has_last) {
+    f->last.next = index;
+    f->has_last = false;
+    return tokenizer_emit(t, f->last_index, &f->last);
+  }
+  return 0;
+}
+
+/**
+   @brief Finish a value (or key) that ended at the current byte.
+ */
+static int tokenizer_finish_value(struct json_tokenizer *t,
+                                   const struct json_token *tok, size_t index,
+                                   bool key)
+{
+  struct json_tokenizer_frame *f;
+
+  t->state = TK_AFTER;
+  if (t->depth == 0) {
+    t->state = TK_DONE;
+    return tokenizer_emit(t, index, tok);
+  }
+  f = &t->frames[t->depth - 1];
+  if (key) {
+    t->state = TK_COLON;
+  } else if (f->tok.type == JSON_OBJECT) {
+    return tokenizer_emit(t, index, tok);
+  }
+  f->last = *tok;
+  f->last_index = index;
+  f->has_last = true;
+  if (key) {
+    f->last.child = index + 1;
+  }
+  return 0;
+}
+
+/**
+   @brief Open an array or object at the current byte.
+ */
+static int tokenizer_open(struct json_tokenizer *t, enum json_type type)
+{
+  struct json_tokenizer_frame *bigger;
+  size_t maxdepth;
+
+  if (t->depth == t->maxdepth) {
+    maxdepth = t->maxdepth > 0 ? 2 * t->maxdepth : 64;
+    bigger = t->alloc->realloc(t->alloc->ctx, t->frames,
+                               t->maxdepth * sizeof(*bigger),
+                               maxdepth * sizeof(*bigger));
+    if (bigger == NULL) {
+      t->errnum = errno = ENOMEM;
+      t->state = TK_ERROR;
+      return -1;
+    }
+    t->frames = bigger;
+    t->maxdepth = maxdepth;
+  }
+  if (tokenizer_start(t, type) != 0) {
+    return -1;
+  }
+  t->frames[t->depth].tok = t->current;
+  t->frames[t->depth].index = t->index;
+  t->frames[t->depth].has_last = false;
+  t->depth++;
+  t->state = type == JSON_OBJECT ? TK_KEY : TK_VALUE;
+  t->opened = true;
+  return 0;
+}
+
+/**
+   @brief Close the innermost array or object with the bracket at the current
+   byte.
+ */
+static int tokenizer_close(struct json_tokenizer *t, char c)
+{
+  struct json_tokenizer_frame *f;
+  struct json_token tok;
+
+  if (t->depth == 0) {
+    return tokenizer_fail(t, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  f = &t->frames[t->depth - 1];
+  if ((c == '}') != (f->tok.type == JSON_OBJECT)) {
+    return tokenizer_fail(t, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  if (f->has_last && tokenizer_emit(t, f->last_index, &f->last) != 0) {
+    return -1;
+  }
+  tok = f->tok;
+  tok.end = t->offset;
+  t->depth--;
+  t->opened = false;
+  return tokenizer_finish_value(t, &tok, f->index, false);
+}
+
+/**
+   @brief Start the value beginning with byte c.
+   @returns 0, or -1 on error.
+ */
+static int tokenizer_value(struct json_tokenizer *t, char c)
+{
+  switch (c) {
+  case '{':
+    return tokenizer_open(t, JSON_OBJECT);
+  case '[':
+    return tokenizer_open(t, JSON_ARRAY);
+  case '"':
+    t->state = TK_STRING;
+    t->surrogate = false;
+    return tokenizer_start(t, JSON_STRING);
+  case '-':
+  case '0': case '1': case '2': case '3': case '4':
+  case '5': case '6': case '7': case '8': case '9':
+    t->state = TK_NUMBER;
+    t->sub = json_number_step(0, (unsigned char) c);
+    return tokenizer_start(t, JSON_NUMBER);
+  case 't':
+    t->literal = "true";
+    break;
+  case 'f':
+    t->literal = "false";
+    break;
+  case 'n':
+    t->literal = "null";
+    break;
+  default:
+    return tokenizer_fail(t, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  t->state = TK_LITERAL;
+  t->sub = 1;
+  return tokenizer_start(t, c == 't' ? JSON_TRUE : c == 'f' ? JSON_FALSE :
+                         JSON_NULL);
+}
+
+/**
+   @brief Handle one byte of a \u escape.
+ */
+static int tokenizer_uesc(struct json_tokenizer *t, char c)
+{
+  unsigned char digit = json_xdigit((unsigned char) c);
+  bool surrogate;
+
+  if (digit == 0xFF) {
+    return tokenizer_fail(t, JSONERR_UNEXPECTED_TOKEN, 0);
+  }
+  t->code = (t->code << 4) | (unsigned long) digit;
+  if (++t->sub < 4) {
+    return 0;
+  }
+
+  // As in the parser, a surrogate must be followed by another surrogate
+  // escape, and the pair is one character.
+  t->state = TK_STRING;
+  surrogate = 0xD800 <= t->code && t->code <= 0xDFFF;
+  if (!t->surrogate && surrogate) {
+    t->surrogate = true;
+  } else if (t->surrogate && !surrogate) {
+    return tokenizer_fail(t, JSONERR_INVALID_SURROGATE, 0);
+  } else {
+    t->surrogate = false;
+    t->current.length++;
+  }
+  return 0;
+}
+
+/**
+   @brief Handle a byte outside of any string, number or literal.
+ */
+static int tokenizer_structural(struct json_tokenizer *t, char c)
+{
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+    return 0;
+  }
+  switch (t->state) {
+  case TK_AFTER:
+    if (c == ',') {
+      // json_parse() allows a trailing comma, so the tokenizer does too.
+      t->state = t->frames[t->depth - 1].tok.type == JSON_OBJECT ? TK_KEY :
+        TK_VALUE;
+      t->opened = true;
+      return 0;
+    } else if (c == (t->frames[t->depth - 1].tok.type == JSON_OBJECT ?
+                     '}' : ']')) {
+      return tokenizer_close(t, c);
+    }
+    return tokenizer_fail(t, JSONERR_EXPECTED_TOKEN, L',');
+  case TK_COLON:
+    if (c != ':') {
+      return tokenizer_fail(t, JSONERR_EXPECTED_TOKEN, L':');
+    }
+    t->state = TK_VALUE;
+    return 0;
+  case TK_KEY:
+    if (t->opened && (c == '}' || c == ']')) {
+      return tokenizer_close(t, c);
+    } else if (c != '"') {
+      return tokenizer_fail(t, JSONERR_UNEXPECTED_TOKEN, 0);
+    }
+    t->opened = false;
+    t->key = true;
+    t->state = TK_STRING;
+    t->surrogate = false;
+    return tokenizer_start(t, JSON_STRING);
+  case TK_VALUE:
+  default:
+    if (t->opened && (c == '}' || c == ']')) {
+      return tokenizer_close(t, c);
+    }
+    t->opened = false;
+    t->key = false;
+    return tokenizer_value(t, c);
+  }
+}
+
+int json_tokenizer_feed(struct json_tokenizer *t, const char *data, size_t len)
+{
+  size_t i = 0;
+  char c;
+  int next;
+
+  while (i < len) {
+    c = data[i];
+    switch (t->state) {
+    case TK_DONE:
+      return 0;
+    case TK_ERROR:
+      errno = t->errnum;
+      return -1;
+    case TK_STRING:
+      // Most of the input is usually string contents, so take those a run at
+      // a time.  The length is in code points: every byte but a continuation.
+      while (c != '"' && c != '\\') {
+        if (t->surrogate) {
+          return tokenizer_fail(t, JSONERR_INVALID_SURROGATE, 0);
+        }
+        t->current.length += ((unsigned char) c & 0xC0) != 0x80;
+        t->offset++;
+        if (++i == len) {
+          return 0;
+        }
+        c = data[i];
+      }
+      if (c == '\\') {
+        t->state = TK_ESCAPE;
+      } else if (t->surrogate) {
+        return tokenizer_fail(t, JSONERR_INVALID_SURROGATE, 0);
+      } else {
+        t->current.end = t->offset;
+        if (tokenizer_finish_value(t, &t->current, t->index, t->key) != 0) {
+          return -1;
+        }
+        t->key = false;
+      }
+      break;
+    case TK_ESCAPE:
+      if (c == 'u') {
+        t->state = TK_UESC;
+        t->sub = 0;
+        t->code = 0;
+        break;
+      } else if (strchr("\"\\/bfnrt", c) == NULL || c == '\0') {
+        return tokenizer_fail(t, JSONERR_UNEXPECTED_TOKEN, 0);
+      } else if (t->surrogate) {
+        return tokenizer_fail(t, JSONERR_INVALID_SURROGATE, 0);
+      }
+      t->current.length++;
+      t->state = TK_STRING;
+      break;
+    case TK_UESC:
+      if (tokenizer_uesc(t, c) != 0) {
+        return -1;
+      }
+      break;
+    case TK_NUMBER:
+      next = json_number_step(t->sub, (unsigned char) c);
+      if (next == JSON_NUMBER_ERROR) {
+        return tokenizer_fail(t, JSONERR_INVALID_NUMBER, 0);
+      } else if (next == JSON_NUMBER_END) {
+        // This byte isn't part of the number, so look at it again.
+        t->current.end = t->offset - 1;
+        if (tokenizer_finish_value(t, &t->current, t->index, false) != 0) {
+          return -1;
+        }
+        continue;
+      }
+      t->sub = next;
+      break;
+    case TK_LITERAL:
+      if (c != t->literal[t->sub]) {
+        t->offset = t->current.start;
+        return tokenizer_fail(t, JSONERR_UNEXPECTED_TOKEN, 0);
+      }
+      if (t->literal[++t->sub] == '\0') {
+        t->current.end = t->offset;
+        if (tokenizer_finish_value(t, &t->current, t->index, false) != 0) {
+          return -1;
+        }
+      }
+      break;
+    default:
+      if (tokenizer_structural(t, c) != 0) {
+        return -1;
+      }
+      break;
+    }
+    t->offset++;
+    i++;
+  }
+  return 0;
+}
+
+int json_tokenizer_finish(struct json_tokenizer *t)
+{
+  if (t->state == TK_NUMBER) {
+    if (json_number_step(t->sub, L'\0') == JSON_NUMBER_ERROR) {
+      return tokenizer_fail(t, JSONERR_INVALID_NUMBER, 0);
+    }
+    t->current.end = t->offset - 1;
+    if (tokenizer_finish_value(t, &t->current, t->index, false) != 0) {
+      return -1;
+    }
+  }
+  // Report the end of input the way json_parse() does: a missing comma or
+  // colon when one was due, and a cut-off literal at its start.
+  switch (t->state) {
+  case TK_DONE:
+    return 0;
+  case TK_ERROR:
+    errno = t->errnum;
+    return -1;
+  case TK_AFTER:
+    return tokenizer_fail(t, JSONERR_EXPECTED_TOKEN, L',');
+  case TK_COLON:
+    return tokenizer_fail(t, JSONERR_EXPECTED_TOKEN, L':');
+  case TK_LITERAL:
+    t->offset = t->current.start;
+    return tokenizer_fail(t, JSONERR_UNEXPECTED_TOKEN, 0);
+  default:
+    return tokenizer_fail(t, JSONERR_PREMATURE_EOF, 0);
+  }
+}
+
+/**
+   @brief The header at the start of a token file.
+ */
+struct tokens_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t token_size;
+  uint32_t reserved;
+  uint64_t ntokens;
+  uint64_t input_bytes;
+};
+
+/**
+   @brief Where json_tokenize_file() collects tokens before writing them.
+ */
+struct tokens_writer {
+  int fd;
+  /**
+     @brief Tokens base to base + TOKENIZE_BLOCK - 1, of which the first
+     count have been reached.
+   */
+  struct json_token *block;
+  size_t base, count;
+};
+
+/**
+   @brief Write the whole buffer at an offset, retrying short writes.
+   @returns 0, or -1 with errno set.
+ */
+static int tokens_pwrite(int fd, const void *data, size_t len, uint64_t offset)
+{
+  const char *p = data;
+  ssize_t n;
+
+  while (len > 0) {
+    n = pwrite(fd, p, len, (off_t) offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      return -1;
+    }
+    p += n;
+    len -= (size_t) n;
+    offset += (uint64_t) n;
+  }
+  return 0;
+}
+
+/**
+   @brief Return the offset of a token in a token file.
+ */
+static uint64_t tokens_offset(size_t index)
+{
+  return TOKENS_HEADER_SIZE + (uint64_t) index * sizeof(struct json_token);
+}
+
+/**
+   @brief Write the block.  Slots not yet filled are written too; every one of
+   them is filled in later, directly in the file.
+ */
+static int tokens_flush(struct tokens_writer *w)
+{
+  if (w->count == 0) {
+    return 0;
+  }
+  return tokens_pwrite(w->fd, w->block, w->count * sizeof(struct json_token),
+                       tokens_offset(w->base));
+}
+
+/**
+   @brief The token function for json_tokenize_file().
+ */
+static int tokens_put(void *arg, size_t index, const struct json_token *tok)
+{
+  struct tokens_writer *w = arg;
+
+  if (index < w->base) {
+    return tokens_pwrite(w->fd, tok, sizeof(*tok), tokens_offset(index));
+  }
+  if (index >= w->base + TOKENIZE_BLOCK) {
+    if (tokens_flush(w) != 0) {
+      return -1;
+    }
+    w->base = index - index % TOKENIZE_BLOCK;
+    w->count = 0;
+  }
+  w->block[index - w->base] = *tok;
+  if (index - w->base >= w->count) {
+    w->count = index - w->base + 1;
+  }
+  return 0;
+}
+
+/**
+   @brief Read from a file, retrying interrupted reads.
+ */
+static ssize_t tokens_read(int fd, char *buffer, size_t len)
+{
+  ssize_t n;
+  do {
+    n = read(fd, buffer, len);
+  } while (n < 0 && errno == EINTR);
+  return n;
+}
+
+int json_tokenize_file(int fd, const char *path, size_t window,
+                       struct json_parser *result)
+{
+  struct json_tokenizer t;
+  struct tokens_writer w = {.fd = -1, .block = NULL, .base = 0, .count = 0};
+  struct tokens_header h;
+  char header[TOKENS_HEADER_SIZE] = {0};
+  char *buffer;
+  ssize_t n = 0;
+  int rv = -1, saved;
+
+  window = window > 0 ? window : TOKENIZE_WINDOW;
+  buffer = malloc(window);
+  w.block = malloc(TOKENIZE_BLOCK * sizeof(struct json_token));
+  json_tokenizer_init(&t, &tokens_put, &w, NULL);
+  if (buffer == NULL || w.block == NULL) {
+    goto out;
+  }
+  w.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (w.fd < 0) {
+    goto out;
+  }
+
+  while ((n = tokens_read(fd, buffer, window)) > 0) {
+    if (json_tokenizer_feed(&t, buffer, (size_t) n) != 0) {
+      goto out;
+    }
+    if (t.state == TK_DONE) {
+      break;
+    }
+  }
+  if (n < 0 || json_tokenizer_finish(&t) != 0 || tokens_flush(&w) != 0) {
+    goto out;
+  }
+
+  // The header goes last, so a file that was cut short is never mistaken for a
+  // complete one.
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TOKENS_MAGIC, sizeof(TOKENS_MAGIC));
+  h.version = TOKENS_VERSION;
+  h.byte_order = TOKENS_BYTE_ORDER;
+  h.token_size = sizeof(struct json_token);
+  h.ntokens = t.ntokens;
+  h.input_bytes = t.offset;
+  memcpy(header, &h, sizeof(h));
+  rv = tokens_pwrite(w.fd, header, sizeof(header), 0);
+
+ out:
+  saved = errno;
+  if (w.fd >= 0 && close(w.fd) != 0 && rv == 0) {
+    saved = errno;
+    rv = -1;
+  }
+  if (w.fd >= 0 && rv != 0) {
+    unlink(path); // don't leave half a token file behind
+  }
+  result->textidx = (size_t) t.offset;
+  result->tokenidx = t.ntokens;
+  result->error = t.error;
+  result->errorarg = t.errorarg;
+  json_tokenizer_free(&t);
+  free(w.block);
+  free(buffer);
+  errno = saved;
+  return rv;
+}
+
+int json_tokens_open(const char *path, size_t *ntokens)
+{
+  struct tokens_header h;
+  char header[TOKENS_HEADER_SIZE];
+  off_t size;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  size = lseek(fd, 0, SEEK_END);
+  if (size < TOKENS_HEADER_SIZE ||
+      pread(fd, header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+    goto invalid;
+  }
+  memcpy(&h, header, sizeof(h));
+  if (memcmp(h.magic, TOKENS_MAGIC, sizeof(TOKENS_MAGIC)) != 0 ||
+      h.version != TOKENS_VERSION || h.byte_order != TOKENS_BYTE_ORDER ||
+      h.token_size != sizeof(struct json_token) ||
+      h.ntokens > (SIZE_MAX - TOKENS_HEADER_SIZE) / sizeof(struct json_token) ||
+      (uint64_t) size != tokens_offset((size_t) h.ntokens)) {
+    goto invalid;
+  }
+  *ntokens = (size_t) h.ntokens;
+  return fd;
+
+ invalid:
+  close(fd);
+  errno = EINVAL;
+  return -1;
+}
+
+int json_tokens_get(int fd, size_t index, struct json_token *tok)
+{
+  ssize_t n;
+  do {
+    n = pread(fd, tok, sizeof(*tok), (off_t) tokens_offset(index));
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return -1;
+  } else if (n != (ssize_t) sizeof(*tok)) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
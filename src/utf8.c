@@ -0,0 +1,251 @@
+/***************************************************************************//**
+
+  @file         utf8.c
+
+  @brief        UTF-8 encoding and decoding helpers.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  NOSJ works on `wchar_t` internally, but most consumers want UTF-8 bytes.
+  These helpers do the conversion without going through the C library's
+  locale-dependent `wcstombs()`.  Each one accepts a null output pointer, in
+  which case it only counts bytes (in the same spirit as `json_parse()`).
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+size_t json_utf8_encode(wchar_t c, char *out)
+{
+  unsigned long cp = (unsigned long) c;
+
+  if (cp < 0x80) {
+    if (out != NULL) {
+      out[0] = (char) cp;
+    }
+    return 1;
+  } else if (cp < 0x800) {
+    if (out != NULL) {
+      out[0] = (char) (0xC0 | (cp >> 6));
+      out[1] = (char) (0x80 | (cp & 0x3F));
+    }
+    return 2;
+  } else if (cp < 0x10000) {
+    if (out != NULL) {
+      out[0] = (char) (0xE0 | (cp >> 12));
+      out[1] = (char) (0x80 | ((cp >> 6) & 0x3F));
+      out[2] = (char) (0x80 | (cp & 0x3F));
+    }
+    return 3;
+  } else {
+    if (out != NULL) {
+      out[0] = (char) (0xF0 | ((cp >> 18) & 0x07));
+      out[1] = (char) (0x80 | ((cp >> 12) & 0x3F));
+      out[2] = (char) (0x80 | ((cp >> 6) & 0x3F));
+      out[3] = (char) (0x80 | (cp & 0x3F));
+    }
+    return 4;
+  }
+}
+
+/**
+   @brief Return true if the four code points starting at src are all ASCII.
+
+   This is written as a single OR and mask, rather than four comparisons, so
+   that the compiler can turn it into one vector compare.
+ */
+static int json_utf8_ascii4(const wchar_t *src)
+{
+  unsigned long bits = (unsigned long) src[0] | (unsigned long) src[1] |
+    (unsigned long) src[2] | (unsigned long) src[3];
+  return (bits & ~0x7FUL) == 0;
+}
+
+/**
+   @brief Return true if the four code points starting at src all take two
+   bytes (U+0080 to U+07FF).
+ */
+static int json_utf8_two4(const wchar_t *src)
+{
+  return ((unsigned long) src[0] - 0x80 < 0x780) &
+    ((unsigned long) src[1] - 0x80 < 0x780) &
+    ((unsigned long) src[2] - 0x80 < 0x780) &
+    ((unsigned long) src[3] - 0x80 < 0x780);
+}
+
+/**
+   @brief Return true if a code point takes three bytes and isn't a surrogate.
+ */
+static int json_utf8_three(unsigned long cp)
+{
+  return (cp - 0x800 < 0xF800) & (cp - 0xD800 >= 0x800);
+}
+
+/**
+   @brief Return true if the four code points starting at src all take three
+   bytes, and none is a surrogate.
+ */
+static int json_utf8_three4(const wchar_t *src)
+{
+  return json_utf8_three((unsigned long) src[0]) &
+    json_utf8_three((unsigned long) src[1]) &
+    json_utf8_three((unsigned long) src[2]) &
+    json_utf8_three((unsigned long) src[3]);
+}
+
+/**
+   @brief Return the number of bytes the UTF-8 encoding of a run would take.
+ */
+static size_t json_utf8_run_size(const wchar_t *src, size_t n)
+{
+  size_t i, size = 0;
+  unsigned long cp;
+  for (i = 0; i < n; i++) {
+    cp = (unsigned long) src[i];
+    size += 1 + (cp >= 0x80) + (cp >= 0x800) + (cp >= 0x10000);
+  }
+  return size;
+}
+
+size_t json_utf8_encode_run(const wchar_t *src, size_t n, char *out)
+{
+  size_t i = 0, outidx = 0, j;
+  unsigned long cp[4];
+
+  if (out == NULL) {
+    return json_utf8_run_size(src, n);
+  }
+
+  // Text in one script is mostly runs of a single width: ASCII, two bytes
+  // (Latin, Greek, Cyrillic, etc.) or three bytes (CJK).  Four code points
+  // of the same width are written as one fixed block, with no per-character
+  // branch on the width.
+  for (; i + 4 <= n; i += 4) {
+    for (j = 0; j < 4; j++) {
+      cp[j] = (unsigned long) src[i + j];
+    }
+    if (json_utf8_ascii4(src + i)) {
+      for (j = 0; j < 4; j++) {
+        out[outidx + j] = (char) cp[j];
+      }
+      outidx += 4;
+    } else if (json_utf8_two4(src + i)) {
+      for (j = 0; j < 4; j++) {
+        out[outidx + 2 * j]     = (char) (0xC0 | (cp[j] >> 6));
+        out[outidx + 2 * j + 1] = (char) (0x80 | (cp[j] & 0x3F));
+      }
+      outidx += 8;
+    } else if (json_utf8_three4(src + i)) {
+      for (j = 0; j < 4; j++) {
+        out[outidx + 3 * j]     = (char) (0xE0 | (cp[j] >> 12));
+        out[outidx + 3 * j + 1] = (char) (0x80 | ((cp[j] >> 6) & 0x3F));
+        out[outidx + 3 * j + 2] = (char) (0x80 | (cp[j] & 0x3F));
+      }
+      outidx += 12;
+    } else {
+      for (j = 0; j < 4; j++) {
+        outidx += json_utf8_encode((wchar_t) cp[j], out + outidx);
+      }
+    }
+  }
+  // The last few, one code point at a time.
+  for (; i < n; i++) {
+    outidx += json_utf8_encode(src[i], out + outidx);
+  }
+  return outidx;
+}
+
+/**
+   @brief Return true if the eight bytes starting at src are all ASCII.
+ */
+static int json_utf8_ascii8(const unsigned char *src)
+{
+  uint64_t w;
+  memcpy(&w, src, 8);
+  return (w & UINT64_C(0x8080808080808080)) == 0;
+}
+
+/**
+   @brief Decode one multi-byte UTF-8 sequence.
+   @param src The bytes, starting with a lead byte of 0x80 or above.
+   @param n The number of bytes available.
+   @param cp Set to the code point, or U+FFFD for an invalid sequence.
+   @returns The number of bytes consumed (always at least one).
+ */
+static size_t json_utf8_decode_one(const unsigned char *src, size_t n,
+                                   unsigned long *cp)
+{
+  static const unsigned long min[5] = {0, 0, 0x80, 0x800, 0x10000};
+  unsigned char c = src[0];
+  size_t len, i;
+  unsigned long value;
+
+  if (c >= 0xC2 && c <= 0xDF) {
+    len = 2;
+    value = c & 0x1F;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    len = 3;
+    value = c & 0x0F;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    len = 4;
+    value = c & 0x07;
+  } else {
+    *cp = 0xFFFD; // stray continuation byte, or an invalid lead byte
+    return 1;
+  }
+
+  for (i = 1; i < len; i++) {
+    if (i >= n || (src[i] & 0xC0) != 0x80) {
+      *cp = 0xFFFD;
+      return i; // resume at the byte that broke the sequence
+    }
+    value = (value << 6) | (src[i] & 0x3F);
+  }
+  // Reject overlong encodings, surrogates, and values past U+10FFFF.
+  if (value < min[len] || (value >= 0xD800 && value <= 0xDFFF) ||
+      value > 0x10FFFF) {
+    value = 0xFFFD;
+  }
+  *cp = value;
+  return len;
+}
+
+size_t json_utf8_decode(const char *src, size_t n, wchar_t *out)
+{
+  const unsigned char *s = (const unsigned char *) src;
+  size_t i = 0, outidx = 0, j;
+  unsigned long cp;
+
+  while (i < n) {
+    // Fast path: eight ASCII bytes at a time widen directly.
+    while (i + 8 <= n && json_utf8_ascii8(s + i)) {
+      if (out != NULL) {
+        for (j = 0; j < 8; j++) {
+          out[outidx + j] = (wchar_t) s[i + j];
+        }
+      }
+      outidx += 8;
+      i += 8;
+    }
+    if (i >= n) {
+      break;
+    }
+    if (s[i] < 0x80) {
+      cp = s[i++];
+    } else {
+      i += json_utf8_decode_one(s + i, n - i, &cp);
+    }
+    if (out != NULL) {
+      out[outidx] = (wchar_t) cp;
+    }
+    outidx++;
+  }
+  return outidx;
+}
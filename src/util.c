@@ -14,6 +14,8 @@
 *******************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
 
 #include "nosj.h"
 
@@ -38,7 +40,7 @@ size_t json_object_get(const wchar_t *json, const struct json_token *tokens,
 size_t json_array_get(const wchar_t *json, const struct json_token *tokens,
                       size_t index, size_t array_index)
 {
-  if (index >= tokens[index].length) {
+  if (tokens[index].type != JSON_ARRAY || array_index >= tokens[index].length) {
     return 0;
   }
 
@@ -53,7 +55,20 @@ size_t json_array_get(const wchar_t *json, const struct json_token *tokens,
 double json_number_get(const wchar_t *json, const struct json_token *tokens,
                        size_t index)
 {
+  char buffer[64];
+  size_t i, len = tokens[index].end - tokens[index].start + 1;
   double result;
-  swscanf(json + tokens[index].start, L"%lf", &result);
-  return result;
+
+  // swscanf() may scan the whole rest of the text (to find its length) before
+  // it converts anything, which makes reading every number quadratic.  Number
+  // tokens are plain ASCII, so copy short ones out and use strtod().
+  if (len >= sizeof(buffer)) {
+    swscanf(json + tokens[index].start, L"%lf", &result);
+    return result;
+  }
+  for (i = 0; i < len; i++) {
+    buffer[i] = (char) json[tokens[index].start + i];
+  }
+  buffer[len] = '\0';
+  return strtod(buffer, NULL);
 }
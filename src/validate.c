@@ -0,0 +1,415 @@
+/***************************************************************************//**
+
+  @file         validate.c
+
+  @brief        Checking that UTF-8 text is valid JSON, without tokenizing it.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  This follows the same recursive descent as json.c, but it has no token
+  buffer to fill in, so it carries no token bookkeeping at all: each value just
+  bumps a counter.  It works on UTF-8 bytes directly, so there is no need to
+  decode the input to wide characters first, and it checks the UTF-8 as it
+  goes.
+
+  It is stricter than json_parse() in a few places where json_parse() is
+  lenient: control characters in strings, unpaired surrogate escapes, trailing
+  commas, and anything other than whitespace after the value are all errors.
+  Nesting is limited to JSON_VALIDATE_MAXDEPTH, so that deeply nested input
+  can't overflow the stack.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief The validator's state.
+ */
+struct validator {
+  const unsigned char *text;
+  size_t len;
+  size_t idx;
+  size_t values;
+  size_t depth;
+  enum json_error error;
+  size_t errorarg;
+};
+
+/**
+   @brief Return the byte at the current position, or 0 at the end.
+
+   Since NUL bytes are never valid outside of strings, treating the end of input
+   as a NUL means most checks don't need to look at the length.
+ */
+static unsigned char validate_peek(const struct validator *v)
+{
+  return v->idx < v->len ? v->text[v->idx] : 0;
+}
+
+static bool validate_fail(struct validator *v, enum json_error error)
+{
+  v->error = error;
+  return false;
+}
+
+static void validate_skip_whitespace(struct validator *v)
+{
+  unsigned char c;
+  while (v->idx < v->len && ((c = v->text[v->idx]) == ' ' || c == '\n' ||
+                             c == '\t' || c == '\r')) {
+    v->idx++;
+  }
+}
+
+/**
+   @brief Check a literal (true, false or null).
+ */
+static bool validate_literal(struct validator *v, const char *lit, size_t n)
+{
+  size_t avail = v->len - v->idx;
+  if (avail >= n && memcmp(v->text + v->idx, lit, n) == 0) {
+    v->idx += n;
+    v->values++;
+    return true;
+  }
+  if (avail < n && memcmp(v->text + v->idx, lit, avail) == 0) {
+    return validate_fail(v, JSONERR_PREMATURE_EOF);
+  }
+  return validate_fail(v, JSONERR_UNEXPECTED_TOKEN);
+}
+
+static bool validate_digits(struct validator *v)
+{
+  size_t start = v->idx;
+  while (v->idx < v->len && v->text[v->idx] >= '0' && v->text[v->idx] <= '9') {
+    v->idx++;
+  }
+  return v->idx > start || validate_fail(v, JSONERR_INVALID_NUMBER);
+}
+
+/**
+   @brief Check a number, following the same grammar as json_parse_number().
+ */
+static bool validate_number(struct validator *v)
+{
+  unsigned char c;
+
+  if (validate_peek(v) == '-') {
+    v->idx++;
+  }
+  c = validate_peek(v);
+  if (c == '0') {
+    v->idx++;
+  } else if (c >= '1' && c <= '9') {
+    validate_digits(v);
+  } else {
+    return validate_fail(v, JSONERR_INVALID_NUMBER);
+  }
+  if (validate_peek(v) == '.') {
+    v->idx++;
+    if (!validate_digits(v)) {
+      return false;
+    }
+  }
+  c = validate_peek(v);
+  if (c == 'e' || c == 'E') {
+    v->idx++;
+    c = validate_peek(v);
+    if (c == '+' || c == '-') {
+      v->idx++;
+    }
+    if (!validate_digits(v)) {
+      return false;
+    }
+  }
+  v->values++;
+  return true;
+}
+
+/**
+   @brief Return the length of the valid UTF-8 sequence at s, or 0 if invalid.
+
+   Overlong encodings, surrogates and code points past U+10FFFF are invalid.
+   @param s The bytes, starting with a lead byte of 0x80 or above.
+   @param n The number of bytes available.
+ */
+static size_t validate_utf8(const unsigned char *s, size_t n)
+{
+  if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+    return n >= 2 && (s[1] & 0xC0) == 0x80 ? 2 : 0;
+  }
+  if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+    if (n < 3 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80 ||
+        (s[0] == 0xE0 && s[1] < 0xA0) ||  // overlong
+        (s[0] == 0xED && s[1] >= 0xA0)) { // surrogate
+      return 0;
+    }
+    return 3;
+  }
+  if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+    if (n < 4 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80 ||
+        (s[3] & 0xC0) != 0x80 ||
+        (s[0] == 0xF0 && s[1] < 0x90) ||  // overlong
+        (s[0] == 0xF4 && s[1] >= 0x90)) { // past U+10FFFF
+      return 0;
+    }
+    return 4;
+  }
+  return 0;
+}
+
+#define ONES  UINT64_C(0x0101010101010101)
+#define HIGHS UINT64_C(0x8080808080808080)
+
+/**
+   @brief Return nonzero if any of eight string bytes needs a closer look: a
+   quote, backslash, control character, or non-ASCII byte.
+ */
+static uint64_t validate_special8(uint64_t w)
+{
+  uint64_t quote = w ^ (ONES * '"');
+  uint64_t slash = w ^ (ONES * '\\');
+  uint64_t ctrl = (w - ONES * 0x20) & ~w;
+  quote = (quote - ONES) & ~quote;
+  slash = (slash - ONES) & ~slash;
+  return (quote | slash | ctrl | w) & HIGHS;
+}
+
+/**
+   @brief Read the four hex digits of a \\u escape.
+   @returns The code unit, or -1 if the digits are invalid.
+ */
+static long validate_hex4(struct validator *v)
+{
+  long value = 0;
+  size_t i;
+  unsigned char c;
+  for (i = 0; i < 4; i++) {
+    c = validate_peek(v);
+    if (c >= '0' && c <= '9') {
+      value = value * 16 + (c - '0');
+    } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+      value = value * 16 + ((c | 0x20) - 'a' + 10);
+    } else {
+      validate_fail(v, c == 0 && v->idx >= v->len ? JSONERR_PREMATURE_EOF :
+                    JSONERR_UNEXPECTED_TOKEN);
+      return -1;
+    }
+    v->idx++;
+  }
+  return value;
+}
+
+/**
+   @brief Check an escape sequence, starting after the backslash.
+ */
+static bool validate_escape(struct validator *v)
+{
+  long unit;
+  switch (validate_peek(v)) {
+  case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r':
+  case 't':
+    v->idx++;
+    return true;
+  case 'u':
+    v->idx++;
+    if ((unit = validate_hex4(v)) < 0) {
+      return false;
+    }
+    if (unit >= 0xDC00 && unit <= 0xDFFF) {
+      return validate_fail(v, JSONERR_INVALID_SURROGATE);
+    }
+    if (unit >= 0xD800 && unit <= 0xDBFF) {
+      // A high surrogate must be followed by a low one.
+      if (v->len - v->idx < 2 || v->text[v->idx] != '\\' ||
+          v->text[v->idx + 1] != 'u') {
+        return validate_fail(v, JSONERR_INVALID_SURROGATE);
+      }
+      v->idx += 2;
+      if ((unit = validate_hex4(v)) < 0) {
+        return false;
+      }
+      if (unit < 0xDC00 || unit > 0xDFFF) {
+        return validate_fail(v, JSONERR_INVALID_SURROGATE);
+      }
+    }
+    return true;
+  case 0:
+    if (v->idx >= v->len) {
+      return validate_fail(v, JSONERR_PREMATURE_EOF);
+    }
+    return validate_fail(v, JSONERR_UNEXPECTED_TOKEN);
+  default:
+    return validate_fail(v, JSONERR_UNEXPECTED_TOKEN);
+  }
+}
+
+/**
+   @brief Check a string, starting at its opening quote.
+ */
+static bool validate_string(struct validator *v)
+{
+  const unsigned char *s = v->text;
+  size_t n;
+  uint64_t w;
+  unsigned char c;
+
+  v->idx++; // opening quote
+  for (;;) {
+    // Skip plain ASCII eight bytes at a time.
+    while (v->len - v->idx >= 8) {
+      memcpy(&w, s + v->idx, 8);
+      if (validate_special8(w)) {
+        break;
+      }
+      v->idx += 8;
+    }
+    if (v->idx >= v->len) {
+      return validate_fail(v, JSONERR_PREMATURE_EOF);
+    }
+    c = s[v->idx];
+    if (c == '"') {
+      v->idx++;
+      v->values++;
+      return true;
+    } else if (c == '\\') {
+      v->idx++;
+      if (!validate_escape(v)) {
+        return false;
+      }
+    } else if (c < 0x20) {
+      return validate_fail(v, JSONERR_UNEXPECTED_TOKEN);
+    } else if (c < 0x80) {
+      v->idx++;
+    } else if ((n = validate_utf8(s + v->idx, v->len - v->idx)) != 0) {
+      v->idx += n;
+    } else {
+      return validate_fail(v, JSONERR_INVALID_UTF8);
+    }
+  }
+}
+
+static bool validate_value(struct validator *v);
+
+/**
+   @brief Check an array or object, starting at its opening bracket.
+ */
+static bool validate_container(struct validator *v, bool object)
+{
+  unsigned char close = object ? '}' : ']';
+
+  if (v->depth >= JSON_VALIDATE_MAXDEPTH) {
+    return validate_fail(v, JSONERR_UNEXPECTED_TOKEN);
+  }
+  v->idx++;
+  v->values++;
+  validate_skip_whitespace(v);
+  if (validate_peek(v) == close) {
+    v->idx++;
+    return true;
+  }
+  v->depth++;
+
+  for (;;) {
+    if (object) {
+      validate_skip_whitespace(v);
+      if (validate_peek(v) != '"') {
+        return validate_fail(v, v->idx >= v->len ? JSONERR_PREMATURE_EOF :
+                             JSONERR_UNEXPECTED_TOKEN);
+      }
+      if (!validate_string(v)) {
+        return false;
+      }
+      validate_skip_whitespace(v);
+      if (validate_peek(v) != ':') {
+        v->errorarg = ':';
+        return validate_fail(v, JSONERR_EXPECTED_TOKEN);
+      }
+      v->idx++;
+    }
+    if (!validate_value(v)) {
+      return false;
+    }
+    validate_skip_whitespace(v);
+    if (validate_peek(v) == ',') {
+      v->idx++;
+    } else if (validate_peek(v) == close) {
+      v->idx++;
+      v->depth--;
+      return true;
+    } else if (v->idx >= v->len) {
+      return validate_fail(v, JSONERR_PREMATURE_EOF);
+    } else {
+      v->errorarg = ',';
+      return validate_fail(v, JSONERR_EXPECTED_TOKEN);
+    }
+  }
+}
+
+/**
+   @brief Check any value, skipping whitespace before it.
+ */
+static bool validate_value(struct validator *v)
+{
+  unsigned char c;
+
+  validate_skip_whitespace(v);
+  c = validate_peek(v);
+  switch (c) {
+  case '{':
+    return validate_container(v, true);
+  case '[':
+    return validate_container(v, false);
+  case '"':
+    return validate_string(v);
+  case 't':
+    return validate_literal(v, "true", 4);
+  case 'f':
+    return validate_literal(v, "false", 5);
+  case 'n':
+    return validate_literal(v, "null", 4);
+  case '-': case '0': case '1': case '2': case '3': case '4': case '5':
+  case '6': case '7': case '8': case '9':
+    return validate_number(v);
+  default:
+    if (v->idx >= v->len) {
+      return validate_fail(v, JSONERR_PREMATURE_EOF);
+    }
+    return validate_fail(v, c >= 0x80 && validate_utf8(v->text + v->idx,
+                                                       v->len - v->idx) == 0 ?
+                         JSONERR_INVALID_UTF8 : JSONERR_UNEXPECTED_TOKEN);
+  }
+}
+
+struct json_parser json_validate(const char *text, size_t len)
+{
+  struct validator v = {
+    .text = (const unsigned char *) text,
+    .len = len,
+    .idx = 0,
+    .values = 0,
+    .depth = 0,
+    .error = JSONERR_NO_ERROR,
+    .errorarg = 0,
+  };
+  struct json_parser p;
+
+  if (validate_value(&v)) {
+    validate_skip_whitespace(&v);
+    if (v.idx < v.len) {
+      validate_fail(&v, JSONERR_UNEXPECTED_TOKEN);
+    }
+  }
+  p.textidx = v.idx;
+  p.tokenidx = v.values;
+  p.error = v.error;
+  p.errorarg = v.errorarg;
+  return p;
+}
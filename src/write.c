@@ -0,0 +1,81 @@
+/***************************************************************************//**
+
+  @file         write.c
+
+  @brief        Serializing parsed JSON back into text.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <wchar.h>
+
+#include "nosj.h"
+#include "json_private.h"
+
+/**
+   @brief Write a value (and its children) to a sink.
+   @param json The original JSON buffer.
+   @param tokens The parsed token buffer.
+   @param index The index of the value to write.
+   @param sink Where to write the output.
+   @param indent Spaces per level of nesting, or zero to minify.
+   @param depth The current level of nesting.
+ */
+static void json_write_rec(const wchar_t *json, const struct json_token *tokens,
+                           size_t index, struct json_sink *sink,
+                           unsigned int indent, size_t depth)
+{
+  const struct json_token *tok = tokens + index;
+  size_t child;
+
+  switch (tok->type) {
+  case JSON_OBJECT:
+  case JSON_ARRAY:
+    json_sink_putc(sink, tok->type == JSON_OBJECT ? '{' : '[');
+    for (child = tok->child; child != 0; child = tokens[child].next) {
+      if (child != tok->child) {
+        json_sink_putc(sink, ',');
+      }
+      if (indent > 0) {
+        json_sink_newline(sink, (depth + 1) * indent);
+      }
+      json_write_rec(json, tokens, child, sink, indent, depth + 1);
+      if (tok->type == JSON_OBJECT) {
+        // child is a key, and the key's child is its value
+        json_sink_write(sink, ": ", indent > 0 ? 2 : 1);
+        json_write_rec(json, tokens, tokens[child].child, sink, indent,
+                       depth + 1);
+      }
+    }
+    if (indent > 0 && tok->child != 0) {
+      json_sink_newline(sink, depth * indent);
+    }
+    json_sink_putc(sink, tok->type == JSON_OBJECT ? '}' : ']');
+    break;
+  case JSON_NUMBER:
+  case JSON_STRING:
+    // Copy the original text verbatim, escapes and all.
+    json_sink_wcs(sink, json + tok->start, tok->end - tok->start + 1);
+    break;
+  case JSON_TRUE:
+    json_sink_write(sink, "true", 4);
+    break;
+  case JSON_FALSE:
+    json_sink_write(sink, "false", 5);
+    break;
+  case JSON_NULL:
+    json_sink_write(sink, "null", 4);
+    break;
+  }
+}
+
+size_t json_write(const wchar_t *json, const struct json_token *tokens,
+                  size_t index, struct json_sink *sink, unsigned int indent)
+{
+  size_t before = sink->total;
+  json_write_rec(json, tokens, index, sink, indent, 0);
+  return sink->total - before;
+}
@@ -0,0 +1,186 @@
+/***************************************************************************//**
+
+  @file         alloc.c
+
+  @brief        Tests for allocators.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <string.h>
+#include <wchar.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+/**
+   @brief Backing memory for arenas and pools, aligned for any type.
+ */
+union test_buffer {
+  double d;
+  void *p;
+  char c[1024];
+};
+
+static int test_arena(void)
+{
+  union test_buffer buffer;
+  struct json_arena arena;
+  struct json_allocator a;
+  char *x, *y, *z;
+  json_arena_init(&arena, &buffer, sizeof(buffer));
+  json_arena_allocator(&arena, &a);
+
+  x = a.alloc(a.ctx, 10);
+  y = a.alloc(a.ctx, 10);
+  TEST_ASSERT(x == buffer.c);
+  TEST_ASSERT(y > x + 9);
+  memcpy(y, "hello", 6);
+
+  // The last allocation grows in place.
+  z = a.realloc(a.ctx, y, 10, 100);
+  TEST_ASSERT(z == y);
+  // Anything else moves, and keeps its contents.
+  memcpy(x, "world", 6);
+  z = a.realloc(a.ctx, x, 10, 20);
+  TEST_ASSERT(z != x);
+  TEST_ASSERT(0 == strcmp(z, "world"));
+
+  TEST_ASSERT(a.alloc(a.ctx, sizeof(buffer)) == NULL);
+  json_arena_reset(&arena);
+  TEST_ASSERT(a.alloc(a.ctx, sizeof(buffer)) == buffer.c);
+  return 0;
+}
+
+static int test_pool(void)
+{
+  union test_buffer buffer;
+  struct json_pool pool;
+  struct json_allocator a;
+  void *blocks[64];
+  size_t n = 0;
+  json_pool_init(&pool, &buffer, sizeof(buffer), 100);
+  json_pool_allocator(&pool, &a);
+
+  TEST_ASSERT(a.alloc(a.ctx, pool.block + 1) == NULL);
+  while ((blocks[n] = a.alloc(a.ctx, 100)) != NULL) {
+    n++;
+  }
+  TEST_ASSERT(n == pool.count);
+  TEST_ASSERT(n >= 9);
+
+  // Freed blocks are reused, in any order.
+  a.free(a.ctx, blocks[3], 100);
+  a.free(a.ctx, blocks[1], 100);
+  TEST_ASSERT(a.alloc(a.ctx, 50) == blocks[1]);
+  TEST_ASSERT(a.alloc(a.ctx, 50) == blocks[3]);
+  TEST_ASSERT(a.alloc(a.ctx, 50) == NULL);
+
+  json_pool_reset(&pool);
+  TEST_ASSERT(a.alloc(a.ctx, 1) == blocks[0]);
+  return 0;
+}
+
+static int test_parse_alloc(void)
+{
+  wchar_t input[] = L"{\"a\": [1, 2, 3]}";
+  union test_buffer buffer;
+  struct json_arena arena;
+  struct json_allocator a;
+  struct json_token *tokens;
+  struct json_parser p;
+  json_arena_init(&arena, &buffer, sizeof(buffer));
+  json_arena_allocator(&arena, &a);
+
+  p = json_parse_alloc(input, &tokens, &a);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == 6);
+  TEST_ASSERT((char *) tokens == buffer.c);
+  TEST_ASSERT(tokens[2].type == JSON_ARRAY);
+
+  // The default allocator is malloc().
+  p = json_parse_alloc(input, &tokens, NULL);
+  TEST_ASSERT(tokens != NULL);
+  TEST_ASSERT(p.tokenidx == 6);
+  json_malloc_allocator.free(NULL, tokens, p.tokenidx * sizeof(*tokens));
+
+  // Not enough memory.
+  json_arena_init(&arena, &buffer, sizeof(struct json_token));
+  p = json_parse_alloc(input, &tokens, &a);
+  TEST_ASSERT(tokens == NULL);
+  return 0;
+}
+
+static int test_dom_alloc(void)
+{
+  wchar_t input[] = L"[\"x\", {\"y\": null}]";
+  union test_buffer buffer;
+  struct json_arena arena;
+  struct json_allocator a;
+  struct json_token tokens[5];
+  struct json_value *root;
+  size_t size;
+  json_arena_init(&arena, &buffer, sizeof(buffer));
+  json_arena_allocator(&arena, &a);
+  json_parse(input, tokens, 5);
+
+  root = json_dom_alloc(input, tokens, 0, &a, &size);
+  TEST_ASSERT(root != NULL);
+  TEST_ASSERT(arena.used == size);
+  TEST_ASSERT(root->length == 2);
+  TEST_ASSERT(0 == wcscmp(root->u.array[1].u.object[0].key, L"y"));
+  a.free(a.ctx, root, size);
+  TEST_ASSERT(arena.used == 0);
+  return 0;
+}
+
+static int test_estimate(void)
+{
+  wchar_t exact[] = L"[\"a long string with \\\" and , and : in it\", 1, "
+    L"{\"k\": null}, [1, 2, 3, 4, 5, 6, 7, 8, 9, 10]]";
+  wchar_t empty[] = L"[[], {}]";
+  wchar_t invalid[] = L"{\"a\": [1, 2";
+  wchar_t unterminated[] = L"[\"abc\\";
+  struct json_parser p;
+
+  // Without empty containers, the estimate is exact.
+  p = json_parse(exact, NULL, 0);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(json_estimate_tokens(exact, wcslen(exact)) == p.tokenidx);
+
+  // Each empty container adds one.
+  p = json_parse(empty, NULL, 0);
+  TEST_ASSERT(json_estimate_tokens(empty, wcslen(empty)) == p.tokenidx + 2);
+
+  // It's still an upper bound when the JSON is invalid.
+  p = json_parse(invalid, NULL, 0);
+  TEST_ASSERT(p.error != JSONERR_NO_ERROR);
+  TEST_ASSERT(json_estimate_tokens(invalid, wcslen(invalid)) >= p.tokenidx);
+  TEST_ASSERT(json_estimate_tokens(unterminated, wcslen(unterminated)) == 2);
+  return 0;
+}
+
+void test_alloc(void)
+{
+  smb_ut_group *group = su_create_test_group("test/alloc.c");
+
+  smb_ut_test *arena = su_create_test("arena", test_arena);
+  su_add_test(group, arena);
+
+  smb_ut_test *pool = su_create_test("pool", test_pool);
+  su_add_test(group, pool);
+
+  smb_ut_test *parse_alloc = su_create_test("parse_alloc", test_parse_alloc);
+  su_add_test(group, parse_alloc);
+
+  smb_ut_test *dom_alloc = su_create_test("dom_alloc", test_dom_alloc);
+  su_add_test(group, dom_alloc);
+
+  smb_ut_test *estimate = su_create_test("estimate", test_estimate);
+  su_add_test(group, estimate);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
@@ -0,0 +1,233 @@
+/***************************************************************************//**
+
+  @file         builder.c
+
+  @brief        Tests for the JSON builder.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <string.h>
+#include <stdint.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+static int test_nested(void)
+{
+  char expected[] = "{\"id\":-42,\"ok\":true,\"tags\":[\"a\",null,{}],"
+    "\"pi\":3.14,\"e\":[]}";
+  char buffer[128];
+  struct json_sink sink;
+  struct json_builder b;
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  json_builder_init(&b, &sink, 0);
+  TEST_ASSERT(json_builder_begin_object(&b));
+  TEST_ASSERT(json_builder_key(&b, "id"));
+  TEST_ASSERT(json_builder_int64(&b, -42));
+  TEST_ASSERT(json_builder_key(&b, "ok"));
+  TEST_ASSERT(json_builder_bool(&b, true));
+  TEST_ASSERT(json_builder_key(&b, "tags"));
+  TEST_ASSERT(json_builder_begin_array(&b));
+  TEST_ASSERT(json_builder_string(&b, "a"));
+  TEST_ASSERT(json_builder_null(&b));
+  TEST_ASSERT(json_builder_begin_object(&b));
+  TEST_ASSERT(json_builder_end(&b));
+  TEST_ASSERT(json_builder_end(&b));
+  TEST_ASSERT(json_builder_key(&b, "pi"));
+  TEST_ASSERT(json_builder_double(&b, 3.14));
+  TEST_ASSERT(json_builder_key(&b, "e"));
+  TEST_ASSERT(json_builder_begin_array(&b));
+  TEST_ASSERT(json_builder_end(&b));
+  TEST_ASSERT(json_builder_end(&b));
+  TEST_ASSERT(json_builder_finish(&b));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_pretty(void)
+{
+  char expected[] =
+    "{\n"
+    "  \"a\": [\n"
+    "    1,\n"
+    "    2\n"
+    "  ],\n"
+    "  \"b\": {}\n"
+    "}";
+  char buffer[128];
+  struct json_sink sink;
+  struct json_builder b;
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  json_builder_init(&b, &sink, 2);
+  json_builder_begin_object(&b);
+  json_builder_key(&b, "a");
+  json_builder_begin_array(&b);
+  json_builder_int64(&b, 1);
+  json_builder_int64(&b, 2);
+  json_builder_end(&b);
+  json_builder_key(&b, "b");
+  json_builder_begin_object(&b);
+  json_builder_end(&b);
+  json_builder_end(&b);
+  TEST_ASSERT(json_builder_finish(&b));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_escapes(void)
+{
+  char input[] = "plain text that is long enough \"quoted\" back\\slash "
+    "tab\there\nnewline \x01 caf\xc3\xa9";
+  char expected[] = "\"plain text that is long enough \\\"quoted\\\" "
+    "back\\\\slash tab\\there\\nnewline \\u0001 caf\xc3\xa9\"";
+  char buffer[128];
+  struct json_sink sink;
+  struct json_builder b;
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  json_builder_init(&b, &sink, 0);
+  TEST_ASSERT(json_builder_string(&b, input));
+  TEST_ASSERT(json_builder_finish(&b));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_int64_limits(void)
+{
+  char expected[] = "[-9223372036854775808,9223372036854775807,0]";
+  char buffer[64];
+  struct json_sink sink;
+  struct json_builder b;
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  json_builder_init(&b, &sink, 0);
+  json_builder_begin_array(&b);
+  json_builder_int64(&b, INT64_MIN);
+  json_builder_int64(&b, INT64_MAX);
+  json_builder_int64(&b, 0);
+  json_builder_end(&b);
+  TEST_ASSERT(json_builder_finish(&b));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_doubles(void)
+{
+  char expected[] = "[0.1,1e21,1.5e-7,-0,100,null]";
+  char buffer[64];
+  struct json_sink sink;
+  struct json_builder b;
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  json_builder_init(&b, &sink, 0);
+  json_builder_begin_array(&b);
+  json_builder_double(&b, 0.1);
+  json_builder_double(&b, 1e21);
+  json_builder_double(&b, 1.5e-7);
+  json_builder_double(&b, -0.0);
+  json_builder_double(&b, 100.0);
+  json_builder_double(&b, 1e308 * 10);
+  json_builder_end(&b);
+  TEST_ASSERT(json_builder_finish(&b));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_misuse(void)
+{
+  struct json_sink sink;
+  struct json_builder b;
+  json_sink_buffer(&sink, NULL, 0);
+
+  // value without a key
+  json_builder_init(&b, &sink, 0);
+  json_builder_begin_object(&b);
+  TEST_ASSERT(!json_builder_int64(&b, 1));
+  TEST_ASSERT(!json_builder_finish(&b));
+
+  // key in an array
+  json_builder_init(&b, &sink, 0);
+  json_builder_begin_array(&b);
+  TEST_ASSERT(!json_builder_key(&b, "a"));
+
+  // end with a dangling key
+  json_builder_init(&b, &sink, 0);
+  json_builder_begin_object(&b);
+  json_builder_key(&b, "a");
+  TEST_ASSERT(!json_builder_end(&b));
+
+  // two top-level values
+  json_builder_init(&b, &sink, 0);
+  json_builder_null(&b);
+  TEST_ASSERT(!json_builder_null(&b));
+
+  // unclosed array
+  json_builder_init(&b, &sink, 0);
+  json_builder_begin_array(&b);
+  TEST_ASSERT(!json_builder_finish(&b));
+  return 0;
+}
+
+static int test_roundtrip(void)
+{
+  char buffer[64];
+  wchar_t wide[64];
+  struct json_sink sink;
+  struct json_builder b;
+  struct json_token tokens[5];
+  struct json_parser p;
+  size_t i;
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  json_builder_init(&b, &sink, 4);
+  json_builder_begin_object(&b);
+  json_builder_key(&b, "x");
+  json_builder_begin_array(&b);
+  json_builder_double(&b, 0.3);
+  json_builder_string(&b, "y\"z");
+  json_builder_end(&b);
+  json_builder_end(&b);
+  TEST_ASSERT(json_sink_finish(&sink));
+  for (i = 0; i <= sink.len; i++) {
+    wide[i] = (wchar_t) buffer[i];
+  }
+  p = json_parse(wide, tokens, 5);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == 5);
+  TEST_ASSERT(json_number_get(wide, tokens, 3) == 0.3);
+  TEST_ASSERT(json_string_match(wide, tokens, 4, L"y\"z"));
+  return 0;
+}
+
+void test_builder(void)
+{
+  smb_ut_group *group = su_create_test_group("test/builder.c");
+
+  smb_ut_test *nested = su_create_test("nested", test_nested);
+  su_add_test(group, nested);
+
+  smb_ut_test *pretty = su_create_test("pretty", test_pretty);
+  su_add_test(group, pretty);
+
+  smb_ut_test *escapes = su_create_test("escapes", test_escapes);
+  su_add_test(group, escapes);
+
+  smb_ut_test *int64_limits = su_create_test("int64_limits", test_int64_limits);
+  su_add_test(group, int64_limits);
+
+  smb_ut_test *doubles = su_create_test("doubles", test_doubles);
+  su_add_test(group, doubles);
+
+  smb_ut_test *misuse = su_create_test("misuse", test_misuse);
+  su_add_test(group, misuse);
+
+  smb_ut_test *roundtrip = su_create_test("roundtrip", test_roundtrip);
+  su_add_test(group, roundtrip);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
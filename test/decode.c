@@ -0,0 +1,156 @@
+/***************************************************************************//**
+
+  @file         decode.c
+
+  @brief        Tests for decoding objects into structs.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+struct user {
+  int id;
+  double score;
+  bool admin;
+  wchar_t name[8];
+  char email[16];
+  size_t tags;
+};
+
+static const struct json_field user_fields[] = {
+  JSON_FIELD(L"id", struct user, id, JSON_FIELD_INT, JSON_FIELD_REQUIRED),
+  JSON_FIELD(L"score", struct user, score, JSON_FIELD_DOUBLE, 0),
+  JSON_FIELD(L"admin", struct user, admin, JSON_FIELD_BOOL, 0),
+  JSON_FIELD(L"name", struct user, name, JSON_FIELD_STRING, 0),
+  JSON_FIELD(L"email", struct user, email, JSON_FIELD_UTF8, 0),
+  JSON_FIELD(L"tags", struct user, tags, JSON_FIELD_INDEX, 0),
+};
+
+#define NFIELDS (sizeof(user_fields) / sizeof(user_fields[0]))
+
+/**
+   @brief Parse input and decode the root object into u.
+ */
+static bool decode(wchar_t *input, struct user *u, size_t *failed)
+{
+  struct json_token tokens[32];
+  struct json_schema schema;
+  struct json_parser p = json_parse(input, tokens, 32);
+  if (p.error != JSONERR_NO_ERROR || !json_schema_init(&schema, user_fields,
+                                                       NFIELDS)) {
+    return false;
+  }
+  memset(u, 0, sizeof(*u));
+  return json_decode(input, tokens, 0, &schema, u, failed);
+}
+
+static int test_all_fields(void)
+{
+  wchar_t input[] = L"{\"name\": \"ann\", \"id\": 7, \"unknown\": [1, 2], "
+    L"\"score\": 9.5, \"admin\": true, \"email\": \"a@\x00e9.x\", "
+    L"\"tags\": [\"x\"]}";
+  struct user u;
+  size_t failed;
+  TEST_ASSERT(decode(input, &u, &failed));
+  TEST_ASSERT(u.id == 7);
+  TEST_ASSERT(u.score == 9.5);
+  TEST_ASSERT(u.admin);
+  TEST_ASSERT(0 == wcscmp(u.name, L"ann"));
+  TEST_ASSERT(0 == strcmp(u.email, "a@\xc3\xa9.x"));
+  TEST_ASSERT(u.tags == 16);
+  return 0;
+}
+
+static int test_escaped_key(void)
+{
+  wchar_t input[] = L"{\"\\u0069d\": 3, \"na\\u006de\": \"b\"}";
+  struct user u;
+  TEST_ASSERT(decode(input, &u, NULL));
+  TEST_ASSERT(u.id == 3);
+  TEST_ASSERT(0 == wcscmp(u.name, L"b"));
+  return 0;
+}
+
+static int test_missing_required(void)
+{
+  wchar_t input[] = L"{\"score\": 1, \"admin\": null}";
+  struct user u;
+  size_t failed;
+  TEST_ASSERT(!decode(input, &u, &failed));
+  TEST_ASSERT(failed == 0);
+  TEST_ASSERT(u.score == 1.0);
+  return 0;
+}
+
+static int test_wrong_type(void)
+{
+  wchar_t input[] = L"{\"id\": 1, \"admin\": \"yes\"}";
+  wchar_t fraction[] = L"{\"id\": 1.5}";
+  wchar_t huge[] = L"{\"id\": 1e30}";
+  wchar_t negative[] = L"{\"id\": -2147483649}";
+  struct user u;
+  size_t failed;
+  TEST_ASSERT(!decode(input, &u, &failed));
+  TEST_ASSERT(failed == 2);
+  TEST_ASSERT(!decode(fraction, &u, &failed));
+  TEST_ASSERT(failed == 0);
+  TEST_ASSERT(!decode(huge, &u, &failed));
+  TEST_ASSERT(failed == 0);
+  TEST_ASSERT(!decode(negative, &u, &failed));
+  TEST_ASSERT(failed == 0);
+  return 0;
+}
+
+static int test_too_long(void)
+{
+  wchar_t input[] = L"{\"id\": 1, \"name\": \"much too long\"}";
+  struct user u;
+  size_t failed;
+  TEST_ASSERT(!decode(input, &u, &failed));
+  TEST_ASSERT(failed == 3);
+  return 0;
+}
+
+static int test_not_object(void)
+{
+  wchar_t input[] = L"[1]";
+  struct user u;
+  size_t failed;
+  TEST_ASSERT(!decode(input, &u, &failed));
+  TEST_ASSERT(failed == NFIELDS);
+  return 0;
+}
+
+void test_decode(void)
+{
+  smb_ut_group *group = su_create_test_group("test/decode.c");
+
+  smb_ut_test *all_fields = su_create_test("all_fields", test_all_fields);
+  su_add_test(group, all_fields);
+
+  smb_ut_test *escaped_key = su_create_test("escaped_key", test_escaped_key);
+  su_add_test(group, escaped_key);
+
+  smb_ut_test *missing_required = su_create_test("missing_required", test_missing_required);
+  su_add_test(group, missing_required);
+
+  smb_ut_test *wrong_type = su_create_test("wrong_type", test_wrong_type);
+  su_add_test(group, wrong_type);
+
+  smb_ut_test *too_long = su_create_test("too_long", test_too_long);
+  su_add_test(group, too_long);
+
+  smb_ut_test *not_object = su_create_test("not_object", test_not_object);
+  su_add_test(group, not_object);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
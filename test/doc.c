@@ -0,0 +1,176 @@
+/***************************************************************************//**
+
+  @file         doc.c
+
+  @brief        Tests for saving and mapping parsed documents.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+#define DOC_PATH "test_doc.nosjdoc"
+
+static wchar_t text[] = L"{\"name\": \"nosj\", \"list\": [1, 2.5, true]}";
+
+/**
+   @brief Parse the test text and save it to DOC_PATH.
+ */
+static int save(void)
+{
+  struct json_token tokens[8];
+  struct json_parser p = json_parse(text, tokens, 8);
+  if (p.error != JSONERR_NO_ERROR || p.tokenidx != 8) {
+    return -1;
+  }
+  return json_doc_save(DOC_PATH, text, wcslen(text), tokens, 8);
+}
+
+static int test_roundtrip(void)
+{
+  struct json_doc doc;
+  size_t list;
+  TEST_ASSERT(save() == 0);
+  TEST_ASSERT(json_doc_map(DOC_PATH, &doc, JSON_DOC_VERIFY) == 0);
+  TEST_ASSERT(doc.textlen == wcslen(text));
+  TEST_ASSERT(0 == wcscmp(doc.text, text));
+  TEST_ASSERT(doc.ntokens == 8);
+  TEST_ASSERT(doc.tokens[0].type == JSON_OBJECT);
+  TEST_ASSERT(json_string_match(doc.text, doc.tokens, doc.tokens[0].child,
+                                L"name"));
+  list = json_object_get(doc.text, doc.tokens, 0, L"list");
+  TEST_ASSERT(doc.tokens[list].type == JSON_ARRAY);
+  TEST_ASSERT(doc.tokens[list].length == 3);
+  json_doc_unmap(&doc);
+  TEST_ASSERT(doc.text == NULL && doc.tokens == NULL);
+  remove(DOC_PATH);
+  return 0;
+}
+
+static int test_corrupt(void)
+{
+  struct json_doc doc;
+  FILE *f;
+  long size;
+  TEST_ASSERT(save() == 0);
+
+  // Flip a byte in the middle of the token array.
+  f = fopen(DOC_PATH, "r+b");
+  TEST_ASSERT(f != NULL);
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, size - 20, SEEK_SET);
+  fputc(0x7f, f);
+  fclose(f);
+
+  TEST_ASSERT(json_doc_map(DOC_PATH, &doc, JSON_DOC_VERIFY) == -1);
+  TEST_ASSERT(errno == EINVAL);
+  // Without verification, only the header is checked.
+  TEST_ASSERT(json_doc_map(DOC_PATH, &doc, 0) == 0);
+  json_doc_unmap(&doc);
+  remove(DOC_PATH);
+  return 0;
+}
+
+static int test_bad_tokens(void)
+{
+  struct json_doc doc;
+  struct json_token tokens[8];
+  size_t i;
+
+  // Each of these has a good checksum, but a token that points outside the
+  // document, or back at itself.
+  for (i = 0; i < 4; i++) {
+    TEST_ASSERT(json_parse(text, tokens, 8).error == JSONERR_NO_ERROR);
+    switch (i) {
+    case 0:
+      tokens[5].next = 8;
+      break;
+    case 1:
+      tokens[4].child = 4;
+      break;
+    case 2:
+      tokens[7].end = wcslen(text);
+      break;
+    default:
+      tokens[2].type = (enum json_type) 42;
+      break;
+    }
+    TEST_ASSERT(json_doc_save(DOC_PATH, text, wcslen(text), tokens, 8) == 0);
+    TEST_ASSERT(json_doc_map(DOC_PATH, &doc, JSON_DOC_VERIFY) == -1);
+    TEST_ASSERT(errno == EINVAL);
+    // Without verification, the tokens are trusted.
+    TEST_ASSERT(json_doc_map(DOC_PATH, &doc, 0) == 0);
+    json_doc_unmap(&doc);
+  }
+  remove(DOC_PATH);
+  return 0;
+}
+
+static int test_not_a_doc(void)
+{
+  struct json_doc doc;
+  FILE *f = fopen(DOC_PATH, "wb");
+  TEST_ASSERT(f != NULL);
+  fputs("{\"this is\": \"plain JSON, and long enough for a header\"}\n", f);
+  fputs("{\"this is\": \"plain JSON, and long enough for a header\"}\n", f);
+  fclose(f);
+  TEST_ASSERT(json_doc_map(DOC_PATH, &doc, 0) == -1);
+  TEST_ASSERT(errno == EINVAL);
+  remove(DOC_PATH);
+
+  TEST_ASSERT(json_doc_map(DOC_PATH, &doc, 0) == -1);
+  TEST_ASSERT(errno == ENOENT);
+  return 0;
+}
+
+static int test_truncated(void)
+{
+  struct json_doc doc;
+  char buffer[4096];
+  size_t len;
+  FILE *f;
+  TEST_ASSERT(save() == 0);
+  f = fopen(DOC_PATH, "rb");
+  TEST_ASSERT(f != NULL);
+  len = fread(buffer, 1, sizeof(buffer), f);
+  fclose(f);
+  f = fopen(DOC_PATH, "wb");
+  TEST_ASSERT(f != NULL);
+  fwrite(buffer, 1, len - 8, f);
+  fclose(f);
+  TEST_ASSERT(json_doc_map(DOC_PATH, &doc, 0) == -1);
+  TEST_ASSERT(errno == EINVAL);
+  remove(DOC_PATH);
+  return 0;
+}
+
+void test_doc(void)
+{
+  smb_ut_group *group = su_create_test_group("test/doc.c");
+
+  smb_ut_test *roundtrip = su_create_test("roundtrip", test_roundtrip);
+  su_add_test(group, roundtrip);
+
+  smb_ut_test *corrupt = su_create_test("corrupt", test_corrupt);
+  su_add_test(group, corrupt);
+
+  smb_ut_test *bad_tokens = su_create_test("bad_tokens", test_bad_tokens);
+  su_add_test(group, bad_tokens);
+
+  smb_ut_test *not_a_doc = su_create_test("not_a_doc", test_not_a_doc);
+  su_add_test(group, not_a_doc);
+
+  smb_ut_test *truncated = su_create_test("truncated", test_truncated);
+  su_add_test(group, truncated);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
@@ -0,0 +1,129 @@
+/***************************************************************************//**
+
+  @file         dom.c
+
+  @brief        Tests for loading values into memory.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <wchar.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+static int test_nested(void)
+{
+  wchar_t input[] = L"{\"a\": [1, \"x\\u00e9\", true, null], \"b\": {}, "
+    L"\"c\": -2.5}";
+  struct json_token tokens[11];
+  struct json_parser p = json_parse(input, tokens, 11);
+  struct json_value *root, *a;
+  size_t size;
+  void *arena;
+
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == 11);
+  size = json_dom_size(input, tokens, 0);
+  arena = malloc(size);
+  root = json_load_dom(input, tokens, 0, arena, size);
+  TEST_ASSERT(root == arena);
+
+  TEST_ASSERT(root->type == JSON_OBJECT);
+  TEST_ASSERT(root->length == 3);
+  TEST_ASSERT(0 == wcscmp(root->u.object[0].key, L"a"));
+  TEST_ASSERT(root->u.object[0].keylen == 1);
+
+  a = &root->u.object[0].value;
+  TEST_ASSERT(a->type == JSON_ARRAY);
+  TEST_ASSERT(a->length == 4);
+  TEST_ASSERT(a->u.array[0].type == JSON_NUMBER);
+  TEST_ASSERT(a->u.array[0].u.number == 1.0);
+  TEST_ASSERT(a->u.array[1].type == JSON_STRING);
+  TEST_ASSERT(a->u.array[1].length == 2);
+  TEST_ASSERT(0 == wcscmp(a->u.array[1].u.string, L"x\x00e9"));
+  TEST_ASSERT(a->u.array[2].type == JSON_TRUE);
+  TEST_ASSERT(a->u.array[3].type == JSON_NULL);
+
+  TEST_ASSERT(0 == wcscmp(root->u.object[1].key, L"b"));
+  TEST_ASSERT(root->u.object[1].value.type == JSON_OBJECT);
+  TEST_ASSERT(root->u.object[1].value.length == 0);
+  TEST_ASSERT(0 == wcscmp(root->u.object[2].key, L"c"));
+  TEST_ASSERT(root->u.object[2].value.u.number == -2.5);
+
+  free(arena); // frees everything
+  return 0;
+}
+
+static int test_scalar(void)
+{
+  wchar_t input[] = L"\"just a string\"";
+  struct json_token tokens[1];
+  union { double d; char c[256]; } arena;
+  struct json_value *root;
+  json_parse(input, tokens, 1);
+  TEST_ASSERT(json_dom_size(input, tokens, 0) <= sizeof(arena));
+  root = json_load_dom(input, tokens, 0, &arena, sizeof(arena));
+  TEST_ASSERT(root != NULL);
+  TEST_ASSERT(root->type == JSON_STRING);
+  TEST_ASSERT(0 == wcscmp(root->u.string, L"just a string"));
+  return 0;
+}
+
+static int test_too_small(void)
+{
+  wchar_t input[] = L"[[1, 2], [3, 4]]";
+  struct json_token tokens[7];
+  size_t size;
+  void *arena;
+  json_parse(input, tokens, 7);
+  size = json_dom_size(input, tokens, 0);
+  arena = malloc(size);
+  TEST_ASSERT(json_load_dom(input, tokens, 0, arena, size - 1) == NULL);
+  TEST_ASSERT(json_load_dom(input, tokens, 0, arena, size) != NULL);
+  free(arena);
+  return 0;
+}
+
+static int test_subtree(void)
+{
+  wchar_t input[] = L"{\"skip\": [1, 2, 3], \"keep\": [\"k\"]}";
+  struct json_token tokens[9];
+  struct json_value *root;
+  size_t keep, size;
+  void *arena;
+  json_parse(input, tokens, 9);
+  keep = json_object_get(input, tokens, 0, L"keep");
+  size = json_dom_size(input, tokens, keep);
+  TEST_ASSERT(size < json_dom_size(input, tokens, 0));
+  arena = malloc(size);
+  root = json_load_dom(input, tokens, keep, arena, size);
+  TEST_ASSERT(root->type == JSON_ARRAY);
+  TEST_ASSERT(root->length == 1);
+  TEST_ASSERT(0 == wcscmp(root->u.array[0].u.string, L"k"));
+  free(arena);
+  return 0;
+}
+
+void test_dom(void)
+{
+  smb_ut_group *group = su_create_test_group("test/dom.c");
+
+  smb_ut_test *nested = su_create_test("nested", test_nested);
+  su_add_test(group, nested);
+
+  smb_ut_test *scalar = su_create_test("scalar", test_scalar);
+  su_add_test(group, scalar);
+
+  smb_ut_test *too_small = su_create_test("too_small", test_too_small);
+  su_add_test(group, too_small);
+
+  smb_ut_test *subtree = su_create_test("subtree", test_subtree);
+  su_add_test(group, subtree);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
@@ -0,0 +1,160 @@
+/***************************************************************************//**
+
+  @file         events.c
+
+  @brief        Tests for json_parse_events().
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <string.h>
+
+#include "libstephen/ut.h"
+
+#include "nosj.h"
+
+/**
+   @brief Each event is written to a log as one character, and strings and
+   numbers also have their values written after them.
+ */
+struct log {
+  char text[256];
+  size_t len;
+};
+
+static void log_char(struct log *log, char c)
+{
+  if (log->len + 1 < sizeof(log->text)) {
+    log->text[log->len++] = c;
+    log->text[log->len] = '\0';
+  }
+}
+
+static void on_start_object(void *arg, const wchar_t *json,
+                            const struct json_token *tok)
+{
+  (void) json;
+  (void) tok;
+  log_char(arg, '{');
+}
+
+static void on_end_object(void *arg, const wchar_t *json,
+                          const struct json_token *tok)
+{
+  (void) json;
+  log_char(arg, (char) ('0' + tok->length));
+  log_char(arg, '}');
+}
+
+static void on_start_array(void *arg, const wchar_t *json,
+                           const struct json_token *tok)
+{
+  (void) json;
+  (void) tok;
+  log_char(arg, '[');
+}
+
+static void on_end_array(void *arg, const wchar_t *json,
+                         const struct json_token *tok)
+{
+  (void) json;
+  log_char(arg, (char) ('0' + tok->length));
+  log_char(arg, ']');
+}
+
+static void on_string(void *arg, const wchar_t *json,
+                      const struct json_token *tok)
+{
+  wchar_t buffer[16];
+  size_t i;
+  json_string_load(json, tok, 0, buffer);
+  for (i = 0; i < tok->length; i++) {
+    log_char(arg, (char) buffer[i]);
+  }
+}
+
+static void on_key(void *arg, const wchar_t *json,
+                   const struct json_token *tok)
+{
+  on_string(arg, json, tok);
+  log_char(arg, ':');
+}
+
+static void on_number(void *arg, const wchar_t *json,
+                      const struct json_token *tok)
+{
+  log_char(arg, (char) ('0' + (int) json_number_get(json, tok, 0)));
+}
+
+static void on_literal(void *arg, const wchar_t *json,
+                       const struct json_token *tok)
+{
+  (void) json;
+  log_char(arg, tok->type == JSON_TRUE ? 't' :
+           tok->type == JSON_FALSE ? 'f' : 'n');
+}
+
+static const struct json_events all_events = {
+  .start_object = on_start_object,
+  .key = on_key,
+  .end_object = on_end_object,
+  .start_array = on_start_array,
+  .end_array = on_end_array,
+  .string = on_string,
+  .number = on_number,
+  .boolean = on_literal,
+  .null = on_literal,
+};
+
+static int test_order(void)
+{
+  wchar_t input[] = L"{\"ab\": [1, \"x\\ny\", true, {}], \"c\": [false, null]}";
+  struct log log = {.len = 0};
+  struct json_parser p = json_parse_events(input, &all_events, &log);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == 11);
+  TEST_ASSERT(strcmp(log.text, "{ab:[1x\nyt{0}4]c:[fn2]2}") == 0);
+  return 0;
+}
+
+static int test_some_callbacks(void)
+{
+  wchar_t input[] = L"[\"a\", [\"b\"], {\"c\": \"d\"}]";
+  struct json_events events = {.string = on_string};
+  struct log log = {.len = 0};
+  struct json_parser p = json_parse_events(input, &events, &log);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(strcmp(log.text, "abd") == 0);
+  return 0;
+}
+
+static int test_error(void)
+{
+  wchar_t input[] = L"[[1, 2], [3, \"x]]";
+  struct log log = {.len = 0};
+  struct json_parser p = json_parse_events(input, &all_events, &log);
+  TEST_ASSERT(p.error == JSONERR_PREMATURE_EOF);
+  // The bad string is not reported, and the open arrays never end.
+  TEST_ASSERT(strcmp(log.text, "[[122][3") == 0);
+  return 0;
+}
+
+void test_events(void)
+{
+  smb_ut_group *group = su_create_test_group("test/events.c");
+
+  smb_ut_test *order = su_create_test("order", test_order);
+  su_add_test(group, order);
+
+  smb_ut_test *some_callbacks = su_create_test("some_callbacks",
+                                               test_some_callbacks);
+  su_add_test(group, some_callbacks);
+
+  smb_ut_test *error = su_create_test("error", test_error);
+  su_add_test(group, error);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
@@ -0,0 +1,157 @@
+/***************************************************************************//**
+
+  @file         format_double.c
+
+  @brief        Tests for formatting doubles.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+static int check(double value, const char *expected)
+{
+  char buffer[JSON_FORMAT_DOUBLE_SIZE];
+  size_t len = json_format_double(value, buffer);
+  return len == strlen(expected) && 0 == strcmp(buffer, expected);
+}
+
+static int test_integers(void)
+{
+  TEST_ASSERT(check(1.0, "1"));
+  TEST_ASSERT(check(-1.0, "-1"));
+  TEST_ASSERT(check(100.0, "100"));
+  TEST_ASSERT(check(1234567890123.0, "1234567890123"));
+  TEST_ASSERT(check(9007199254740991.0, "9007199254740991"));
+  TEST_ASSERT(check(-9007199254740991.0, "-9007199254740991"));
+  TEST_ASSERT(check(1e20, "100000000000000000000"));
+  return 0;
+}
+
+static int test_zero(void)
+{
+  TEST_ASSERT(check(0.0, "0"));
+  TEST_ASSERT(check(-0.0, "-0"));
+  return 0;
+}
+
+static int test_shortest(void)
+{
+  TEST_ASSERT(check(0.1, "0.1"));
+  TEST_ASSERT(check(0.3, "0.3"));
+  TEST_ASSERT(check(1.5, "1.5"));
+  TEST_ASSERT(check(-123.456, "-123.456"));
+  TEST_ASSERT(check(3.14159, "3.14159"));
+  TEST_ASSERT(check(2.0 / 3.0, "0.6666666666666666"));
+  // Plain Grisu2 gives each of these an extra digit.
+  TEST_ASSERT(check(729.3143371560531, "729.314337156053"));
+  TEST_ASSERT(check(712.78514521499994, "712.785145215"));
+  TEST_ASSERT(check(559.45628824999994, "559.45628825"));
+  return 0;
+}
+
+static int test_exponents(void)
+{
+  TEST_ASSERT(check(1e21, "1e21"));
+  TEST_ASSERT(check(1.5e300, "1.5e300"));
+  TEST_ASSERT(check(0.000001, "0.000001"));
+  TEST_ASSERT(check(1e-7, "1e-7"));
+  TEST_ASSERT(check(-2.5e-10, "-2.5e-10"));
+  TEST_ASSERT(check(5e-324, "5e-324"));
+  TEST_ASSERT(check(1.7976931348623157e308, "1.7976931348623157e308"));
+  return 0;
+}
+
+static int test_nonfinite(void)
+{
+  double inf = 1e308 * 10;
+  TEST_ASSERT(check(inf, "null"));
+  TEST_ASSERT(check(-inf, "null"));
+  TEST_ASSERT(check(inf - inf, "null"));
+  return 0;
+}
+
+/**
+   @brief Return the fewest significant digits that read back as value.
+ */
+static int fewest_digits(double value)
+{
+  char buffer[32];
+  int n;
+  for (n = 1; n < 17; n++) {
+    sprintf(buffer, "%.*e", n - 1, value);
+    if (strtod(buffer, NULL) == value) {
+      break;
+    }
+  }
+  return n;
+}
+
+/**
+   @brief Count the significant digits in formatted output.
+ */
+static int significant_digits(const char *buffer)
+{
+  int n = 0, zeros = 0;
+  for (; *buffer != '\0' && *buffer != 'e'; buffer++) {
+    if (*buffer == '0') {
+      zeros += n > 0; // leading zeros don't count, trailing ones are undone
+    } else if (*buffer >= '1' && *buffer <= '9') {
+      n += zeros + 1;
+      zeros = 0;
+    }
+  }
+  return n;
+}
+
+static int test_round_trip(void)
+{
+  char buffer[JSON_FORMAT_DOUBLE_SIZE];
+  double value = 1.0;
+  int i;
+  for (i = 0; i < 2000; i++) {
+    json_format_double(value, buffer);
+    TEST_ASSERT(strtod(buffer, NULL) == value);
+    TEST_ASSERT(significant_digits(buffer) == fewest_digits(value));
+    json_format_double(-value / 7, buffer);
+    TEST_ASSERT(strtod(buffer, NULL) == -value / 7);
+    value *= 1.37;
+    if (value > 1e300) {
+      value = 1e-300;
+    }
+  }
+  return 0;
+}
+
+void test_format_double(void)
+{
+  smb_ut_group *group = su_create_test_group("test/format_double.c");
+
+  smb_ut_test *integers = su_create_test("integers", test_integers);
+  su_add_test(group, integers);
+
+  smb_ut_test *zero = su_create_test("zero", test_zero);
+  su_add_test(group, zero);
+
+  smb_ut_test *shortest = su_create_test("shortest", test_shortest);
+  su_add_test(group, shortest);
+
+  smb_ut_test *exponents = su_create_test("exponents", test_exponents);
+  su_add_test(group, exponents);
+
+  smb_ut_test *nonfinite = su_create_test("nonfinite", test_nonfinite);
+  su_add_test(group, nonfinite);
+
+  smb_ut_test *round_trip = su_create_test("round_trip", test_round_trip);
+  su_add_test(group, round_trip);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
@@ -0,0 +1,190 @@
+/***************************************************************************//**
+
+  @file         gen.c
+
+  @brief        Tests for decoders generated by nosj_gen from account.schema.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stddef.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+#include "account.h"
+
+/**
+   @brief Parse input and decode the root object into a.
+ */
+static bool decode(wchar_t *input, struct account *a)
+{
+  struct json_token tokens[32];
+  struct json_parser p = json_parse(input, tokens, 32);
+  if (p.error != JSONERR_NO_ERROR) {
+    return false;
+  }
+  memset(a, 0, sizeof(*a));
+  return account_decode(input, tokens, 0, a);
+}
+
+static int test_all_fields(void)
+{
+  wchar_t input[] = L"{\"name\": \"ann\", \"id\": 7, \"unknown\": [1, 2], "
+    L"\"score\": 9.5, \"admin\": true, \"email\": \"a@\x00e9.x\", "
+    L"\"tags\": [\"x\"], \"login-count\": -3}";
+  struct account a;
+  TEST_ASSERT(decode(input, &a));
+  TEST_ASSERT(a.id == 7);
+  TEST_ASSERT(a.score == 9.5);
+  TEST_ASSERT(a.admin);
+  TEST_ASSERT(0 == wcscmp(a.name, L"ann"));
+  TEST_ASSERT(0 == strcmp(a.email, "a@\xc3\xa9.x"));
+  TEST_ASSERT(a.tags == 16);
+  TEST_ASSERT(a.login_count == -3);
+  return 0;
+}
+
+static int test_missing_required(void)
+{
+  wchar_t missing[] = L"{\"score\": 1, \"admin\": null}";
+  wchar_t null[] = L"{\"id\": null}";
+  wchar_t unknown[] = L"{\"ids\": 1, \"i\": 2, \"Id\": 3}";
+  struct account a;
+  TEST_ASSERT(!decode(missing, &a));
+  TEST_ASSERT(a.score == 1.0);
+  TEST_ASSERT(!decode(null, &a));
+  TEST_ASSERT(!decode(unknown, &a));
+  return 0;
+}
+
+static int test_wrong_type(void)
+{
+  wchar_t *inputs[] = {
+    L"{\"id\": \"1\"}",
+    L"{\"id\": 1, \"score\": \"9.5\"}",
+    L"{\"id\": 1, \"admin\": \"yes\"}",
+    L"{\"id\": 1, \"admin\": 0}",
+    L"{\"id\": 1, \"name\": 3}",
+    L"{\"id\": 1, \"email\": true}",
+    L"{\"id\": 1, \"login-count\": [1]}",
+  };
+  wchar_t buffer[64];
+  struct account a;
+  size_t i;
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    wcscpy(buffer, inputs[i]);
+    TEST_ASSERT(!decode(buffer, &a));
+  }
+  return 0;
+}
+
+static int test_out_of_range(void)
+{
+  wchar_t *bad[] = {
+    L"{\"id\": 1.5}",
+    L"{\"id\": 1e30}",
+    L"{\"id\": 2147483648}",
+    L"{\"id\": -2147483649}",
+    L"{\"id\": 1, \"login-count\": 1e-3}",
+  };
+  wchar_t max[] = L"{\"id\": 2147483647, \"login-count\": -2147483648}";
+  wchar_t exponent[] = L"{\"id\": 25e1}";
+  wchar_t buffer[64];
+  struct account a;
+  size_t i;
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    wcscpy(buffer, bad[i]);
+    TEST_ASSERT(!decode(buffer, &a));
+  }
+  TEST_ASSERT(decode(max, &a));
+  TEST_ASSERT(a.id == 2147483647);
+  TEST_ASSERT(a.login_count == -2147483647 - 1);
+  TEST_ASSERT(decode(exponent, &a));
+  TEST_ASSERT(a.id == 250);
+  return 0;
+}
+
+static int test_escaped_key(void)
+{
+  // Keys with escapes skip the length switch and go to json_string_match().
+  wchar_t input[] = L"{\"\\u0069d\": 3, \"na\\u006de\": \"b\", "
+    L"\"login\\u002dcount\": 4, \"\\u0069ds\": 5, \"t\\u0061g\": true}";
+  wchar_t only_escaped[] = L"{\"\\u0069\\u0064\\u0073\": 5}";
+  struct account a;
+  TEST_ASSERT(decode(input, &a));
+  TEST_ASSERT(a.id == 3);
+  TEST_ASSERT(0 == wcscmp(a.name, L"b"));
+  TEST_ASSERT(a.login_count == 4);
+  TEST_ASSERT(!decode(only_escaped, &a));
+  return 0;
+}
+
+static int test_too_long(void)
+{
+  wchar_t fits[] = L"{\"id\": 1, \"name\": \"1234567\", \"email\": \"1234567\"}";
+  wchar_t escapes_fit[] = L"{\"id\": 1, \"name\": \"123\\u0034567\", "
+    L"\"email\": \"\\u00e9\\u00e9\\u00e9x\"}";
+  wchar_t *bad[] = {
+    L"{\"id\": 1, \"name\": \"12345678\"}",
+    L"{\"id\": 1, \"name\": \"123\\u00345678\"}",
+    L"{\"id\": 1, \"email\": \"12345678\"}",
+    L"{\"id\": 1, \"email\": \"\\u00e9\\u00e9\\u00e9\\u00e9\"}",
+    L"{\"id\": 1, \"email\": \"1234567\\u00e9\"}",
+  };
+  wchar_t buffer[64];
+  struct account a;
+  size_t i;
+  TEST_ASSERT(decode(fits, &a));
+  TEST_ASSERT(0 == wcscmp(a.name, L"1234567"));
+  TEST_ASSERT(0 == strcmp(a.email, "1234567"));
+  TEST_ASSERT(decode(escapes_fit, &a));
+  TEST_ASSERT(0 == wcscmp(a.name, L"1234567"));
+  TEST_ASSERT(0 == strcmp(a.email, "\xc3\xa9\xc3\xa9\xc3\xa9x"));
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    wcscpy(buffer, bad[i]);
+    TEST_ASSERT(!decode(buffer, &a));
+    TEST_ASSERT(a.name[0] == L'\0' && a.email[0] == '\0');
+  }
+  return 0;
+}
+
+static int test_not_object(void)
+{
+  wchar_t input[] = L"[1, 2]";
+  struct account a;
+  TEST_ASSERT(!decode(input, &a));
+  return 0;
+}
+
+void test_gen(void)
+{
+  smb_ut_group *group = su_create_test_group("test/gen.c");
+
+  smb_ut_test *all_fields = su_create_test("all_fields", test_all_fields);
+  su_add_test(group, all_fields);
+
+  smb_ut_test *missing_required = su_create_test("missing_required", test_missing_required);
+  su_add_test(group, missing_required);
+
+  smb_ut_test *wrong_type = su_create_test("wrong_type", test_wrong_type);
+  su_add_test(group, wrong_type);
+
+  smb_ut_test *out_of_range = su_create_test("out_of_range", test_out_of_range);
+  su_add_test(group, out_of_range);
+
+  smb_ut_test *escaped_key = su_create_test("escaped_key", test_escaped_key);
+  su_add_test(group, escaped_key);
+
+  smb_ut_test *too_long = su_create_test("too_long", test_too_long);
+  su_add_test(group, too_long);
+
+  smb_ut_test *not_object = su_create_test("not_object", test_not_object);
+  su_add_test(group, not_object);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
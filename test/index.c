@@ -0,0 +1,217 @@
+/***************************************************************************//**
+
+  @file         index.c
+
+  @brief        Tests for sidecar indexes of newline-delimited JSON.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+#define DATA_PATH "test_index.ndjson"
+#define INDEX_PATH "test_index.ndjson.idx"
+
+#define NRECORDS 20000
+
+/**
+   @brief Write NRECORDS records, with blank lines and a few odd ones.
+
+   Record i has "id": "r<i>" and "n": i, except that every 1000th record is an
+   array instead of an object.  The file is big enough to be split between
+   several threads.
+ */
+static int write_data(void)
+{
+  FILE *f = fopen(DATA_PATH, "w");
+  unsigned long i;
+  if (f == NULL) {
+    return -1;
+  }
+  for (i = 0; i < NRECORDS; i++) {
+    if (i % 1000 == 999) {
+      fprintf(f, "[%lu, \"r%lu\"]\n", i, i);
+    } else {
+      fprintf(f, "{\"meta\": {\"id\": \"no\"}, \"id\": \"r%lu\", \"n\": %lu}\n",
+              i, i);
+    }
+    if (i % 7 == 0) {
+      fputs("  \n", f);
+    }
+  }
+  return fclose(f);
+}
+
+static int test_record(void)
+{
+  struct json_index ix;
+  struct json_element el;
+  size_t n;
+
+  TEST_ASSERT(write_data() == 0);
+  TEST_ASSERT(json_index_build(DATA_PATH, INDEX_PATH, L"id", 4, NULL) == 0);
+  TEST_ASSERT(json_index_open(&ix, DATA_PATH, INDEX_PATH, NULL) == 0);
+  TEST_ASSERT(ix.nrecords == NRECORDS);
+  TEST_ASSERT(ix.nentries == NRECORDS - NRECORDS / 1000);
+  TEST_ASSERT(wcscmp(ix.key, L"id") == 0);
+
+  // Each record is parsed on its own, as its own line.
+  for (n = 0; n < NRECORDS; n += 997) {
+    TEST_ASSERT(json_index_record(&ix, n, &el) == 0);
+    TEST_ASSERT(el.index == n && el.text[el.textlen - 1] == L'}');
+    TEST_ASSERT(json_number_get(el.text, el.tokens,
+                                json_object_get(el.text, el.tokens, 0, L"n"))
+                == (double) n);
+  }
+  TEST_ASSERT(json_index_record(&ix, NRECORDS - 1, &el) == 0);
+  TEST_ASSERT(el.tokens[0].type == JSON_ARRAY);
+  TEST_ASSERT(json_index_record(&ix, NRECORDS, &el) == -1 && errno == ERANGE);
+  json_index_close(&ix);
+  return 0;
+}
+
+static int test_find(void)
+{
+  struct json_index ix;
+  struct json_element el;
+
+  TEST_ASSERT(write_data() == 0);
+  TEST_ASSERT(json_index_build(DATA_PATH, INDEX_PATH, L"id", 0, NULL) == 0);
+  TEST_ASSERT(json_index_open(&ix, DATA_PATH, INDEX_PATH, NULL) == 0);
+
+  TEST_ASSERT(json_index_find(&ix, L"r12345", &el) == 1);
+  TEST_ASSERT(el.index == 12345);
+  TEST_ASSERT(json_index_find(&ix, L"r0", &el) == 1 && el.index == 0);
+  // Only top-level keys count, and arrays have no keys.
+  TEST_ASSERT(json_index_find(&ix, L"no", &el) == 0);
+  TEST_ASSERT(json_index_find(&ix, L"r999", &el) == 0);
+  TEST_ASSERT(json_index_find(&ix, L"r20000", &el) == 0);
+  json_index_close(&ix);
+
+  // Numbers are found by how they are written.
+  TEST_ASSERT(json_index_build(DATA_PATH, INDEX_PATH, L"n", 3, NULL) == 0);
+  TEST_ASSERT(json_index_open(&ix, DATA_PATH, INDEX_PATH, NULL) == 0);
+  TEST_ASSERT(json_index_find(&ix, L"777", &el) == 1 && el.index == 777);
+  TEST_ASSERT(json_index_find(&ix, L"777.0", &el) == 0);
+  json_index_close(&ix);
+
+  // Without a key, records can only be found by number.
+  TEST_ASSERT(json_index_build(DATA_PATH, INDEX_PATH, NULL, 2, NULL) == 0);
+  TEST_ASSERT(json_index_open(&ix, DATA_PATH, INDEX_PATH, NULL) == 0);
+  TEST_ASSERT(ix.nrecords == NRECORDS && ix.nentries == 0);
+  TEST_ASSERT(json_index_find(&ix, L"r1", &el) == -1 && errno == EINVAL);
+  json_index_close(&ix);
+  return 0;
+}
+
+static int test_threads_agree(void)
+{
+  struct json_index one, many;
+  size_t i;
+
+  TEST_ASSERT(write_data() == 0);
+  TEST_ASSERT(json_index_build(DATA_PATH, INDEX_PATH, L"id", 1, NULL) == 0);
+  TEST_ASSERT(json_index_open(&one, DATA_PATH, INDEX_PATH, NULL) == 0);
+  TEST_ASSERT(json_index_build(DATA_PATH, "test_index.2.idx", L"id", 7,
+                               NULL) == 0);
+  TEST_ASSERT(json_index_open(&many, DATA_PATH, "test_index.2.idx",
+                              NULL) == 0);
+  TEST_ASSERT(one.size == many.size);
+  TEST_ASSERT(memcmp(one.base, many.base, one.size) == 0);
+  for (i = 1; i <= one.nrecords; i++) {
+    TEST_ASSERT(one.offsets[i] > one.offsets[i - 1]);
+  }
+  json_index_close(&one);
+  json_index_close(&many);
+  remove("test_index.2.idx");
+  return 0;
+}
+
+static int test_allocator(void)
+{
+  static char buffer[4 << 20];
+  struct json_arena arena;
+  struct json_allocator a;
+  struct json_index ix;
+  struct json_element el;
+
+  TEST_ASSERT(write_data() == 0);
+  json_arena_init(&arena, buffer, sizeof(buffer));
+  json_arena_allocator(&arena, &a);
+
+  // Arenas aren't thread safe, so build on one thread.
+  TEST_ASSERT(json_index_build(DATA_PATH, INDEX_PATH, L"id", 1, &a) == 0);
+  TEST_ASSERT(arena.used > 0);
+  json_arena_reset(&arena);
+  TEST_ASSERT(json_index_open(&ix, DATA_PATH, INDEX_PATH, &a) == 0);
+  TEST_ASSERT(json_index_find(&ix, L"r4321", &el) == 1 && el.index == 4321);
+  TEST_ASSERT(arena.used > 0);
+  json_index_close(&ix);
+
+  // Running out of memory is an error, not a crash.
+  json_arena_init(&arena, buffer, 64);
+  TEST_ASSERT(json_index_build(DATA_PATH, INDEX_PATH, L"id", 1, &a) == -1);
+  TEST_ASSERT(errno == ENOMEM);
+  json_arena_init(&arena, buffer, 64);
+  TEST_ASSERT(json_index_open(&ix, DATA_PATH, INDEX_PATH, &a) == 0);
+  TEST_ASSERT(json_index_record(&ix, 0, &el) == -1 && errno == ENOMEM);
+  json_index_close(&ix);
+  remove(DATA_PATH);
+  remove(INDEX_PATH);
+  return 0;
+}
+
+static int test_stale(void)
+{
+  struct json_index ix;
+  FILE *f;
+
+  TEST_ASSERT(write_data() == 0);
+  TEST_ASSERT(json_index_build(DATA_PATH, INDEX_PATH, L"id", 0, NULL) == 0);
+  f = fopen(DATA_PATH, "a");
+  TEST_ASSERT(f != NULL);
+  fputs("{\"id\": \"new\"}\n", f);
+  fclose(f);
+  TEST_ASSERT(json_index_open(&ix, DATA_PATH, INDEX_PATH, NULL) == -1);
+  TEST_ASSERT(errno == ESTALE);
+
+  // The data file is not an index.
+  TEST_ASSERT(json_index_open(&ix, DATA_PATH, DATA_PATH, NULL) == -1);
+  TEST_ASSERT(errno == EINVAL);
+  remove(DATA_PATH);
+  remove(INDEX_PATH);
+  return 0;
+}
+
+void test_index(void)
+{
+  smb_ut_group *group = su_create_test_group("test/index.c");
+
+  smb_ut_test *record = su_create_test("record", test_record);
+  su_add_test(group, record);
+
+  smb_ut_test *find = su_create_test("find", test_find);
+  su_add_test(group, find);
+
+  smb_ut_test *threads_agree = su_create_test("threads_agree",
+                                              test_threads_agree);
+  su_add_test(group, threads_agree);
+
+  smb_ut_test *allocator = su_create_test("allocator", test_allocator);
+  su_add_test(group, allocator);
+
+  smb_ut_test *stale = su_create_test("stale", test_stale);
+  su_add_test(group, stale);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
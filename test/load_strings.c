@@ -13,6 +13,7 @@
 
 *******************************************************************************/
 
+#include <string.h>
 #include <wchar.h>
 
 #include "libstephen/ut.h"
@@ -108,6 +109,145 @@ static int test_surrogate_pair(void)
   return 0;
 }
 
+static int test_utf8_ascii(void)
+{
+  wchar_t input[] = L"\"hello, world\"";
+  char string[] = "hello, world";
+  char buffer[13];
+  struct json_token tokens[1];
+  struct json_parser p = json_parse(input, tokens, 1);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(json_string_utf8_size(input, tokens, 0) == 12);
+  json_string_load_utf8(input, tokens, 0, buffer);
+  TEST_ASSERT(0 == strcmp(buffer, string));
+  return 0;
+}
+
+static int test_utf8_escapes(void)
+{
+  wchar_t input[] = L"\"a\\\\b\\\"c\\n\\u00e9\"";
+  char string[] = "a\\b\"c\n\xc3\xa9";
+  char buffer[9];
+  struct json_token tokens[1];
+  struct json_parser p = json_parse(input, tokens, 1);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(tokens[0].length == 7);
+  TEST_ASSERT(json_string_utf8_size(input, tokens, 0) == 8);
+  json_string_load_utf8(input, tokens, 0, buffer);
+  TEST_ASSERT(0 == strcmp(buffer, string));
+  return 0;
+}
+
+static int test_utf8_multibyte(void)
+{
+  wchar_t input[] = L"\"\u00e9\u20ac\u4e2d\u00e9\u20ac\u4e2d\"";
+  char string[] = "\xc3\xa9\xe2\x82\xac\xe4\xb8\xad"
+    "\xc3\xa9\xe2\x82\xac\xe4\xb8\xad";
+  char buffer[17];
+  struct json_token tokens[1];
+  struct json_parser p = json_parse(input, tokens, 1);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(tokens[0].length == 6);
+  TEST_ASSERT(json_string_utf8_size(input, tokens, 0) == 16);
+  json_string_load_utf8(input, tokens, 0, buffer);
+  TEST_ASSERT(0 == strcmp(buffer, string));
+  return 0;
+}
+
+static int test_utf8_literal(void)
+{
+  wchar_t input[] = L"\"caf\x00e9 \x20ac" L"5\"";
+  char string[] = "caf\xc3\xa9 \xe2\x82\xac" "5";
+  char buffer[11];
+  struct json_token tokens[1];
+  struct json_parser p = json_parse(input, tokens, 1);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(tokens[0].length == 7);
+  TEST_ASSERT(json_string_utf8_size(input, tokens, 0) == 10);
+  json_string_load_utf8(input, tokens, 0, buffer);
+  TEST_ASSERT(0 == strcmp(buffer, string));
+  return 0;
+}
+
+static int test_utf8_surrogate_pair(void)
+{
+  wchar_t input[] = L"\"\\uD83D\\uDCA9\"";
+  char string[] = "\xf0\x9f\x92\xa9";
+  char buffer[5];
+  struct json_token tokens[1];
+  struct json_parser p = json_parse(input, tokens, 1);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(tokens[0].length == 1);
+  TEST_ASSERT(json_string_utf8_size(input, tokens, 0) == 4);
+  json_string_load_utf8(input, tokens, 0, buffer);
+  TEST_ASSERT(0 == strcmp(buffer, string));
+  return 0;
+}
+
+static int test_utf8_runs(void)
+{
+  // Runs of each width, long and short, with the edges of each range.
+  wchar_t input[] = L"\"ab\x00e9\x0416\x07ff\x0080\x00e9\x0416\x0430" L"c"
+    L"\x4e2d\x0800\xffff\x4e2d\x4e2d\x0416\x4e2d\x4e2d\x4e2d\x4e2d\x4e2d"
+    L"\x1f4a9\x00e9\x00e9\x00e9\x00e9\x4e2d\x4e2d\x4e2d\"";
+  size_t widths = 2 + 7 * 2 + 1 + 5 * 3 + 2 + 5 * 3 + 4 + 4 * 2 + 3 * 3;
+  char buffer[80];
+  wchar_t decoded[32];
+  struct json_token tokens[1];
+  struct json_parser p = json_parse(input, tokens, 1);
+  size_t n;
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(json_string_utf8_size(input, tokens, 0) == widths);
+  json_string_load_utf8(input, tokens, 0, buffer);
+  TEST_ASSERT(strlen(buffer) == widths);
+  n = json_utf8_decode(buffer, widths, decoded);
+  TEST_ASSERT(n == tokens[0].length);
+  TEST_ASSERT(0 == wmemcmp(decoded, input + 1, n));
+  return 0;
+}
+
+static int test_utf8_lone_surrogate(void)
+{
+  // The parser rejects this, so make the token by hand.
+  wchar_t input[] = L"\"a\\uD83D\"";
+  struct json_token tokens[1] = {{JSON_STRING, 0, 9, 1, 0, 0}};
+  wchar_t wide[3];
+  char buffer[3];
+  TEST_ASSERT(json_parse(input, NULL, 0).error == JSONERR_INVALID_SURROGATE);
+  // Both loaders drop it, rather than encoding half a character.
+  json_string_load(input, tokens, 0, wide);
+  TEST_ASSERT(0 == wcscmp(wide, L"a"));
+  TEST_ASSERT(json_string_utf8_size(input, tokens, 0) == 1);
+  json_string_load_utf8(input, tokens, 0, buffer);
+  TEST_ASSERT(0 == strcmp(buffer, "a"));
+  return 0;
+}
+
+static int test_utf8_decode(void)
+{
+  char input[] = "{\"k\": \"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x92\xa9\"}";
+  wchar_t expected[] = L"{\"k\": \"caf\x00e9 \x20ac \x1f4a9\"}";
+  wchar_t buffer[sizeof(input)];
+  size_t n = json_utf8_decode(input, sizeof(input) - 1, NULL);
+  TEST_ASSERT(n == wcslen(expected));
+  TEST_ASSERT(json_utf8_decode(input, sizeof(input) - 1, buffer) == n);
+  buffer[n] = L'\0';
+  TEST_ASSERT(0 == wcscmp(buffer, expected));
+  return 0;
+}
+
+static int test_utf8_decode_invalid(void)
+{
+  // stray continuation, overlong '/', encoded surrogate, truncated sequence
+  char input[] = "a\x80" "b\xc0\xaf" "c\xed\xa0\x80" "d\xe2\x82";
+  wchar_t expected[] = L"a\xfffd" L"b\xfffd\xfffd" L"c\xfffd" L"d\xfffd";
+  wchar_t buffer[sizeof(input)];
+  size_t n = json_utf8_decode(input, sizeof(input) - 1, buffer);
+  buffer[n] = L'\0';
+  TEST_ASSERT(0 == wcscmp(buffer, expected));
+  return 0;
+}
+
 void test_load_strings(void)
 {
   smb_ut_group *group = su_create_test_group("test/load_strings.c");
@@ -127,6 +267,33 @@ void test_load_strings(void)
   smb_ut_test *surrogate_pair = su_create_test("surrogate_pair", test_surrogate_pair);
   su_add_test(group, surrogate_pair);
 
+  smb_ut_test *utf8_ascii = su_create_test("utf8_ascii", test_utf8_ascii);
+  su_add_test(group, utf8_ascii);
+
+  smb_ut_test *utf8_escapes = su_create_test("utf8_escapes", test_utf8_escapes);
+  su_add_test(group, utf8_escapes);
+
+  smb_ut_test *utf8_multibyte = su_create_test("utf8_multibyte", test_utf8_multibyte);
+  su_add_test(group, utf8_multibyte);
+
+  smb_ut_test *utf8_literal = su_create_test("utf8_literal", test_utf8_literal);
+  su_add_test(group, utf8_literal);
+
+  smb_ut_test *utf8_surrogate_pair = su_create_test("utf8_surrogate_pair", test_utf8_surrogate_pair);
+  su_add_test(group, utf8_surrogate_pair);
+
+  smb_ut_test *utf8_runs = su_create_test("utf8_runs", test_utf8_runs);
+  su_add_test(group, utf8_runs);
+
+  smb_ut_test *utf8_lone_surrogate = su_create_test("utf8_lone_surrogate", test_utf8_lone_surrogate);
+  su_add_test(group, utf8_lone_surrogate);
+
+  smb_ut_test *utf8_decode = su_create_test("utf8_decode", test_utf8_decode);
+  su_add_test(group, utf8_decode);
+
+  smb_ut_test *utf8_decode_invalid = su_create_test("utf8_decode_invalid", test_utf8_decode_invalid);
+  su_add_test(group, utf8_decode_invalid);
+
   su_run_group(group);
   su_delete_group(group);
 }
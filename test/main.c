@@ -27,6 +27,23 @@ int main(int argc, char *argv[])
   test_parse_objects();
   test_compare_strings();
   test_load_strings();
+  test_write();
+  test_builder();
+  test_format_double();
+  test_reformat();
+  test_doc();
+  test_dom();
+  test_alloc();
+  test_decode();
+  test_validate();
+  test_stats();
+  test_trace();
+  test_events();
+  test_reader();
+  test_stream();
+  test_tokenize();
+  test_index();
+  test_gen();
 
   return 0;
 }
@@ -179,6 +179,39 @@ static int test_get_empty(void)
   return 0;
 }
 
+static int test_get_nested(void)
+{
+  wchar_t input[] = L"[[1, 2], 3]";
+  struct json_token tokens[5];
+  json_parse(input, tokens, 5);
+
+  TEST_ASSERT(3 == json_array_get(input, tokens, 1, 1));
+  TEST_ASSERT(0 == json_array_get(input, tokens, 1, 2));
+  TEST_ASSERT(0 == json_array_get(input, tokens, 2, 0)); // not an array
+  return 0;
+}
+
+static int test_short_buffer(void)
+{
+  wchar_t input[] = L"[1, [2, 3]]";
+  struct json_token tokens[2];
+  struct json_parser p = json_parse(input, NULL, 0);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == 5);
+
+  // Tokens past the end of the buffer are counted, but not stored.
+  p = json_parse(input, tokens, 2);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == 5);
+  TEST_ASSERT(tokens[0].type == JSON_ARRAY);
+  TEST_ASSERT(tokens[0].end == 10);
+  TEST_ASSERT(tokens[0].length == 2);
+  TEST_ASSERT(tokens[0].child == 1);
+  TEST_ASSERT(tokens[1].type == JSON_NUMBER);
+  TEST_ASSERT(tokens[1].next == 2);
+  return 0;
+}
+
 void test_parse_arrays(void)
 {
   smb_ut_group *group = su_create_test_group("test/parse_arrays.c");
@@ -210,6 +243,12 @@ void test_parse_arrays(void)
   smb_ut_test *get_empty = su_create_test("get_empty", test_get_empty);
   su_add_test(group, get_empty);
 
+  smb_ut_test *get_nested = su_create_test("get_nested", test_get_nested);
+  su_add_test(group, get_nested);
+
+  smb_ut_test *short_buffer = su_create_test("short_buffer", test_short_buffer);
+  su_add_test(group, short_buffer);
+
   su_run_group(group);
   su_delete_group(group);
 }
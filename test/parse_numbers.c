@@ -248,6 +248,22 @@ static int test_double_digit_exp(void)
   return 0;
 }
 
+static int test_in_array(void)
+{
+  // Numbers that are followed by more text, and one too long to copy out.
+  wchar_t input[] = L"[-2.5e1, 7, 1000000000000000000000000000000000000000000"
+    L"000000000000000000000000000000]";
+  size_t ntok = 4;
+  struct json_token tokens[ntok];
+  struct json_parser p = json_parse(input, tokens, ntok);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == ntok);
+  TEST_ASSERT(json_number_get(input, tokens, 1) == -25.0);
+  TEST_ASSERT(json_number_get(input, tokens, 2) == 7.0);
+  TEST_ASSERT(json_number_get(input, tokens, 3) == 1e72);
+  return 0;
+}
+
 void test_parse_numbers(void)
 {
   smb_ut_group *group = su_create_test_group("test/parse_numbers.c");
@@ -309,6 +325,9 @@ void test_parse_numbers(void)
   smb_ut_test *double_digit_exp = su_create_test("double_digit_exp", test_double_digit_exp);
   su_add_test(group, double_digit_exp);
 
+  smb_ut_test *in_array = su_create_test("in_array", test_in_array);
+  su_add_test(group, in_array);
+
   su_run_group(group);
   su_delete_group(group);
 }
@@ -0,0 +1,145 @@
+/***************************************************************************//**
+
+  @file         reader.c
+
+  @brief        Tests for the pull parser (json_reader).
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include "libstephen/ut.h"
+
+#include "nosj.h"
+
+static int test_events(void)
+{
+  wchar_t input[] = L"{\"a\": [1, \"x\", {}], \"b\": null}";
+  struct json_reader r;
+  json_reader_init(&r, input);
+
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_BEGIN);
+  TEST_ASSERT(r.token.type == JSON_OBJECT && r.depth == 1);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_KEY);
+  TEST_ASSERT(r.token.start == 1 && r.token.end == 3 && r.token.length == 1);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_BEGIN);
+  TEST_ASSERT(r.token.type == JSON_ARRAY && r.token.start == 6);
+  TEST_ASSERT(r.depth == 2);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_VALUE);
+  TEST_ASSERT(r.token.type == JSON_NUMBER);
+  TEST_ASSERT(json_number_get(input, &r.token, 0) == 1.0);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_VALUE);
+  TEST_ASSERT(r.token.type == JSON_STRING && r.token.length == 1);
+  TEST_ASSERT(json_string_match(input, &r.token, 0, L"x"));
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_BEGIN);
+  TEST_ASSERT(r.depth == 3);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_END);
+  TEST_ASSERT(r.token.type == JSON_OBJECT && r.depth == 2);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_END);
+  TEST_ASSERT(r.token.type == JSON_ARRAY && r.token.start == 17);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_KEY);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_VALUE);
+  TEST_ASSERT(r.token.type == JSON_NULL);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_END);
+  TEST_ASSERT(r.depth == 0);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_DONE);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_DONE);
+  TEST_ASSERT(r.parser.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(r.parser.tokenidx == 8);
+  return 0;
+}
+
+static int test_skip(void)
+{
+  wchar_t input[] = L"{\"skip\": {\"x\": \"]}\\\"\", \"y\": [1, [2]]}, "
+    L"\"also\": [[], {}], \"keep\": 3, \"last\": 4}";
+  struct json_reader r;
+  json_reader_init(&r, input);
+
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_BEGIN);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_KEY);
+  TEST_ASSERT(json_reader_skip(&r) == JSON_EVENT_END);
+  TEST_ASSERT(r.token.type == JSON_OBJECT && r.depth == 1);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_KEY);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_BEGIN);
+  TEST_ASSERT(json_reader_skip(&r) == JSON_EVENT_END);
+  TEST_ASSERT(r.token.type == JSON_ARRAY && r.depth == 1);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_KEY);
+  TEST_ASSERT(json_string_match(input, &r.token, 0, L"keep"));
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_VALUE);
+  TEST_ASSERT(json_number_get(input, &r.token, 0) == 3.0);
+  // Nothing to skip after a value.
+  TEST_ASSERT(json_reader_skip(&r) == JSON_EVENT_VALUE);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_KEY);
+  // Skipping a scalar reads it.
+  TEST_ASSERT(json_reader_skip(&r) == JSON_EVENT_VALUE);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_END);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_DONE);
+  return 0;
+}
+
+static int test_skip_eof(void)
+{
+  wchar_t input[] = L"[1, [2, \"]\\\"";
+  struct json_reader r;
+  json_reader_init(&r, input);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_BEGIN);
+  TEST_ASSERT(json_reader_skip(&r) == JSON_EVENT_ERROR);
+  TEST_ASSERT(r.parser.error == JSONERR_PREMATURE_EOF);
+  TEST_ASSERT(json_reader_next(&r) == JSON_EVENT_ERROR);
+  return 0;
+}
+
+/**
+   @brief Reading a whole document should give the same result as parsing it.
+ */
+static int test_same_as_parse(void)
+{
+  static wchar_t *inputs[] = {
+    L"[1 2]", L"[1,]", L"{\"a\" 1}", L"{1:2}", L"[", L"", L"  ", L"[tru]",
+    L"\"abc", L"[1}", L"{\"a\": 1]", L"-", L"{\"a\":1,}", L"[\"\\x\"]",
+    L"[1.5e3, -0, true, false, null, \"\\ud83d\\ude00\"]",
+    L"{\"a\": {\"b\": [[], {}, [{}]]}} trailing", L"3", L"[]", L"{}",
+    L"[1", L"[1 ", L"{\"a\":1", L"[[]",
+  };
+  struct json_reader r;
+  struct json_parser p;
+  size_t i;
+
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    p = json_parse(inputs[i], NULL, 0);
+    json_reader_init(&r, inputs[i]);
+    while (json_reader_next(&r) != JSON_EVENT_DONE &&
+           r.event != JSON_EVENT_ERROR) {
+    }
+    TEST_ASSERT(r.parser.error == p.error);
+    TEST_ASSERT(r.parser.textidx == p.textidx);
+    TEST_ASSERT(r.parser.errorarg == p.errorarg);
+    if (p.error == JSONERR_NO_ERROR) {
+      TEST_ASSERT(r.parser.tokenidx == p.tokenidx);
+    }
+  }
+  return 0;
+}
+
+void test_reader(void)
+{
+  smb_ut_group *group = su_create_test_group("test/reader.c");
+
+  smb_ut_test *events = su_create_test("events", test_events);
+  su_add_test(group, events);
+
+  smb_ut_test *skip = su_create_test("skip", test_skip);
+  su_add_test(group, skip);
+
+  smb_ut_test *skip_eof = su_create_test("skip_eof", test_skip_eof);
+  su_add_test(group, skip_eof);
+
+  smb_ut_test *same_as_parse = su_create_test("same_as_parse",
+                                              test_same_as_parse);
+  su_add_test(group, same_as_parse);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
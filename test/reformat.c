@@ -0,0 +1,216 @@
+/***************************************************************************//**
+
+  @file         reformat.c
+
+  @brief        Tests for streaming minify and pretty-print.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <string.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+/**
+   @brief Reformat input, feeding it in chunks of the given size.
+ */
+static bool reformat(const char *input, size_t chunk, unsigned int indent,
+                     char *buffer, size_t size, struct json_reformatter *r)
+{
+  struct json_sink sink;
+  size_t len = strlen(input), i, n;
+  json_sink_buffer(&sink, buffer, size);
+  json_reformat_init(r, &sink, indent);
+  for (i = 0; i < len; i += n) {
+    n = len - i < chunk ? len - i : chunk;
+    if (!json_reformat_feed(r, input + i, n)) {
+      return false;
+    }
+  }
+  return json_reformat_finish(r) && json_sink_finish(&sink);
+}
+
+static int test_minify(void)
+{
+  char input[] = " {\n \"a b\" : [ 1 , -2.5e3, \"x\\\\\\\" ]\" ],\t\"c\" : { } ,"
+    " \"d\": [ ], \"e\": true }  ";
+  char expected[] = "{\"a b\":[1,-2.5e3,\"x\\\\\\\" ]\"],\"c\":{},\"d\":[],"
+    "\"e\":true}\n";
+  char buffer[128];
+  struct json_reformatter r;
+  TEST_ASSERT(reformat(input, sizeof(input), 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_pretty(void)
+{
+  char input[] = "{\"a\":[1,{}],\"b\":[]}";
+  char expected[] =
+    "{\n"
+    "  \"a\": [\n"
+    "    1,\n"
+    "    {}\n"
+    "  ],\n"
+    "  \"b\": []\n"
+    "}\n";
+  char buffer[128];
+  struct json_reformatter r;
+  TEST_ASSERT(reformat(input, sizeof(input), 2, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_chunked(void)
+{
+  char input[] = "{ \"k\\\"ey\" : [ 12345 , \"caf\xc3\xa9\" , null ] }";
+  char expected[] = "{\"k\\\"ey\":[12345,\"caf\xc3\xa9\",null]}\n";
+  char buffer[64];
+  struct json_reformatter r;
+  size_t chunk;
+  for (chunk = 1; chunk < sizeof(input); chunk++) {
+    TEST_ASSERT(reformat(input, chunk, 0, buffer, sizeof(buffer), &r));
+    TEST_ASSERT(0 == strcmp(buffer, expected));
+  }
+  return 0;
+}
+
+static int test_multiple_values(void)
+{
+  char input[] = "{\"a\": 1}\n{\"b\": 2}\n3 \"four\"";
+  char expected[] = "{\"a\":1}\n{\"b\":2}\n3\n\"four\"\n";
+  char buffer[64];
+  struct json_reformatter r;
+  TEST_ASSERT(reformat(input, 5, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_mismatched(void)
+{
+  char buffer[64];
+  struct json_reformatter r;
+  TEST_ASSERT(!reformat("{\"a\": [1}", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(r.offset == 8);
+  TEST_ASSERT(!reformat("[1]]", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(!reformat("[1: 2]", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_EXPECTED_TOKEN && r.errorarg == L',');
+  return 0;
+}
+
+static int test_invalid(void)
+{
+  static const char *inputs[] = {
+    "[1 2]", "{\"a\" \"b\"}", "[true false]", "hello world", "{1:2}",
+    "[\"a\":1]", "truefalse", "[tru]", "[-]", "[1x]", "[,]", "{\"a\":}",
+    "[\"\\x\"]", "\"a\\u12\"", "\"\\ud83d\"", "\"\\ud83d\\n\"",
+    "\"\\ud83d\\u0041\"",
+  };
+  static const enum json_error errors[] = {
+    JSONERR_EXPECTED_TOKEN, JSONERR_EXPECTED_TOKEN, JSONERR_EXPECTED_TOKEN,
+    JSONERR_UNEXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN, JSONERR_EXPECTED_TOKEN,
+    JSONERR_UNEXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN, JSONERR_INVALID_NUMBER,
+    JSONERR_EXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN,
+    JSONERR_UNEXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN,
+    JSONERR_INVALID_SURROGATE, JSONERR_INVALID_SURROGATE,
+    JSONERR_INVALID_SURROGATE,
+  };
+  static const size_t offsets[] = {
+    3, 5, 6, 0, 1, 4, 4, 4, 2, 2, 1, 5, 3, 6, 7, 8, 12,
+  };
+  char buffer[64];
+  struct json_reformatter r;
+  size_t i, chunk;
+
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    for (chunk = 1; chunk <= 2; chunk++) {
+      TEST_ASSERT(!reformat(inputs[i], chunk, 0, buffer, sizeof(buffer), &r));
+      TEST_ASSERT(r.error == errors[i]);
+      TEST_ASSERT(r.offset == offsets[i]);
+    }
+  }
+  TEST_ASSERT(!reformat("{\"a\" 1}", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_EXPECTED_TOKEN && r.errorarg == L':');
+  // A surrogate pair is fine.
+  TEST_ASSERT(reformat("\"\\ud83d\\uDE00\"", 1, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(0 == strcmp(buffer, "\"\\ud83d\\uDE00\"\n"));
+  return 0;
+}
+
+static int test_trailing_comma(void)
+{
+  char input[] = "[1, [2,], {\"a\": 3,},]";
+  char expected[] =
+    "[\n"
+    " 1,\n"
+    " [\n"
+    "  2\n"
+    " ],\n"
+    " {\n"
+    "  \"a\": 3\n"
+    " }\n"
+    "]\n";
+  char buffer[64];
+  struct json_reformatter r;
+  TEST_ASSERT(reformat(input, sizeof(input), 1, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  TEST_ASSERT(reformat(input, 3, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(0 == strcmp(buffer, "[1,[2],{\"a\":3}]\n"));
+  return 0;
+}
+
+static int test_premature_eof(void)
+{
+  char buffer[64];
+  struct json_reformatter r;
+  TEST_ASSERT(!reformat("{\"a\": [1", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_PREMATURE_EOF);
+  TEST_ASSERT(!reformat("\"abc\\\"", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_PREMATURE_EOF);
+  TEST_ASSERT(!reformat("\"\\u12", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_PREMATURE_EOF);
+  // There must be a value at all.
+  TEST_ASSERT(!reformat("", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_PREMATURE_EOF);
+  TEST_ASSERT(!reformat(" \n ", 64, 0, buffer, sizeof(buffer), &r));
+  TEST_ASSERT(r.error == JSONERR_PREMATURE_EOF);
+  return 0;
+}
+
+void test_reformat(void)
+{
+  smb_ut_group *group = su_create_test_group("test/reformat.c");
+
+  smb_ut_test *minify = su_create_test("minify", test_minify);
+  su_add_test(group, minify);
+
+  smb_ut_test *pretty = su_create_test("pretty", test_pretty);
+  su_add_test(group, pretty);
+
+  smb_ut_test *chunked = su_create_test("chunked", test_chunked);
+  su_add_test(group, chunked);
+
+  smb_ut_test *multiple_values = su_create_test("multiple_values", test_multiple_values);
+  su_add_test(group, multiple_values);
+
+  smb_ut_test *mismatched = su_create_test("mismatched", test_mismatched);
+  su_add_test(group, mismatched);
+
+  smb_ut_test *invalid = su_create_test("invalid", test_invalid);
+  su_add_test(group, invalid);
+
+  smb_ut_test *trailing_comma = su_create_test("trailing_comma",
+                                               test_trailing_comma);
+  su_add_test(group, trailing_comma);
+
+  smb_ut_test *premature_eof = su_create_test("premature_eof", test_premature_eof);
+  su_add_test(group, premature_eof);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
@@ -0,0 +1,77 @@
+/***************************************************************************//**
+
+  @file         stats.c
+
+  @brief        Tests for parse statistics (only built with NOSJ_STATS).
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include "libstephen/ut.h"
+
+#include "nosj.h"
+
+#ifdef NOSJ_STATS
+
+static int test_shape(void)
+{
+  wchar_t input[] = L"{\"a\": [1, 2, {\"b\": \"x\\ny\"}], "
+    L"\"\\ud83d\\ude00\": [], \"c\": true}";
+  struct json_token tokens[12];
+  struct json_stats stats;
+  struct json_parser p = json_parse_stats(input, tokens, 12, &stats);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == 12);
+  TEST_ASSERT(tokens[2].type == JSON_ARRAY);
+  TEST_ASSERT(tokens[2].length == 3);
+
+  TEST_ASSERT(stats.tokens[JSON_OBJECT] == 2);
+  TEST_ASSERT(stats.tokens[JSON_ARRAY] == 2);
+  TEST_ASSERT(stats.tokens[JSON_NUMBER] == 2);
+  TEST_ASSERT(stats.tokens[JSON_STRING] == 5);
+  TEST_ASSERT(stats.tokens[JSON_TRUE] == 1);
+  TEST_ASSERT(stats.tokens[JSON_FALSE] == 0);
+  TEST_ASSERT(stats.max_depth == 3);
+  TEST_ASSERT(stats.whitespace == 8);
+  TEST_ASSERT(stats.escapes == 3);
+  TEST_ASSERT(stats.surrogate_pairs == 1);
+  TEST_ASSERT(stats.longest_string == 3);
+  TEST_ASSERT(stats.largest_object == 3);
+  TEST_ASSERT(stats.largest_array == 3);
+  return 0;
+}
+
+static int test_count_and_error(void)
+{
+  wchar_t input[] = L"[[null, false], [[\"long string\"]]";
+  struct json_stats stats;
+  struct json_parser p = json_parse_stats(input, NULL, 0, &stats);
+  TEST_ASSERT(p.error == JSONERR_EXPECTED_TOKEN);
+  TEST_ASSERT(p.tokenidx == 7);
+  TEST_ASSERT(stats.tokens[JSON_ARRAY] == 4);
+  TEST_ASSERT(stats.tokens[JSON_NULL] == 1);
+  TEST_ASSERT(stats.max_depth == 3);
+  TEST_ASSERT(stats.longest_string == 11);
+  TEST_ASSERT(stats.largest_array == 2);
+  return 0;
+}
+
+#endif // NOSJ_STATS
+
+void test_stats(void)
+{
+  smb_ut_group *group = su_create_test_group("test/stats.c");
+
+#ifdef NOSJ_STATS
+  smb_ut_test *shape = su_create_test("shape", test_shape);
+  su_add_test(group, shape);
+
+  smb_ut_test *count_and_error = su_create_test("count_and_error", test_count_and_error);
+  su_add_test(group, count_and_error);
+#endif
+
+  su_run_group(group);
+  su_delete_group(group);
+}
@@ -0,0 +1,200 @@
+/***************************************************************************//**
+
+  @file         stream.c
+
+  @brief        Tests for streaming the elements of an array.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+static int test_buffer(void)
+{
+  const char input[] = " [ {\"id\": 1, \"s\": \"a,]\\\"}\"}, [1, 2],\"x\", 3 ,"
+    "true ,{\"z\": \"\xc3\xa9\", \"n\": null}]  ";
+  struct json_array_stream s;
+  struct json_element el;
+  size_t value;
+
+  json_array_stream_buffer(&s, input, strlen(input), NULL);
+
+  TEST_ASSERT(json_array_stream_next(&s, &el) == 1);
+  TEST_ASSERT(el.index == 0 && el.offset == 3 && el.bytes == 24);
+  TEST_ASSERT(el.ntokens == 5 && el.tokens[0].type == JSON_OBJECT);
+  value = json_object_get(el.text, el.tokens, 0, L"s");
+  TEST_ASSERT(value != 0 && el.tokens[value].length == 5);
+
+  TEST_ASSERT(json_array_stream_next(&s, &el) == 1);
+  TEST_ASSERT(el.tokens[0].type == JSON_ARRAY && el.tokens[0].length == 2);
+  TEST_ASSERT(json_array_stream_next(&s, &el) == 1);
+  TEST_ASSERT(el.tokens[0].type == JSON_STRING && el.textlen == 3);
+  TEST_ASSERT(json_array_stream_next(&s, &el) == 1);
+  TEST_ASSERT(el.tokens[0].type == JSON_NUMBER && el.textlen == 1);
+  TEST_ASSERT(json_array_stream_next(&s, &el) == 1);
+  TEST_ASSERT(el.tokens[0].type == JSON_TRUE);
+
+  TEST_ASSERT(json_array_stream_next(&s, &el) == 1);
+  TEST_ASSERT(el.index == 5);
+  value = json_object_get(el.text, el.tokens, 0, L"n");
+  TEST_ASSERT(el.tokens[value].type == JSON_NULL);
+  // The e-acute is two bytes, so "null" is one byte further into the file
+  // than it is characters into the element.
+  TEST_ASSERT(input[json_element_offset(&el, el.tokens[value].start)] == 'n');
+  TEST_ASSERT(json_element_offset(&el, el.tokens[value].start) ==
+              el.offset + el.tokens[value].start + 1);
+
+  TEST_ASSERT(json_array_stream_next(&s, &el) == 0);
+  TEST_ASSERT(json_array_stream_next(&s, &el) == 0);
+  json_array_stream_free(&s);
+  return 0;
+}
+
+/**
+   @brief Write a file of n records, seek back to its start, and return it.
+ */
+static FILE *records(size_t n)
+{
+  FILE *f = tmpfile();
+  size_t i;
+  if (f == NULL) {
+    return NULL;
+  }
+  fputc('[', f);
+  for (i = 0; i < n; i++) {
+    fprintf(f, "%s\n  {\"id\": %lu, \"tags\": [\"t%lu\", \"u\"]}",
+            i > 0 ? "," : "", (unsigned long) i, (unsigned long) i);
+  }
+  fputs("\n]\n", f);
+  fflush(f);
+  rewind(f);
+  return f;
+}
+
+static int test_fd(void)
+{
+  FILE *f = records(5000);
+  struct json_array_stream s;
+  struct json_element el;
+  size_t i = 0, id;
+  int r;
+
+  TEST_ASSERT(f != NULL);
+  TEST_ASSERT(json_array_stream_fd(&s, fileno(f), 0, NULL) == 0);
+  while ((r = json_array_stream_next(&s, &el)) == 1) {
+    TEST_ASSERT(el.index == i);
+    TEST_ASSERT(el.ntokens == 7);
+    id = json_object_get(el.text, el.tokens, 0, L"id");
+    TEST_ASSERT(json_number_get(el.text, el.tokens, id) == (double) i);
+    i++;
+  }
+  TEST_ASSERT(r == 0);
+  TEST_ASSERT(i == 5000);
+  // The file is several times the first buffer, which never had to grow.
+  TEST_ASSERT(s.cap == 65536);
+  json_array_stream_free(&s);
+  fclose(f);
+  return 0;
+}
+
+static int test_max_record(void)
+{
+  FILE *f = records(10);
+  struct json_array_stream s;
+  struct json_element el;
+
+  TEST_ASSERT(f != NULL);
+  TEST_ASSERT(json_array_stream_fd(&s, fileno(f), 16, NULL) == 0);
+  TEST_ASSERT(json_array_stream_next(&s, &el) == -1);
+  TEST_ASSERT(errno == EFBIG);
+  json_array_stream_free(&s);
+  fclose(f);
+  return 0;
+}
+
+static int test_allocator(void)
+{
+  const char input[] = "[{\"a\": [1, 2, 3]}, \"xyz\", 4]";
+  static char buffer[4096];
+  struct json_arena arena;
+  struct json_allocator a;
+  struct json_array_stream s;
+  struct json_element el;
+  size_t i = 0;
+
+  json_arena_init(&arena, buffer, sizeof(buffer));
+  json_arena_allocator(&arena, &a);
+  json_array_stream_buffer(&s, input, strlen(input), &a);
+  while (json_array_stream_next(&s, &el) == 1) {
+    i++;
+  }
+  TEST_ASSERT(i == 3 && arena.used > 0);
+  json_array_stream_free(&s);
+
+  // Running out of memory is an error, not a crash.
+  json_arena_init(&arena, buffer, 16);
+  json_array_stream_buffer(&s, input, strlen(input), &a);
+  TEST_ASSERT(json_array_stream_next(&s, &el) == -1 && errno == ENOMEM);
+  json_array_stream_free(&s);
+  TEST_ASSERT(json_array_stream_fd(&s, 0, 0, &a) == -1 && errno == ENOMEM);
+  json_array_stream_free(&s);
+  return 0;
+}
+
+static int test_errors(void)
+{
+  static const char *inputs[] = {"[1 2]", "{}", "[1, tru]", "[1,", "[12ab]"};
+  static const enum json_error errors[] = {
+    JSONERR_EXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN,
+    JSONERR_PREMATURE_EOF, JSONERR_UNEXPECTED_TOKEN,
+  };
+  static const uint64_t offsets[] = {3, 0, 4, 3, 3};
+  struct json_array_stream s;
+  struct json_element el;
+  size_t i;
+
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    json_array_stream_buffer(&s, inputs[i], strlen(inputs[i]), NULL);
+    while (json_array_stream_next(&s, &el) == 1) {
+    }
+    TEST_ASSERT(errno == EINVAL);
+    TEST_ASSERT(s.error == errors[i]);
+    TEST_ASSERT(s.error_offset == offsets[i]);
+    TEST_ASSERT(json_array_stream_next(&s, &el) == -1);
+    json_array_stream_free(&s);
+  }
+  return 0;
+}
+
+void test_stream(void)
+{
+  smb_ut_group *group = su_create_test_group("test/stream.c");
+
+  smb_ut_test *buffer = su_create_test("buffer", test_buffer);
+  su_add_test(group, buffer);
+
+  smb_ut_test *fd = su_create_test("fd", test_fd);
+  su_add_test(group, fd);
+
+  smb_ut_test *max_record = su_create_test("max_record", test_max_record);
+  su_add_test(group, max_record);
+
+  smb_ut_test *allocator = su_create_test("allocator", test_allocator);
+  su_add_test(group, allocator);
+
+  smb_ut_test *errors = su_create_test("errors", test_errors);
+  su_add_test(group, errors);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
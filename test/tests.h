@@ -23,5 +23,22 @@ void test_parse_arrays(void);
 void test_parse_objects(void);
 void test_compare_strings(void);
 void test_load_strings(void);
+void test_write(void);
+void test_builder(void);
+void test_format_double(void);
+void test_reformat(void);
+void test_doc(void);
+void test_dom(void);
+void test_alloc(void);
+void test_decode(void);
+void test_validate(void);
+void test_stats(void);
+void test_trace(void);
+void test_events(void);
+void test_reader(void);
+void test_stream(void);
+void test_tokenize(void);
+void test_index(void);
+void test_gen(void);
 
 #endif // SMB_JSON_TEST_H
@@ -0,0 +1,305 @@
+/***************************************************************************//**
+
+  @file         tokenize.c
+
+  @brief        Tests for the out-of-core tokenizer and token files.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+#define TOKENS_PATH "test_tokenize.nosjtok"
+
+#define MAXTOKENS 64
+
+/**
+   @brief Tokens collected by the test token function.
+ */
+struct collected {
+  struct json_token tokens[MAXTOKENS];
+  int seen[MAXTOKENS];
+};
+
+static int collect(void *arg, size_t index, const struct json_token *tok)
+{
+  struct collected *c = arg;
+  if (index >= MAXTOKENS) {
+    errno = ENOSPC;
+    return -1;
+  }
+  c->tokens[index] = *tok;
+  c->seen[index]++;
+  return 0;
+}
+
+/**
+   @brief Widen ASCII text, so that character and byte offsets are the same.
+ */
+static wchar_t *widen(const char *s)
+{
+  size_t i, n = strlen(s);
+  wchar_t *w = malloc((n + 1) * sizeof(wchar_t));
+  for (i = 0; i <= n; i++) {
+    w[i] = (unsigned char) s[i];
+  }
+  return w;
+}
+
+static bool same_token(const struct json_token *a, const struct json_token *b)
+{
+  return a->type == b->type && a->start == b->start && a->end == b->end &&
+    a->length == b->length && a->child == b->child && a->next == b->next;
+}
+
+static int test_matches_parse(void)
+{
+  static const char *inputs[] = {
+    "{\"a\": [1, {\"b\": null}, [], \"x\"], \"c\": {}, \"d\": -1.5e3}",
+    " [ [[1, 2], [3]], {\"k\": [true, false]}, \"\\u00e9\\n\", 0 ] ",
+    "{\"s\": \"\\ud83d\\ude00!\", \"t\": [1,], \"u\": {\"v\": 2,},}",
+    "\"just a string\"",
+    "42",
+  };
+  struct json_token expected[MAXTOKENS];
+  struct collected c;
+  struct json_tokenizer t;
+  struct json_parser p;
+  wchar_t *text;
+  size_t i, j, len;
+
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    text = widen(inputs[i]);
+    p = json_parse(text, expected, MAXTOKENS);
+    free(text);
+    TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+
+    // Feed one byte at a time, so that every token is split between chunks.
+    memset(&c, 0, sizeof(c));
+    json_tokenizer_init(&t, &collect, &c, NULL);
+    len = strlen(inputs[i]);
+    for (j = 0; j < len; j++) {
+      TEST_ASSERT(json_tokenizer_feed(&t, inputs[i] + j, 1) == 0);
+    }
+    TEST_ASSERT(json_tokenizer_finish(&t) == 0);
+    TEST_ASSERT(t.ntokens == p.tokenidx);
+    for (j = 0; j < p.tokenidx; j++) {
+      TEST_ASSERT(c.seen[j] == 1);
+      TEST_ASSERT(same_token(&c.tokens[j], &expected[j]));
+    }
+    json_tokenizer_free(&t);
+  }
+  return 0;
+}
+
+static int test_errors(void)
+{
+  static const char *inputs[] = {
+    "[1 2]", "[1}", "{\"a\" 1}", "{1: 2}", "[1, tru]", "[1,", "[-]",
+    "\"\\ud800x\"", "\"\\q\"", "", "[1", "[12 ", "{\"a\"", "nu", "[t",
+  };
+  static const enum json_error errors[] = {
+    JSONERR_EXPECTED_TOKEN, JSONERR_EXPECTED_TOKEN, JSONERR_EXPECTED_TOKEN,
+    JSONERR_UNEXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN, JSONERR_PREMATURE_EOF,
+    JSONERR_INVALID_NUMBER, JSONERR_INVALID_SURROGATE, JSONERR_UNEXPECTED_TOKEN,
+    JSONERR_PREMATURE_EOF, JSONERR_EXPECTED_TOKEN, JSONERR_EXPECTED_TOKEN,
+    JSONERR_EXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN, JSONERR_UNEXPECTED_TOKEN,
+  };
+  static const uint64_t offsets[] = {3, 2, 5, 1, 4, 3, 2, 7, 2, 0, 2, 4, 4, 0,
+                                     1};
+  struct json_tokenizer t;
+  struct json_parser p;
+  wchar_t *text;
+  size_t i;
+  int r;
+
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    // The parser finds the same problem.
+    text = widen(inputs[i]);
+    p = json_parse(text, NULL, 0);
+    free(text);
+    TEST_ASSERT(p.error == errors[i]);
+
+    json_tokenizer_init(&t, NULL, NULL, NULL);
+    r = json_tokenizer_feed(&t, inputs[i], strlen(inputs[i]));
+    if (r == 0) {
+      // At the end of the input, it is found in the same place, too.
+      r = json_tokenizer_finish(&t);
+      TEST_ASSERT(t.offset == p.textidx);
+    }
+    TEST_ASSERT(r == -1 && errno == EINVAL);
+    TEST_ASSERT(t.error == errors[i]);
+    TEST_ASSERT(t.offset == offsets[i]);
+    TEST_ASSERT(t.errorarg == p.errorarg);
+    TEST_ASSERT(json_tokenizer_feed(&t, "]", 1) == -1);
+    json_tokenizer_free(&t);
+  }
+  return 0;
+}
+
+static int test_allocator(void)
+{
+  static char buffer[65536];
+  char input[401];
+  struct json_arena arena;
+  struct json_allocator a;
+  struct json_tokenizer t;
+
+  // Deeper than the first block of frames, so that it has to grow.
+  memset(input, '[', 200);
+  memset(input + 200, ']', 200);
+  input[400] = '\0';
+  json_arena_init(&arena, buffer, sizeof(buffer));
+  json_arena_allocator(&arena, &a);
+  json_tokenizer_init(&t, NULL, NULL, &a);
+  TEST_ASSERT(json_tokenizer_feed(&t, input, 400) == 0);
+  TEST_ASSERT(json_tokenizer_finish(&t) == 0);
+  TEST_ASSERT(t.ntokens == 200 && arena.used > 0);
+  json_tokenizer_free(&t);
+
+  // Running out of memory is an error, not a crash.
+  json_arena_init(&arena, buffer, 16);
+  json_tokenizer_init(&t, NULL, NULL, &a);
+  TEST_ASSERT(json_tokenizer_feed(&t, input, 400) == -1 && errno == ENOMEM);
+  json_tokenizer_free(&t);
+  return 0;
+}
+
+/**
+   @brief Write an object holding n records with every kind of token in them,
+   seek back to its start, and return it.
+
+   It is all ASCII, so that byte offsets from the tokenizer are the same as
+   character offsets from the parser.  Escapes (including a surrogate pair)
+   and exponents give the tokenizer's slower states some input.
+ */
+static FILE *document(size_t n)
+{
+  FILE *f = tmpfile();
+  size_t i;
+  if (f == NULL) {
+    return NULL;
+  }
+  fputs("{\"records\": [", f);
+  for (i = 0; i < n; i++) {
+    fprintf(f, "%s\n  {\"id\": %lu, \"name\": \"r\\u00e9\\ud83d\\ude00%lu\\n\", "
+            "\"x\": -%lu.5e-3, \"ok\": %s, \"empty\": [[], {}, null]}",
+            i > 0 ? "," : "", (unsigned long) i, (unsigned long) i,
+            (unsigned long) i, i % 2 ? "true" : "false");
+  }
+  fputs("\n], \"count\": true}\n", f);
+  fflush(f);
+  rewind(f);
+  return f;
+}
+
+static int test_file(void)
+{
+  FILE *f = document(3000);
+  struct json_parser p, q;
+  struct json_token *expected, tok;
+  char *bytes;
+  wchar_t *text;
+  size_t i, n, ntokens;
+  int fd;
+
+  // Parse the whole file in memory, for comparison.
+  TEST_ASSERT(f != NULL);
+  fseek(f, 0, SEEK_END);
+  n = (size_t) ftell(f);
+  rewind(f);
+  bytes = malloc(n + 1);
+  TEST_ASSERT(fread(bytes, 1, n, f) == n);
+  bytes[n] = '\0';
+  rewind(f);
+  text = widen(bytes);
+  free(bytes);
+  p = json_parse(text, NULL, 0);
+  expected = malloc(p.tokenidx * sizeof(struct json_token));
+  p = json_parse(text, expected, p.tokenidx);
+  free(text);
+
+  // A window smaller than one record, and an odd size, so that windows end
+  // everywhere; there are many more tokens than fit in the writer's block.
+  TEST_ASSERT(json_tokenize_file(fileno(f), TOKENS_PATH, 37, &q) == 0);
+  TEST_ASSERT(q.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(q.tokenidx == p.tokenidx && q.textidx == p.textidx);
+  TEST_ASSERT(q.tokenidx > 8192);
+  fclose(f);
+
+  fd = json_tokens_open(TOKENS_PATH, &ntokens);
+  TEST_ASSERT(fd >= 0);
+  TEST_ASSERT(ntokens == p.tokenidx);
+  for (i = 0; i < ntokens; i++) {
+    TEST_ASSERT(json_tokens_get(fd, i, &tok) == 0);
+    TEST_ASSERT(same_token(&tok, &expected[i]));
+  }
+  TEST_ASSERT(json_tokens_get(fd, ntokens, &tok) == -1 && errno == EINVAL);
+  close(fd);
+  free(expected);
+  remove(TOKENS_PATH);
+  return 0;
+}
+
+static int test_file_errors(void)
+{
+  FILE *f = tmpfile();
+  struct json_parser p;
+  size_t ntokens;
+
+  TEST_ASSERT(f != NULL);
+  fputs("[1, 2, [3, 4]", f);
+  fflush(f);
+  rewind(f);
+  TEST_ASSERT(json_tokenize_file(fileno(f), TOKENS_PATH, 0, &p) == -1);
+  TEST_ASSERT(errno == EINVAL && p.error == JSONERR_EXPECTED_TOKEN);
+  TEST_ASSERT(p.textidx == 13 && p.errorarg == L',');
+  // Nothing is left behind.
+  TEST_ASSERT(access(TOKENS_PATH, F_OK) != 0);
+  fclose(f);
+
+  // Something that isn't a token file.
+  f = fopen(TOKENS_PATH, "w");
+  TEST_ASSERT(f != NULL);
+  fputs("[1, 2, 3]", f);
+  fclose(f);
+  TEST_ASSERT(json_tokens_open(TOKENS_PATH, &ntokens) == -1);
+  TEST_ASSERT(errno == EINVAL);
+  remove(TOKENS_PATH);
+  return 0;
+}
+
+void test_tokenize(void)
+{
+  smb_ut_group *group = su_create_test_group("test/tokenize.c");
+
+  smb_ut_test *matches_parse = su_create_test("matches_parse",
+                                              test_matches_parse);
+  su_add_test(group, matches_parse);
+
+  smb_ut_test *errors = su_create_test("errors", test_errors);
+  su_add_test(group, errors);
+
+  smb_ut_test *allocator = su_create_test("allocator", test_allocator);
+  su_add_test(group, allocator);
+
+  smb_ut_test *file = su_create_test("file", test_file);
+  su_add_test(group, file);
+
+  smb_ut_test *file_errors = su_create_test("file_errors", test_file_errors);
+  su_add_test(group, file_errors);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
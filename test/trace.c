@@ -0,0 +1,90 @@
+/***************************************************************************//**
+
+  @file         trace.c
+
+  @brief        Tests for parse tracing (only built with NOSJ_TRACE).
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include "libstephen/ut.h"
+
+#include "nosj.h"
+
+#ifdef NOSJ_TRACE
+
+struct events {
+  struct json_trace_event list[16];
+  size_t n;
+};
+
+static void record(void *arg, const struct json_trace_event *event)
+{
+  struct events *events = arg;
+  if (events->n < 16) {
+    events->list[events->n] = *event;
+  }
+  events->n++;
+}
+
+static int check(const struct json_trace_event *e, enum json_trace_kind kind,
+                 enum json_type type, size_t start, size_t end, size_t depth)
+{
+  return e->kind == kind && e->type == type && e->start == start &&
+    e->end == end && e->depth == depth;
+}
+
+static int test_events(void)
+{
+  wchar_t input[] = L"{\"a\": [1, \"x\"]}";
+  struct json_token tokens[5];
+  struct events events = {.n = 0};
+  struct json_parser p = json_parse_trace(input, tokens, 5, record, &events);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(p.tokenidx == 5);
+  TEST_ASSERT(tokens[2].length == 2);
+  TEST_ASSERT(events.n == 7);
+  TEST_ASSERT(check(&events.list[0], JSON_TRACE_ENTER, JSON_OBJECT, 0, 0, 0));
+  TEST_ASSERT(check(&events.list[1], JSON_TRACE_STRING, JSON_STRING, 1, 3, 1));
+  TEST_ASSERT(check(&events.list[2], JSON_TRACE_ENTER, JSON_ARRAY, 6, 6, 1));
+  TEST_ASSERT(check(&events.list[3], JSON_TRACE_NUMBER, JSON_NUMBER, 7, 7, 2));
+  TEST_ASSERT(check(&events.list[4], JSON_TRACE_STRING, JSON_STRING, 10, 12, 2));
+  TEST_ASSERT(check(&events.list[5], JSON_TRACE_LEAVE, JSON_ARRAY, 6, 13, 1));
+  TEST_ASSERT(check(&events.list[6], JSON_TRACE_LEAVE, JSON_OBJECT, 0, 14, 0));
+  return 0;
+}
+
+static int test_error(void)
+{
+  wchar_t input[] = L"[1, tru]";
+  struct events events = {.n = 0};
+  struct json_parser p = json_parse_trace(input, NULL, 0, record, &events);
+  TEST_ASSERT(p.error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(events.n == 3);
+  TEST_ASSERT(events.list[1].kind == JSON_TRACE_NUMBER);
+  TEST_ASSERT(events.list[2].kind == JSON_TRACE_ERROR);
+  TEST_ASSERT(events.list[2].error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(events.list[2].start == 4);
+  TEST_ASSERT(events.list[2].depth == 1);
+  return 0;
+}
+
+#endif // NOSJ_TRACE
+
+void test_trace(void)
+{
+  smb_ut_group *group = su_create_test_group("test/trace.c");
+
+#ifdef NOSJ_TRACE
+  smb_ut_test *events = su_create_test("events", test_events);
+  su_add_test(group, events);
+
+  smb_ut_test *error = su_create_test("error", test_error);
+  su_add_test(group, error);
+#endif
+
+  su_run_group(group);
+  su_delete_group(group);
+}
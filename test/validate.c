@@ -0,0 +1,153 @@
+/***************************************************************************//**
+
+  @file         validate.c
+
+  @brief        Tests for validating without tokenizing.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+static struct json_parser validate(const char *text)
+{
+  return json_validate(text, strlen(text));
+}
+
+static int test_valid(void)
+{
+  const char *docs[] = {
+    "0", "-0.5e+10", "true", "null", "\"\"", "[]", "{}",
+    " { \"a\" : [1, 2.0, -3e4, \"x\\n\\u00e9\\ud83d\\ude00\"], \"b\": {} } \n",
+    "\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80\"",
+    "[\"a long string that spans several eight byte words\", false]",
+  };
+  size_t i;
+  for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+    TEST_ASSERT(validate(docs[i]).error == JSONERR_NO_ERROR);
+  }
+  return 0;
+}
+
+static int test_token_count(void)
+{
+  char text[] = "{\"a\": [1, \"x\", true], \"b\": {\"c\": null}}";
+  wchar_t wide[sizeof(text)];
+  struct json_parser v = validate(text), p;
+  size_t i;
+  for (i = 0; i < sizeof(text); i++) {
+    wide[i] = (wchar_t) text[i];
+  }
+  p = json_parse(wide, NULL, 0);
+  TEST_ASSERT(v.error == JSONERR_NO_ERROR);
+  TEST_ASSERT(v.tokenidx == p.tokenidx);
+  TEST_ASSERT(v.tokenidx == 10);
+  return 0;
+}
+
+static int test_invalid(void)
+{
+  TEST_ASSERT(validate("[1, 2").error == JSONERR_PREMATURE_EOF);
+  TEST_ASSERT(validate("\"abc").error == JSONERR_PREMATURE_EOF);
+  TEST_ASSERT(validate("tru").error == JSONERR_PREMATURE_EOF);
+  TEST_ASSERT(validate("").error == JSONERR_PREMATURE_EOF);
+  TEST_ASSERT(validate("[1 2]").error == JSONERR_EXPECTED_TOKEN);
+  TEST_ASSERT(validate("{\"a\" 1}").error == JSONERR_EXPECTED_TOKEN);
+  TEST_ASSERT(validate("{1: 2}").error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(validate("[1,]").error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(validate("{\"a\": 1,}").error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(validate("1.").error == JSONERR_INVALID_NUMBER);
+  TEST_ASSERT(validate("-").error == JSONERR_INVALID_NUMBER);
+  TEST_ASSERT(validate("1e").error == JSONERR_INVALID_NUMBER);
+  TEST_ASSERT(validate("\"\\x\"").error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(validate("\"tab\there\"").error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(validate("1 2").error == JSONERR_UNEXPECTED_TOKEN);
+  return 0;
+}
+
+static int test_surrogates(void)
+{
+  TEST_ASSERT(validate("\"\\ud83d\"").error == JSONERR_INVALID_SURROGATE);
+  TEST_ASSERT(validate("\"\\ude00\"").error == JSONERR_INVALID_SURROGATE);
+  TEST_ASSERT(validate("\"\\ud83d\\u0041\"").error == JSONERR_INVALID_SURROGATE);
+  return 0;
+}
+
+static int test_utf8(void)
+{
+  struct json_parser p;
+  // stray continuation byte, with its offset
+  p = validate("[\"ab\x80\"]");
+  TEST_ASSERT(p.error == JSONERR_INVALID_UTF8);
+  TEST_ASSERT(p.textidx == 4);
+  TEST_ASSERT(validate("\"\xc0\xaf\"").error == JSONERR_INVALID_UTF8);
+  TEST_ASSERT(validate("\"\xed\xa0\x80\"").error == JSONERR_INVALID_UTF8);
+  TEST_ASSERT(validate("\"\xf4\x90\x80\x80\"").error == JSONERR_INVALID_UTF8);
+  TEST_ASSERT(validate("\"\xe2\x82\"").error == JSONERR_INVALID_UTF8);
+  TEST_ASSERT(validate("\xff").error == JSONERR_INVALID_UTF8);
+  return 0;
+}
+
+static int test_embedded_nul(void)
+{
+  char text[] = "[1, \0]";
+  TEST_ASSERT(json_validate(text, sizeof(text) - 1).error != JSONERR_NO_ERROR);
+  TEST_ASSERT(json_validate("[1]\0", 4).error == JSONERR_UNEXPECTED_TOKEN);
+  return 0;
+}
+
+static int test_depth(void)
+{
+  size_t n = 2 * 1024 * 1024;
+  char *text = malloc(n);
+  struct json_parser p;
+
+  // Deep enough to overflow the stack without a limit.
+  TEST_ASSERT(text != NULL);
+  memset(text, '[', n);
+  p = json_validate(text, n);
+  TEST_ASSERT(p.error == JSONERR_UNEXPECTED_TOKEN);
+  TEST_ASSERT(p.textidx == JSON_VALIDATE_MAXDEPTH);
+
+  // Right at the limit is fine.
+  memset(text + JSON_VALIDATE_MAXDEPTH, ']', JSON_VALIDATE_MAXDEPTH);
+  p = json_validate(text, 2 * JSON_VALIDATE_MAXDEPTH);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  free(text);
+  return 0;
+}
+
+void test_validate(void)
+{
+  smb_ut_group *group = su_create_test_group("test/validate.c");
+
+  smb_ut_test *valid = su_create_test("valid", test_valid);
+  su_add_test(group, valid);
+
+  smb_ut_test *token_count = su_create_test("token_count", test_token_count);
+  su_add_test(group, token_count);
+
+  smb_ut_test *invalid = su_create_test("invalid", test_invalid);
+  su_add_test(group, invalid);
+
+  smb_ut_test *depth = su_create_test("depth", test_depth);
+  su_add_test(group, depth);
+
+  smb_ut_test *surrogates = su_create_test("surrogates", test_surrogates);
+  su_add_test(group, surrogates);
+
+  smb_ut_test *utf8 = su_create_test("utf8", test_utf8);
+  su_add_test(group, utf8);
+
+  smb_ut_test *embedded_nul = su_create_test("embedded_nul", test_embedded_nul);
+  su_add_test(group, embedded_nul);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
@@ -0,0 +1,170 @@
+/***************************************************************************//**
+
+  @file         write.c
+
+  @brief        Tests for serializing JSON.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <string.h>
+
+#include "libstephen/ut.h"
+#include "nosj.h"
+
+static int test_minify(void)
+{
+  wchar_t input[] = L" { \"a\" : [ 1, 2.5e3 , true ],\n \"b\":{ }, \"c\" : null,"
+    L" \"d\": \"x\\\"y\", \"e\": [], \"f\": false } ";
+  char expected[] = "{\"a\":[1,2.5e3,true],\"b\":{},\"c\":null,"
+    "\"d\":\"x\\\"y\",\"e\":[],\"f\":false}";
+  char buffer[128];
+  struct json_token tokens[16];
+  struct json_sink sink;
+  struct json_parser p = json_parse(input, tokens, 16);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  TEST_ASSERT(json_write(input, tokens, 0, &sink, 0) == strlen(expected));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_pretty(void)
+{
+  wchar_t input[] = L"{\"a\":[1,{}],\"b\":[]}";
+  char expected[] =
+    "{\n"
+    "  \"a\": [\n"
+    "    1,\n"
+    "    {}\n"
+    "  ],\n"
+    "  \"b\": []\n"
+    "}";
+  char buffer[128];
+  struct json_token tokens[7];
+  struct json_sink sink;
+  struct json_parser p = json_parse(input, tokens, 7);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  TEST_ASSERT(json_write(input, tokens, 0, &sink, 2) == strlen(expected));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_subtree(void)
+{
+  wchar_t input[] = L"{\"a\": {\"b\": [ \"\x00e9\" ]}, \"c\": 1}";
+  char expected[] = "{\"b\":[\"\xc3\xa9\"]}";
+  char buffer[32];
+  struct json_token tokens[7];
+  struct json_sink sink;
+  struct json_parser p = json_parse(input, tokens, 7);
+  size_t value;
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  value = json_object_get(input, tokens, 0, L"a");
+  TEST_ASSERT(value != 0);
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  TEST_ASSERT(json_write(input, tokens, value, &sink, 0) == strlen(expected));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(0 == strcmp(buffer, expected));
+  return 0;
+}
+
+static int test_size_query(void)
+{
+  wchar_t input[] = L"[ \"\x20ac\", 12345, false ]";
+  struct json_token tokens[4];
+  struct json_sink sink;
+  struct json_parser p = json_parse(input, tokens, 4);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  json_sink_buffer(&sink, NULL, 0);
+  TEST_ASSERT(json_write(input, tokens, 0, &sink, 0) == 19);
+  TEST_ASSERT(sink.total == 19);
+  TEST_ASSERT(!json_sink_finish(&sink));
+  return 0;
+}
+
+static int test_truncated(void)
+{
+  wchar_t input[] = L"[1, 2, 3]";
+  char buffer[4];
+  struct json_token tokens[4];
+  struct json_sink sink;
+  struct json_parser p = json_parse(input, tokens, 4);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  json_sink_buffer(&sink, buffer, sizeof(buffer));
+  TEST_ASSERT(json_write(input, tokens, 0, &sink, 0) == 7);
+  TEST_ASSERT(!json_sink_finish(&sink));
+  TEST_ASSERT(0 == memcmp(buffer, "[1,2", 4));
+  return 0;
+}
+
+/**
+   @brief Where append_flush() collects its output.
+ */
+struct append_arg {
+  char *buffer;
+  size_t len;
+  size_t calls;
+};
+
+/**
+   @brief Flush function that appends to a larger buffer.
+ */
+static int append_flush(void *arg, const char *data, size_t len)
+{
+  struct append_arg *aa = arg;
+  memcpy(aa->buffer + aa->len, data, len);
+  aa->len += len;
+  aa->calls++;
+  return 0;
+}
+
+static int test_stream(void)
+{
+  wchar_t input[] = L"{\"key\": [\"a long string value\", 12345678, null]}";
+  char expected[] = "{\"key\":[\"a long string value\",12345678,null]}";
+  char small[5], big[64];
+  struct append_arg aa = {.buffer = big, .len = 0, .calls = 0};
+  struct json_token tokens[6];
+  struct json_sink sink;
+  struct json_parser p = json_parse(input, tokens, 6);
+  TEST_ASSERT(p.error == JSONERR_NO_ERROR);
+  json_sink_stream(&sink, small, sizeof(small), append_flush, &aa);
+  TEST_ASSERT(json_write(input, tokens, 0, &sink, 0) == strlen(expected));
+  TEST_ASSERT(json_sink_finish(&sink));
+  TEST_ASSERT(aa.len == strlen(expected));
+  TEST_ASSERT(aa.calls > 1);
+  TEST_ASSERT(0 == memcmp(big, expected, aa.len));
+  return 0;
+}
+
+void test_write(void)
+{
+  smb_ut_group *group = su_create_test_group("test/write.c");
+
+  smb_ut_test *minify = su_create_test("minify", test_minify);
+  su_add_test(group, minify);
+
+  smb_ut_test *pretty = su_create_test("pretty", test_pretty);
+  su_add_test(group, pretty);
+
+  smb_ut_test *subtree = su_create_test("subtree", test_subtree);
+  su_add_test(group, subtree);
+
+  smb_ut_test *size_query = su_create_test("size_query", test_size_query);
+  su_add_test(group, size_query);
+
+  smb_ut_test *truncated = su_create_test("truncated", test_truncated);
+  su_add_test(group, truncated);
+
+  smb_ut_test *stream = su_create_test("stream", test_stream);
+  su_add_test(group, stream);
+
+  su_run_group(group);
+  su_delete_group(group);
+}
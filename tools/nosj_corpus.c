@@ -0,0 +1,507 @@
+/***************************************************************************//**
+
+  @file         nosj_corpus.c
+
+  @brief        Generate synthetic JSON documents of any size and shape.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: nosj_corpus [OPTIONS]
+
+  Writes one JSON array of tweet-like records (modeled on twitapi.json) to
+  stdout, or to a file.  Output is streamed through a fixed buffer, so any size
+  can be generated in constant memory.  The same options always produce the
+  same bytes.
+
+  Options (defaults in brackets):
+    --seed=N       seed for the random choices [1]
+    --records=N    number of records [1000]
+    --size=N[kMG]  instead of --records, stop after about this many bytes
+    --depth=N      containers nested under each record's "replies" [2]
+    --fanout=N     hashtags, metrics and user fields per record [3]
+    --strlen=N     average string length, in characters [24]
+    --escapes=P    fraction of string characters that need escaping [0.02]
+    --unicode=P    fraction of string characters that are non-ASCII [0.05]
+    --numbers=I:F:E  weights of integers, decimals and exponents [6:3:1]
+    --pretty[=N]   indent by N spaces (2 if N is omitted) [minified]
+    -o FILE        write to FILE instead of stdout
+
+  Any shape can be pushed to an extreme: --depth for deep nesting, --fanout
+  for wide objects and long arrays, --strlen with --escapes or --unicode for
+  slow string paths, --numbers for the number scanner.  The replies chain is
+  written straight to the output rather than through the builder, which stops
+  at JSON_BUILDER_MAXDEPTH levels, so --depth can be in the thousands (or
+  more).  It is always minified, since indenting it would make each record
+  grow with the square of the depth.
+
+*******************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nosj.h"
+#include "json_private.h" // for json_builder_raw() and json_sink_write()
+
+/**
+   @brief Size of the output buffer.
+ */
+#define OUTPUT_BUFFER 65536
+
+struct options {
+  uint64_t seed;
+  size_t records;
+  size_t size;
+  size_t depth;
+  size_t fanout;
+  size_t strlen;
+  double escapes;
+  double unicode;
+  unsigned long numbers[3];
+  unsigned int indent;
+  const char *output;
+};
+
+struct generator {
+  struct json_builder *b;
+  const struct options *opt;
+  uint64_t state;
+  char *string;
+};
+
+/*******************************************************************************
+
+                               Random Choices
+
+*******************************************************************************/
+
+/**
+   @brief A xorshift64* generator, so output doesn't depend on the C library.
+ */
+static uint64_t gen_rand(struct generator *g)
+{
+  uint64_t x = g->state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  g->state = x;
+  return x * UINT64_C(2685821657736338717);
+}
+
+/**
+   @brief Return a number in [0, n).
+ */
+static size_t gen_below(struct generator *g, size_t n)
+{
+  return n == 0 ? 0 : (size_t) (gen_rand(g) >> 33) % n;
+}
+
+/**
+   @brief Return true with probability p.
+ */
+static bool gen_chance(struct generator *g, double p)
+{
+  return (double) (gen_rand(g) >> 11) / 9007199254740992.0 < p;
+}
+
+/*******************************************************************************
+
+                                   Values
+
+*******************************************************************************/
+
+static const char *gen_escaped[] = {"\"", "\\", "\n", "\t", "\x01", "/"};
+static const char *gen_unicode[] = {
+  "\xc3\xa9", "\xc3\xbc", "\xe6\x97\xa5", "\xe2\x80\xa6", "\xf0\x9f\x98\x80",
+};
+static const char gen_ascii[] =
+  "abcdefghijklmnopqrstuvwxyz abcdefghijklmnopqrstuvwxyz ABCDEFGHIJ 0123456789";
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+/**
+   @brief Write a string of about opt->strlen characters.
+ */
+static void gen_string(struct generator *g)
+{
+  size_t len = 1 + gen_below(g, 2 * g->opt->strlen), n = 0, i;
+  const char *c;
+
+  for (i = 0; i < len; i++) {
+    if (gen_chance(g, g->opt->escapes)) {
+      c = gen_escaped[gen_below(g, COUNT(gen_escaped))];
+    } else if (gen_chance(g, g->opt->unicode)) {
+      c = gen_unicode[gen_below(g, COUNT(gen_unicode))];
+    } else {
+      g->string[n++] = gen_ascii[gen_below(g, sizeof(gen_ascii) - 1)];
+      continue;
+    }
+    memcpy(g->string + n, c, strlen(c));
+    n += strlen(c);
+  }
+  json_builder_string_n(g->b, g->string, n);
+}
+
+/**
+   @brief Write a number: an integer, decimal or exponent, by the weights.
+ */
+static void gen_number(struct generator *g)
+{
+  unsigned long total = g->opt->numbers[0] + g->opt->numbers[1] +
+    g->opt->numbers[2];
+  unsigned long pick = (unsigned long) gen_below(g, total);
+  uint64_t r = gen_rand(g);
+
+  if (pick < g->opt->numbers[0]) {
+    // Mostly small, sometimes full 64-bit ids.
+    json_builder_int64(g->b, r % 8 == 0 ? (int64_t) (r >> 1) :
+                       (int64_t) (r >> 44) - 500000);
+  } else if (pick < g->opt->numbers[0] + g->opt->numbers[1]) {
+    json_builder_double(g->b, (double) (r >> 11) / 9007199254740992.0 * 360 -
+                        180);
+  } else {
+    json_builder_double(g->b, ((double) (r >> 11) + 1) *
+                        (r % 2 ? 1e-200 : 1e200));
+  }
+}
+
+/**
+   @brief Write a chain of depth nested replies (alternating objects and
+   arrays), ending in null.
+
+   The brackets go straight to the sink.  Each number and string in the chain
+   is written by a builder of its own, which only ever holds that one value.
+ */
+static void gen_replies(struct generator *g, size_t depth)
+{
+  struct json_builder *b = g->b, leaf;
+  struct json_sink *sink = b->sink;
+  size_t j;
+
+  if (!json_builder_raw(b)) {
+    return;
+  }
+  g->b = &leaf;
+  for (j = depth; j > 0; j--) {
+    json_builder_init(&leaf, sink, 0);
+    if (j % 2 == 0) {
+      json_sink_write(sink, "{\"id\":", 6);
+      gen_number(g);
+      json_sink_write(sink, ",\"replies\":", 11);
+    } else {
+      json_sink_putc(sink, '[');
+      gen_string(g);
+      json_sink_putc(sink, ',');
+    }
+  }
+  json_sink_write(sink, "null", 4);
+  for (j = 1; j <= depth; j++) {
+    json_sink_putc(sink, j % 2 == 0 ? '}' : ']');
+  }
+  g->b = b;
+}
+
+static void gen_record(struct generator *g, size_t i)
+{
+  struct json_builder *b = g->b;
+  size_t fanout = g->opt->fanout, j;
+  char key[32];
+
+  json_builder_begin_object(b);
+  json_builder_key(b, "id");
+  json_builder_int64(b, (int64_t) (UINT64_C(210462857140252672) + i));
+  json_builder_key(b, "created_at");
+  json_builder_string(b, "Wed Jun 06 20:07:10 +0000 2012");
+  json_builder_key(b, "text");
+  gen_string(g);
+  json_builder_key(b, "favorited");
+  json_builder_bool(b, gen_below(g, 2));
+  json_builder_key(b, "coordinates");
+  if (gen_below(g, 4) == 0) {
+    json_builder_begin_array(b);
+    gen_number(g);
+    gen_number(g);
+    json_builder_end(b);
+  } else {
+    json_builder_null(b);
+  }
+
+  json_builder_key(b, "user");
+  json_builder_begin_object(b);
+  json_builder_key(b, "name");
+  gen_string(g);
+  json_builder_key(b, "followers_count");
+  gen_number(g);
+  for (j = 0; j < fanout; j++) {
+    sprintf(key, "field_%lu", (unsigned long) j);
+    json_builder_key(b, key);
+    if (j % 2) {
+      gen_string(g);
+    } else {
+      gen_number(g);
+    }
+  }
+  json_builder_end(b);
+
+  json_builder_key(b, "entities");
+  json_builder_begin_object(b);
+  json_builder_key(b, "hashtags");
+  json_builder_begin_array(b);
+  for (j = 0; j < fanout; j++) {
+    json_builder_begin_object(b);
+    json_builder_key(b, "text");
+    gen_string(g);
+    json_builder_key(b, "indices");
+    json_builder_begin_array(b);
+    json_builder_int64(b, (int64_t) j * 8);
+    json_builder_int64(b, (int64_t) j * 8 + 7);
+    json_builder_end(b);
+    json_builder_end(b);
+  }
+  json_builder_end(b);
+  json_builder_end(b);
+
+  json_builder_key(b, "metrics");
+  json_builder_begin_array(b);
+  for (j = 0; j < fanout; j++) {
+    gen_number(g);
+  }
+  json_builder_end(b);
+
+  json_builder_key(b, "replies");
+  gen_replies(g, g->opt->depth);
+  json_builder_end(b);
+}
+
+/*******************************************************************************
+
+                                  Driver
+
+*******************************************************************************/
+
+static int flush_file(void *arg, const char *data, size_t len)
+{
+  return fwrite(data, 1, len, arg) == len ? 0 : -1;
+}
+
+/**
+   @brief Parse a whole string as an unsigned decimal number.
+   @returns False if it isn't one, or is out of range.
+ */
+static bool parse_unsigned(const char *str, unsigned long long *value)
+{
+  char *end;
+  // strtoull() would take leading spaces and a minus sign.
+  if (*str < '0' || *str > '9') {
+    return false;
+  }
+  errno = 0;
+  *value = strtoull(str, &end, 10);
+  return errno == 0 && *end == '\0';
+}
+
+/**
+   @brief Parse an unsigned number that has to fit in a size_t.
+ */
+static bool parse_count(const char *str, size_t *value)
+{
+  unsigned long long n;
+  if (!parse_unsigned(str, &n) || n > SIZE_MAX) {
+    return false;
+  }
+  *value = (size_t) n;
+  return true;
+}
+
+/**
+   @brief Parse a fraction from 0 to 1.
+ */
+static bool parse_fraction(const char *str, double *value)
+{
+  char *end;
+  errno = 0;
+  *value = strtod(str, &end);
+  return end != str && *end == '\0' && errno == 0 && *value >= 0 &&
+    *value <= 1;
+}
+
+/**
+   @brief Parse a size like 100, 64k, 10M or 2G.
+ */
+static bool parse_size(const char *str, size_t *size)
+{
+  char *end;
+  double value;
+
+  if (*str < '0' || *str > '9') {
+    return false;
+  }
+  value = strtod(str, &end);
+  switch (*end) {
+  case 'k': case 'K':
+    value *= 1024;
+    end++;
+    break;
+  case 'm': case 'M':
+    value *= 1024 * 1024;
+    end++;
+    break;
+  case 'g': case 'G':
+    value *= 1024.0 * 1024 * 1024;
+    end++;
+    break;
+  }
+  if (*end != '\0' || !isfinite(value) || value >= (double) SIZE_MAX) {
+    return false;
+  }
+  *size = (size_t) value;
+  return true;
+}
+
+/**
+   @brief Parse the weights of --numbers, like 6:3:1.  They can't all be zero.
+ */
+static bool parse_weights(const char *str, unsigned long weights[3])
+{
+  char *end;
+  int i;
+  for (i = 0; i < 3; i++) {
+    if (*str < '0' || *str > '9') {
+      return false;
+    }
+    errno = 0;
+    weights[i] = strtoul(str, &end, 10);
+    if (errno != 0 || *end != (i < 2 ? ':' : '\0')) {
+      return false;
+    }
+    str = end + 1;
+  }
+  // Their sum is used as a bound, so it must not overflow.
+  return weights[0] + weights[1] + weights[2] != 0 &&
+    weights[0] <= ULONG_MAX / 3 && weights[1] <= ULONG_MAX / 3 &&
+    weights[2] <= ULONG_MAX / 3;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [--seed=N] [--records=N | --size=N[kMG]] "
+          "[--depth=N] [--fanout=N]\n"
+          "       [--strlen=N] [--escapes=P] [--unicode=P] "
+          "[--numbers=I:F:E] [--pretty[=N]] [-o FILE]\n", name);
+}
+
+/**
+   @brief Read the command line into opt.
+   @returns False if it was invalid.
+ */
+static bool parse_options(int argc, char *argv[], struct options *opt)
+{
+  unsigned long long seed = 0;
+  size_t indent;
+  int i;
+  bool ok = true;
+
+  for (i = 1; ok && i < argc; i++) {
+    if (strncmp(argv[i], "--seed=", 7) == 0) {
+      ok = parse_unsigned(argv[i] + 7, &seed);
+      opt->seed = (uint64_t) seed;
+    } else if (strncmp(argv[i], "--records=", 10) == 0) {
+      ok = parse_count(argv[i] + 10, &opt->records);
+    } else if (strncmp(argv[i], "--size=", 7) == 0) {
+      ok = parse_size(argv[i] + 7, &opt->size);
+    } else if (strncmp(argv[i], "--depth=", 8) == 0) {
+      ok = parse_count(argv[i] + 8, &opt->depth);
+    } else if (strncmp(argv[i], "--fanout=", 9) == 0) {
+      ok = parse_count(argv[i] + 9, &opt->fanout);
+    } else if (strncmp(argv[i], "--strlen=", 9) == 0) {
+      // Strings are generated in a buffer of 8 bytes per character.
+      ok = parse_count(argv[i] + 9, &opt->strlen) &&
+        opt->strlen <= SIZE_MAX / 16;
+    } else if (strncmp(argv[i], "--escapes=", 10) == 0) {
+      ok = parse_fraction(argv[i] + 10, &opt->escapes);
+    } else if (strncmp(argv[i], "--unicode=", 10) == 0) {
+      ok = parse_fraction(argv[i] + 10, &opt->unicode);
+    } else if (strncmp(argv[i], "--numbers=", 10) == 0) {
+      ok = parse_weights(argv[i] + 10, opt->numbers);
+    } else if (strcmp(argv[i], "--pretty") == 0) {
+      opt->indent = 2;
+    } else if (strncmp(argv[i], "--pretty=", 9) == 0) {
+      ok = parse_count(argv[i] + 9, &indent) && indent <= UINT_MAX;
+      opt->indent = (unsigned int) indent;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      opt->output = argv[++i];
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "invalid option: %s\n", argv[i]);
+    }
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  struct options opt = {
+    .seed = 1, .records = 1000, .size = 0, .depth = 2, .fanout = 3,
+    .strlen = 24, .escapes = 0.02, .unicode = 0.05, .numbers = {6, 3, 1},
+    .indent = 0, .output = NULL,
+  };
+  static char buffer[OUTPUT_BUFFER];
+  struct generator g;
+  struct json_builder b;
+  struct json_sink sink;
+  FILE *out = stdout;
+  size_t i;
+  bool ok;
+
+  if (!parse_options(argc, argv, &opt)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (opt.output != NULL && (out = fopen(opt.output, "w")) == NULL) {
+    perror(opt.output);
+    return 1;
+  }
+
+  // Each character of a string is at most four bytes.
+  g.string = malloc(2 * opt.strlen * 4 + 4);
+  if (g.string == NULL) {
+    perror("nosj_corpus");
+    return 1;
+  }
+  g.b = &b;
+  g.opt = &opt;
+  g.state = opt.seed != 0 ? opt.seed : 1;
+
+  json_sink_stream(&sink, buffer, sizeof(buffer), flush_file, out);
+  json_builder_init(&b, &sink, opt.indent);
+  json_builder_begin_array(&b);
+  for (i = 0; opt.size > 0 ? sink.total < opt.size : i < opt.records; i++) {
+    gen_record(&g, i);
+    if (sink.error) {
+      break;
+    }
+  }
+  json_builder_end(&b);
+  ok = json_builder_finish(&b) && json_sink_finish(&sink);
+  free(g.string);
+
+  if (fputc('\n', out) == EOF) {
+    ok = false;
+  }
+  if (out != stdout) {
+    ok = fclose(out) == 0 && ok;
+  }
+  if (!ok) {
+    perror(opt.output != NULL ? opt.output : "stdout");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,556 @@
+/***************************************************************************//**
+
+  @file         nosj_gen.c
+
+  @brief        Generate specialized struct decoders from a schema.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: nosj_gen SCHEMA OUTBASE
+
+  Reads a schema and writes OUTBASE.h (the structs and decoder prototypes) and
+  OUTBASE.c (the decoders).  A schema looks like this:
+
+      # comments start with '#'
+      struct user
+        int id required
+        double score
+        bool admin
+        string name 16
+        utf8 email 64
+        index tags
+        int user_id as user-id
+
+  Each field is a type, a member name, a size (only for string and utf8, in
+  characters and bytes respectively), and optionally "as KEY" when the JSON key
+  isn't the member name, and "required".  The types mean the same as the
+  `enum json_field_type` values for `json_decode()`.
+
+  For each struct, the generated `NAME_decode()` dispatches keys on their length
+  and first character, then compares the rest, so most unknown keys are
+  rejected after a couple of comparisons.  Values are type checked and stored
+  straight into the struct, and numbers without a fraction or exponent are
+  converted inline.
+
+*******************************************************************************/
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE 1024
+#define MAX_NAME 128
+#define MAX_FIELDS 64
+#define MAX_STRUCTS 64
+
+enum gen_type {
+  GEN_DOUBLE, GEN_INT, GEN_BOOL, GEN_STRING, GEN_UTF8, GEN_INDEX
+};
+
+static const char *gen_type_names[] = {
+  "double", "int", "bool", "string", "utf8", "index"
+};
+
+struct gen_field {
+  enum gen_type type;
+  char member[MAX_NAME];
+  char key[MAX_NAME];
+  size_t keylen;
+  unsigned long size;
+  bool required;
+};
+
+struct gen_struct {
+  char name[MAX_NAME];
+  struct gen_field fields[MAX_FIELDS];
+  size_t nfields;
+};
+
+static struct gen_struct structs[MAX_STRUCTS];
+static size_t nstructs;
+
+/*******************************************************************************
+
+                                Schema Parsing
+
+*******************************************************************************/
+
+static void die(const char *file, int line, const char *msg, const char *arg)
+{
+  fprintf(stderr, "%s:%d: %s%s\n", file, line, msg, arg);
+  exit(1);
+}
+
+static bool is_identifier(const char *s)
+{
+  if (!isalpha((unsigned char) *s) && *s != '_') {
+    return false;
+  }
+  for (s++; *s; s++) {
+    if (!isalnum((unsigned char) *s) && *s != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+   @brief Keys are written into wide string and character literals, so keep
+   them to printable ASCII that doesn't need escaping.
+ */
+static bool is_simple_key(const char *s)
+{
+  for (; *s; s++) {
+    if (*s < 0x20 || *s > 0x7e || *s == '"' || *s == '\\' || *s == '\'') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void parse_field(struct gen_struct *st, char **words, int nwords,
+                        const char *file, int line)
+{
+  struct gen_field *f;
+  int i, t, w = 2;
+
+  if (st->nfields >= MAX_FIELDS) {
+    die(file, line, "too many fields in struct ", st->name);
+  }
+  f = &st->fields[st->nfields++];
+  memset(f, 0, sizeof(*f));
+
+  for (t = 0; t <= GEN_INDEX; t++) {
+    if (strcmp(words[0], gen_type_names[t]) == 0) {
+      break;
+    }
+  }
+  if (t > GEN_INDEX) {
+    die(file, line, "unknown type ", words[0]);
+  }
+  f->type = (enum gen_type) t;
+  if (nwords < 2 || !is_identifier(words[1]) ||
+      strlen(words[1]) >= MAX_NAME) {
+    die(file, line, "expected a member name after ", words[0]);
+  }
+  strcpy(f->member, words[1]);
+  strcpy(f->key, words[1]);
+
+  if (f->type == GEN_STRING || f->type == GEN_UTF8) {
+    if (nwords < 3 || (f->size = strtoul(words[2], NULL, 10)) == 0) {
+      die(file, line, "expected a size for ", f->member);
+    }
+    w = 3;
+  }
+
+  for (i = w; i < nwords; i++) {
+    if (strcmp(words[i], "required") == 0) {
+      f->required = true;
+    } else if (strcmp(words[i], "as") == 0 && i + 1 < nwords &&
+               strlen(words[i + 1]) < MAX_NAME && is_simple_key(words[i + 1])) {
+      strcpy(f->key, words[++i]);
+    } else {
+      die(file, line, "unexpected ", words[i]);
+    }
+  }
+  f->keylen = strlen(f->key);
+
+  for (i = 0; i < (int) st->nfields - 1; i++) {
+    if (strcmp(st->fields[i].key, f->key) == 0) {
+      die(file, line, "duplicate key ", f->key);
+    }
+  }
+}
+
+static void parse_schema(const char *file)
+{
+  char line[MAX_LINE], *words[16], *tok;
+  struct gen_struct *st = NULL;
+  int lineno = 0, nwords;
+  FILE *f = fopen(file, "r");
+
+  if (f == NULL) {
+    perror(file);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    lineno++;
+    if ((tok = strchr(line, '#')) != NULL) {
+      *tok = '\0';
+    }
+    nwords = 0;
+    for (tok = strtok(line, " \t\r\n"); tok != NULL && nwords < 16;
+         tok = strtok(NULL, " \t\r\n")) {
+      words[nwords++] = tok;
+    }
+    if (nwords == 0) {
+      continue;
+    }
+    if (strcmp(words[0], "struct") == 0) {
+      if (nwords != 2 || !is_identifier(words[1]) ||
+          strlen(words[1]) >= MAX_NAME) {
+        die(file, lineno, "expected a struct name", "");
+      }
+      if (nstructs >= MAX_STRUCTS) {
+        die(file, lineno, "too many structs", "");
+      }
+      st = &structs[nstructs++];
+      strcpy(st->name, words[1]);
+      st->nfields = 0;
+    } else if (st == NULL) {
+      die(file, lineno, "field outside of a struct: ", words[0]);
+    } else {
+      parse_field(st, words, nwords, file, lineno);
+    }
+  }
+  fclose(f);
+}
+
+/*******************************************************************************
+
+                                Code Generation
+
+*******************************************************************************/
+
+static bool uses_type(const struct gen_struct *st, enum gen_type type)
+{
+  size_t i;
+  for (i = 0; i < st->nfields; i++) {
+    if (st->fields[i].type == type) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool uses_any(enum gen_type type)
+{
+  size_t s;
+  for (s = 0; s < nstructs; s++) {
+    if (uses_type(&structs[s], type)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void gen_header(FILE *out, const char *guard, const char *schema)
+{
+  size_t s, i;
+  struct gen_field *f;
+
+  fprintf(out, "/* Generated by nosj_gen from %s.  Do not edit. */\n\n", schema);
+  fprintf(out, "#ifndef %s\n#define %s\n\n", guard, guard);
+  fprintf(out, "#include <stdbool.h>\n#include <stddef.h>\n#include <wchar.h>\n\n");
+  fprintf(out, "#include \"nosj.h\"\n");
+
+  for (s = 0; s < nstructs; s++) {
+    fprintf(out, "\nstruct %s {\n", structs[s].name);
+    for (i = 0; i < structs[s].nfields; i++) {
+      f = &structs[s].fields[i];
+      switch (f->type) {
+      case GEN_DOUBLE: fprintf(out, "  double %s;\n", f->member); break;
+      case GEN_INT: fprintf(out, "  int %s;\n", f->member); break;
+      case GEN_BOOL: fprintf(out, "  bool %s;\n", f->member); break;
+      case GEN_STRING:
+        fprintf(out, "  wchar_t %s[%lu];\n", f->member, f->size);
+        break;
+      case GEN_UTF8:
+        fprintf(out, "  char %s[%lu];\n", f->member, f->size);
+        break;
+      case GEN_INDEX: fprintf(out, "  size_t %s;\n", f->member); break;
+      }
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out,
+            "/**\n"
+            "   @brief Decode an object into a struct %s.\n\n"
+            "   Same rules as json_decode(): unknown keys and nulls are skipped,\n"
+            "   and missing members are left untouched.\n"
+            "   @returns False for a non-object, a value of the wrong type, a\n"
+            "   string that doesn't fit, or a missing required key.\n"
+            " */\n", structs[s].name);
+    fprintf(out, "bool %s_decode(const wchar_t *json, const struct json_token "
+            "*tokens,\n", structs[s].name);
+    fprintf(out, "     size_t index, struct %s *out);\n", structs[s].name);
+  }
+  fprintf(out, "\n#endif // %s\n", guard);
+}
+
+/**
+   @brief Helpers shared by every decoder in the generated file.  Each is only
+   written out if some field needs it, so that the output compiles cleanly with
+   -Wunused-function.
+ */
+static const char *gen_number_helper =
+  "/**\n"
+  "   @brief Convert a number token.  Plain integers of up to 15 digits are\n"
+  "   converted inline (exactly); anything else goes through json_number_get().\n"
+  " */\n"
+  "static double nosj_gen_number(const wchar_t *json,\n"
+  "                              const struct json_token *tokens, size_t index)\n"
+  "{\n"
+  "  const wchar_t *p = json + tokens[index].start;\n"
+  "  const wchar_t *end = json + tokens[index].end + 1;\n"
+  "  bool negative = *p == L'-';\n"
+  "  long long value = 0;\n"
+  "  p += negative;\n"
+  "  if (end - p > 15) {\n"
+  "    return json_number_get(json, tokens, index);\n"
+  "  }\n"
+  "  for (; p < end; p++) {\n"
+  "    if (*p < L'0' || *p > L'9') {\n"
+  "      return json_number_get(json, tokens, index);\n"
+  "    }\n"
+  "    value = value * 10 + (*p - L'0');\n"
+  "  }\n"
+  "  return negative ? -(double) value : (double) value;\n"
+  "}\n";
+
+static const char *gen_string_helper =
+  "/**\n"
+  "   @brief Load a string token into a wchar_t array of the given size.\n"
+  " */\n"
+  "static bool nosj_gen_string(const wchar_t *json,\n"
+  "                            const struct json_token *tokens, size_t index,\n"
+  "                            wchar_t *out, size_t size)\n"
+  "{\n"
+  "  const struct json_token *tok = tokens + index;\n"
+  "  if (tok->length + 1 > size) {\n"
+  "    return false;\n"
+  "  }\n"
+  "  if (tok->end - tok->start - 1 == tok->length) {\n"
+  "    // no escapes, so copy the text directly\n"
+  "    wmemcpy(out, json + tok->start + 1, tok->length);\n"
+  "    out[tok->length] = L'\\0';\n"
+  "  } else {\n"
+  "    json_string_load(json, tokens, index, out);\n"
+  "  }\n"
+  "  return true;\n"
+  "}\n";
+
+static const char *gen_utf8_helper =
+  "/**\n"
+  "   @brief Load a string token into a char array of the given size, as UTF-8.\n"
+  " */\n"
+  "static bool nosj_gen_utf8(const wchar_t *json,\n"
+  "                          const struct json_token *tokens, size_t index,\n"
+  "                          char *out, size_t size)\n"
+  "{\n"
+  "  if (json_string_utf8_size(json, tokens, index) + 1 > size) {\n"
+  "    return false;\n"
+  "  }\n"
+  "  json_string_load_utf8(json, tokens, index, out);\n"
+  "  return true;\n"
+  "}\n";
+
+static int compare_fields(const void *a, const void *b)
+{
+  const struct gen_field *const *x = a, *const *y = b;
+  if ((*x)->keylen != (*y)->keylen) {
+    return (*x)->keylen < (*y)->keylen ? -1 : 1;
+  }
+  return strcmp((*x)->key, (*y)->key);
+}
+
+/**
+   @brief Write the key lookup function for a struct.
+ */
+static void gen_lookup(FILE *out, struct gen_struct *st)
+{
+  struct gen_field *sorted[MAX_FIELDS], *f;
+  size_t i, j, k, idx;
+
+  for (i = 0; i < st->nfields; i++) {
+    sorted[i] = &st->fields[i];
+  }
+  qsort(sorted, st->nfields, sizeof(sorted[0]), compare_fields);
+
+  fprintf(out, "\n/**\n   @brief Return the field number for a key, or -1.\n */\n");
+  fprintf(out, "static int %s_field(const wchar_t *json,\n", st->name);
+  fprintf(out, "    const struct json_token *tokens, size_t key)\n{\n");
+  fprintf(out, "  const wchar_t *k = json + tokens[key].start + 1;\n");
+  fprintf(out, "  size_t len = tokens[key].end - tokens[key].start - 1;\n\n");
+
+  // Keys with escapes can't be matched against their text.
+  fprintf(out, "  if (len != tokens[key].length) {\n");
+  for (i = 0; i < st->nfields; i++) {
+    fprintf(out, "    if (json_string_match(json, tokens, key, L\"%s\")) {\n"
+            "      return %lu;\n    }\n", st->fields[i].key, (unsigned long) i);
+  }
+  fprintf(out, "    return -1;\n  }\n\n");
+
+  fprintf(out, "  switch (len) {\n");
+  for (i = 0; i < st->nfields; i = j) {
+    // Fields [i, j) share a length.
+    for (j = i; j < st->nfields && sorted[j]->keylen == sorted[i]->keylen; j++) {
+    }
+    fprintf(out, "  case %lu:\n", (unsigned long) sorted[i]->keylen);
+    if (sorted[i]->keylen == 0) {
+      fprintf(out, "    return %lu;\n",
+              (unsigned long) (sorted[i] - st->fields));
+      continue;
+    }
+    fprintf(out, "    switch (k[0]) {\n");
+    for (k = i; k < j; k++) {
+      f = sorted[k];
+      idx = (size_t) (f - st->fields);
+      if (k == i || f->key[0] != sorted[k - 1]->key[0]) {
+        fprintf(out, "    case L'%c':\n", f->key[0]);
+      }
+      if (f->keylen == 1) {
+        fprintf(out, "      return %lu;\n", (unsigned long) idx);
+      } else {
+        fprintf(out, "      if (wmemcmp(k + 1, L\"%s\", %lu) == 0) {\n"
+                "        return %lu;\n      }\n", f->key + 1,
+                (unsigned long) (f->keylen - 1), (unsigned long) idx);
+      }
+      if (k + 1 == j || sorted[k + 1]->key[0] != f->key[0]) {
+        if (f->keylen != 1) {
+          fprintf(out, "      break;\n");
+        }
+      }
+    }
+    fprintf(out, "    }\n    break;\n");
+  }
+  fprintf(out, "  }\n  return -1;\n}\n");
+}
+
+/**
+   @brief Write the decode function for a struct.
+ */
+static void gen_decoder(FILE *out, struct gen_struct *st)
+{
+  unsigned long long required = 0;
+  struct gen_field *f;
+  size_t i;
+
+  gen_lookup(out, st);
+
+  fprintf(out, "\nbool %s_decode(const wchar_t *json, const struct json_token "
+          "*tokens,\n", st->name);
+  fprintf(out, "     size_t index, struct %s *out)\n{\n", st->name);
+  fprintf(out, "  unsigned long long seen = 0;\n");
+  fprintf(out, "  size_t key, value;\n");
+  fprintf(out, "  enum json_type type;\n");
+  if (uses_type(st, GEN_INT)) {
+    fprintf(out, "  double number;\n");
+  }
+  fprintf(out, "\n");
+  fprintf(out, "  if (tokens[index].type != JSON_OBJECT) {\n    return false;\n  }\n");
+  fprintf(out, "  for (key = tokens[index].child; key != 0; "
+          "key = tokens[key].next) {\n");
+  fprintf(out, "    value = tokens[key].child;\n");
+  fprintf(out, "    type = tokens[value].type;\n");
+  fprintf(out, "    if (type == JSON_NULL) {\n      continue;\n    }\n");
+  fprintf(out, "    switch (%s_field(json, tokens, key)) {\n", st->name);
+
+  for (i = 0; i < st->nfields; i++) {
+    f = &st->fields[i];
+    if (f->required) {
+      required |= 1ULL << i;
+    }
+    fprintf(out, "    case %lu: // %s\n", (unsigned long) i, f->key);
+    switch (f->type) {
+    case GEN_DOUBLE:
+      fprintf(out, "      if (type != JSON_NUMBER) {\n        return false;\n      }\n");
+      fprintf(out, "      out->%s = nosj_gen_number(json, tokens, value);\n",
+              f->member);
+      break;
+    case GEN_INT:
+      fprintf(out, "      if (type != JSON_NUMBER) {\n        return false;\n      }\n");
+      fprintf(out, "      number = nosj_gen_number(json, tokens, value);\n");
+      fprintf(out, "      if (number < INT_MIN || number > INT_MAX ||\n"
+              "          (int) number != number) {\n        return false;\n      }\n");
+      fprintf(out, "      out->%s = (int) number;\n", f->member);
+      break;
+    case GEN_BOOL:
+      fprintf(out, "      if (type != JSON_TRUE && type != JSON_FALSE) {\n"
+              "        return false;\n      }\n");
+      fprintf(out, "      out->%s = type == JSON_TRUE;\n", f->member);
+      break;
+    case GEN_STRING:
+      fprintf(out, "      if (type != JSON_STRING ||\n"
+              "          !nosj_gen_string(json, tokens, value, out->%s, %lu)) {\n"
+              "        return false;\n      }\n", f->member, f->size);
+      break;
+    case GEN_UTF8:
+      fprintf(out, "      if (type != JSON_STRING ||\n"
+              "          !nosj_gen_utf8(json, tokens, value, out->%s, %lu)) {\n"
+              "        return false;\n      }\n", f->member, f->size);
+      break;
+    case GEN_INDEX:
+      fprintf(out, "      out->%s = value;\n", f->member);
+      break;
+    }
+    fprintf(out, "      seen |= 1ULL << %lu;\n      break;\n", (unsigned long) i);
+  }
+  fprintf(out, "    default:\n      break; // unknown key\n    }\n  }\n");
+  fprintf(out, "  return (seen & 0x%llxULL) == 0x%llxULL;\n}\n", required,
+          required);
+}
+
+static void gen_source(FILE *out, const char *header, const char *schema)
+{
+  size_t s;
+  fprintf(out, "/* Generated by nosj_gen from %s.  Do not edit. */\n\n", schema);
+  fprintf(out, "#include <limits.h>\n#include <stdbool.h>\n#include <stddef.h>\n"
+          "#include <wchar.h>\n\n");
+  fprintf(out, "#include \"nosj.h\"\n#include \"%s\"\n\n", header);
+  if (uses_any(GEN_DOUBLE) || uses_any(GEN_INT)) {
+    fprintf(out, "%s\n", gen_number_helper);
+  }
+  if (uses_any(GEN_STRING)) {
+    fprintf(out, "%s\n", gen_string_helper);
+  }
+  if (uses_any(GEN_UTF8)) {
+    fprintf(out, "%s\n", gen_utf8_helper);
+  }
+  for (s = 0; s < nstructs; s++) {
+    gen_decoder(out, &structs[s]);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  char path[4096], guard[MAX_NAME + 16];
+  const char *base;
+  FILE *out;
+  size_t i;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s SCHEMA OUTBASE\n", argv[0]);
+    return 1;
+  }
+  parse_schema(argv[1]);
+
+  // The include guard and #include use the last path component of OUTBASE.
+  base = strrchr(argv[2], '/');
+  base = base == NULL ? argv[2] : base + 1;
+  snprintf(guard, sizeof(guard), "NOSJ_GEN_%s_H", base);
+  for (i = 0; guard[i]; i++) {
+    guard[i] = isalnum((unsigned char) guard[i]) ?
+      (char) toupper((unsigned char) guard[i]) : '_';
+  }
+
+  snprintf(path, sizeof(path), "%s.h", argv[2]);
+  if ((out = fopen(path, "w")) == NULL) {
+    perror(path);
+    return 1;
+  }
+  gen_header(out, guard, argv[1]);
+  fclose(out);
+
+  snprintf(path, sizeof(path), "%s.c", argv[2]);
+  if ((out = fopen(path, "w")) == NULL) {
+    perror(path);
+    return 1;
+  }
+  snprintf(path, sizeof(path), "%s.h", base);
+  gen_source(out, path, argv[1]);
+  fclose(out);
+  return 0;
+}
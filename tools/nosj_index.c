@@ -0,0 +1,175 @@
+/***************************************************************************//**
+
+  @file         nosj_index.c
+
+  @brief        Build and use sidecar indexes of newline-delimited JSON.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: nosj_index [--key=KEY] [--threads=N] [-i INDEX] FILE
+         nosj_index --get=N [-i INDEX] FILE
+         nosj_index --find=VALUE [-i INDEX] FILE
+
+  The first form builds an index of FILE (FILE.idx by default) with
+  json_index_build(): the offset of every record, and if a key is given, the
+  hashed value of that top-level key in each record.
+
+  --get prints record N (counting from 0), and --find prints the first record
+  whose value for the key is VALUE.  Either one reads only the index and that
+  record, so it takes the same time however big the file is.  The record goes
+  to stdout, as its own line; its number and offset go to stderr.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nosj.h"
+#include "json_private.h" // for json_utf8_encode_run()
+
+/**
+   @brief Return a wide copy of a UTF-8 argument, or NULL.
+ */
+static wchar_t *widen(const char *s)
+{
+  size_t len = strlen(s);
+  wchar_t *w = malloc((len + 1) * sizeof(wchar_t));
+  if (w != NULL) {
+    w[json_utf8_decode(s, len, w)] = L'\0';
+  }
+  return w;
+}
+
+/**
+   @brief Print a record as UTF-8.
+ */
+static bool print_record(const struct json_element *el)
+{
+  char *out = malloc(json_utf8_encode_run(el->text, el->textlen, NULL) + 1);
+  size_t n;
+
+  if (out == NULL) {
+    return false;
+  }
+  n = json_utf8_encode_run(el->text, el->textlen, out);
+  out[n++] = '\n';
+  fwrite(out, 1, n, stdout);
+  free(out);
+  fprintf(stderr, "record %zu at offset %llu\n", el->index,
+          (unsigned long long) el->offset);
+  return true;
+}
+
+/**
+   @brief Look up a record by number or by key, and print it.
+   @returns Exit code.
+ */
+static int lookup(const char *input, const char *index, const char *get,
+                  const char *find)
+{
+  struct json_index ix;
+  struct json_element el;
+  wchar_t *value;
+  int r;
+
+  if (json_index_open(&ix, input, index, NULL) != 0) {
+    perror(index);
+    return 1;
+  }
+  if (get != NULL) {
+    r = json_index_record(&ix, strtoul(get, NULL, 10), &el) == 0 ? 1 : -1;
+  } else {
+    value = widen(find);
+    r = value != NULL ? json_index_find(&ix, value, &el) : -1;
+    free(value);
+  }
+
+  if (r == 1) {
+    r = print_record(&el) ? 0 : 1;
+  } else if (r == 0) {
+    fprintf(stderr, "%s: no record has %ls \"%s\"\n", input, ix.key, find);
+    r = 1;
+  } else if (errno == EINVAL && ix.key[0] == L'\0' && find != NULL) {
+    fprintf(stderr, "%s: built without --key\n", index);
+    r = 1;
+  } else if (errno == EINVAL) {
+    fprintf(stderr, "%s: record %s is not valid JSON\n", input, get);
+    r = 1;
+  } else {
+    perror(input);
+    r = 1;
+  }
+  json_index_close(&ix);
+  return r;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [--key=KEY] [--threads=N] [-i INDEX] FILE\n",
+          name);
+  fprintf(stderr, "       %s --get=N [-i INDEX] FILE\n", name);
+  fprintf(stderr, "       %s --find=VALUE [-i INDEX] FILE\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *input = NULL, *index = NULL, *key = NULL, *get = NULL,
+    *find = NULL;
+  unsigned int threads = 0;
+  char *path = NULL;
+  wchar_t *wkey = NULL;
+  int i, rv;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      index = argv[++i];
+    } else if (strncmp(argv[i], "--key=", 6) == 0) {
+      key = argv[i] + 6;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = (unsigned int) strtoul(argv[i] + 10, NULL, 10);
+    } else if (strncmp(argv[i], "--get=", 6) == 0) {
+      get = argv[i] + 6;
+    } else if (strncmp(argv[i], "--find=", 7) == 0) {
+      find = argv[i] + 7;
+    } else if (argv[i][0] != '-' && input == NULL) {
+      input = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (input == NULL || (get != NULL && find != NULL)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (index == NULL) {
+    path = malloc(strlen(input) + 5);
+    if (path == NULL) {
+      perror("nosj_index");
+      return 1;
+    }
+    strcpy(path, input);
+    strcat(path, ".idx");
+    index = path;
+  }
+
+  if (get != NULL || find != NULL) {
+    rv = lookup(input, index, get, find);
+  } else if (key != NULL && (wkey = widen(key)) == NULL) {
+    perror("nosj_index");
+    rv = 1;
+  } else if (json_index_build(input, index, wkey, threads, NULL) != 0) {
+    perror(input);
+    rv = 1;
+  } else {
+    rv = 0;
+  }
+  free(wkey);
+  free(path);
+  return rv;
+}
@@ -0,0 +1,512 @@
+/***************************************************************************//**
+
+  @file         nosj_trace.c
+
+  @brief        Record and summarize parse traces.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+  Usage: nosj_trace [-o TRACE] FILE
+         nosj_trace --fold TRACE
+         nosj_trace --top[=N] TRACE
+
+  The first form parses FILE with json_parse_trace(), and writes each event,
+  with a timestamp, to TRACE (nosj.trace by default).  This is the example
+  json_trace_fn: it does no work besides buffering a 24-byte record.
+
+  --fold turns a trace into "folded stacks": one line per distinct path of
+  containers from the root (like "array;object;object"), with the time spent
+  directly in containers at that path, in nanoseconds.  This is the input
+  format of flamegraph.pl, so the result is a flame graph of where in the
+  document the parser spends its time.
+
+  --top finds what is unusual about a document: the N slowest containers
+  (10 by default) with their offsets, the deepest nesting, the longest string,
+  and where parsing failed, if it did.  Run it over traces of documents from
+  logs to find the ones that are pathological for the parser, and where.
+
+  This needs the library built with NOSJ_TRACE: "make TRACE=1 trace".
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nosj.h"
+#include "json_private.h" // for the names of types and errors
+
+#ifndef NOSJ_TRACE
+#error "nosj_trace needs NOSJ_TRACE: run make clean, then make TRACE=1 trace"
+#endif
+
+/**
+   @brief Identifies a trace file (and its version).
+ */
+#define TRACE_MAGIC "NOSJTRC1"
+
+/**
+   @brief Records buffered before writing them out.
+ */
+#define TRACE_BUFFER 4096
+
+/**
+   @brief One event in a trace file, in native byte order.
+ */
+struct trace_record {
+  /**
+     @brief Nanoseconds since parsing started.
+   */
+  uint64_t time;
+  /**
+     @brief Text offset of the start of the value (or of the error).
+   */
+  uint64_t start;
+  /**
+     @brief Characters from start to end, saturated at UINT32_MAX.
+   */
+  uint32_t span;
+  /**
+     @brief Enclosing containers, saturated at UINT16_MAX.
+   */
+  uint16_t depth;
+  /**
+     @brief The enum json_trace_kind.
+   */
+  uint8_t kind;
+  /**
+     @brief The enum json_type, or for errors the enum json_error.
+   */
+  uint8_t detail;
+};
+
+/**
+   @brief State for the recording callback.
+ */
+struct recorder {
+  FILE *out;
+  struct timespec epoch;
+  struct trace_record records[TRACE_BUFFER];
+  size_t n;
+  bool error;
+};
+
+static void recorder_flush(struct recorder *r)
+{
+  if (r->n > 0 && fwrite(r->records, sizeof(r->records[0]), r->n, r->out) !=
+      r->n) {
+    r->error = true;
+  }
+  r->n = 0;
+}
+
+/**
+   @brief The example json_trace_fn: timestamp an event and buffer it.
+ */
+static void recorder_event(void *arg, const struct json_trace_event *event)
+{
+  struct recorder *r = arg;
+  struct trace_record *rec = &r->records[r->n];
+  struct timespec now;
+  size_t span = event->end - event->start;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rec->time = (uint64_t) (now.tv_sec - r->epoch.tv_sec) * 1000000000 +
+    (uint64_t) now.tv_nsec - (uint64_t) r->epoch.tv_nsec;
+  rec->start = event->start;
+  rec->span = span < UINT32_MAX ? (uint32_t) span : UINT32_MAX;
+  rec->depth = event->depth < UINT16_MAX ? (uint16_t) event->depth :
+    UINT16_MAX;
+  rec->kind = (uint8_t) event->kind;
+  rec->detail = (uint8_t) (event->kind == JSON_TRACE_ERROR ? event->error :
+                           event->type);
+  if (++r->n == TRACE_BUFFER) {
+    recorder_flush(r);
+  }
+}
+
+/**
+   @brief Read a whole file and decode it for the parser.
+ */
+static wchar_t *read_text(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  char *bytes = NULL;
+  wchar_t *text = NULL;
+  long size;
+  size_t len;
+
+  if (f == NULL) {
+    return NULL;
+  }
+  if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+      fseek(f, 0, SEEK_SET) == 0 && (bytes = malloc((size_t) size + 1)) &&
+      fread(bytes, 1, (size_t) size, f) == (size_t) size &&
+      (text = malloc(((size_t) size + 1) * sizeof(wchar_t)))) {
+    len = json_utf8_decode(bytes, (size_t) size, text);
+    text[len] = L'\0';
+  }
+  free(bytes);
+  fclose(f);
+  return text;
+}
+
+/**
+   @brief Parse a file, writing its trace.
+   @returns Exit code.
+ */
+static int record(const char *path, const char *output)
+{
+  static struct recorder r;
+  wchar_t *text = read_text(path);
+  struct json_parser p;
+
+  if (text == NULL) {
+    perror(path);
+    return 1;
+  }
+  if ((r.out = fopen(output, "wb")) == NULL) {
+    perror(output);
+    free(text);
+    return 1;
+  }
+  fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), r.out);
+
+  // The tokens aren't needed, so use the counting pass.
+  clock_gettime(CLOCK_MONOTONIC, &r.epoch);
+  p = json_parse_trace(text, NULL, 0, recorder_event, &r);
+  recorder_flush(&r);
+  if (fclose(r.out) != 0 || r.error) {
+    perror(output);
+    free(text);
+    return 1;
+  }
+  if (p.error != JSONERR_NO_ERROR) {
+    json_print_error(stderr, p);
+  }
+  free(text);
+  return 0;
+}
+
+/*******************************************************************************
+
+                                Reading Traces
+
+*******************************************************************************/
+
+/**
+   @brief A container that is still open while reading a trace.
+ */
+struct frame {
+  uint64_t enter;
+  uint64_t children;
+  uint64_t start;
+  size_t node;
+  uint8_t type;
+};
+
+/**
+   @brief A path of containers from the root: a node in a tree of paths.
+ */
+struct path {
+  size_t parent;
+  size_t child[2];
+  uint8_t type;
+  uint64_t self;
+};
+
+/**
+   @brief A container from the trace, for the --top list.
+ */
+struct slow {
+  uint64_t time;
+  uint64_t start;
+  uint64_t end;
+  uint16_t depth;
+  uint8_t type;
+};
+
+/**
+   @brief Everything gathered from one pass over a trace.
+ */
+struct summary {
+  // The path tree.  Node 0 is the root (above the top-level value).
+  struct path *paths;
+  size_t npaths, cappaths;
+  // The N slowest containers, slowest first.
+  struct slow *top;
+  size_t ntop, maxtop;
+  // Other oddities.
+  struct trace_record deepest, longest, error;
+  bool failed;
+};
+
+/**
+   @brief Find (or add) the child of a path for a container type.
+   @returns The child's index, or 0 when out of memory.
+ */
+static size_t path_child(struct summary *s, size_t parent, uint8_t type)
+{
+  size_t slot = type == JSON_ARRAY, idx = s->paths[parent].child[slot];
+  struct path *bigger;
+
+  if (idx != 0) {
+    return idx;
+  }
+  if (s->npaths == s->cappaths) {
+    bigger = realloc(s->paths, 2 * s->cappaths * sizeof(struct path));
+    if (bigger == NULL) {
+      return 0;
+    }
+    s->paths = bigger;
+    s->cappaths *= 2;
+  }
+  idx = s->npaths++;
+  memset(&s->paths[idx], 0, sizeof(struct path));
+  s->paths[idx].parent = parent;
+  s->paths[idx].type = type;
+  s->paths[parent].child[slot] = idx;
+  return idx;
+}
+
+/**
+   @brief Insert a finished container into the --top list, if it is slow enough.
+ */
+static void top_insert(struct summary *s, struct slow c)
+{
+  size_t i;
+  if (s->ntop == s->maxtop && (s->maxtop == 0 ||
+                               c.time <= s->top[s->ntop - 1].time)) {
+    return;
+  }
+  i = s->ntop < s->maxtop ? s->ntop++ : s->ntop - 1;
+  for (; i > 0 && s->top[i - 1].time < c.time; i--) {
+    s->top[i] = s->top[i - 1];
+  }
+  s->top[i] = c;
+}
+
+/**
+   @brief Finish the innermost open container at time `now`.
+ */
+static void frame_pop(struct summary *s, struct frame *stack, size_t *depth,
+                      uint64_t now, uint64_t end)
+{
+  struct frame *f = &stack[--*depth];
+  uint64_t total = now - f->enter;
+  struct slow c = {
+    .time = total, .start = f->start, .end = end, .depth = (uint16_t) *depth,
+    .type = f->type,
+  };
+  s->paths[f->node].self += total - f->children;
+  if (*depth > 0) {
+    stack[*depth - 1].children += total;
+  }
+  top_insert(s, c);
+}
+
+/**
+   @brief Read a trace and summarize it.
+   @returns True on success.
+ */
+static bool summarize(const char *path, struct summary *s)
+{
+  FILE *f = fopen(path, "rb");
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  struct trace_record rec, last = {0};
+  struct frame *stack = NULL, *bigger;
+  size_t depth = 0, capacity = 64, node;
+  bool ok = false;
+
+  s->paths = calloc(64, sizeof(struct path));
+  s->npaths = 1;
+  s->cappaths = 64;
+  s->ntop = 0;
+  s->top = malloc((s->maxtop + 1) * sizeof(struct slow));
+  s->failed = false;
+  memset(&s->deepest, 0, sizeof(s->deepest));
+  memset(&s->longest, 0, sizeof(s->longest));
+  stack = malloc(capacity * sizeof(struct frame));
+  if (f == NULL || s->paths == NULL || s->top == NULL || stack == NULL) {
+    goto out;
+  }
+  if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "%s: not a trace file\n", path);
+    goto out;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    last = rec;
+    if (rec.depth > s->deepest.depth) {
+      s->deepest = rec;
+    }
+    switch (rec.kind) {
+    case JSON_TRACE_ENTER:
+      node = path_child(s, depth > 0 ? stack[depth - 1].node : 0, rec.detail);
+      if (node == 0) {
+        goto out;
+      }
+      if (depth == capacity) {
+        bigger = realloc(stack, 2 * capacity * sizeof(struct frame));
+        if (bigger == NULL) {
+          goto out;
+        }
+        stack = bigger;
+        capacity *= 2;
+      }
+      stack[depth].enter = rec.time;
+      stack[depth].children = 0;
+      stack[depth].start = rec.start;
+      stack[depth].node = node;
+      stack[depth].type = rec.detail;
+      depth++;
+      break;
+    case JSON_TRACE_LEAVE:
+      if (depth > 0) {
+        frame_pop(s, stack, &depth, rec.time, rec.start + rec.span);
+      }
+      break;
+    case JSON_TRACE_STRING:
+      if (rec.span > s->longest.span) {
+        s->longest = rec;
+      }
+      break;
+    case JSON_TRACE_ERROR:
+      s->error = rec;
+      s->failed = true;
+      break;
+    default:
+      break;
+    }
+  }
+  ok = !ferror(f);
+
+  // Containers left open by an error end when the trace does.
+  while (depth > 0) {
+    frame_pop(s, stack, &depth, last.time, last.start);
+  }
+
+ out:
+  if (f != NULL) {
+    fclose(f);
+  } else {
+    perror(path);
+  }
+  free(stack);
+  return ok;
+}
+
+/**
+   @brief Print the folded stack for a path, then for each path below it.
+ */
+static void print_folded(const struct summary *s, size_t node, char *buffer,
+                         size_t len)
+{
+  const char *name;
+  size_t n, i;
+  if (node != 0) {
+    name = json_type_str[s->paths[node].type];
+    n = strlen(name);
+    if (len > 0) {
+      buffer[len++] = ';';
+    }
+    memcpy(buffer + len, name, n);
+    len += n;
+    if (s->paths[node].self > 0) {
+      printf("%.*s %llu\n", (int) len, buffer,
+             (unsigned long long) s->paths[node].self);
+    }
+  }
+  for (i = 0; i < 2; i++) {
+    if (s->paths[node].child[i] != 0) {
+      print_folded(s, s->paths[node].child[i], buffer, len);
+    }
+  }
+}
+
+static void print_top(const struct summary *s)
+{
+  size_t i;
+  if (s->failed) {
+    // The trace doesn't keep the expected token, so leave it out.
+    printf("error\t%s at %llu (depth %u)\n",
+           s->error.detail == JSONERR_EXPECTED_TOKEN ? "expected token" :
+           json_error_str[s->error.detail],
+           (unsigned long long) s->error.start, (unsigned) s->error.depth);
+  }
+  printf("deepest\tdepth %u at %llu\n", (unsigned) s->deepest.depth,
+         (unsigned long long) s->deepest.start);
+  printf("longest\tstring spanning %lu characters at %llu\n",
+         (unsigned long) s->longest.span + (s->longest.span > 0),
+         (unsigned long long) s->longest.start);
+  printf("ns\ttype\tstart\tend\tdepth\n");
+  for (i = 0; i < s->ntop; i++) {
+    printf("%llu\t%s\t%llu\t%llu\t%u\n", (unsigned long long) s->top[i].time,
+           json_type_str[s->top[i].type], (unsigned long long) s->top[i].start,
+           (unsigned long long) s->top[i].end, (unsigned) s->top[i].depth);
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-o TRACE] FILE\n", name);
+  fprintf(stderr, "       %s --fold TRACE\n", name);
+  fprintf(stderr, "       %s --top[=N] TRACE\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *output = "nosj.trace", *input = NULL;
+  struct summary s = {.maxtop = 10};
+  bool fold = false, top = false, ok;
+  char *buffer;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "--fold") == 0) {
+      fold = true;
+    } else if (strcmp(argv[i], "--top") == 0) {
+      top = true;
+    } else if (strncmp(argv[i], "--top=", 6) == 0) {
+      top = true;
+      s.maxtop = strtoul(argv[i] + 6, NULL, 10);
+    } else if (argv[i][0] != '-' && input == NULL) {
+      input = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (input == NULL || (fold && top)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (!fold && !top) {
+    return record(input, output);
+  }
+
+  ok = summarize(input, &s);
+  if (ok && fold) {
+    // Each level adds at most "object;".
+    buffer = malloc(8 * s.npaths + 1);
+    if (buffer != NULL) {
+      print_folded(&s, 0, buffer, 0);
+    }
+    ok = buffer != NULL;
+    free(buffer);
+  } else if (ok) {
+    print_top(&s);
+  }
+  free(s.paths);
+  free(s.top);
+  return ok ? 0 : 1;
+}